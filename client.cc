@@ -0,0 +1,91 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "util.h"
+#include "wire_protocol.h"
+
+using namespace pgaccel;
+using namespace std;
+
+/*
+ * pgaccel_client sends queries to a pgaccel server and prints the results.
+ *
+ *   pgaccel_client <address> [query ...]
+ *
+ * Queries are read from stdin, separated by ';', if none are given. All
+ * queries are sent before reading any result, so they are pipelined.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " <unix:path|tcp:[host:]port> [query ...]" << endl;
+        return 1;
+    }
+
+    vector<string> queries;
+    for (int i = 2; i < argc; i++)
+        queries.push_back(argv[i]);
+
+    if (queries.empty())
+    {
+        string input((istreambuf_iterator<char>(cin)), istreambuf_iterator<char>());
+        for (auto query: Split(input, [](char c) { return c == ';'; }))
+            if (query.find_first_not_of(" \t\r\n") != string::npos)
+                queries.push_back(query);
+    }
+
+    // the parser expects terminated queries
+    for (auto &query: queries)
+    {
+        auto last = query.find_last_not_of(" \t\r\n");
+        if (last == string::npos || query[last] != ';')
+            query += ";";
+    }
+
+    auto client = QueryClient::Connect(argv[1]);
+    if (!client.ok())
+    {
+        cerr << "ERROR: " << client.status().Message() << endl;
+        return 1;
+    }
+
+    int failures = 0;
+    auto durationMs = MeasureDurationMs([&]() {
+        for (const auto &query: queries)
+        {
+            auto sendResult = (*client)->Send(query);
+            if (!sendResult.ok())
+            {
+                cerr << "ERROR: " << sendResult.status().Message() << endl;
+                exit(1);
+            }
+        }
+
+        for (int i = 0; i < queries.size(); i++)
+        {
+            auto output = (*client)->Receive();
+            if (!output.ok())
+            {
+                cout << "ERROR: " << output.status().Message() << endl;
+                failures++;
+                continue;
+            }
+
+            auto printRow = [](const vector<string> &row) {
+                for (int col = 0; col < row.size(); col++)
+                    cout << (col ? "\t" : "") << row[col];
+                cout << endl;
+            };
+
+            printRow(output->FieldNames());
+            for (size_t row = 0; row < output->RowCount(); row++)
+                printRow(output->FormatRow(row));
+        }
+    });
+
+    cerr << queries.size() << " queries in " << durationMs << "ms" << endl;
+
+    return failures ? 1 : 0;
+}
@@ -1,8 +1,10 @@
 #include <iostream>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <string>
 #include <map>
+#include <thread>
 #include <setjmp.h>
 #include <signal.h>
 #include <unistd.h>
@@ -12,9 +14,16 @@
 #include <pwd.h>
 #include <papi.h>
 
+#include "arrow_export.h"
+#include "catalog.h"
+#include "column_storage.h"
 #include "column_data.hpp"
 #include "executor.h"
+#include "numa_placement.h"
 #include "parser.h"
+#include "prefetch.h"
+#include "query_server.h"
+#include "selection_cache.h"
 #include "types.hpp"
 #include "columnar_table.h"
 #include "result_type.hpp"
@@ -45,11 +54,18 @@ int papi_events[papi_event_count] = {
 };
 
 struct ReplState {
-    TableRegistry tables;
+    Catalog catalog;
+    std::unique_ptr<QueryServer> server;
 
     // how many times run each query. useful when we want to benchmark.
     int repeats = 1;
 
+    // how many sessions run each query concurrently.
+    int sessions = 1;
+
+    // rows per row group of tables loaded from parquet.
+    int rowGroupSize = DefaultRowGroupSize;
+
     bool done = false;
     int papiEventSet = PAPI_NULL;
     bool papiAvailable = false;
@@ -81,6 +97,10 @@ static void LoadHistory(const std::string &historyFile);
 static void InitPAPI(ReplState &state);
 static void StartPAPI(ReplState &state);
 static void StopPAPI(ReplState &state);
+static Result<std::shared_ptr<ColumnarTable>> FindTable(ReplState &state,
+                                                        const std::string &tableName);
+static Result<ResultBatch> RunSessions(ReplState &state,
+                                       const std::string &commandText);
 
 // commands
 static Result<bool> ProcessHelp(ReplState &state,
@@ -111,10 +131,42 @@ static Result<bool> ProcessLoad(ReplState &state,
                                 const std::string &commandName,
                                 const vector<std::string> &args,
                                 const std::string &commandText);
+static Result<bool> ProcessOpen(ReplState &state,
+                                const std::string &commandName,
+                                const vector<std::string> &args,
+                                const std::string &commandText);
 static Result<bool> ProcessSave(ReplState &state,
                                 const std::string &commandName,
                                 const vector<std::string> &args,
                                 const std::string &commandText);
+static Result<bool> ProcessSaveAppend(ReplState &state,
+                                      const std::string &commandName,
+                                      const vector<std::string> &args,
+                                      const std::string &commandText);
+static Result<bool> ProcessExport(ReplState &state,
+                                  const std::string &commandName,
+                                  const vector<std::string> &args,
+                                  const std::string &commandText);
+static Result<bool> ProcessExportQuery(ReplState &state,
+                                       const std::string &commandName,
+                                       const vector<std::string> &args,
+                                       const std::string &commandText);
+static Result<bool> ProcessImport(ReplState &state,
+                                  const std::string &commandName,
+                                  const vector<std::string> &args,
+                                  const std::string &commandText);
+static Result<bool> ProcessAppendParquet(ReplState &state,
+                                         const std::string &commandName,
+                                         const vector<std::string> &args,
+                                         const std::string &commandText);
+static Result<bool> ProcessSort(ReplState &state,
+                               const std::string &commandName,
+                               const vector<std::string> &args,
+                               const std::string &commandText);
+static Result<bool> ProcessFlush(ReplState &state,
+                                 const std::string &commandName,
+                                 const vector<std::string> &args,
+                                 const std::string &commandText);
 static Result<bool> ProcessForget(ReplState &state,
                                   const std::string &commandName,
                                   const vector<std::string> &args,
@@ -123,16 +175,64 @@ static Result<bool> ProcessRepeat(ReplState &state,
                                   const std::string &commandName,
                                   const vector<std::string> &args,
                                   const std::string &commandText);
+static Result<bool> ProcessSessions(ReplState &state,
+                                    const std::string &commandName,
+                                    const vector<std::string> &args,
+                                    const std::string &commandText);
+static Result<bool> ProcessRowGroupSize(ReplState &state,
+                                        const std::string &commandName,
+                                        const vector<std::string> &args,
+                                        const std::string &commandText);
+static Result<bool> ProcessListen(ReplState &state,
+                                  const std::string &commandName,
+                                  const vector<std::string> &args,
+                                  const std::string &commandText);
+static Result<bool> ProcessNuma(ReplState &state,
+                                const std::string &commandName,
+                                const vector<std::string> &args,
+                                const std::string &commandText);
+static Result<bool> ProcessHugePages(ReplState &state,
+                                     const std::string &commandName,
+                                     const vector<std::string> &args,
+                                     const std::string &commandText);
+static Result<bool> ProcessPrefetch(ReplState &state,
+                                    const std::string &commandName,
+                                    const vector<std::string> &args,
+                                    const std::string &commandText);
+static Result<bool> ProcessSelectionCache(ReplState &state,
+                                          const std::string &commandName,
+                                          const vector<std::string> &args,
+                                          const std::string &commandText);
+static Result<bool> ProcessCubes(ReplState &state,
+                                 const std::string &commandName,
+                                 const vector<std::string> &args,
+                                 const std::string &commandText);
 
 std::vector<ReplCommand> commands = {
     { "help", ProcessHelp },
     { "quit", ProcessQuit },
     { "set", ProcessSet },
     { "load", ProcessLoad },
+    { "open", ProcessOpen },
     { "save", ProcessSave },
+    { "save_append", ProcessSaveAppend },
+    { "export", ProcessExport },
+    { "export_query", ProcessExportQuery },
     { "load_parquet", ProcessLoadParquet },
+    { "import", ProcessImport },
+    { "append_parquet", ProcessAppendParquet },
+    { "sort", ProcessSort },
+    { "flush", ProcessFlush },
     { "forget", ProcessForget },
     { "repeat", ProcessRepeat },
+    { "sessions", ProcessSessions },
+    { "row_group_size", ProcessRowGroupSize },
+    { "listen", ProcessListen },
+    { "numa", ProcessNuma },
+    { "hugepages", ProcessHugePages },
+    { "prefetch", ProcessPrefetch },
+    { "selection_cache", ProcessSelectionCache },
+    { "cubes", ProcessCubes },
     { "select", ProcessSelect },
     { "schema", ProcessSchema }
 };
@@ -328,7 +428,8 @@ ProcessLoadParquet(ReplState &state,
     ColumnarTableP table;
 
     auto durationMs = MeasureDurationMs([&]() {
-        table = ColumnarTable::ImportParquet(tableName, path, fields);
+        table = ColumnarTable::ImportParquet(tableName, path, fields,
+                                             state.rowGroupSize);
     });
 
     if (!table)
@@ -337,7 +438,154 @@ ProcessLoadParquet(ReplState &state,
     if (state.timingEnabled)
         std::cout << "Duration: " << durationMs << "ms" << std::endl;
     
-    state.tables[tableName] = std::move(table);
+    state.catalog.Put(tableName, std::move(table));
+
+    return true;
+}
+
+/*
+ * "import <table> <path> [<fields>] [sort=<columns>]" loads a Parquet or
+ * Arrow IPC file through Arrow record batches, see
+ * ColumnarTable::ImportArrow(). With sort=, rows are then clustered by the
+ * given comma separated columns, see ColumnarTable::SortBy().
+ */
+static Result<bool>
+ProcessImport(ReplState &state,
+              const std::string &commandName,
+              const vector<std::string> &args,
+              const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 4);
+
+    std::string tableName = ToLower(args[0]);
+    std::string path = args[1];
+    std::optional<std::set<std::string>> fields;
+    std::vector<std::string> sortColumns;
+    for (int argIdx = 2; argIdx < args.size(); argIdx++)
+    {
+        const auto &arg = args[argIdx];
+        if (ToLower(arg).rfind("sort=", 0) == 0)
+        {
+            sortColumns = Split(arg.substr(5), [](char c) { return c == ','; });
+        }
+        else if (!fields.has_value())
+        {
+            auto fieldsVec = Split(arg, [](char c) { return c == ','; });
+            fields = std::set<std::string>(fieldsVec.begin(), fieldsVec.end());
+        }
+        else
+        {
+            return Status::Invalid("Unexpected argument: ", arg);
+        }
+    }
+
+    Result<ColumnarTableP> importResult(Status::Invalid(""));
+    Result<bool> sortResult(true);
+
+    auto durationMs = MeasureDurationMs([&]() {
+        importResult = ColumnarTable::ImportArrowFile(tableName, path, fields,
+                                                      state.rowGroupSize);
+        if (importResult.ok() && !sortColumns.empty())
+            sortResult = (*importResult)->SortBy(sortColumns);
+    });
+
+    ColumnarTableP table;
+    ASSIGN_OR_RAISE(table, importResult);
+    RAISE_IF_FAILS(sortResult);
+
+    if (state.timingEnabled)
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+    state.catalog.Put(tableName, std::move(table));
+
+    return true;
+}
+
+static Result<bool>
+ProcessAppendParquet(ReplState &state,
+                     const std::string &commandName,
+                     const vector<std::string> &args,
+                     const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 2);
+
+    std::string tableName = ToLower(args[0]);
+    std::string path = args[1];
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    std::set<std::string> fields;
+    for (const auto &columnDesc: table->Schema())
+        fields.insert(columnDesc.name);
+
+    Result<bool> appendResult(false);
+
+    auto durationMs = MeasureDurationMs([&]() {
+        auto newRows = ColumnarTable::ImportParquet(tableName, path, fields,
+                                                    table->RowGroupSize());
+        if (!newRows)
+            appendResult = Status::Invalid("Failed to load a parquet file from ", path);
+        else
+            appendResult = table->Append(*newRows);
+    });
+
+    RAISE_IF_FAILS(appendResult);
+
+    std::cout << "Buffered rows: " << table->BufferedRowCount() << std::endl;
+
+    if (state.timingEnabled)
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+    return true;
+}
+
+/*
+ * "sort <table> <column>[,<column>...]" rewrites the table with its rows
+ * ordered by the given columns, see ColumnarTable::SortBy().
+ */
+static Result<bool>
+ProcessSort(ReplState &state,
+            const std::string &commandName,
+            const vector<std::string> &args,
+            const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 2);
+
+    std::string tableName = ToLower(args[0]);
+    auto columnNames = Split(args[1], [](char c) { return c == ','; });
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    Result<bool> sortResult(false);
+
+    auto durationMs = MeasureDurationMs([&]() {
+        sortResult = table->SortBy(columnNames);
+    });
+
+    RAISE_IF_FAILS(sortResult);
+
+    if (state.timingEnabled)
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+    return true;
+}
+
+static Result<bool>
+ProcessFlush(ReplState &state,
+             const std::string &commandName,
+             const vector<std::string> &args,
+             const std::string &commandText)
+{
+    REQUIRED_ARGS(1, 1);
+
+    std::string tableName = ToLower(args[0]);
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    table->Flush();
 
     return true;
 }
@@ -348,8 +596,12 @@ ProcessSelect(ReplState &state,
               const vector<std::string> &args,
               const std::string &commandText)
 {
+    // tables stay alive until the query is done, even if they're forgotten
+    // or replaced meanwhile.
+    auto snapshot = state.catalog.Snapshot();
+
     QueryDesc queryDesc;
-    ASSIGN_OR_RAISE(queryDesc, ParseSelect(commandText, state.tables));
+    ASSIGN_OR_RAISE(queryDesc, ParseSelect(commandText, snapshot->tables));
 
     if (state.showQueryDesc)
         std::cout << queryDesc.ToString() << std::endl;
@@ -357,11 +609,20 @@ ProcessSelect(ReplState &state,
     if (state.repeats != 1)
         std::cout << "repeating " << state.repeats << " times." << std::endl;
 
-    Result<QueryOutput> queryOutput(Status::Invalid(""));
+    if (state.sessions != 1)
+        std::cout << "running in " << state.sessions << " sessions." << std::endl;
+
+    Result<ResultBatch> queryOutput(Status::Invalid(""));
 
     StartPAPI(state);
 
     auto durationMs = MeasureDurationMs([&]() {
+        if (state.sessions != 1)
+        {
+            queryOutput = RunSessions(state, commandText);
+            return;
+        }
+
         for (int i = 0; i < state.repeats; i++)
             queryOutput = ExecuteQuery(queryDesc, state.useAvx, state.useParallelism);
     });
@@ -371,10 +632,14 @@ ProcessSelect(ReplState &state,
     if (!queryOutput.ok())
         return queryOutput.status();
 
+    // values are formatted only now, after the query's been timed
+    Row fieldNames = queryOutput->FieldNames();
+    Rows rows = queryOutput->FormatRows();
+
     std::vector<size_t> widths;
-    for (auto field: queryOutput->fieldNames)
+    for (auto field: fieldNames)
         widths.push_back(field.length());
-    for (auto row: queryOutput->values)
+    for (auto row: rows)
         for (int i = 0; i < row.size(); i++)
             widths[i] = std::max(widths[i], row[i].length());
 
@@ -386,9 +651,9 @@ ProcessSelect(ReplState &state,
         std::cout << std::endl;
     };
 
-    printRow(queryOutput->fieldNames);
+    printRow(fieldNames);
  
-    for (int i = 0; i < queryOutput->fieldNames.size(); i++) {
+    for (int i = 0; i < fieldNames.size(); i++) {
         std::string s;
         for (int j = 0; j < widths[i]; j++)
             s += "=";
@@ -398,15 +663,60 @@ ProcessSelect(ReplState &state,
     }
     std::cout << std::endl;
 
-    for (auto row: queryOutput->values)
+    for (auto row: rows)
         printRow(row);
 
     if (state.timingEnabled)
+    {
         std::cout << "Duration: " << durationMs << "ms" << std::endl;
+        if (state.sessions != 1)
+            std::cout << "Throughput: "
+                      << state.sessions * state.repeats * 1000.0 / std::max<uint64_t>(durationMs, 1)
+                      << " queries/s" << std::endl;
+    }
 
     return true;
 }
 
+/*
+ * Runs the query concurrently in state.sessions sessions, each of which
+ * pins its own catalog snapshot and runs the query state.repeats times.
+ * Returns the first session's output, or the first failure.
+ */
+static Result<ResultBatch>
+RunSessions(ReplState &state, const std::string &commandText)
+{
+    std::vector<Result<ResultBatch>> outputs(state.sessions, Status::Invalid(""));
+    std::vector<std::thread> sessions;
+
+    for (int session = 0; session < state.sessions; session++)
+    {
+        sessions.emplace_back([&, session]() {
+            auto snapshot = state.catalog.Snapshot();
+            auto queryDesc = ParseSelect(commandText, snapshot->tables);
+            if (!queryDesc.ok())
+            {
+                outputs[session] = queryDesc.status();
+                return;
+            }
+
+            for (int i = 0; i < state.repeats; i++)
+                outputs[session] = ExecuteQuery(*queryDesc,
+                                                state.useAvx,
+                                                state.useParallelism);
+        });
+    }
+
+    for (auto &session: sessions)
+        session.join();
+
+    for (auto &output: outputs)
+        if (!output.ok())
+            return output;
+
+    return outputs[0];
+}
+
 static Result<bool>
 ProcessQuit(ReplState &state,
             const std::string &commandName,
@@ -427,10 +737,12 @@ ProcessSchema(ReplState &state,
     REQUIRED_ARGS(1, 1);
     std::string tableName = ToLower(args[0]);
 
-    if (state.tables.count(tableName) == 0)
-        return Status::Invalid("Table not found: ", tableName);
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
 
-    const auto &schema = state.tables[tableName]->Schema();
+    const auto &schema = table->Schema();
+    auto rowGroups = table->RowGroups();
+    int groupCount = rowGroups->size();
 
     std::cout << std::left
               << std::setw(20) << "Name"
@@ -449,9 +761,13 @@ ProcessSchema(ReplState &state,
     for (int colIdx = 0; colIdx < schema.size(); colIdx++)
     {
         const auto &field = schema[colIdx];
-        int groupCount = state.tables[tableName]->RowGroupCount();
-        int groupType = state.tables[tableName]->GetRowGroup(0).columns[colIdx]->type;
+        ColumnDataP columnData;
+        if (groupCount > 0)
+            columnData = (*rowGroups)[0].columns[colIdx];
+        int groupType = columnData ? columnData->type : -1;
         std::string groupTypeStr =
+            groupCount == 0 ? "EMPTY" :
+            !columnData ? "NOT LOADED" :
             groupType == ColumnDataBase::RAW_COLUMN_DATA ? "RAW" :
             groupType == ColumnDataBase::DICT_COLUMN_DATA ? "DICT" :
             "UNKNOWN";
@@ -463,6 +779,15 @@ ProcessSchema(ReplState &state,
                   << std::endl;
     }
 
+    auto sortKeys = table->SortKeys();
+    if (!sortKeys.empty())
+    {
+        std::cout << "Sorted by: ";
+        for (int keyIdx = 0; keyIdx < sortKeys.size(); keyIdx++)
+            std::cout << (keyIdx ? ", " : "") << schema[sortKeys[keyIdx]].name;
+        std::cout << std::endl;
+    }
+
     return true;
 }
 
@@ -491,10 +816,56 @@ ProcessLoad(ReplState &state,
     ColumnarTableP table;
     ASSIGN_OR_RAISE(table, loadResult);
 
+    if (state.timingEnabled)
+    {
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+        // only meaningful when the whole file was read
+        std::error_code error;
+        auto fileBytes = std::filesystem::file_size(path, error);
+        if (!fields.has_value() && !error)
+            std::cout << "Throughput: " << std::fixed << std::setprecision(2)
+                      << fileBytes / 1e6 / std::max<uint64_t>(durationMs, 1)
+                      << "GB/s" << std::defaultfloat << std::endl;
+    }
+
+    state.catalog.Put(tableName, std::move(table));
+
+    return true;
+}
+
+/*
+ * "open <table> <path> [<budget MB>]" opens a saved table without loading
+ * column data. Columns are loaded when queries first reference them, and
+ * with a budget least recently used columns are evicted to stay within it.
+ */
+static Result<bool>
+ProcessOpen(ReplState &state,
+            const std::string &commandName,
+            const vector<std::string> &args,
+            const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 3);
+
+    std::string tableName = ToLower(args[0]);
+    std::string path = args[1];
+    size_t budgetBytes = 0;
+    if (args.size() == 3)
+        budgetBytes = (size_t) std::max(0, std::stoi(args[2])) << 20;
+
+    Result<ColumnarTableP> openResult(Status::Invalid(""));
+
+    auto durationMs = MeasureDurationMs([&]() {
+        openResult = ColumnarTable::Open(tableName, path, budgetBytes);
+    });
+
+    ColumnarTableP table;
+    ASSIGN_OR_RAISE(table, openResult);
+
     if (state.timingEnabled)
         std::cout << "Duration: " << durationMs << "ms" << std::endl;
 
-    state.tables[tableName] = std::move(table);
+    state.catalog.Put(tableName, std::move(table));
 
     return true;
 }
@@ -510,13 +881,41 @@ ProcessSave(ReplState &state,
     std::string tableName = ToLower(args[0]);
     std::string path = args[1];
 
-    if (state.tables.count(tableName) == 0)
-        return Status::Invalid("Table not found: ", tableName);
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    Result<bool> saveResult(false);
+
+    auto durationMs = MeasureDurationMs([&]() {
+        saveResult = table->Save(path);
+    });
+
+    RAISE_IF_FAILS(saveResult);
+
+    if (state.timingEnabled)
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+    return true;
+}
+
+static Result<bool>
+ProcessSaveAppend(ReplState &state,
+                  const std::string &commandName,
+                  const vector<std::string> &args,
+                  const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 2);
+
+    std::string tableName = ToLower(args[0]);
+    std::string path = args[1];
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
 
     Result<bool> saveResult(false);
 
     auto durationMs = MeasureDurationMs([&]() {
-        saveResult = state.tables[tableName]->Save(path);
+        saveResult = table->SaveAppend(path);
     });
 
     RAISE_IF_FAILS(saveResult);
@@ -527,6 +926,87 @@ ProcessSave(ReplState &state,
     return true;
 }
 
+
+/*
+ * "export <table> <path>" writes the table as Parquet or an Arrow IPC file,
+ * depending on the extension of path.
+ */
+static Result<bool>
+ProcessExport(ReplState &state,
+              const std::string &commandName,
+              const vector<std::string> &args,
+              const std::string &commandText)
+{
+    REQUIRED_ARGS(2, 2);
+
+    std::string tableName = ToLower(args[0]);
+    std::string path = args[1];
+
+    ExportFormat format;
+    ASSIGN_OR_RAISE(format, ExportFormatFromPath(path));
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    Result<bool> exportResult(false);
+
+    auto durationMs = MeasureDurationMs([&]() {
+        auto arrowTable = ToArrowTable(*table);
+        if (!arrowTable.ok())
+        {
+            exportResult = arrowTable.status();
+            return;
+        }
+
+        exportResult = WriteArrowTable(**arrowTable, path, format,
+                                       table->RowGroupSize());
+    });
+
+    RAISE_IF_FAILS(exportResult);
+
+    if (state.timingEnabled)
+        std::cout << "Duration: " << durationMs << "ms" << std::endl;
+
+    return true;
+}
+
+/*
+ * "export_query <path> <select statement>" writes the result of the query
+ * like export does.
+ */
+static Result<bool>
+ProcessExportQuery(ReplState &state,
+                   const std::string &commandName,
+                   const vector<std::string> &args,
+                   const std::string &commandText)
+{
+    if (args.size() < 2)
+        return Status::Invalid(commandName, " requires a path and a query.");
+
+    std::string path = args[0];
+    std::string queryText = commandText.substr(commandText.find(path) + path.size());
+
+    ExportFormat format;
+    ASSIGN_OR_RAISE(format, ExportFormatFromPath(path));
+
+    auto snapshot = state.catalog.Snapshot();
+
+    QueryDesc queryDesc;
+    ASSIGN_OR_RAISE(queryDesc, ParseSelect(queryText, snapshot->tables));
+
+    ResultBatch queryOutput;
+    ASSIGN_OR_RAISE(queryOutput, ExecuteQuery(queryDesc, state.useAvx,
+                                              state.useParallelism));
+
+    std::shared_ptr<arrow::Table> arrowTable;
+    ASSIGN_OR_RAISE(arrowTable, ToArrowTable(queryOutput));
+    RAISE_IF_FAILS(WriteArrowTable(*arrowTable, path, format, state.rowGroupSize));
+
+    std::cout << "Exported " << queryOutput.RowCount() << " rows." << std::endl;
+
+    return true;
+}
+
 static Result<bool>
 ProcessForget(ReplState &state,
               const std::string &commandName,
@@ -537,14 +1017,23 @@ ProcessForget(ReplState &state,
 
     std::string tableName = ToLower(args[0]);
 
-    if (state.tables.count(tableName) == 0)
+    if (!state.catalog.Drop(tableName))
         return Status::Invalid("Table not found: ", tableName);
 
-    state.tables.erase(tableName);
-
     return true;
 }
 
+static Result<std::shared_ptr<ColumnarTable>>
+FindTable(ReplState &state, const std::string &tableName)
+{
+    auto snapshot = state.catalog.Snapshot();
+    auto it = snapshot->tables.find(tableName);
+    if (it == snapshot->tables.end())
+        return Status::Invalid("Table not found: ", tableName);
+
+    return std::shared_ptr<ColumnarTable>(it->second);
+}
+
 static Result<bool>
 ProcessRepeat(ReplState &state,
               const std::string &commandName,
@@ -560,6 +1049,183 @@ ProcessRepeat(ReplState &state,
     return true;
 }
 
+static Result<bool>
+ProcessSessions(ReplState &state,
+                const std::string &commandName,
+                const vector<std::string> &args,
+                const std::string &commandText)
+{
+    REQUIRED_ARGS(1, 1);
+
+    std::string sessionsStr = args[0];
+
+    state.sessions = std::max(1, std::stoi(sessionsStr));
+
+    return true;
+}
+
+/*
+ * row_group_size <rows> sets the row group size of tables loaded with
+ * load_parquet afterwards. Appends use the row group size of their table.
+ */
+static Result<bool>
+ProcessRowGroupSize(ReplState &state,
+                    const std::string &commandName,
+                    const vector<std::string> &args,
+                    const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 1);
+
+    if (args.size() == 1)
+    {
+        int rowGroupSize = std::stoi(args[0]);
+        if (rowGroupSize < 1 || rowGroupSize > MaxRowGroupSize)
+            return Status::Invalid("Row group size must be between 1 and ",
+                                   MaxRowGroupSize);
+        state.rowGroupSize = rowGroupSize;
+    }
+
+    std::cout << "row group size: " << state.rowGroupSize << std::endl;
+
+    return true;
+}
+
+/*
+ * listen <address> serves queries over a socket in the background, using
+ * the tables of this REPL and the current avx and parallel settings.
+ * "listen off" stops the server.
+ */
+static Result<bool>
+ProcessListen(ReplState &state,
+              const std::string &commandName,
+              const vector<std::string> &args,
+              const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 1);
+
+    if (args.size() == 0)
+    {
+        if (state.server)
+            std::cout << "listening on " << state.server->Address() << ", "
+                      << state.server->QueryCount() << " queries served."
+                      << std::endl;
+        else
+            std::cout << "not listening." << std::endl;
+        return true;
+    }
+
+    // stop the old server first, so we can listen on the same address again
+    state.server.reset();
+
+    if (ToLower(args[0]) == "off")
+        return true;
+
+    ServerOptions options;
+    options.useAvx = state.useAvx;
+    options.useParallelism = state.useParallelism;
+    ASSIGN_OR_RAISE(state.server, QueryServer::Start(args[0], state.catalog, options));
+
+    std::cout << "listening on " << args[0] << "." << std::endl;
+    return true;
+}
+
+/*
+ * numa shows the NUMA placement policy and how many bytes queries scanned
+ * from row groups on the local and on remote nodes. "numa <policy>" sets
+ * the policy for row groups published afterwards, "numa reset" resets the
+ * traffic counters.
+ */
+static Result<bool>
+ProcessNuma(ReplState &state,
+            const std::string &commandName,
+            const vector<std::string> &args,
+            const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 1);
+
+    if (args.size() == 1)
+    {
+        std::string arg = ToLower(args[0]);
+        if (arg == "reset")
+            ResetNumaTraffic();
+        else if (arg == "off")
+            SetNumaPlacement(NumaPlacement::OFF);
+        else if (arg == "interleave")
+            SetNumaPlacement(NumaPlacement::INTERLEAVE);
+        else if (arg == "partition")
+            SetNumaPlacement(NumaPlacement::PARTITION);
+        else
+            return Status::Invalid("Unknown numa option: ", arg);
+    }
+
+    const auto &traffic = GetNumaTraffic();
+    uint64_t localBytes = traffic.localBytes;
+    uint64_t remoteBytes = traffic.remoteBytes;
+    uint64_t unplacedBytes = traffic.unplacedBytes;
+    uint64_t totalBytes = localBytes + remoteBytes + unplacedBytes;
+
+    auto formatBytes = [&](uint64_t bytes) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1) << bytes / 1048576.0 << "MB";
+        if (totalBytes > 0)
+            out << " (" << 100.0 * bytes / totalBytes << "%)";
+        return out.str();
+    };
+
+    std::cout << "nodes: " << NumaNodeCount() << std::endl;
+    std::cout << "placement: " << NumaPlacementName(GetNumaPlacement()) << std::endl;
+    std::cout << "local: " << formatBytes(localBytes) << std::endl;
+    std::cout << "remote: " << formatBytes(remoteBytes) << std::endl;
+    std::cout << "unplaced: " << formatBytes(unplacedBytes) << std::endl;
+
+    return true;
+}
+
+/*
+ * hugepages shows how much column storage is backed by huge pages.
+ * "hugepages off|thp|2m|1g" sets the mode for column data loaded
+ * afterwards.
+ */
+static Result<bool>
+ProcessHugePages(ReplState &state,
+                 const std::string &commandName,
+                 const vector<std::string> &args,
+                 const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 1);
+
+    if (args.size() == 1)
+    {
+        std::string arg = ToLower(args[0]);
+        if (arg == "off")
+            SetHugePageMode(HugePageMode::OFF);
+        else if (arg == "thp")
+            SetHugePageMode(HugePageMode::THP);
+        else if (arg == "2m")
+            SetHugePageMode(HugePageMode::HUGETLB_2M);
+        else if (arg == "1g")
+            SetHugePageMode(HugePageMode::HUGETLB_1G);
+        else
+            return Status::Invalid("Unknown huge page mode: ", arg);
+    }
+
+    auto stats = GetColumnStorageStats();
+    auto formatBytes = [](size_t bytes) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1) << bytes / 1048576.0 << "MB";
+        return out.str();
+    };
+
+    std::cout << "mode: " << HugePageModeName(GetHugePageMode()) << std::endl;
+    std::cout << "regions: " << stats.regionCount << std::endl;
+    std::cout << "hugetlb: " << formatBytes(stats.hugeTlbBytes) << std::endl;
+    std::cout << "thp: " << formatBytes(stats.thpBytes) << std::endl;
+    std::cout << "used: " << formatBytes(stats.usedBytes) << std::endl;
+    std::cout << "hugetlb fallbacks: " << stats.hugeTlbFallbacks << std::endl;
+
+    return true;
+}
+
 static void AddHistory(const std::string &command)
 {
     HISTORY_STATE * state = history_get_history_state();
@@ -655,3 +1321,135 @@ StopPAPI(ReplState &state)
 int main() {
     return repl();
 }
+
+/*
+ * prefetch shows how far ahead scans prefetch. "prefetch <bytes> [nt]"
+ * sets the distance, and nt makes the prefetches non-temporal.
+ * "prefetch off" disables prefetching.
+ */
+static Result<bool>
+ProcessPrefetch(ReplState &state,
+                const std::string &commandName,
+                const vector<std::string> &args,
+                const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 2);
+
+    if (args.size() >= 1)
+    {
+        ScanPrefetch prefetch { 0, false };
+        if (ToLower(args[0]) != "off")
+            prefetch.distance = std::max(0, std::stoi(args[0]));
+
+        if (args.size() == 2)
+        {
+            if (ToLower(args[1]) != "nt")
+                return Status::Invalid("Unknown prefetch option: ", args[1]);
+            prefetch.nonTemporal = true;
+        }
+
+        SetScanPrefetch(prefetch);
+    }
+
+    auto prefetch = GetScanPrefetch();
+    if (prefetch.distance == 0)
+        std::cout << "distance: off" << std::endl;
+    else
+        std::cout << "distance: " << prefetch.distance << " bytes" << std::endl;
+    std::cout << "non-temporal: " << (prefetch.nonTemporal ? "on" : "off") << std::endl;
+
+    return true;
+}
+
+/*
+ * selection_cache shows the size and hit rate of the selection bitmap
+ * cache. "selection_cache <MB>" sets its capacity, "selection_cache off"
+ * disables it, "selection_cache reset" empties it and resets the stats.
+ */
+static Result<bool>
+ProcessSelectionCache(ReplState &state,
+                      const std::string &commandName,
+                      const vector<std::string> &args,
+                      const std::string &commandText)
+{
+    REQUIRED_ARGS(0, 1);
+
+    auto &cache = SelectionCache::Shared();
+    if (args.size() == 1)
+    {
+        std::string arg = ToLower(args[0]);
+        if (arg == "off")
+        {
+            cache.SetCapacity(0);
+        }
+        else if (arg == "reset")
+        {
+            cache.Clear();
+            cache.ResetStats();
+        }
+        else
+        {
+            cache.SetCapacity((size_t) std::max(0, std::stoi(arg)) << 20);
+        }
+    }
+
+    auto stats = cache.Stats();
+    uint64_t lookups = stats.hits + stats.misses;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "capacity: " << stats.capacity / 1048576.0 << "MB" << std::endl;
+    std::cout << "used: " << stats.bytes / 1048576.0 << "MB in "
+              << stats.entryCount << " entries" << std::endl;
+    std::cout << "hits: " << stats.hits << std::endl;
+    std::cout << "misses: " << stats.misses << std::endl;
+    std::cout << "hit rate: "
+              << (lookups ? 100.0 * stats.hits / lookups : 0.0) << "%" << std::endl;
+    std::cout << "evictions: " << stats.evictions << std::endl;
+    std::cout << std::defaultfloat;
+
+    return true;
+}
+
+/*
+ * "cubes <table> on|off" enables or disables the table's per-row-group
+ * pre-aggregates. "cubes <table>" shows whether they're enabled and their
+ * size.
+ */
+static Result<bool>
+ProcessCubes(ReplState &state,
+             const std::string &commandName,
+             const vector<std::string> &args,
+             const std::string &commandText)
+{
+    REQUIRED_ARGS(1, 2);
+
+    std::string tableName = ToLower(args[0]);
+
+    std::shared_ptr<ColumnarTable> table;
+    ASSIGN_OR_RAISE(table, FindTable(state, tableName));
+
+    if (args.size() == 2)
+    {
+        bool enabled;
+        ASSIGN_OR_RAISE(enabled, ParseBool(args[1]));
+
+        auto durationMs = MeasureDurationMs([&]() {
+            table->SetCubes(enabled);
+        });
+
+        if (state.timingEnabled)
+            std::cout << "Duration: " << durationMs << "ms" << std::endl;
+    }
+
+    size_t bytes = 0;
+    for (const auto &rowGroup: *table->RowGroups())
+        if (rowGroup.cube)
+            bytes += rowGroup.cube->ByteSize();
+
+    std::cout << "cubes: " << (table->CubesEnabled() ? "on" : "off") << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "used: " << bytes / 1048576.0 << "MB" << std::endl;
+    std::cout << std::defaultfloat;
+
+    return true;
+}
@@ -0,0 +1,49 @@
+#include "arena.h"
+
+#include <algorithm>
+
+namespace pgaccel
+{
+
+const size_t MinArenaBlockSize = 256 * 1024;
+
+void *
+Arena::AllocateSlow(size_t size, size_t alignment)
+{
+    // rounded up, since the next allocation may need padding when it comes
+    // after this one in a consolidated block.
+    allocatedSinceReset_ += (used_ + 63) & ~63UL;
+
+    size_t blockSize = std::max({ MinArenaBlockSize,
+                                  2 * blockSize_,
+                                  size + alignment });
+    auto block = static_cast<uint8_t *>(aligned_alloc(64, (blockSize + 63) & ~63UL));
+    blocks_.emplace_back(block);
+    blockSize_ = blockSize;
+    capacity_ += blockSize;
+    used_ = 0;
+
+    return Allocate(size, alignment);
+}
+
+void
+Arena::Reset()
+{
+    allocatedSinceReset_ += used_;
+
+    // replace the blocks by one block which fits everything, so the next
+    // round doesn't need to allocate.
+    if (blocks_.size() > 1)
+    {
+        blocks_.clear();
+        capacity_ = 0;
+        blockSize_ = 0;
+        used_ = 0;
+        AllocateSlow(allocatedSinceReset_, 64);
+    }
+
+    used_ = 0;
+    allocatedSinceReset_ = 0;
+}
+
+};
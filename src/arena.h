@@ -0,0 +1,88 @@
+#pragma once
+
+#include "worker_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace pgaccel
+{
+
+/*
+ * Arena is a bump allocator for transient state of an operator, such as
+ * selection bitmaps and group code buffers of the row group being
+ * processed.
+ *
+ * Each worker of a query owns an arena and resets it before every row
+ * group, so after the first few row groups everything comes from memory
+ * the arena already has, and nothing is malloc'ed. Memory is released
+ * when the arena is destroyed. Objects allocated in an arena are not
+ * destructed, so only use it for trivially destructible types.
+ */
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    Arena(Arena &&) = default;
+
+    void *Allocate(size_t size, size_t alignment = 64)
+    {
+        size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+        if (blocks_.empty() || offset + size > blockSize_)
+            return AllocateSlow(size, alignment);
+
+        used_ = offset + size;
+        return blocks_.back().get() + offset;
+    }
+
+    template<class T>
+    T *AllocateArray(size_t count)
+    {
+        return static_cast<T *>(Allocate(count * sizeof(T), alignof(T) < 64 ? 64 : alignof(T)));
+    }
+
+    template<class T>
+    T *AllocateZeroed(size_t count)
+    {
+        T *result = AllocateArray<T>(count);
+        memset(result, 0, count * sizeof(T));
+        return result;
+    }
+
+    /*
+     * Makes all memory available again. Keeps only the last block, which
+     * after a few resets is large enough for everything allocated between
+     * two resets.
+     */
+    void Reset();
+
+    // bytes of memory owned by the arena
+    size_t Capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+    struct FreeDeleter {
+        void operator()(uint8_t *p) const { free(p); }
+    };
+
+    void *AllocateSlow(size_t size, size_t alignment);
+
+    std::vector<std::unique_ptr<uint8_t[], FreeDeleter>> blocks_;
+    size_t blockSize_ = 0;
+    size_t used_ = 0;
+    size_t capacity_ = 0;
+
+    // bytes allocated since the last reset, used to size the next block
+    size_t allocatedSinceReset_ = 0;
+};
+
+// arenas of the workers of a query
+typedef PerWorker<Arena> WorkerArenas;
+
+};
@@ -0,0 +1,568 @@
+#include "arrow_export.h"
+#include "columnar_table.h"
+#include "result_batch.h"
+#include "util.h"
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+
+#include <algorithm>
+#include <cstring>
+#include <execution>
+
+namespace pgaccel
+{
+
+// widest precision of 64-bit decimals
+const int DecimalPrecision = 18;
+
+static Status FromArrowStatus(const arrow::Status &status);
+static std::shared_ptr<arrow::DataType> ArrowValueType(const AccelType *type);
+static Result<std::shared_ptr<arrow::Array>> ToArrowArray(
+    const ColumnDataP &columnData,
+    const std::shared_ptr<arrow::DataType> &arrowType);
+static Result<std::shared_ptr<arrow::Array>> RawToArrowArray(
+    const ColumnDataP &columnData,
+    const std::shared_ptr<arrow::DataType> &arrowType);
+static Result<std::shared_ptr<arrow::Array>> DictToArrowArray(
+    const ColumnDataP &columnData,
+    const std::shared_ptr<arrow::DataType> &arrowType);
+template<class AccelTy>
+static Result<std::shared_ptr<arrow::Array>> DictValuesToArrowArray(
+    const ColumnDataP &columnData,
+    const std::shared_ptr<arrow::DataType> &valueType);
+template<class targetType>
+static Result<std::shared_ptr<arrow::Buffer>> WidenValues(
+    const uint8_t *values, int bytesPerValue, bool isSigned, int size);
+template<class storageType, class targetType>
+static void Widen(const uint8_t *values, int size, targetType *out);
+static Result<std::shared_ptr<arrow::Table>> WidenDictionaryCodes(
+    const arrow::Table &table);
+template<class targetType>
+static Result<std::shared_ptr<arrow::Array>> IntsToArrowArray(
+    const std::vector<int64_t> &ints,
+    const std::shared_ptr<arrow::DataType> &arrowType);
+template<class stringType>
+static Result<std::shared_ptr<arrow::Array>> StringsToArrowArray(
+    const std::vector<stringType> &strings);
+
+/*
+ * Arrow buffer over memory owned by column data, which it keeps alive.
+ */
+class ColumnDataBuffer: public arrow::Buffer {
+public:
+    ColumnDataBuffer(const uint8_t *data, int64_t size, ColumnDataP owner)
+        : arrow::Buffer(data, size), owner(std::move(owner))
+    {
+    }
+
+private:
+    ColumnDataP owner;
+};
+
+Result<ExportFormat>
+ExportFormatFromPath(const std::string &path)
+{
+    std::string extension;
+    auto dot = path.rfind('.');
+    if (dot != std::string::npos)
+        extension = ToLower(path.substr(dot + 1));
+
+    if (extension == "parquet")
+        return ExportFormat::PARQUET;
+    if (extension == "arrow" || extension == "ipc" || extension == "feather")
+        return ExportFormat::IPC_FILE;
+    if (extension == "arrows")
+        return ExportFormat::IPC_STREAM;
+
+    return Status::Invalid("Unknown export format of ", path,
+                           ", expected .parquet, .arrow, .arrows, .ipc or .feather");
+}
+
+Result<std::shared_ptr<arrow::Table>>
+ToArrowTable(ColumnarTable &table)
+{
+    const auto &schema = table.Schema();
+    int columnCount = schema.size();
+
+    std::vector<int> columns(columnCount);
+    for (int i = 0; i < columnCount; i++)
+        columns[i] = i;
+
+    uint64_t version;
+    RowGroupsSnapshot rowGroups;
+    ASSIGN_OR_RAISE(rowGroups, table.RowGroups(columns, version));
+    int groupCount = rowGroups->size();
+
+    /*
+     * Types are per column, so dictionary codes of a column are widened to
+     * 2 bytes unless all of its row groups have 1-byte codes.
+     */
+    std::vector<std::shared_ptr<arrow::Field>> fields;
+    std::vector<std::shared_ptr<arrow::DataType>> arrowTypes;
+    for (int col = 0; col < columnCount; col++)
+    {
+        auto arrowType = ArrowValueType(schema[col].type.get());
+        if (schema[col].layout == ColumnDataBase::DICT_COLUMN_DATA)
+        {
+            int bytesPerCode = 1;
+            for (const auto &rowGroup: *rowGroups)
+            {
+                auto dictData =
+                    static_cast<const DictColumnDataBase *>(rowGroup.columns[col].get());
+                bytesPerCode = std::max(bytesPerCode, dictData->bytesPerValue());
+            }
+
+            auto indexType = bytesPerCode == 1 ? arrow::uint8() : arrow::uint16();
+            arrowType = arrow::dictionary(indexType, arrowType);
+        }
+
+        arrowTypes.push_back(arrowType);
+        fields.push_back(arrow::field(schema[col].name, arrowType, false));
+    }
+
+    // row group major, so each task converts one chunk
+    std::vector<Result<std::shared_ptr<arrow::Array>>> chunks(
+        groupCount * columnCount, Status::Invalid(""));
+    std::for_each(std::execution::par, chunks.begin(), chunks.end(),
+                  [&](Result<std::shared_ptr<arrow::Array>> &chunk)
+                  {
+                      int idx = &chunk - chunks.data();
+                      int group = idx / columnCount;
+                      int col = idx % columnCount;
+                      chunk = ToArrowArray((*rowGroups)[group].columns[col],
+                                           arrowTypes[col]);
+                  });
+
+    std::vector<std::shared_ptr<arrow::ChunkedArray>> arrowColumns;
+    for (int col = 0; col < columnCount; col++)
+    {
+        arrow::ArrayVector columnChunks;
+        for (int group = 0; group < groupCount; group++)
+        {
+            std::shared_ptr<arrow::Array> chunk;
+            ASSIGN_OR_RAISE(chunk, chunks[group * columnCount + col]);
+            columnChunks.push_back(std::move(chunk));
+        }
+
+        arrowColumns.push_back(std::make_shared<arrow::ChunkedArray>(
+            std::move(columnChunks), arrowTypes[col]));
+    }
+
+    return arrow::Table::Make(arrow::schema(fields), arrowColumns);
+}
+
+Result<std::shared_ptr<arrow::Table>>
+ToArrowTable(const ResultBatch &batch)
+{
+    std::vector<std::shared_ptr<arrow::Field>> fields;
+    std::vector<std::shared_ptr<arrow::Array>> arrowColumns;
+
+    for (int col = 0; col < batch.ColumnCount(); col++)
+    {
+        const auto &column = batch.Column(col);
+        auto arrowType = ArrowValueType(column.type.get());
+
+        std::shared_ptr<arrow::Array> array;
+        switch (column.type->type_num())
+        {
+            case STRING_TYPE:
+                ASSIGN_OR_RAISE(array, StringsToArrowArray(column.strings));
+                break;
+
+            case INT32_TYPE:
+            case DATE_TYPE:
+                ASSIGN_OR_RAISE(array, IntsToArrowArray<int32_t>(column.ints, arrowType));
+                break;
+
+            case INT64_TYPE:
+            case DECIMAL_TYPE:
+                ASSIGN_OR_RAISE(array, IntsToArrowArray<int64_t>(column.ints, arrowType));
+                break;
+
+            default:
+                return Status::Invalid("Can't export column ", column.name,
+                                       " of type ", column.type->ToString());
+        }
+
+        fields.push_back(arrow::field(column.name, arrowType, false));
+        arrowColumns.push_back(std::move(array));
+    }
+
+    return arrow::Table::Make(arrow::schema(fields), arrowColumns, batch.RowCount());
+}
+
+Result<bool>
+WriteArrowTable(const arrow::Table &table,
+                const std::string &path,
+                ExportFormat format,
+                int rowGroupSize)
+{
+    auto openResult = arrow::io::FileOutputStream::Open(path);
+    if (!openResult.ok())
+        return FromArrowStatus(openResult.status());
+    auto out = *openResult;
+
+    arrow::Status status;
+    switch (format)
+    {
+        case ExportFormat::PARQUET:
+        {
+            auto properties = parquet::WriterProperties::Builder()
+                .enable_store_decimal_as_integer()
+                ->build();
+            auto arrowProperties = parquet::ArrowWriterProperties::Builder()
+                .set_use_threads(true)
+                ->build();
+            status = parquet::arrow::WriteTable(table, arrow::default_memory_pool(),
+                                                out, rowGroupSize, properties,
+                                                arrowProperties);
+            break;
+        }
+
+        case ExportFormat::IPC_FILE:
+        case ExportFormat::IPC_STREAM:
+        {
+            auto options = arrow::ipc::IpcWriteOptions::Defaults();
+            const arrow::Table *ipcTable = &table;
+            std::shared_ptr<arrow::Table> widenedTable;
+
+            arrow::Result<std::shared_ptr<arrow::ipc::RecordBatchWriter>> writerResult;
+            if (format == ExportFormat::IPC_FILE)
+            {
+                /*
+                 * The file format can't replace dictionaries between
+                 * batches, so they're unified, which may need wider codes.
+                 */
+                ASSIGN_OR_RAISE(widenedTable, WidenDictionaryCodes(table));
+                ipcTable = widenedTable.get();
+                options.unify_dictionaries = true;
+                writerResult = arrow::ipc::MakeFileWriter(out, ipcTable->schema(),
+                                                          options);
+            }
+            else
+            {
+                writerResult = arrow::ipc::MakeStreamWriter(out, ipcTable->schema(),
+                                                            options);
+            }
+
+            if (!writerResult.ok())
+                return FromArrowStatus(writerResult.status());
+
+            auto writer = *writerResult;
+            status = writer->WriteTable(*ipcTable, rowGroupSize);
+            if (status.ok())
+                status = writer->Close();
+            break;
+        }
+    }
+
+    if (status.ok())
+        status = out->Close();
+    if (!status.ok())
+        return FromArrowStatus(status);
+
+    return true;
+}
+
+static Status
+FromArrowStatus(const arrow::Status &status)
+{
+    return Status::Invalid("Arrow: ", status.ToString());
+}
+
+static std::shared_ptr<arrow::DataType>
+ArrowValueType(const AccelType *type)
+{
+    switch (type->type_num())
+    {
+        case STRING_TYPE:
+            return arrow::utf8();
+        case INT32_TYPE:
+            return arrow::int32();
+        case INT64_TYPE:
+            return arrow::int64();
+        case DECIMAL_TYPE:
+            return arrow::decimal64(
+                DecimalPrecision,
+                static_cast<const DecimalType *>(type)->scale);
+        case DATE_TYPE:
+            return arrow::date32();
+        default:
+            return arrow::null();
+    }
+}
+
+static Result<std::shared_ptr<arrow::Array>>
+ToArrowArray(const ColumnDataP &columnData,
+             const std::shared_ptr<arrow::DataType> &arrowType)
+{
+    if (columnData->type == ColumnDataBase::DICT_COLUMN_DATA)
+        return DictToArrowArray(columnData, arrowType);
+    else
+        return RawToArrowArray(columnData, arrowType);
+}
+
+static Result<std::shared_ptr<arrow::Array>>
+RawToArrowArray(const ColumnDataP &columnData,
+                const std::shared_ptr<arrow::DataType> &arrowType)
+{
+    auto rawData = static_cast<const RawColumnDataBase *>(columnData.get());
+    int width = arrowType->byte_width();
+
+    std::shared_ptr<arrow::Buffer> buffer;
+    if (rawData->bytesPerValue == width)
+    {
+        buffer = std::make_shared<ColumnDataBuffer>(
+            rawData->values, (int64_t) rawData->size * width, columnData);
+    }
+    else if (width == 4)
+    {
+        ASSIGN_OR_RAISE(buffer, WidenValues<int32_t>(rawData->values,
+                                                     rawData->bytesPerValue, true,
+                                                     rawData->size));
+    }
+    else
+    {
+        ASSIGN_OR_RAISE(buffer, WidenValues<int64_t>(rawData->values,
+                                                     rawData->bytesPerValue, true,
+                                                     rawData->size));
+    }
+
+    auto data = arrow::ArrayData::Make(arrowType, rawData->size,
+                                       { nullptr, std::move(buffer) }, 0);
+    return arrow::MakeArray(data);
+}
+
+static Result<std::shared_ptr<arrow::Array>>
+DictToArrowArray(const ColumnDataP &columnData,
+                 const std::shared_ptr<arrow::DataType> &arrowType)
+{
+    auto dictData = static_cast<const DictColumnDataBase *>(columnData.get());
+    auto &dictType = static_cast<const arrow::DictionaryType &>(*arrowType);
+    int bytesPerCode = dictType.index_type()->byte_width();
+
+    std::shared_ptr<arrow::Buffer> codes;
+    if (dictData->bytesPerValue() == bytesPerCode)
+    {
+        codes = std::make_shared<ColumnDataBuffer>(
+            dictData->values, (int64_t) dictData->size * bytesPerCode, columnData);
+    }
+    else
+    {
+        ASSIGN_OR_RAISE(codes, WidenValues<uint16_t>(dictData->values,
+                                                     dictData->bytesPerValue(), false,
+                                                     dictData->size));
+    }
+
+    std::shared_ptr<arrow::Array> dictionary;
+    switch (dictData->valueType->type_num())
+    {
+        case STRING_TYPE:
+            ASSIGN_OR_RAISE(dictionary, DictValuesToArrowArray<StringType>(
+                columnData, dictType.value_type()));
+            break;
+        case INT32_TYPE:
+            ASSIGN_OR_RAISE(dictionary, DictValuesToArrowArray<Int32Type>(
+                columnData, dictType.value_type()));
+            break;
+        case INT64_TYPE:
+            ASSIGN_OR_RAISE(dictionary, DictValuesToArrowArray<Int64Type>(
+                columnData, dictType.value_type()));
+            break;
+        case DECIMAL_TYPE:
+            ASSIGN_OR_RAISE(dictionary, DictValuesToArrowArray<DecimalType>(
+                columnData, dictType.value_type()));
+            break;
+        case DATE_TYPE:
+            ASSIGN_OR_RAISE(dictionary, DictValuesToArrowArray<DateType>(
+                columnData, dictType.value_type()));
+            break;
+        default:
+            return Status::Invalid("Can't export dictionary of type ",
+                                   dictData->valueType->ToString());
+    }
+
+    auto data = arrow::ArrayData::Make(arrowType, dictData->size,
+                                       { nullptr, std::move(codes) }, 0);
+    data->dictionary = dictionary->data();
+    return arrow::MakeArray(data);
+}
+
+// wraps the dictionary entries, string dictionaries are already laid out
+// as arrow's offsets and bytes
+template<class AccelTy>
+static Result<std::shared_ptr<arrow::Array>>
+DictValuesToArrowArray(const ColumnDataP &columnData,
+                       const std::shared_ptr<arrow::DataType> &valueType)
+{
+    auto &dict = static_cast<const DictColumnData<AccelTy> &>(*columnData).dict;
+
+    if constexpr (std::is_same<AccelTy, StringType>::value)
+    {
+        auto offsets = std::make_shared<ColumnDataBuffer>(
+            reinterpret_cast<const uint8_t *>(dict.offsets.data()),
+            dict.offsets.size() * sizeof(uint32_t),
+            columnData);
+        auto bytes = std::make_shared<ColumnDataBuffer>(
+            reinterpret_cast<const uint8_t *>(dict.bytes.data()),
+            dict.bytes.size(),
+            columnData);
+        auto data = arrow::ArrayData::Make(valueType, dict.size(),
+                                           { nullptr, std::move(offsets), std::move(bytes) },
+                                           0);
+        return arrow::MakeArray(data);
+    }
+    else
+    {
+        auto buffer = std::make_shared<ColumnDataBuffer>(
+            reinterpret_cast<const uint8_t *>(dict.data()),
+            dict.size() * sizeof(dict[0]),
+            columnData);
+        auto data = arrow::ArrayData::Make(valueType, dict.size(),
+                                           { nullptr, std::move(buffer) }, 0);
+        return arrow::MakeArray(data);
+    }
+}
+
+/*
+ * Same table with 32-bit dictionary codes, so that dictionaries of all
+ * chunks can be unified. Expects chunks without nulls, like those of
+ * ToArrowTable().
+ */
+static Result<std::shared_ptr<arrow::Table>>
+WidenDictionaryCodes(const arrow::Table &table)
+{
+    std::vector<std::shared_ptr<arrow::Field>> fields;
+    std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+
+    for (int col = 0; col < table.num_columns(); col++)
+    {
+        auto field = table.schema()->field(col);
+        auto column = table.column(col);
+        if (field->type()->id() != arrow::Type::DICTIONARY)
+        {
+            fields.push_back(field);
+            columns.push_back(column);
+            continue;
+        }
+
+        auto &dictType = static_cast<const arrow::DictionaryType &>(*field->type());
+        auto indexType = dictType.index_type();
+        auto widenedType = arrow::dictionary(arrow::int32(), dictType.value_type());
+        bool isSigned = arrow::is_signed_integer(indexType->id());
+        int bytesPerCode = indexType->byte_width();
+
+        arrow::ArrayVector chunks;
+        for (const auto &chunk: column->chunks())
+        {
+            auto data = chunk->data();
+            std::shared_ptr<arrow::Buffer> codes = data->buffers[1];
+            if (bytesPerCode != 4)
+            {
+                ASSIGN_OR_RAISE(codes, WidenValues<int32_t>(
+                    data->buffers[1]->data() + data->offset * bytesPerCode,
+                    bytesPerCode, isSigned, data->length));
+            }
+
+            auto widened = arrow::ArrayData::Make(widenedType, data->length,
+                                                  { nullptr, std::move(codes) },
+                                                  0, bytesPerCode != 4 ? 0 : data->offset);
+            widened->dictionary = data->dictionary;
+            chunks.push_back(arrow::MakeArray(widened));
+        }
+
+        fields.push_back(field->WithType(widenedType));
+        columns.push_back(std::make_shared<arrow::ChunkedArray>(std::move(chunks),
+                                                                widenedType));
+    }
+
+    return arrow::Table::Make(arrow::schema(fields), columns, table.num_rows());
+}
+
+template<class targetType>
+static Result<std::shared_ptr<arrow::Buffer>>
+WidenValues(const uint8_t *values, int bytesPerValue, bool isSigned, int size)
+{
+    auto allocateResult = arrow::AllocateBuffer(size * sizeof(targetType));
+    if (!allocateResult.ok())
+        return FromArrowStatus(allocateResult.status());
+
+    std::shared_ptr<arrow::Buffer> result = std::move(*allocateResult);
+    auto out = reinterpret_cast<targetType *>(result->mutable_data());
+
+    switch (bytesPerValue)
+    {
+        case 1:
+            if (isSigned)
+                Widen<int8_t>(values, size, out);
+            else
+                Widen<uint8_t>(values, size, out);
+            break;
+        case 2:
+            if (isSigned)
+                Widen<int16_t>(values, size, out);
+            else
+                Widen<uint16_t>(values, size, out);
+            break;
+        case 4:
+            if (isSigned)
+                Widen<int32_t>(values, size, out);
+            else
+                Widen<uint32_t>(values, size, out);
+            break;
+    }
+
+    return result;
+}
+
+template<class storageType, class targetType>
+static void
+Widen(const uint8_t *values, int size, targetType *out)
+{
+    auto in = reinterpret_cast<const storageType *>(values);
+    for (int i = 0; i < size; i++)
+        out[i] = in[i];
+}
+
+template<class targetType>
+static Result<std::shared_ptr<arrow::Array>>
+IntsToArrowArray(const std::vector<int64_t> &ints,
+                 const std::shared_ptr<arrow::DataType> &arrowType)
+{
+    auto allocateResult = arrow::AllocateBuffer(ints.size() * sizeof(targetType));
+    if (!allocateResult.ok())
+        return FromArrowStatus(allocateResult.status());
+
+    std::shared_ptr<arrow::Buffer> buffer = std::move(*allocateResult);
+    auto out = reinterpret_cast<targetType *>(buffer->mutable_data());
+    for (size_t i = 0; i < ints.size(); i++)
+        out[i] = ints[i];
+
+    auto data = arrow::ArrayData::Make(arrowType, ints.size(),
+                                       { nullptr, std::move(buffer) }, 0);
+    return arrow::MakeArray(data);
+}
+
+template<class stringType>
+static Result<std::shared_ptr<arrow::Array>>
+StringsToArrowArray(const std::vector<stringType> &strings)
+{
+    arrow::StringBuilder builder;
+    auto status = builder.Reserve(strings.size());
+    for (const auto &value: strings)
+        if (status.ok())
+            status = builder.Append(value);
+
+    std::shared_ptr<arrow::Array> result;
+    if (status.ok())
+        status = builder.Finish(&result);
+    if (!status.ok())
+        return FromArrowStatus(status);
+    return result;
+}
+
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "result_type.hpp"
+
+#include <memory>
+#include <string>
+
+namespace arrow
+{
+class Table;
+};
+
+namespace pgaccel
+{
+
+class ColumnarTable;
+class ResultBatch;
+
+enum class ExportFormat {
+    IPC_FILE,
+    IPC_STREAM,
+    PARQUET
+};
+
+// ".parquet" is Parquet, ".arrow", ".ipc" and ".feather" are Arrow IPC files,
+// and ".arrows" is an Arrow IPC stream
+Result<ExportFormat> ExportFormatFromPath(const std::string &path);
+
+/*
+ * Arrow view of the table, with one chunk per row group. Raw columns stored
+ * at the full width of their type wrap the column buffers without copying,
+ * narrower ones are widened. Dictionary columns become DictionaryArrays over
+ * their codes, with the row group's dictionary as values. The returned table
+ * keeps the column data alive. Unloaded columns of lazily opened tables are
+ * loaded first.
+ */
+Result<std::shared_ptr<arrow::Table>> ToArrowTable(ColumnarTable &table);
+
+Result<std::shared_ptr<arrow::Table>> ToArrowTable(const ResultBatch &batch);
+
+/*
+ * Writes the table to path. Parquet row groups have rowGroupSize rows and
+ * their columns are encoded in parallel, and decimals are stored as
+ * integers so ImportParquet() can read the file back. IPC streams keep the
+ * dictionaries of each row group, while IPC files, which can't replace
+ * dictionaries, get unified dictionaries with 32-bit codes.
+ */
+Result<bool> WriteArrowTable(const arrow::Table &table,
+                             const std::string &path,
+                             ExportFormat format,
+                             int rowGroupSize);
+
+};
@@ -0,0 +1,575 @@
+#include "arrow_export.h"
+#include "columnar_table.h"
+#include "util.h"
+
+#include <arrow/api.h>
+#include <arrow/c/bridge.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/reader.h>
+#include <parquet/arrow/reader.h>
+#include <parquet/file_reader.h>
+
+#include <algorithm>
+#include <execution>
+#include <string_view>
+
+namespace pgaccel
+{
+
+static Status FromArrowStatus(const arrow::Status &status);
+static Result<ColumnDesc> ColumnDescFromArrow(const arrow::Field &field);
+static Result<bool> ConvertRowGroups(
+    const std::vector<ColumnDesc> &schema,
+    const std::vector<int> &sourceColumns,
+    std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+    int rowGroupSize,
+    bool flush,
+    std::vector<RowGroup> &rowGroups);
+static arrow::ArrayVector SliceColumn(
+    const std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+    int column, int64_t offset, int64_t length);
+static Result<ColumnDataP> ConvertColumnData(const ColumnDesc &columnDesc,
+                                             const arrow::ArrayVector &pieces,
+                                             int size);
+template<class AccelTy>
+static ColumnDataP RawFromArrow(const arrow::ArrayVector &pieces, int size);
+template<class storageType, class valueType>
+static void Narrow(const std::vector<std::pair<const uint8_t *, int64_t>> &spans,
+                   int stride, uint8_t *out);
+template<class AccelTy, class keyType>
+static ColumnDataP DictFromArrow(const arrow::ArrayVector &pieces, int size);
+template<class keyType>
+static keyType KeyAt(const arrow::ArrayData &data, int64_t idx);
+
+Result<ColumnarTableP>
+ColumnarTable::ImportArrow(const std::string &tableName,
+                           arrow::RecordBatchReader &reader,
+                           std::optional<std::set<std::string>> fields,
+                           int rowGroupSize)
+{
+    if (rowGroupSize < 1 || rowGroupSize > MaxRowGroupSize)
+        return Status::Invalid("Invalid row group size: ", rowGroupSize);
+
+    std::set<std::string> fieldsToLoad;
+    if (fields.has_value())
+        for (const auto &field: *fields)
+            fieldsToLoad.insert(ToLower(field));
+
+    auto result = std::unique_ptr<ColumnarTable>(new ColumnarTable);
+    result->name_ = tableName;
+    result->row_group_size_ = rowGroupSize;
+
+    auto arrowSchema = reader.schema();
+    std::vector<int> sourceColumns;
+    for (int col = 0; col < arrowSchema->num_fields(); col++)
+    {
+        const auto &field = *arrowSchema->field(col);
+        if (fields.has_value() && !fieldsToLoad.count(ToLower(field.name())))
+            continue;
+
+        ColumnDesc columnDesc;
+        ASSIGN_OR_RAISE(columnDesc, ColumnDescFromArrow(field));
+        result->schema_.push_back(std::move(columnDesc));
+        sourceColumns.push_back(col);
+    }
+
+    // full row groups are converted as soon as enough batches arrived
+    std::vector<RowGroup> rowGroups;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    int64_t pendingRows = 0;
+    while (true)
+    {
+        std::shared_ptr<arrow::RecordBatch> batch;
+        auto status = reader.ReadNext(&batch);
+        if (!status.ok())
+            return FromArrowStatus(status);
+        if (!batch)
+            break;
+
+        pendingRows += batch->num_rows();
+        batches.push_back(std::move(batch));
+
+        if (pendingRows >= rowGroupSize)
+        {
+            RAISE_IF_FAILS(ConvertRowGroups(result->schema_, sourceColumns,
+                                            batches, rowGroupSize, false,
+                                            rowGroups));
+            pendingRows %= rowGroupSize;
+        }
+    }
+
+    RAISE_IF_FAILS(ConvertRowGroups(result->schema_, sourceColumns, batches,
+                                    rowGroupSize, true, rowGroups));
+
+    result->sealed_count_ = rowGroups.size();
+    result->Publish(std::move(rowGroups));
+
+    return result;
+}
+
+Result<ColumnarTableP>
+ColumnarTable::ImportArrowStream(const std::string &tableName,
+                                 struct ArrowArrayStream *stream,
+                                 std::optional<std::set<std::string>> fields,
+                                 int rowGroupSize)
+{
+    auto readerResult = arrow::ImportRecordBatchReader(stream);
+    if (!readerResult.ok())
+        return FromArrowStatus(readerResult.status());
+
+    return ImportArrow(tableName, **readerResult, fields, rowGroupSize);
+}
+
+Result<ColumnarTableP>
+ColumnarTable::ImportArrowFile(const std::string &tableName,
+                               const std::string &path,
+                               std::optional<std::set<std::string>> fields,
+                               int rowGroupSize)
+{
+    ExportFormat format;
+    ASSIGN_OR_RAISE(format, ExportFormatFromPath(path));
+
+    auto fileResult = arrow::io::ReadableFile::Open(path);
+    if (!fileResult.ok())
+        return FromArrowStatus(fileResult.status());
+    auto file = *fileResult;
+
+    switch (format)
+    {
+        case ExportFormat::PARQUET:
+        {
+            parquet::arrow::FileReaderBuilder builder;
+            auto status = builder.Open(file);
+            if (!status.ok())
+                return FromArrowStatus(status);
+
+            std::set<std::string> fieldsToLoad;
+            if (fields.has_value())
+                for (const auto &field: *fields)
+                    fieldsToLoad.insert(ToLower(field));
+
+            /*
+             * Strings are read as dictionaries, so they're transcoded from
+             * Parquet's dictionary pages instead of being hashed per row.
+             * Batches of a row group's size keep few batches pending.
+             */
+            parquet::ArrowReaderProperties properties;
+            properties.set_batch_size(rowGroupSize);
+            properties.set_use_threads(true);
+            properties.set_smallest_decimal_enabled(true);
+
+            auto parquetSchema = builder.raw_reader()->metadata()->schema();
+            std::vector<int> columnIndices;
+            for (int col = 0; col < parquetSchema->num_columns(); col++)
+            {
+                auto column = parquetSchema->Column(col);
+                if (fields.has_value() && !fieldsToLoad.count(ToLower(column->name())))
+                    continue;
+
+                columnIndices.push_back(col);
+                if (column->physical_type() == parquet::Type::BYTE_ARRAY)
+                    properties.set_read_dictionary(col, true);
+            }
+
+            std::unique_ptr<parquet::arrow::FileReader> fileReader;
+            status = builder.properties(properties)->Build(&fileReader);
+            if (!status.ok())
+                return FromArrowStatus(status);
+
+            std::vector<int> rowGroupIndices(fileReader->num_row_groups());
+            for (int i = 0; i < rowGroupIndices.size(); i++)
+                rowGroupIndices[i] = i;
+
+            auto readerResult = fileReader->GetRecordBatchReader(rowGroupIndices,
+                                                                 columnIndices);
+            if (!readerResult.ok())
+                return FromArrowStatus(readerResult.status());
+
+            return ImportArrow(tableName, **readerResult, fields, rowGroupSize);
+        }
+
+        case ExportFormat::IPC_FILE:
+        {
+            auto readerResult = arrow::ipc::RecordBatchFileReader::Open(file);
+            if (!readerResult.ok())
+                return FromArrowStatus(readerResult.status());
+
+            auto batchesResult = (*readerResult)->ToRecordBatches();
+            if (!batchesResult.ok())
+                return FromArrowStatus(batchesResult.status());
+
+            auto batchReader = arrow::RecordBatchReader::Make(
+                *batchesResult, (*readerResult)->schema());
+            if (!batchReader.ok())
+                return FromArrowStatus(batchReader.status());
+
+            return ImportArrow(tableName, **batchReader, fields, rowGroupSize);
+        }
+
+        case ExportFormat::IPC_STREAM:
+        {
+            auto readerResult = arrow::ipc::RecordBatchStreamReader::Open(file);
+            if (!readerResult.ok())
+                return FromArrowStatus(readerResult.status());
+
+            return ImportArrow(tableName, **readerResult, fields, rowGroupSize);
+        }
+    }
+
+    return Status::Invalid("Unsupported format of ", path);
+}
+
+static Status
+FromArrowStatus(const arrow::Status &status)
+{
+    return Status::Invalid("Arrow: ", status.ToString());
+}
+
+static Result<ColumnDesc>
+ColumnDescFromArrow(const arrow::Field &field)
+{
+    ColumnDesc columnDesc;
+    columnDesc.name = field.name();
+
+    auto type = field.type();
+    if (type->id() == arrow::Type::DICTIONARY)
+        type = static_cast<const arrow::DictionaryType &>(*type).value_type();
+
+    switch (type->id())
+    {
+        case arrow::Type::STRING:
+        case arrow::Type::LARGE_STRING:
+            columnDesc.type = std::make_shared<StringType>();
+            columnDesc.layout = ColumnDataBase::DICT_COLUMN_DATA;
+            return columnDesc;
+
+        case arrow::Type::DATE32:
+            columnDesc.type = std::make_shared<DateType>();
+            columnDesc.layout = ColumnDataBase::DICT_COLUMN_DATA;
+            return columnDesc;
+
+        default:
+            break;
+    }
+
+    if (field.type()->id() == arrow::Type::DICTIONARY)
+        return Status::Invalid("Unsupported dictionary type of ", field.name(),
+                               ": ", field.type()->ToString());
+
+    switch (type->id())
+    {
+        case arrow::Type::INT32:
+            columnDesc.type = std::make_shared<Int32Type>();
+            break;
+
+        case arrow::Type::INT64:
+            columnDesc.type = std::make_shared<Int64Type>();
+            break;
+
+        case arrow::Type::DECIMAL32:
+        case arrow::Type::DECIMAL64:
+        case arrow::Type::DECIMAL128:
+        {
+            auto &decimalType = static_cast<const arrow::DecimalType &>(*type);
+            if (decimalType.precision() > 18)
+                return Status::Invalid("Decimal ", field.name(),
+                                       " doesn't fit in 64 bits");
+
+            auto accelDecimalType = std::make_shared<DecimalType>();
+            accelDecimalType->scale = decimalType.scale();
+            columnDesc.type = std::move(accelDecimalType);
+            break;
+        }
+
+        default:
+            return Status::Invalid("Unsupported type of ", field.name(), ": ",
+                                   type->ToString());
+    }
+
+    columnDesc.layout = ColumnDataBase::RAW_COLUMN_DATA;
+    return columnDesc;
+}
+
+/*
+ * Converts the full row groups of batches, or all of their rows if flush
+ * is set, and leaves the remaining rows in batches.
+ */
+static Result<bool>
+ConvertRowGroups(const std::vector<ColumnDesc> &schema,
+                 const std::vector<int> &sourceColumns,
+                 std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+                 int rowGroupSize,
+                 bool flush,
+                 std::vector<RowGroup> &rowGroups)
+{
+    int64_t rowCount = 0;
+    for (const auto &batch: batches)
+        rowCount += batch->num_rows();
+
+    int groupCount = flush ? (rowCount + rowGroupSize - 1) / rowGroupSize
+                           : rowCount / rowGroupSize;
+    int columnCount = schema.size();
+
+    std::vector<Result<ColumnDataP>> columnData(groupCount * columnCount,
+                                                Status::Invalid(""));
+    std::for_each(std::execution::par, columnData.begin(), columnData.end(),
+                  [&](Result<ColumnDataP> &data)
+                  {
+                      int idx = &data - columnData.data();
+                      int group = idx / columnCount;
+                      int col = idx % columnCount;
+                      int64_t offset = (int64_t) group * rowGroupSize;
+                      int size = std::min<int64_t>(rowGroupSize, rowCount - offset);
+                      auto pieces = SliceColumn(batches, sourceColumns[col],
+                                                offset, size);
+                      data = ConvertColumnData(schema[col], pieces, size);
+                  });
+
+    for (int group = 0; group < groupCount; group++)
+    {
+        RowGroup rowGroup;
+        rowGroup.size = std::min<int64_t>(rowGroupSize,
+                                          rowCount - (int64_t) group * rowGroupSize);
+        for (int col = 0; col < columnCount; col++)
+        {
+            ColumnDataP data;
+            ASSIGN_OR_RAISE(data, columnData[group * columnCount + col]);
+            rowGroup.columns.push_back(std::move(data));
+        }
+
+        rowGroups.push_back(std::move(rowGroup));
+    }
+
+    // keep the rows after the converted row groups
+    int64_t converted = std::min<int64_t>(rowCount, (int64_t) groupCount * rowGroupSize);
+    std::vector<std::shared_ptr<arrow::RecordBatch>> remaining;
+    int64_t batchStart = 0;
+    for (auto &batch: batches)
+    {
+        int64_t batchEnd = batchStart + batch->num_rows();
+        if (batchEnd > converted)
+            remaining.push_back(batchStart >= converted
+                                    ? batch
+                                    : batch->Slice(converted - batchStart));
+        batchStart = batchEnd;
+    }
+    batches = std::move(remaining);
+
+    return true;
+}
+
+// zero-copy slices of the column in the given rows of batches
+static arrow::ArrayVector
+SliceColumn(const std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+            int column, int64_t offset, int64_t length)
+{
+    arrow::ArrayVector result;
+    int64_t batchStart = 0;
+    for (const auto &batch: batches)
+    {
+        int64_t batchEnd = batchStart + batch->num_rows();
+        int64_t start = std::max(offset, batchStart);
+        int64_t end = std::min(offset + length, batchEnd);
+        if (start < end)
+            result.push_back(batch->column(column)->Slice(start - batchStart,
+                                                          end - start));
+        batchStart = batchEnd;
+    }
+    return result;
+}
+
+static Result<ColumnDataP>
+ConvertColumnData(const ColumnDesc &columnDesc,
+                  const arrow::ArrayVector &pieces,
+                  int size)
+{
+    for (const auto &piece: pieces)
+        if (piece->null_count() != 0)
+            return Status::Invalid("Column ", columnDesc.name, " has nulls");
+
+    switch (columnDesc.type->type_num())
+    {
+        case STRING_TYPE:
+            return DictFromArrow<StringType, std::string_view>(pieces, size);
+        case DATE_TYPE:
+            return DictFromArrow<DateType, int32_t>(pieces, size);
+        case INT32_TYPE:
+            return RawFromArrow<Int32Type>(pieces, size);
+        case INT64_TYPE:
+            return RawFromArrow<Int64Type>(pieces, size);
+        case DECIMAL_TYPE:
+            return RawFromArrow<DecimalType>(pieces, size);
+        default:
+            return Status::Invalid("Unsupported type of ", columnDesc.name);
+    }
+}
+
+/*
+ * Narrows values straight from the Arrow buffers into the column buffer,
+ * after a pass which finds the narrowest width which fits them. Values of
+ * 128-bit decimals are their low 64 bits.
+ */
+template<class AccelTy>
+static ColumnDataP
+RawFromArrow(const arrow::ArrayVector &pieces, int size)
+{
+    using valueType = typename AccelTy::c_type;
+
+    // decimal32 values are 4 bytes, decimal128 values 16
+    std::vector<std::pair<const uint8_t *, int64_t>> spans;
+    int byteWidth = sizeof(valueType);
+    for (const auto &piece: pieces)
+    {
+        const auto &data = *piece->data();
+        byteWidth = data.type->byte_width();
+        spans.push_back({ data.buffers[1]->data() + data.offset * byteWidth,
+                          data.length });
+    }
+
+    auto columnData = std::make_shared<RawColumnData<AccelTy>>();
+    columnData->type = ColumnDataBase::RAW_COLUMN_DATA;
+    columnData->size = size;
+
+    valueType minValue = 0, maxValue = 0;
+    bool first = true;
+    auto updateMinMax = [&](const auto *values, int64_t length, int stride)
+    {
+        for (int64_t i = 0; i < length; i++)
+        {
+            valueType value = values[i * stride];
+            minValue = first ? value : std::min(minValue, value);
+            maxValue = first ? value : std::max(maxValue, value);
+            first = false;
+        }
+    };
+
+    for (const auto &span: spans)
+    {
+        if (byteWidth == 4)
+            updateMinMax(reinterpret_cast<const int32_t *>(span.first), span.second, 1);
+        else
+            updateMinMax(reinterpret_cast<const int64_t *>(span.first), span.second,
+                         byteWidth / 8);
+    }
+
+    int bytesPerValue;
+    if (maxValue <= INT8_MAX && minValue >= INT8_MIN)
+        bytesPerValue = 1;
+    else if (maxValue <= INT16_MAX && minValue >= INT16_MIN)
+        bytesPerValue = 2;
+    else if (maxValue <= INT32_MAX && minValue >= INT32_MIN)
+        bytesPerValue = 4;
+    else
+        bytesPerValue = 8;
+
+    columnData->bytesPerValue = bytesPerValue;
+    columnData->values = AllocateColumnBuffer(bytesPerValue * size);
+    columnData->minValue = minValue;
+    columnData->maxValue = maxValue;
+
+    int stride = byteWidth <= 8 ? 1 : byteWidth / 8;
+    switch (bytesPerValue)
+    {
+    #define NARROW_VALUES(width, storageType) \
+        case width: \
+            if (byteWidth == 4) \
+                Narrow<storageType, int32_t>(spans, stride, columnData->values); \
+            else \
+                Narrow<storageType, int64_t>(spans, stride, columnData->values); \
+            break;
+
+        NARROW_VALUES(1, int8_t);
+        NARROW_VALUES(2, int16_t);
+        NARROW_VALUES(4, int32_t);
+        NARROW_VALUES(8, int64_t);
+    #undef NARROW_VALUES
+    }
+
+    return columnData;
+}
+
+template<class storageType, class valueType>
+static void
+Narrow(const std::vector<std::pair<const uint8_t *, int64_t>> &spans,
+       int stride, uint8_t *out)
+{
+    auto outTyped = reinterpret_cast<storageType *>(out);
+    for (const auto &span: spans)
+    {
+        auto values = reinterpret_cast<const valueType *>(span.first);
+        if (stride == 1)
+        {
+            for (int64_t i = 0; i < span.second; i++)
+                outTyped[i] = values[i];
+        }
+        else
+        {
+            for (int64_t i = 0; i < span.second; i++)
+                outTyped[i] = values[i * stride];
+        }
+        outTyped += span.second;
+    }
+}
+
+/*
+ * Dictionary encodes the row group with a DictionaryBuilder. Dictionary
+ * encoded input only hashes the dictionary entries its rows use, and rows
+ * are transcoded through their index.
+ */
+template<class AccelTy, class keyType>
+static ColumnDataP
+DictFromArrow(const arrow::ArrayVector &pieces, int size)
+{
+    DictionaryBuilder<AccelTy> builder;
+    std::vector<uint32_t> ids(size);
+
+    int64_t row = 0;
+    for (const auto &piece: pieces)
+    {
+        const auto &data = *piece->data();
+        if (data.type->id() != arrow::Type::DICTIONARY)
+        {
+            for (int64_t i = 0; i < data.length; i++)
+                ids[row++] = builder.Add(KeyAt<keyType>(data, i));
+            continue;
+        }
+
+        // ids of the used dictionary entries
+        auto &dictArray = static_cast<const arrow::DictionaryArray &>(*piece);
+        auto &dictionary = *data.dictionary;
+        std::vector<int64_t> idOfEntry(dictionary.length, -1);
+        for (int64_t i = 0; i < data.length; i++)
+        {
+            int64_t entry = dictArray.GetValueIndex(i);
+            if (idOfEntry[entry] < 0)
+                idOfEntry[entry] = builder.Add(KeyAt<keyType>(dictionary, entry));
+            ids[row++] = idOfEntry[entry];
+        }
+    }
+
+    return builder.Finish(ids.data(), size);
+}
+
+template<class keyType>
+static keyType
+KeyAt(const arrow::ArrayData &data, int64_t idx)
+{
+    if constexpr (std::is_same<keyType, std::string_view>::value)
+    {
+        auto bytes = reinterpret_cast<const char *>(data.buffers[2]->data());
+        if (data.type->id() == arrow::Type::LARGE_STRING)
+        {
+            auto offsets = data.GetValues<int64_t>(1);
+            return { bytes + offsets[idx], (size_t) (offsets[idx + 1] - offsets[idx]) };
+        }
+
+        auto offsets = data.GetValues<int32_t>(1);
+        return { bytes + offsets[idx], (size_t) (offsets[idx + 1] - offsets[idx]) };
+    }
+    else
+    {
+        return data.GetValues<keyType>(1)[idx];
+    }
+}
+
+};
@@ -0,0 +1,45 @@
+#include "catalog.h"
+
+namespace pgaccel
+{
+
+Catalog::Catalog()
+    : current_(std::make_shared<const CatalogSnapshot>(CatalogSnapshot { 0, {} }))
+{
+}
+
+CatalogSnapshotP
+Catalog::Snapshot() const
+{
+    std::lock_guard lock(mutex_);
+    return current_;
+}
+
+void
+Catalog::Put(const std::string &name, std::shared_ptr<ColumnarTable> table)
+{
+    std::lock_guard lock(mutex_);
+
+    auto next = std::make_shared<CatalogSnapshot>(*current_);
+    next->epoch++;
+    next->tables[name] = std::move(table);
+    current_ = std::move(next);
+}
+
+bool
+Catalog::Drop(const std::string &name)
+{
+    std::lock_guard lock(mutex_);
+
+    if (current_->tables.count(name) == 0)
+        return false;
+
+    auto next = std::make_shared<CatalogSnapshot>(*current_);
+    next->epoch++;
+    next->tables.erase(name);
+    current_ = std::move(next);
+
+    return true;
+}
+
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "columnar_table.h"
+#include "parser.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace pgaccel
+{
+
+struct CatalogSnapshot {
+    // incremented by every change to the table list
+    uint64_t epoch;
+    TableRegistry tables;
+};
+
+typedef std::shared_ptr<const CatalogSnapshot> CatalogSnapshotP;
+
+/*
+ * Catalog holds the table list shared by all sessions.
+ *
+ * Changes publish a new immutable snapshot, so a change becomes visible to
+ * all sessions at once. Queries pin a snapshot for their whole duration,
+ * which keeps tables dropped in the meantime alive until they finish.
+ */
+class Catalog {
+public:
+    Catalog();
+
+    CatalogSnapshotP Snapshot() const;
+
+    void Put(const std::string &name, std::shared_ptr<ColumnarTable> table);
+
+    // Returns false if there was no table with the given name.
+    bool Drop(const std::string &name);
+
+private:
+    mutable std::mutex mutex_;
+    CatalogSnapshotP current_;
+};
+
+};
@@ -1,83 +1,230 @@
 #include "column_data.hpp"
 
+#include <immintrin.h>
+#include <nmmintrin.h>
+
 namespace pgaccel
 {
 
+/*
+ * CRC32C of 8 bytes per instruction, spread over the upper bits which
+ * select hash table slots.
+ */
+uint64_t
+HashBytes(const char *bytes, size_t length)
+{
+    uint64_t crc = length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+
+    if (i < length)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, length - i);
+        crc = _mm_crc32_u64(crc, word);
+    }
+
+    return crc * 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * Dictionaries with 1-byte codes have at most 256 prefix keys, which are
+ * counted 8 at a time with AVX-512 compares. That's branch free and faster
+ * than a binary search at this size. Larger dictionaries are binary
+ * searched.
+ */
+size_t
+CountPrefixKeysBelow(const uint64_t *prefixKeys, size_t count, uint64_t key)
+{
+    if (count > 256)
+        return std::lower_bound(prefixKeys, prefixKeys + count, key) - prefixKeys;
+
+    __m512i keys = _mm512_set1_epi64(key);
+    size_t below = 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m512i values = _mm512_loadu_si512(prefixKeys + i);
+        below += _mm_popcnt_u32(_mm512_cmplt_epu64_mask(values, keys));
+    }
+
+    if (i < count)
+    {
+        __mmask8 tail = (1u << (count - i)) - 1;
+        __m512i values = _mm512_maskz_loadu_epi64(tail, prefixKeys + i);
+        below += _mm_popcnt_u32(_mm512_mask_cmplt_epu64_mask(tail, values, keys));
+    }
+
+    return below;
+}
+
+/*
+ * String dictionaries are saved as their entry offsets followed by the
+ * bytes of all entries, or entry by entry in the legacy format.
+ */
 template<>
 Result<bool>
-DictColumnData<StringType>::SaveValue(std::ostream &out,
-                                      const std::string &value) const
+DictColumnData<StringType>::Save(std::ostream &out, Format format) const
 {
-    int len = value.length();
-    out.write((char *) &len, sizeof(len));
-    out.write(value.c_str(), len);
+    out.write((char *) &type, sizeof(type));
+    int dictSize = dict.size();
+    out.write((char *) &dictSize, sizeof(dictSize));
+    if (format == LEGACY_FORMAT)
+    {
+        for (int i = 0; i < dictSize; i++)
+        {
+            int length = dict[i].size();
+            out.write((char *) &length, sizeof(length));
+            out.write(dict[i].data(), length);
+        }
+    }
+    else
+    {
+        out.write((char *) dict.offsets.data(), dict.offsets.size() * sizeof(uint32_t));
+        out.write(dict.bytes.data(), dict.bytes.size());
+    }
+    out.write((char *) &size, sizeof(size));
+    out.write((char *) values, size * bytesPerValue());
     return true;
 }
 
+/*
+ * Bytes which can still be read from in, UINT64_MAX if that's not known.
+ * Streams which don't have a BoundedStreamBuf are measured by seeking.
+ */
+static uint64_t
+BytesLeft(std::istream &in)
+{
+    if (auto boundedBuf = dynamic_cast<BoundedStreamBuf *>(in.rdbuf()))
+        return boundedBuf->BytesLeft();
+
+    auto position = in.tellg();
+    if (!in || position < 0)
+    {
+        in.clear();
+        return UINT64_MAX;
+    }
+
+    in.seekg(0, std::ios::end);
+    auto end = in.tellg();
+    in.clear();
+    in.seekg(position);
+    if (end < position)
+        return UINT64_MAX;
+    return end - position;
+}
+
 template<class AccelTy>
-static void
-ReadValues(std::istream &in, int count, typename AccelTy::c_type *out)
+static Result<bool>
+ReadDict(std::istream &in, int dictSize, typename DictStorage<AccelTy>::type &dict,
+         ColumnDataBase::Format format)
 {
-    in.read((char *) out, count * sizeof(typename AccelTy::c_type));
+    dict.resize(dictSize);
+    in.read((char *) dict.data(), dictSize * sizeof(typename AccelTy::c_type));
+    if (!in)
+        return Status::Invalid("Failed to read dictionary");
+    return true;
 }
 
 template<>
-void
-ReadValues<StringType>(std::istream &in, int count, std::string *out)
+Result<bool>
+ReadDict<StringType>(std::istream &in, int dictSize, StringDict &dict,
+                     ColumnDataBase::Format format)
 {
-    for (int i = 0; i < count; i++)
+    if (format == ColumnDataBase::LEGACY_FORMAT)
     {
-        int size;
-        in.read((char *) &size, sizeof(size));
-        for (int j = 0; j < size; j++)
+        // lengths are checked before allocating for them, since corrupt
+        // lengths could be up to 2GB
+        uint64_t bytesLeft = BytesLeft(in);
+        std::string value;
+        dict.reserve(dictSize);
+        for (int i = 0; i < dictSize; i++)
         {
-            char c;
-            in.read((char *) &c, sizeof(c));
-            out[i].push_back(c);
+            int length;
+            in.read((char *) &length, sizeof(length));
+            if (!in || length < 0 || length + sizeof(length) > bytesLeft)
+                return Status::Invalid("Invalid string dictionary entry length");
+            bytesLeft -= length + sizeof(length);
+
+            value.resize(length);
+            in.read(value.data(), length);
+            if (!in)
+                return Status::Invalid("Failed to read string dictionary entry");
+            dict.push_back(value);
         }
+        return true;
     }
+
+    dict.offsets.resize(dictSize + 1);
+    in.read((char *) dict.offsets.data(), (dictSize + 1) * sizeof(uint32_t));
+    if (!in || dict.offsets[0] != 0)
+        return Status::Invalid("Invalid string dictionary offsets");
+
+    for (int i = 0; i < dictSize; i++)
+        if (dict.offsets[i + 1] < dict.offsets[i])
+            return Status::Invalid("Invalid string dictionary offsets");
+
+    if (dict.offsets[dictSize] > BytesLeft(in))
+        return Status::Invalid("String dictionary is longer than its data");
+
+    dict.bytes.resize(dict.offsets[dictSize]);
+    in.read(dict.bytes.data(), dict.bytes.size());
+    if (!in)
+        return Status::Invalid("Failed to read string dictionary bytes");
+
+    dict.ComputePrefixKeys();
+    return true;
 }
 
 template<class AccelTy>
 static Result<ColumnDataP>
-LoadDictColumnData(std::istream &in)
+LoadDictColumnData(std::istream &in, ColumnDataBase::Format format)
 {
     int dictSize;
     auto result = std::make_shared<DictColumnData<AccelTy>>();
     result->type = ColumnDataBase::DICT_COLUMN_DATA;
     result->valueType = std::make_unique<AccelTy>();
     in.read((char *) &dictSize, sizeof(dictSize));
-    for (int i = 0; i < dictSize; i++)
-    {
-        typename AccelTy::c_type value;
-        ReadValues<AccelTy>(in, 1, &value);
-        result->dict.push_back(value);
-    }
+    if (!in || dictSize < 0 || dictSize > MaxRowGroupSize)
+        return Status::Invalid("Invalid dictionary size: ", dictSize);
+
+    RAISE_IF_FAILS(ReadDict<AccelTy>(in, dictSize, result->dict, format));
 
     in.read((char *) &result->size, sizeof(result->size));
-    int bytesPerValue = (dictSize < 256) ? 1 : 2;
-    result->values = (uint8_t *) aligned_alloc(512, bytesPerValue * result->size);
+    if (!in || result->size < 0 || result->size > MaxRowGroupSize)
+        return Status::Invalid("Invalid column data size: ", result->size);
+
+    int bytesPerValue = result->bytesPerValue();
+    result->values = AllocateColumnBuffer(bytesPerValue * result->size);
     in.read((char *) result->values, bytesPerValue * result->size);
+    if (!in)
+        return Status::Invalid("Failed to read column values");
 
     ColumnDataP resultCasted = std::move(result);
     return resultCasted;
 }
 
 static Result<ColumnDataP>
-LoadDictColumnData(std::istream &in, AccelType *dataType)
+LoadDictColumnData(std::istream &in, AccelType *dataType,
+                   ColumnDataBase::Format format)
 {
     switch (dataType->type_num())
     {
         case TypeNum::INT32_TYPE:
-            return LoadDictColumnData<Int32Type>(in);
+            return LoadDictColumnData<Int32Type>(in, format);
         case TypeNum::INT64_TYPE:
-            return LoadDictColumnData<Int64Type>(in);
+            return LoadDictColumnData<Int64Type>(in, format);
         case TypeNum::STRING_TYPE:
-            return LoadDictColumnData<StringType>(in);
+            return LoadDictColumnData<StringType>(in, format);
         case TypeNum::DATE_TYPE:
-            return LoadDictColumnData<DateType>(in);
+            return LoadDictColumnData<DateType>(in, format);
         case TypeNum::DECIMAL_TYPE:
-            return LoadDictColumnData<DecimalType>(in);
+            return LoadDictColumnData<DecimalType>(in, format);
     }
 
     return Status::Invalid("Invalid type for DictColumnData: ", dataType->type_num());
@@ -95,9 +242,17 @@ LoadRawColumnData(std::istream &in)
     in.read((char *) &result->minValue, sizeof (result->minValue));
     in.read((char *) &result->maxValue, sizeof (result->maxValue));
 
+    int bytesPerValue = result->bytesPerValue;
+    if (!in || result->size < 0 || result->size > MaxRowGroupSize ||
+        (bytesPerValue != 1 && bytesPerValue != 2 &&
+         bytesPerValue != 4 && bytesPerValue != 8))
+        return Status::Invalid("Invalid raw column data header");
+
     result->values =
-        (uint8_t *) aligned_alloc(512, result->bytesPerValue * result->size);
+        AllocateColumnBuffer(result->bytesPerValue * result->size);
     in.read((char *) result->values, result->bytesPerValue * result->size);
+    if (!in)
+        return Status::Invalid("Failed to read column values");
 
     ColumnDataP resultCasted = std::move(result);
     return resultCasted;
@@ -121,7 +276,8 @@ LoadRawColumnData(std::istream &in, AccelType *dataType)
     return Status::Invalid("Invalid type for RawColumnDate: ", dataType->type_num());
 }
 
-Result<ColumnDataP> ColumnDataBase::Load(std::istream &in, AccelType *dataType)
+Result<ColumnDataP> ColumnDataBase::Load(std::istream &in, AccelType *dataType,
+                                         Format format)
 {
     ColumnDataBase::Type type;
     in.read((char *) &type, sizeof(type));
@@ -129,7 +285,7 @@ Result<ColumnDataP> ColumnDataBase::Load(std::istream &in, AccelType *dataType)
     switch (type)
     {
         case ColumnDataBase::DICT_COLUMN_DATA:
-            return LoadDictColumnData(in, dataType);
+            return LoadDictColumnData(in, dataType, format);
         case ColumnDataBase::RAW_COLUMN_DATA:
             return LoadRawColumnData(in, dataType);
         default:
@@ -137,23 +293,4 @@ Result<ColumnDataP> ColumnDataBase::Load(std::istream &in, AccelType *dataType)
     }
 }
 
-void
-DictColumnDataBase::to_16(uint16_t *out)
-{
-    switch (bytesPerValue())
-    {
-        case 1:
-        {
-            for (int i = 0; i < size; i++)
-                out[i] = values[i];
-            break;
-        }
-        case 2:
-        {
-            memcpy(out, values, 2 * size);
-            break;
-        }
-    }
-}
-
 };
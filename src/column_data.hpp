@@ -5,9 +5,15 @@
 #include <execution>
 #include <algorithm>
 #include <set>
+#include <unordered_set>
+#include <unordered_map>
 #include <cstdint>
 #include <iostream>
+#include <string_view>
+#include <type_traits>
 
+#include "arena.h"
+#include "column_storage.h"
 #include "result_type.hpp"
 #include "types.hpp"
 
@@ -17,7 +23,19 @@ namespace pgaccel
 /*
  * Data Structures
 */
-const int RowGroupSize = 1 << 16;
+
+// dictionary codes and group ids of a row group fit in 16 bits
+const int MaxRowGroupSize = 1 << 16;
+const int DefaultRowGroupSize = MaxRowGroupSize;
+
+/*
+ * Stream buffers which know how many bytes are left, so loaders can check
+ * lengths read from the stream before allocating for them.
+ */
+class BoundedStreamBuf: public std::streambuf {
+public:
+    virtual uint64_t BytesLeft() const = 0;
+};
 
 struct ColumnDataBase;
 typedef std::shared_ptr<ColumnDataBase> ColumnDataP;
@@ -29,11 +47,27 @@ struct ColumnDataBase {
     } type;
     int size;
 
-    virtual Result<bool> Save(std::ostream &out) const = 0;
+    /*
+     * The legacy .data/.metadata files save string dictionary entries one
+     * at a time as a length and bytes, table files save them as a
+     * StringDict's offsets and bytes. Other column data is the same in
+     * both.
+     */
+    enum Format {
+        TABLE_FILE_FORMAT = 0,
+        LEGACY_FORMAT = 1
+    };
+
+    virtual Result<bool> Save(std::ostream &out,
+                              Format format = TABLE_FILE_FORMAT) const = 0;
+
+    // buffer of the encoded values and its length in bytes
+    virtual std::pair<uint8_t *, size_t> ValuesBuffer() const = 0;
 
     virtual ~ColumnDataBase() {};
 
-    static Result<ColumnDataP> Load(std::istream &in, AccelType *type);
+    static Result<ColumnDataP> Load(std::istream &in, AccelType *type,
+                                    Format format = TABLE_FILE_FORMAT);
 };
 
 struct DictColumnDataBase: public ColumnDataBase {
@@ -44,19 +78,116 @@ struct DictColumnDataBase: public ColumnDataBase {
     virtual std::vector<std::string> labels() const = 0;
     virtual std::string label(int) const = 0;
 
-    void to_16(uint16_t *out);
+    virtual std::pair<uint8_t *, size_t> ValuesBuffer() const {
+        return { values, (size_t) size * bytesPerValue() };
+    }
+};
+
+/*
+ * First 8 bytes of str as a big-endian integer, zero padded. Prefix keys
+ * order like the strings they're taken from, so most comparisons of
+ * strings are one integer comparison, and only strings with equal prefix
+ * keys need to be compared in full.
+ */
+inline uint64_t
+StringPrefixKey(std::string_view str)
+{
+    uint64_t word = 0;
+    memcpy(&word, str.data(), std::min<size_t>(str.size(), 8));
+    return __builtin_bswap64(word);
+}
+
+// number of the sorted prefix keys which are less than key
+size_t CountPrefixKeysBelow(const uint64_t *prefixKeys, size_t count, uint64_t key);
+
+/*
+ * Entries of a string dictionary, stored back to back in one buffer. Entry
+ * i is bytes[offsets[i], offsets[i + 1]), so a dictionary is two
+ * allocations however many entries it has, and is saved and loaded with
+ * one write or read of each array. Entries are accessed as views.
+ *
+ * prefixKeys has the StringPrefixKey() of each entry. It isn't saved, and
+ * is computed when entries are added or loaded.
+ */
+struct StringDict {
+    std::vector<uint32_t> offsets = { 0 };
+    std::string bytes;
+    std::vector<uint64_t> prefixKeys;
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    std::string_view operator[](size_t idx) const {
+        return std::string_view(bytes.data() + offsets[idx],
+                                offsets[idx + 1] - offsets[idx]);
+    }
+
+    void push_back(std::string_view value) {
+        bytes.append(value.data(), value.size());
+        offsets.push_back(bytes.size());
+        prefixKeys.push_back(StringPrefixKey(value));
+    }
+
+    void reserve(size_t count) {
+        offsets.reserve(count + 1);
+        prefixKeys.reserve(count);
+    }
+
+    void ComputePrefixKeys() {
+        prefixKeys.resize(size());
+        for (size_t i = 0; i < size(); i++)
+            prefixKeys[i] = StringPrefixKey((*this)[i]);
+    }
+
+    // <0, 0 or >0 as entry idx is less than, equal to or greater than value
+    int Compare(size_t idx, std::string_view value, uint64_t valueKey) const {
+        if (prefixKeys[idx] != valueKey)
+            return prefixKeys[idx] < valueKey ? -1 : 1;
+        return (*this)[idx].compare(value);
+    }
+
+    // index of the first entry which isn't less than value
+    size_t LowerBound(std::string_view value) const {
+        uint64_t valueKey = StringPrefixKey(value);
+        size_t left = CountPrefixKeysBelow(prefixKeys.data(), size(), valueKey);
+        size_t right = size();
+        while (left < right)
+        {
+            size_t mid = (left + right) / 2;
+            if (Compare(mid, value, valueKey) < 0)
+                left = mid + 1;
+            else
+                right = mid;
+        }
+        return left;
+    }
+};
+
+// container of dictionary entries, and how an entry is accessed
+template<class Ty>
+struct DictStorage {
+    using type = std::vector<typename Ty::c_type>;
+    using entry_type = typename Ty::c_type;
+};
+
+template<>
+struct DictStorage<StringType> {
+    using type = StringDict;
+    using entry_type = std::string_view;
 };
 
 template<class Ty>
 struct DictColumnData: public DictColumnDataBase {
     using DictTy = typename Ty::c_type;
-    std::vector<DictTy> dict;
+    typename DictStorage<Ty>::type dict;
 
-    virtual Result<bool> Save(std::ostream &out) const;
+    virtual Result<bool> Save(std::ostream &out,
+                              Format format = TABLE_FILE_FORMAT) const;
 
     virtual ~DictColumnData() {
         if (values)
-            free(values);
+            FreeColumnBuffer(values);
     }
 
     virtual int bytesPerValue() const {
@@ -69,26 +200,27 @@ struct DictColumnData: public DictColumnDataBase {
 
     virtual std::vector<std::string> labels() const {
         std::vector<std::string> result;
-        for (const auto& v: dict)
-            result.push_back(ToString(valueType.get(), v));
+        for (int i = 0; i < dict.size(); i++)
+            result.push_back(label(i));
         return result;
     }
 
     virtual std::string label(int idx) const {
-        return ToString(valueType.get(), dict[idx]);
+        return ToString(valueType.get(), DictTy(dict[idx]));
     }
-
-private:
-    Result<bool> SaveValue(std::ostream &out, const DictTy &value) const;
 };
 
 struct RawColumnDataBase: public ColumnDataBase {
     uint8_t *values = NULL;
     int bytesPerValue;
 
+    virtual std::pair<uint8_t *, size_t> ValuesBuffer() const {
+        return { values, (size_t) size * bytesPerValue };
+    }
+
     virtual ~RawColumnDataBase() {
         if (values)
-            free(values);
+            FreeColumnBuffer(values);
     }
 };
 
@@ -96,13 +228,297 @@ template<class Ty>
 struct RawColumnData: public RawColumnDataBase {
     typename Ty::c_type minValue, maxValue;
 
-    virtual Result<bool> Save(std::ostream &out) const;
+    virtual Result<bool> Save(std::ostream &out,
+                              Format format = TABLE_FILE_FORMAT) const;
+};
+
+// Construction from values
+template<class AccelTy>
+ColumnDataP
+CreateRawColumnData(const typename AccelTy::c_type *values, int size)
+{
+    auto columnData = std::make_unique<RawColumnData<AccelTy>>();
+    columnData->type = ColumnDataBase::RAW_COLUMN_DATA;
+
+    typename AccelTy::c_type maxValue = values[0], minValue = values[0];
+    for (int i = 0; i < size; i++) {
+        minValue = std::min(minValue, values[i]);
+        maxValue = std::max(maxValue, values[i]);
+    }
+
+#define FILL_RAW_DATA(type) \
+    { \
+    auto valuesTyped = reinterpret_cast<type *>(columnData->values); \
+    for (int i = 0; i < size; i++) \
+        valuesTyped[i] = values[i]; \
+    }
+
+    if (maxValue <= INT8_MAX && minValue >= INT8_MIN) {
+        columnData->bytesPerValue = 1;
+        columnData->values = AllocateColumnBuffer(size);
+        FILL_RAW_DATA(int8_t);
+    } else if (maxValue <= INT16_MAX && minValue >= INT16_MIN) {
+        columnData->bytesPerValue = 2;
+        columnData->values = AllocateColumnBuffer(2 * size);
+        FILL_RAW_DATA(int16_t);
+    } else if (maxValue <= INT32_MAX && minValue >= INT32_MIN) {
+        columnData->bytesPerValue = 4;
+        columnData->values = AllocateColumnBuffer(4 * size);
+        FILL_RAW_DATA(int32_t);
+    } else {
+        columnData->bytesPerValue = 8;
+        columnData->values = AllocateColumnBuffer(8 * size);
+        FILL_RAW_DATA(int64_t);
+    }
+
+#undef FILL_RAW_DATA
+
+    columnData->size = size;
+    columnData->minValue = minValue;
+    columnData->maxValue = maxValue;
+
+    return columnData;
+}
+
+// hash of a dictionary key, see DictionaryBuilder
+uint64_t HashBytes(const char *bytes, size_t length);
+
+/*
+ * Builds the dictionary of a row group. Distinct values are found with an
+ * open addressing hash table and numbered in order of appearance. String
+ * keys are views, and the bytes of each distinct string are copied into an
+ * arena, so keys may point into buffers which are reused and nothing is
+ * allocated per row.
+ */
+template<class AccelTy>
+class DictionaryBuilder {
+public:
+    using DictTy = typename AccelTy::c_type;
+    using KeyTy = typename std::conditional<
+        std::is_same<AccelTy, StringType>::value, std::string_view, DictTy>::type;
+
+    // id of key, which is added if it's new
+    uint32_t Add(KeyTy key)
+    {
+        if (2 * (keys_.size() + 1) > slots_.size())
+            Grow();
+
+        uint64_t hash = Hash(key);
+        size_t mask = slots_.size() - 1;
+        for (size_t slot = (hash >> 32) & mask; ; slot = (slot + 1) & mask)
+        {
+            uint32_t entry = slots_[slot];
+            if (entry == 0)
+            {
+                uint32_t id = keys_.size();
+                slots_[slot] = id + 1;
+                keys_.push_back(Store(key));
+                hashes_.push_back(hash);
+                return id;
+            }
+
+            uint32_t id = entry - 1;
+            if (hashes_[id] == hash && keys_[id] == key)
+                return id;
+        }
+    }
+
+    int DistinctCount() const
+    {
+        return keys_.size();
+    }
+
+    // forgets all keys, keeping allocated memory for the next row group
+    void Reset()
+    {
+        keys_.clear();
+        hashes_.clear();
+        std::fill(slots_.begin(), slots_.end(), 0);
+        arena_.Reset();
+    }
+
+    /*
+     * Column data of rows with the given ids. The dictionary is sorted, so
+     * ids are mapped to codes in the order of their keys.
+     */
+    ColumnDataP Finish(const uint32_t *ids, int size) const
+    {
+        std::vector<uint32_t> sortedIds(keys_.size());
+        for (uint32_t id = 0; id < sortedIds.size(); id++)
+            sortedIds[id] = id;
+        if constexpr (std::is_same<KeyTy, std::string_view>::value)
+        {
+            // most comparisons are decided by the prefix keys
+            std::vector<uint64_t> prefixKeys(keys_.size());
+            for (uint32_t id = 0; id < keys_.size(); id++)
+                prefixKeys[id] = StringPrefixKey(keys_[id]);
+
+            std::sort(sortedIds.begin(), sortedIds.end(),
+                      [&](uint32_t a, uint32_t b)
+                      {
+                          if (prefixKeys[a] != prefixKeys[b])
+                              return prefixKeys[a] < prefixKeys[b];
+                          return keys_[a] < keys_[b];
+                      });
+        }
+        else
+        {
+            std::sort(sortedIds.begin(), sortedIds.end(),
+                      [this](uint32_t a, uint32_t b)
+                      {
+                          return keys_[a] < keys_[b];
+                      });
+        }
+
+        auto columnData = std::make_shared<DictColumnData<AccelTy>>();
+        columnData->type = ColumnDataBase::DICT_COLUMN_DATA;
+        columnData->valueType = std::make_unique<AccelTy>();
+        columnData->size = size;
+
+        std::vector<uint32_t> codeOfId(sortedIds.size());
+        columnData->dict.reserve(sortedIds.size());
+        for (uint32_t code = 0; code < sortedIds.size(); code++)
+        {
+            codeOfId[sortedIds[code]] = code;
+            columnData->dict.push_back(keys_[sortedIds[code]]);
+        }
+
+        if (columnData->bytesPerValue() == 1)
+        {
+            uint8_t *values8 = AllocateColumnBuffer(size);
+            for (int i = 0; i < size; i++)
+                values8[i] = codeOfId[ids[i]];
+            columnData->values = values8;
+        }
+        else
+        {
+            uint16_t *values16 = (uint16_t *) AllocateColumnBuffer(2 * size);
+            for (int i = 0; i < size; i++)
+                values16[i] = codeOfId[ids[i]];
+            columnData->values = (uint8_t *) values16;
+        }
+
+        return columnData;
+    }
+
+private:
+    static uint64_t Hash(KeyTy key)
+    {
+        if constexpr (std::is_same<KeyTy, std::string_view>::value)
+            return HashBytes(key.data(), key.size());
+        else
+            return (uint64_t) key * 0x9E3779B97F4A7C15ULL;
+    }
+
+    KeyTy Store(KeyTy key)
+    {
+        if constexpr (std::is_same<KeyTy, std::string_view>::value)
+        {
+            char *bytes = static_cast<char *>(arena_.Allocate(key.size(), 1));
+            memcpy(bytes, key.data(), key.size());
+            return std::string_view(bytes, key.size());
+        }
+        else
+        {
+            return key;
+        }
+    }
+
+    // doubles the slots, which are reinserted from the stored hashes
+    void Grow()
+    {
+        size_t slotCount = std::max<size_t>(1024, 2 * slots_.size());
+        slots_.assign(slotCount, 0);
+
+        size_t mask = slotCount - 1;
+        for (uint32_t id = 0; id < keys_.size(); id++)
+        {
+            size_t slot = (hashes_[id] >> 32) & mask;
+            while (slots_[slot] != 0)
+                slot = (slot + 1) & mask;
+            slots_[slot] = id + 1;
+        }
+    }
+
+    // per id
+    std::vector<KeyTy> keys_;
+    std::vector<uint64_t> hashes_;
+
+    // id + 1 of the key in each slot, 0 for empty slots
+    std::vector<uint32_t> slots_;
+
+    Arena arena_;
 };
 
+template<class AccelTy>
+ColumnDataP
+CreateDictColumnData(const typename AccelTy::c_type *values, int size)
+{
+    DictionaryBuilder<AccelTy> builder;
+    std::vector<uint32_t> ids(size);
+    for (int i = 0; i < size; i++)
+        ids[i] = builder.Add(values[i]);
+
+    return builder.Finish(ids.data(), size);
+}
+
+// Decoding back to values, appends to out
+template<class AccelTy>
+void
+DecodeColumnData(const ColumnDataBase &columnData,
+                 std::vector<typename AccelTy::c_type> &out)
+{
+    switch (columnData.type)
+    {
+        case ColumnDataBase::DICT_COLUMN_DATA:
+        {
+            auto &dictData = static_cast<const DictColumnData<AccelTy> &>(columnData);
+            if (dictData.bytesPerValue() == 1)
+            {
+                for (int i = 0; i < dictData.size; i++)
+                    out.emplace_back(dictData.dict[dictData.values[i]]);
+            }
+            else
+            {
+                auto codes = reinterpret_cast<const uint16_t *>(dictData.values);
+                for (int i = 0; i < dictData.size; i++)
+                    out.emplace_back(dictData.dict[codes[i]]);
+            }
+            break;
+        }
+
+        case ColumnDataBase::RAW_COLUMN_DATA:
+        {
+            if constexpr (!std::is_same<AccelTy, StringType>::value)
+            {
+                auto &rawData = static_cast<const RawColumnData<AccelTy> &>(columnData);
+                switch (rawData.bytesPerValue)
+                {
+                #define DECODE_RAW_DATA(width, storageType) \
+                    case width: \
+                    { \
+                        auto values = reinterpret_cast<const storageType *>(rawData.values); \
+                        for (int i = 0; i < rawData.size; i++) \
+                            out.push_back(values[i]); \
+                        break; \
+                    }
+
+                    DECODE_RAW_DATA(1, int8_t);
+                    DECODE_RAW_DATA(2, int16_t);
+                    DECODE_RAW_DATA(4, int32_t);
+                    DECODE_RAW_DATA(8, int64_t);
+                #undef DECODE_RAW_DATA
+                }
+            }
+            break;
+        }
+    }
+}
+
 // Save functions
 template<typename AccelTy>
 Result<bool>
-RawColumnData<AccelTy>::Save(std::ostream &out) const
+RawColumnData<AccelTy>::Save(std::ostream &out, Format format) const
 {
     out.write((char *) &type, sizeof(type));
     out.write((char *) &size, sizeof(size));
@@ -115,34 +531,19 @@ RawColumnData<AccelTy>::Save(std::ostream &out) const
 
 template<typename AccelTy>
 Result<bool>
-DictColumnData<AccelTy>::Save(std::ostream &out) const
+DictColumnData<AccelTy>::Save(std::ostream &out, Format format) const
 {
     out.write((char *) &type, sizeof(type));
     int dictSize = dict.size();
     out.write((char *) &dictSize, sizeof(dictSize));
-    for (auto v: dict)
-    {
-        SaveValue(out, v);
-    }
+    out.write((char *) dict.data(), dictSize * sizeof(DictTy));
     out.write((char *) &size, sizeof(size));
-    int bytesPerValue = (dictSize < 256) ? 1 : 2;
-    out.write((char *) values, size * bytesPerValue);
-    return true;
-}
-
-template<typename AccelTy>
-Result<bool>
-DictColumnData<AccelTy>::SaveValue(std::ostream &out,
-                                   const typename AccelTy::c_type &value) const
-{
-    out.write((char *) &value, sizeof(value));
+    out.write((char *) values, size * bytesPerValue());
     return true;
 }
 
 // declare specialized version for StringType, define in .cc
 template<>
-Result<bool> DictColumnData<StringType>::SaveValue(
-    std::ostream &out,
-    const std::string &value) const;
+Result<bool> DictColumnData<StringType>::Save(std::ostream &out, Format format) const;
 
 };
@@ -0,0 +1,290 @@
+#include "column_storage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace pgaccel
+{
+
+const size_t ColumnBufferAlignment = 512;
+const size_t HugePageSize2M = 2UL << 20;
+const size_t HugePageSize1G = 1UL << 30;
+
+// regions are mapped in units of this many bytes, unless a buffer is larger
+const size_t DefaultRegionSize = 64UL << 20;
+
+struct Region {
+    uint8_t *start;
+    size_t size;
+    size_t used;
+    int liveBuffers;
+    bool hugeTlb;
+    // see SetColumnBufferRegionNode()
+    int numaNode;
+};
+
+static bool MapRegion(HugePageMode mode, size_t minSize, Region &region);
+static void *MapAligned(size_t size, size_t alignment);
+static void ReleaseCurrent();
+
+static std::mutex mutex;
+static HugePageMode hugePageMode = HugePageMode::THP;
+
+// mapped regions, keyed by start address
+static std::map<uintptr_t, Region> regions;
+
+// region which new buffers are carved from, nullptr if none
+static Region *current = nullptr;
+static int hugeTlbFallbacks = 0;
+
+HugePageMode
+GetHugePageMode()
+{
+    std::lock_guard lock(mutex);
+    return hugePageMode;
+}
+
+void
+SetHugePageMode(HugePageMode mode)
+{
+    std::lock_guard lock(mutex);
+    hugePageMode = mode;
+
+    // stop carving from a region mapped with the old mode
+    ReleaseCurrent();
+}
+
+std::string
+HugePageModeName(HugePageMode mode)
+{
+    switch (mode)
+    {
+        case HugePageMode::OFF:
+            return "off";
+        case HugePageMode::THP:
+            return "thp";
+        case HugePageMode::HUGETLB_2M:
+            return "2m";
+        case HugePageMode::HUGETLB_1G:
+            return "1g";
+    }
+    return "unknown";
+}
+
+uint8_t *
+AllocateColumnBuffer(size_t size)
+{
+    size = std::max((size + ColumnBufferAlignment - 1) & ~(ColumnBufferAlignment - 1),
+                    ColumnBufferAlignment);
+
+    std::lock_guard lock(mutex);
+    if (hugePageMode == HugePageMode::OFF)
+        return (uint8_t *) aligned_alloc(ColumnBufferAlignment, size);
+
+    if (current == nullptr || current->used + size > current->size)
+    {
+        Region region;
+        if (!MapRegion(hugePageMode, size, region))
+            return (uint8_t *) aligned_alloc(ColumnBufferAlignment, size);
+
+        ReleaseCurrent();
+        current = &regions.emplace((uintptr_t) region.start, region).first->second;
+    }
+
+    uint8_t *buffer = current->start + current->used;
+    current->used += size;
+    current->liveBuffers++;
+
+    return buffer;
+}
+
+void
+FreeColumnBuffer(uint8_t *buffer)
+{
+    if (buffer == nullptr)
+        return;
+
+    std::lock_guard lock(mutex);
+
+    auto it = regions.upper_bound((uintptr_t) buffer);
+    if (it != regions.begin())
+    {
+        --it;
+        Region &region = it->second;
+        if (buffer < region.start + region.size)
+        {
+            if (--region.liveBuffers > 0)
+                return;
+
+            if (&region == current)
+            {
+                // nothing lives in it, start over
+                region.used = 0;
+            }
+            else
+            {
+                munmap(region.start, region.size);
+                regions.erase(it);
+            }
+            return;
+        }
+    }
+
+    // allocated with huge pages off, or when mapping failed
+    free(buffer);
+}
+
+bool
+ColumnBufferRegion(const uint8_t *buffer, uint8_t *&start, size_t &size,
+                   int &numaNode)
+{
+    std::lock_guard lock(mutex);
+
+    auto it = regions.upper_bound((uintptr_t) buffer);
+    if (it == regions.begin())
+        return false;
+
+    --it;
+    const Region &region = it->second;
+    if (buffer >= region.start + region.size)
+        return false;
+
+    start = region.start;
+    size = region.size;
+    numaNode = region.numaNode;
+    return true;
+}
+
+void
+SetColumnBufferRegionNode(const uint8_t *start, int numaNode)
+{
+    std::lock_guard lock(mutex);
+
+    auto it = regions.find((uintptr_t) start);
+    if (it != regions.end())
+        it->second.numaNode = numaNode;
+}
+
+ColumnStorageStats
+GetColumnStorageStats()
+{
+    std::lock_guard lock(mutex);
+
+    ColumnStorageStats stats;
+    for (const auto &entry: regions)
+    {
+        const Region &region = entry.second;
+        stats.regionCount++;
+        stats.usedBytes += region.used;
+        if (region.hugeTlb)
+            stats.hugeTlbBytes += region.size;
+        else
+            stats.thpBytes += region.size;
+    }
+    stats.hugeTlbFallbacks = hugeTlbFallbacks;
+
+    return stats;
+}
+
+/*
+ * Stops carving from the current region. It stays mapped until its live
+ * buffers are freed, see FreeColumnBuffer(), and is unmapped now if it has
+ * none. Called with mutex held.
+ */
+static void
+ReleaseCurrent()
+{
+    if (current && current->liveBuffers == 0)
+    {
+        munmap(current->start, current->size);
+        regions.erase((uintptr_t) current->start);
+    }
+
+    current = nullptr;
+}
+
+/*
+ * Maps a region of at least minSize bytes. MAP_HUGETLB regions fall back
+ * to transparent huge pages, which only fails if we're out of memory.
+ */
+static bool
+MapRegion(HugePageMode mode, size_t minSize, Region &region)
+{
+    if (mode == HugePageMode::HUGETLB_2M || mode == HugePageMode::HUGETLB_1G)
+    {
+        size_t pageSize = HugePageSize2M;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB;
+        if (mode == HugePageMode::HUGETLB_1G)
+        {
+            pageSize = HugePageSize1G;
+            flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB;
+        }
+
+        size_t size = std::max(DefaultRegionSize, minSize);
+        size = (size + pageSize - 1) & ~(pageSize - 1);
+
+        void *start = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (start != MAP_FAILED)
+        {
+            region = { (uint8_t *) start, size, 0, 0, true, -1 };
+            return true;
+        }
+
+        hugeTlbFallbacks++;
+    }
+
+    size_t size = std::max(DefaultRegionSize, minSize);
+    size = (size + HugePageSize2M - 1) & ~(HugePageSize2M - 1);
+
+    void *start = MapAligned(size, HugePageSize2M);
+    if (start == nullptr)
+        return false;
+
+    // only a hint, the kernel may still use small pages
+    madvise(start, size, MADV_HUGEPAGE);
+
+    region = { (uint8_t *) start, size, 0, 0, false, -1 };
+    return true;
+}
+
+/*
+ * Transparent huge pages need 2MB aligned ranges, but mmap only aligns to
+ * the page size. Map more than needed and unmap the unaligned ends.
+ */
+static void *
+MapAligned(size_t size, size_t alignment)
+{
+    size_t mappedSize = size + alignment;
+    void *mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+        return nullptr;
+
+    uintptr_t mappedStart = (uintptr_t) mapped;
+    uintptr_t start = (mappedStart + alignment - 1) & ~(alignment - 1);
+    uintptr_t end = start + size;
+
+    if (start > mappedStart)
+        munmap(mapped, start - mappedStart);
+    if (mappedStart + mappedSize > end)
+        munmap((void *) end, mappedStart + mappedSize - end);
+
+    return (void *) start;
+}
+
+};
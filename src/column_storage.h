@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pgaccel
+{
+
+/*
+ * Column buffers are carved out of large regions backed by huge pages, so
+ * scans over many row groups don't thrash the TLB. Buffers are 512-byte
+ * aligned, and a region is unmapped when its last buffer is freed.
+ *
+ * HUGETLB_2M and HUGETLB_1G map regions with MAP_HUGETLB, which needs
+ * reserved huge pages (vm.nr_hugepages). When that fails, the region falls
+ * back to transparent huge pages. OFF allocates each buffer separately
+ * with aligned_alloc().
+ */
+enum class HugePageMode {
+    OFF,
+    THP,
+    HUGETLB_2M,
+    HUGETLB_1G
+};
+
+HugePageMode GetHugePageMode();
+
+// applies to regions mapped afterwards
+void SetHugePageMode(HugePageMode mode);
+
+std::string HugePageModeName(HugePageMode mode);
+
+uint8_t *AllocateColumnBuffer(size_t size);
+void FreeColumnBuffer(uint8_t *buffer);
+
+/*
+ * Start and size of the region which buffer was carved from, and the NUMA
+ * node it was moved to, -1 if it wasn't. False for buffers which were
+ * allocated separately.
+ */
+bool ColumnBufferRegion(const uint8_t *buffer, uint8_t *&start, size_t &size,
+                        int &numaNode);
+
+// records the node which the region starting at start was moved to
+void SetColumnBufferRegionNode(const uint8_t *start, int numaNode);
+
+struct ColumnStorageStats {
+    int regionCount = 0;
+    size_t hugeTlbBytes = 0;
+    size_t thpBytes = 0;
+    // bytes handed out to live buffers
+    size_t usedBytes = 0;
+    // MAP_HUGETLB regions which fell back to transparent huge pages
+    int hugeTlbFallbacks = 0;
+};
+
+ColumnStorageStats GetColumnStorageStats();
+
+};
@@ -1,16 +1,34 @@
 #include "columnar_table.h"
+#include "numa_placement.h"
+#include "selection_cache.h"
+#include "table_file.h"
 #include "util.h"
 
 #include <execution>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <string>
 
 namespace pgaccel 
 {
 
+// versions of published row group lists
+static std::atomic<uint64_t> nextVersion{1};
+
+ColumnarTable::~ColumnarTable()
+{
+    // background loads publish into this table
+    for (auto &columnLoad: column_loads_)
+        if (columnLoad.valid())
+            columnLoad.wait();
+
+    SelectionCache::Shared().Invalidate(version_);
+}
+
 std::optional<int>
 ColumnarTable::ColumnIndex(const std::string& name) const
 {
@@ -26,16 +44,93 @@ ColumnarTable::ColumnIndex(const std::string& name) const
 Result<bool>
 ColumnarTable::Save(const std::string &path)
 {
-    std::ofstream dataStream(path);
-    std::ofstream metadataStream(path + ".metadata");
-    return Save(metadataStream, dataStream);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return Status::Invalid("Could not open ", path);
+
+    return Save(out);
+}
+
+Result<bool>
+ColumnarTable::Save(std::ostream &out)
+{
+    RAISE_IF_FAILS(LoadAllColumns());
+
+    std::lock_guard lock(append_mutex_);
+
+    auto rowGroups = RowGroups();
+
+    TableFileFooter footer;
+    footer.rowGroupSize = row_group_size_;
+    for (const auto &columnDesc: schema_)
+    {
+        int scale = 0;
+        if (columnDesc.type->type_num() == DECIMAL_TYPE)
+            scale = columnDesc.type->asDecimalType()->scale;
+
+        footer.columns.push_back({ columnDesc.name,
+                                   columnDesc.type->type_num(),
+                                   scale,
+                                   columnDesc.layout });
+    }
+
+    footer.rowGroupSizes.resize(rowGroups->size());
+    footer.chunks.resize(rowGroups->size());
+    for (auto sortKey: SortKeys())
+        footer.sortKeys.push_back(sortKey);
+
+    WriteTableFileHeader(out);
+    RAISE_IF_FAILS(WriteTableFileChunks(out, *rowGroups, 0, footer));
+    WriteTableFileFooter(out, footer);
+    if (!out)
+        return Status::Invalid("Failed to write table file");
+
+    // buffered row groups are in the file now, so we can't merge them anymore.
+    sealed_count_ = rowGroups->size();
+    persisted_count_ = rowGroups->size();
+    rewritten_ = false;
+
+    return true;
+}
+
+/*
+ * Writes the chunks of row groups starting at firstGroup column by column,
+ * so each column's chunks are contiguous, and records them in footer.
+ */
+Result<bool>
+ColumnarTable::WriteTableFileChunks(std::ostream &out,
+                                    const std::vector<RowGroup> &rowGroups,
+                                    int firstGroup,
+                                    TableFileFooter &footer) const
+{
+    for (int group = firstGroup; group < footer.chunks.size(); group++)
+    {
+        footer.rowGroupSizes[group] = rowGroups[group].size;
+        footer.chunks[group].resize(schema_.size());
+    }
+
+    for (int colIdx = 0; colIdx < schema_.size(); colIdx++)
+        for (int group = firstGroup; group < footer.chunks.size(); group++)
+        {
+            TableFileChunk chunk;
+            ASSIGN_OR_RAISE(chunk, WriteTableFileChunk(
+                out, *rowGroups[group].columns[colIdx], schema_[colIdx].type.get()));
+            footer.chunks[group][colIdx] = chunk;
+        }
+
+    return true;
 }
 
 
 Result<bool>
 ColumnarTable::Save(std::ostream& metadataStream,
-                    std::ostream& dataStream) const
+                    std::ostream& dataStream)
 {
+    RAISE_IF_FAILS(LoadAllColumns());
+
+    std::lock_guard lock(append_mutex_);
+
+    auto rowGroups = RowGroups();
     std::vector<uint64_t> column_positions;
 
     int numCols = schema_.size();
@@ -45,9 +140,10 @@ ColumnarTable::Save(std::ostream& metadataStream,
     {
         column_positions.push_back(dataStream.tellp());
 
-        for (const auto &rowGroup: row_groups_)
+        for (const auto &rowGroup: *rowGroups)
         {
-            RAISE_IF_FAILS(rowGroup.columns[colIdx]->Save(dataStream));
+            RAISE_IF_FAILS(rowGroup.columns[colIdx]->Save(dataStream,
+                                                          ColumnDataBase::LEGACY_FORMAT));
         }
     }
 
@@ -56,7 +152,7 @@ ColumnarTable::Save(std::ostream& metadataStream,
     {
         AccelType *type = schema_[colIdx].type.get();
         metadataStream << column_positions[colIdx];
-        metadataStream << " " << row_groups_.size();
+        metadataStream << " " << rowGroups->size();
         metadataStream << " " << schema_[colIdx].name;
         metadataStream << " " << type->type_num();
         switch (type->type_num())
@@ -70,6 +166,115 @@ ColumnarTable::Save(std::ostream& metadataStream,
         metadataStream << std::endl;
     }
 
+    // buffered row groups are in the file now, so we can't merge them anymore.
+    sealed_count_ = rowGroups->size();
+    persisted_count_ = rowGroups->size();
+    rewritten_ = false;
+
+    return true;
+}
+
+Result<bool>
+ColumnarTable::SaveAppend(const std::string &path)
+{
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file)
+        return Status::Invalid("Could not open ", path);
+
+    if (IsTableFile(file))
+    {
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = file.tellg();
+
+        auto result = SaveAppend(file);
+        if (!result.ok())
+        {
+            // don't leave chunks of the failed append behind
+            file.close();
+            std::error_code error;
+            std::filesystem::resize_file(path, fileSize, error);
+        }
+        return result;
+    }
+
+    std::ofstream metadataStream(path + ".metadata", std::ios::app);
+    return SaveAppend(metadataStream, file);
+}
+
+Result<bool>
+ColumnarTable::SaveAppend(std::iostream &file)
+{
+    std::lock_guard lock(append_mutex_);
+
+    if (rewritten_)
+        return Status::Invalid("Table was sorted since it was saved, use Save()");
+
+    auto rowGroups = RowGroups();
+    if (sealed_count_ == persisted_count_)
+        return true;
+
+    TableFileFooter footer;
+    ASSIGN_OR_RAISE(footer, ReadTableFileFooter(file));
+    if (footer.rowGroupSizes.size() != persisted_count_ ||
+        footer.columns.size() != schema_.size())
+        return Status::Invalid("Table file doesn't match the saved table");
+
+    footer.rowGroupSizes.resize(sealed_count_);
+    footer.chunks.resize(sealed_count_);
+    footer.sortKeys.clear();
+    for (auto sortKey: SortKeys())
+        footer.sortKeys.push_back(sortKey);
+
+    // the old footer stays valid until the new trailer is written
+    file.clear();
+    file.seekp(0, std::ios::end);
+    RAISE_IF_FAILS(WriteTableFileChunks(file, *rowGroups, persisted_count_, footer));
+    WriteTableFileFooter(file, footer);
+    file.flush();
+    if (!file)
+        return Status::Invalid("Failed to write table file");
+
+    persisted_count_ = sealed_count_;
+
+    return true;
+}
+
+Result<bool>
+ColumnarTable::SaveAppend(std::ostream& metadataStream,
+                          std::ostream& dataStream)
+{
+    std::lock_guard lock(append_mutex_);
+
+    if (rewritten_)
+        return Status::Invalid("Table was sorted since it was saved, use Save()");
+
+    auto rowGroups = RowGroups();
+    int groupCount = sealed_count_ - persisted_count_;
+    if (groupCount == 0)
+        return true;
+
+    std::vector<uint64_t> column_positions;
+
+    dataStream.seekp(0, std::ios::end);
+    for (int colIdx = 0; colIdx < schema_.size(); colIdx++)
+    {
+        column_positions.push_back(dataStream.tellp());
+
+        for (int group = persisted_count_; group < sealed_count_; group++)
+        {
+            RAISE_IF_FAILS((*rowGroups)[group].columns[colIdx]->Save(
+                dataStream, ColumnDataBase::LEGACY_FORMAT));
+        }
+    }
+
+    metadataStream.seekp(0, std::ios::end);
+    metadataStream << "segment " << groupCount;
+    for (auto position: column_positions)
+        metadataStream << " " << position;
+    metadataStream << std::endl;
+
+    persisted_count_ = sealed_count_;
+
     return true;
 }
 
@@ -78,9 +283,130 @@ ColumnarTable::Load(const std::string &tableName,
                     const std::string &path,
                     std::optional<std::set<std::string>> fields)
 {
-    std::ifstream dataStream(path);
-    std::ifstream metadataStream(path + ".metadata");
-    return Load(tableName, metadataStream, dataStream, fields);
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return Status::Invalid("Could not open ", path);
+
+    if (!IsTableFile(in))
+    {
+        std::ifstream metadataStream(path + ".metadata");
+        return Load(tableName, metadataStream, in, fields);
+    }
+
+    TableFileFooter footer;
+    ASSIGN_OR_RAISE(footer, ReadTableFileFooter(in));
+
+    return LoadTableFile(tableName, footer, fields,
+        [&path](const std::vector<TableFileChunkRead> &reads)
+        {
+            return ReadTableFileChunks(path, reads);
+        });
+}
+
+Result<ColumnarTableP>
+ColumnarTable::Load(const std::string &tableName,
+                    std::istream& in,
+                    std::optional<std::set<std::string>> fields)
+{
+    TableFileFooter footer;
+    ASSIGN_OR_RAISE(footer, ReadTableFileFooter(in));
+
+    return LoadTableFile(tableName, footer, fields,
+        [&in](const std::vector<TableFileChunkRead> &reads)
+            -> Result<std::vector<ColumnDataP>>
+        {
+            std::vector<ColumnDataP> result;
+            for (const auto &read: reads)
+            {
+                ColumnDataP columnData;
+                ASSIGN_OR_RAISE(columnData,
+                                ReadTableFileChunk(in, read.chunk, read.type));
+                result.push_back(std::move(columnData));
+            }
+            return result;
+        });
+}
+
+/*
+ * Builds a table from the footer of a single-file container, with the
+ * chunks of the selected fields read by readChunks.
+ */
+Result<ColumnarTableP>
+ColumnarTable::LoadTableFile(const std::string &tableName,
+                             const TableFileFooter &footer,
+                             std::optional<std::set<std::string>> fields,
+                             const ChunkReader &readChunks)
+{
+    std::set<std::string> fieldsToLoad;
+    if (fields.has_value())
+        for (const auto &field: *fields)
+            fieldsToLoad.insert(ToLower(field));
+
+    auto result = std::unique_ptr<ColumnarTable>(new ColumnarTable);
+    result->name_ = tableName;
+    result->row_group_size_ = footer.rowGroupSize;
+    if (result->row_group_size_ <= 0 || result->row_group_size_ > MaxRowGroupSize)
+        return Status::Invalid("Invalid row group size: ", footer.rowGroupSize);
+
+    int groupCount = footer.rowGroupSizes.size();
+    std::vector<RowGroup> rowGroups(groupCount);
+    for (int group = 0; group < groupCount; group++)
+        rowGroups[group].size = footer.rowGroupSizes[group];
+
+    std::vector<int> loadedColumns;
+    for (int colIdx = 0; colIdx < footer.columns.size(); colIdx++)
+    {
+        const auto &column = footer.columns[colIdx];
+
+        ColumnDesc columnDesc;
+        columnDesc.name = ToLower(column.name);
+        if (fields.has_value() && !fieldsToLoad.count(columnDesc.name))
+            continue;
+
+        ASSIGN_OR_RAISE(columnDesc.type, CreateAccelType(column.typeNum, column.scale));
+        columnDesc.layout = column.layout;
+
+        loadedColumns.push_back(colIdx);
+        result->schema_.push_back(std::move(columnDesc));
+    }
+
+    // in file order, column by column
+    std::vector<TableFileChunkRead> reads;
+    for (int i = 0; i < loadedColumns.size(); i++)
+        for (int group = 0; group < groupCount; group++)
+            reads.push_back({ footer.chunks[group][loadedColumns[i]],
+                              result->schema_[i].type.get() });
+
+    std::vector<ColumnDataP> columnData;
+    ASSIGN_OR_RAISE(columnData, readChunks(reads));
+
+    for (int i = 0; i < loadedColumns.size(); i++)
+        for (int group = 0; group < groupCount; group++)
+        {
+            auto &chunkData = columnData[i * groupCount + group];
+            if (chunkData->size != rowGroups[group].size)
+                return Status::Invalid("Row count mismatch in column ",
+                                       result->schema_[i].name,
+                                       " of row group ", group);
+
+            rowGroups[group].columns.push_back(std::move(chunkData));
+        }
+
+    // rows are still ordered by the loaded leading sort keys
+    std::vector<int> sortKeys;
+    for (auto sortKey: footer.sortKeys)
+    {
+        auto loaded = std::find(loadedColumns.begin(), loadedColumns.end(), sortKey);
+        if (loaded == loadedColumns.end())
+            break;
+        sortKeys.push_back(loaded - loadedColumns.begin());
+    }
+
+    result->sealed_count_ = groupCount;
+    result->persisted_count_ = groupCount;
+    result->Publish(std::move(rowGroups), std::move(sortKeys));
+
+    return result;
 }
 
 Result<ColumnarTableP>
@@ -91,6 +417,7 @@ ColumnarTable::Load(const std::string &tableName,
 {
     auto result = std::unique_ptr<ColumnarTable>(new ColumnarTable);
     result->name_ = tableName;
+    result->row_group_size_ = 0;
 
     bool loadAll = false;
     std::set<std::string> fieldsToLoad;
@@ -154,6 +481,28 @@ ColumnarTable::Load(const std::string &tableName,
         column_descs.push_back(std::move(columnDesc));
     }
 
+    // row groups added by SaveAppend
+    std::vector<std::vector<uint64_t>> segment_positions;
+    std::vector<int> segment_groups;
+
+    std::string keyword;
+    while (metadataStream >> keyword)
+    {
+        if (keyword != "segment")
+            return Status::Invalid("Unexpected metadata entry: ", keyword);
+
+        int groupCount;
+        std::vector<uint64_t> positions(numCols);
+        metadataStream >> groupCount;
+        for (auto &position: positions)
+            metadataStream >> position;
+
+        segment_groups.push_back(groupCount);
+        segment_positions.push_back(std::move(positions));
+    }
+
+    std::vector<RowGroup> rowGroups;
+
     for (int colIdx = 0; colIdx < numCols; colIdx++)
     {
         ColumnDesc &columnDesc = column_descs[colIdx];
@@ -163,27 +512,742 @@ ColumnarTable::Load(const std::string &tableName,
             continue;
         }
 
-        uint64_t position = column_positions[colIdx];
-        int groupCount = column_groups[colIdx];
-        dataStream.seekg(position);
-
-        while(result->row_groups_.size() < groupCount)
-            result->row_groups_.push_back({});
+        std::vector<std::pair<uint64_t, int>> extents;
+        extents.push_back({ column_positions[colIdx], column_groups[colIdx] });
+        for (int segment = 0; segment < segment_groups.size(); segment++)
+            extents.push_back({ segment_positions[segment][colIdx],
+                                segment_groups[segment] });
 
-        for (int group = 0; group < groupCount; group++)
+        int group = 0;
+        for (auto [position, groupCount]: extents)
         {
-            auto &rowGroup = result->row_groups_[group];
-            auto columnData = ColumnDataBase::Load(dataStream, columnDesc.type.get());
-            RAISE_IF_FAILS(columnData);
-            rowGroup.columns.push_back(std::move(columnData).ValueUnsafe());
-            rowGroup.size = rowGroup.columns.back()->size;
+            dataStream.seekg(position);
+
+            for (int i = 0; i < groupCount; i++, group++)
+            {
+                if (rowGroups.size() <= group)
+                    rowGroups.push_back({});
+
+                auto &rowGroup = rowGroups[group];
+                auto columnData = ColumnDataBase::Load(dataStream, columnDesc.type.get(),
+                                                       ColumnDataBase::LEGACY_FORMAT);
+                RAISE_IF_FAILS(columnData);
+                rowGroup.columns.push_back(std::move(columnData).ValueUnsafe());
+                rowGroup.size = rowGroup.columns.back()->size;
+            }
         }
 
-        columnDesc.layout = result->row_groups_[0].columns.back()->type;
+        columnDesc.layout = rowGroups[0].columns.back()->type;
 
         result->schema_.push_back(std::move(column_descs[colIdx]));
     }
 
+    // all but trailing row groups are full, so the largest one has the
+    // table's row group size
+    for (const auto &rowGroup: rowGroups)
+        result->row_group_size_ = std::max(result->row_group_size_, rowGroup.size);
+    if (result->row_group_size_ == 0)
+        result->row_group_size_ = DefaultRowGroupSize;
+
+    result->sealed_count_ = rowGroups.size();
+    result->persisted_count_ = rowGroups.size();
+    result->Publish(std::move(rowGroups));
+
+    return result;
+}
+
+RowGroupsSnapshot
+ColumnarTable::RowGroups() const
+{
+    std::lock_guard lock(row_groups_mutex_);
+    return row_groups_;
+}
+
+RowGroupsSnapshot
+ColumnarTable::RowGroups(uint64_t &version) const
+{
+    std::lock_guard lock(row_groups_mutex_);
+    version = version_;
+    return row_groups_;
+}
+
+void
+ColumnarTable::Publish(std::vector<RowGroup> &&rowGroups)
+{
+    Publish(std::move(rowGroups), SortKeys());
+}
+
+void
+ColumnarTable::Publish(std::vector<RowGroup> &&rowGroups, std::vector<int> sortKeys)
+{
+    PlaceRowGroups(rowGroups);
+
+    // row groups carried over from the previous list keep their cubes
+    bool cubesEnabled = cubes_enabled_;
+    std::for_each(std::execution::par, rowGroups.begin(), rowGroups.end(),
+                  [cubesEnabled](RowGroup &rowGroup)
+                  {
+                      if (!cubesEnabled)
+                          rowGroup.cube = nullptr;
+                      else if (!rowGroup.cube)
+                          rowGroup.cube = RowGroupCube::Build(rowGroup);
+                  });
+
+    auto snapshot =
+        std::make_shared<const std::vector<RowGroup>>(std::move(rowGroups));
+
+    uint64_t oldVersion;
+    {
+        std::lock_guard lock(row_groups_mutex_);
+        row_groups_ = std::move(snapshot);
+        sort_keys_ = std::move(sortKeys);
+        oldVersion = version_;
+        version_ = nextVersion++;
+    }
+
+    // queries which pinned the old row groups may still add entries for
+    // them, but no later query looks those up
+    SelectionCache::Shared().Invalidate(oldVersion);
+}
+
+/*
+ * Publishes row groups which only differ from the current ones in which of
+ * the given columns are resident. Their rows are the same, so the version
+ * stays, and with it the selection cache entries and sort keys. New column
+ * buffers are placed, and cubes are only updated for these columns.
+ */
+void
+ColumnarTable::PublishColumns(std::vector<RowGroup> &&rowGroups,
+                              const std::vector<int> &columns)
+{
+    PlaceColumns(rowGroups, columns);
+
+    bool cubesEnabled = cubes_enabled_;
+    std::for_each(std::execution::par, rowGroups.begin(), rowGroups.end(),
+                  [cubesEnabled, &columns](RowGroup &rowGroup)
+                  {
+                      if (!cubesEnabled)
+                          rowGroup.cube = nullptr;
+                      else if (!rowGroup.cube)
+                          rowGroup.cube = RowGroupCube::Build(rowGroup);
+                      else
+                          rowGroup.cube = RowGroupCube::Update(*rowGroup.cube,
+                                                               rowGroup, columns);
+                  });
+
+    auto snapshot =
+        std::make_shared<const std::vector<RowGroup>>(std::move(rowGroups));
+
+    std::lock_guard lock(row_groups_mutex_);
+    row_groups_ = std::move(snapshot);
+}
+
+Result<bool>
+ColumnarTable::Append(const ColumnarTable &other)
+{
+    std::vector<int> columnMap;
+    for (const auto &columnDesc: schema_)
+    {
+        auto maybeColumnIdx = other.ColumnIndex(columnDesc.name);
+        if (!maybeColumnIdx.has_value())
+            return Status::Invalid("Column not found in appended data: ",
+                                   columnDesc.name);
+
+        const auto &otherDesc = other.schema_[*maybeColumnIdx];
+        if (otherDesc.type->type_num() != columnDesc.type->type_num() ||
+            otherDesc.layout != columnDesc.layout)
+            return Status::Invalid("Column type mismatch in appended data: ",
+                                   columnDesc.name);
+
+        // values are stored unscaled, so they are only comparable at one scale
+        if (columnDesc.type->type_num() == DECIMAL_TYPE &&
+            otherDesc.type->asDecimalType()->scale !=
+                columnDesc.type->asDecimalType()->scale)
+            return Status::Invalid("Decimal scale mismatch in appended data: ",
+                                   columnDesc.name);
+
+        columnMap.push_back(*maybeColumnIdx);
+    }
+
+    RAISE_IF_FAILS(LoadAllColumns());
+
+    auto otherRowGroups = other.RowGroups();
+    for (const auto &otherRowGroup: *otherRowGroups)
+        for (auto columnIdx: columnMap)
+            if (!otherRowGroup.columns[columnIdx])
+                return Status::Invalid("Column isn't loaded in appended data: ",
+                                       other.schema_[columnIdx].name);
+
+    std::lock_guard lock(append_mutex_);
+
+    auto current = RowGroups();
+    std::vector<RowGroup> sealed, pending;
+    int pendingRows = 0;
+
+    for (int group = 0; group < current->size(); group++)
+    {
+        if (group < sealed_count_)
+        {
+            sealed.push_back((*current)[group]);
+        }
+        else
+        {
+            pending.push_back((*current)[group]);
+            pendingRows += pending.back().size;
+        }
+    }
+
+    for (const auto &otherRowGroup: *otherRowGroups)
+    {
+        RowGroup rowGroup;
+        for (auto columnIdx: columnMap)
+            rowGroup.columns.push_back(otherRowGroup.columns[columnIdx]);
+        rowGroup.size = otherRowGroup.size;
+
+        if (rowGroup.size == row_group_size_)
+        {
+            sealed.push_back(std::move(rowGroup));
+        }
+        else
+        {
+            pendingRows += rowGroup.size;
+            pending.push_back(std::move(rowGroup));
+        }
+    }
+
+    if (pendingRows >= row_group_size_)
+    {
+        auto merged = MergeRowGroups(pending);
+        pending.clear();
+        for (auto &rowGroup: merged)
+        {
+            if (rowGroup.size == row_group_size_)
+                sealed.push_back(std::move(rowGroup));
+            else
+                pending.push_back(std::move(rowGroup));
+        }
+    }
+
+    sealed_count_ = sealed.size();
+    for (auto &rowGroup: pending)
+        sealed.push_back(std::move(rowGroup));
+
+    // appended rows aren't in order
+    Publish(std::move(sealed), {});
+
+    return true;
+}
+
+void
+ColumnarTable::Flush()
+{
+    std::lock_guard lock(append_mutex_);
+
+    auto current = RowGroups();
+    if (sealed_count_ == current->size())
+        return;
+
+    std::vector<RowGroup> rowGroups, pending;
+    for (int group = 0; group < current->size(); group++)
+    {
+        if (group < sealed_count_)
+            rowGroups.push_back((*current)[group]);
+        else
+            pending.push_back((*current)[group]);
+    }
+
+    if (pending.size() > 1)
+        pending = MergeRowGroups(pending);
+
+    for (auto &rowGroup: pending)
+        rowGroups.push_back(std::move(rowGroup));
+
+    sealed_count_ = rowGroups.size();
+    Publish(std::move(rowGroups));
+}
+
+void
+ColumnarTable::SetCubes(bool enabled)
+{
+    std::lock_guard lock(append_mutex_);
+
+    if (cubes_enabled_ == enabled)
+        return;
+
+    cubes_enabled_ = enabled;
+
+    auto current = RowGroups();
+    Publish(std::vector<RowGroup>(current->begin(), current->end()));
+}
+
+Result<bool>
+ColumnarTable::SortBy(const std::vector<std::string> &columnNames)
+{
+    std::vector<int> sortKeys;
+    for (const auto &columnName: columnNames)
+    {
+        auto maybeColumnIdx = ColumnIndex(columnName);
+        if (!maybeColumnIdx.has_value())
+            return Status::Invalid("Column not found: ", columnName);
+        sortKeys.push_back(*maybeColumnIdx);
+    }
+
+    if (sortKeys.empty())
+        return Status::Invalid("No sort keys given");
+
+    RAISE_IF_FAILS(LoadAllColumns());
+
+    std::lock_guard lock(append_mutex_);
+
+    auto current = RowGroups();
+    auto rowOrder = SortedRowOrder(*current, sortKeys);
+    auto rowGroups = MergeRowGroups(*current, &rowOrder);
+
+    // all row groups are rewritten, so the file has none of them, and
+    // appending them to it would store every row twice
+    sealed_count_ = rowGroups.size();
+    persisted_count_ = 0;
+    rewritten_ = true;
+    Publish(std::move(rowGroups), std::move(sortKeys));
+
+    return true;
+}
+
+std::vector<int>
+ColumnarTable::SortKeys() const
+{
+    std::lock_guard lock(row_groups_mutex_);
+    return sort_keys_;
+}
+
+std::vector<int>
+ColumnarTable::SortKeys(uint64_t version) const
+{
+    std::lock_guard lock(row_groups_mutex_);
+    if (version != version_)
+        return {};
+    return sort_keys_;
+}
+
+Result<ColumnarTableP>
+ColumnarTable::Open(const std::string &tableName,
+                    const std::string &path,
+                    size_t budgetBytes)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return Status::Invalid("Could not open ", path);
+
+    TableFileFooter footer;
+    ASSIGN_OR_RAISE(footer, ReadTableFileFooter(in));
+
+    auto result = std::unique_ptr<ColumnarTable>(new ColumnarTable);
+    result->name_ = tableName;
+    result->row_group_size_ = footer.rowGroupSize;
+    if (result->row_group_size_ <= 0 || result->row_group_size_ > MaxRowGroupSize)
+        return Status::Invalid("Invalid row group size: ", footer.rowGroupSize);
+
+    for (const auto &column: footer.columns)
+    {
+        ColumnDesc columnDesc;
+        columnDesc.name = ToLower(column.name);
+        ASSIGN_OR_RAISE(columnDesc.type, CreateAccelType(column.typeNum, column.scale));
+        columnDesc.layout = column.layout;
+        result->schema_.push_back(std::move(columnDesc));
+    }
+
+    int groupCount = footer.rowGroupSizes.size();
+    std::vector<RowGroup> rowGroups(groupCount);
+    for (int group = 0; group < groupCount; group++)
+    {
+        rowGroups[group].size = footer.rowGroupSizes[group];
+        rowGroups[group].columns.resize(footer.columns.size());
+    }
+
+    std::vector<int> sortKeys(footer.sortKeys.begin(), footer.sortKeys.end());
+
+    result->lazy_path_ = path;
+    result->lazy_footer_ = std::make_shared<const TableFileFooter>(std::move(footer));
+    result->column_budget_ = budgetBytes;
+    result->evictable_ = true;
+    result->column_loads_.resize(result->schema_.size());
+    result->column_last_use_.resize(result->schema_.size());
+
+    result->sealed_count_ = groupCount;
+    result->persisted_count_ = groupCount;
+    result->Publish(std::move(rowGroups), std::move(sortKeys));
+
+    return result;
+}
+
+void
+ColumnarTable::RequestColumn(int columnIdx)
+{
+    if (!lazy_footer_)
+        return;
+
+    std::lock_guard lock(lazy_mutex_);
+    StartColumnLoad(columnIdx);
+}
+
+/*
+ * Starts loading the column unless it's loading or resident, and returns
+ * its load. Caller must hold lazy_mutex_, so the load isn't evicted before
+ * the caller has its copy.
+ */
+std::shared_future<Result<bool>>
+ColumnarTable::StartColumnLoad(int columnIdx)
+{
+    column_last_use_[columnIdx] = ++use_clock_;
+    if (!column_loads_[columnIdx].valid())
+        column_loads_[columnIdx] = std::async(std::launch::async,
+                                              [this, columnIdx]()
+                                              {
+                                                  return LoadColumn(columnIdx);
+                                              }).share();
+
+    return column_loads_[columnIdx];
+}
+
+Result<RowGroupsSnapshot>
+ColumnarTable::RowGroups(const std::vector<int> &columns, uint64_t &version)
+{
+    if (!lazy_footer_)
+        return RowGroups(version);
+
+    while (true)
+    {
+        // all loads start before waiting for any of them
+        std::vector<std::shared_future<Result<bool>>> columnLoads;
+        {
+            std::lock_guard lock(lazy_mutex_);
+            for (auto columnIdx: columns)
+                columnLoads.push_back(StartColumnLoad(columnIdx));
+        }
+
+        for (int i = 0; i < columns.size(); i++)
+        {
+            auto loadResult = columnLoads[i].get();
+            if (!loadResult.ok())
+            {
+                // let a later query retry
+                std::lock_guard lock(lazy_mutex_);
+                column_loads_[columns[i]] = {};
+                return loadResult.status();
+            }
+        }
+
+        std::lock_guard lock(lazy_mutex_);
+        EvictColumns(columns);
+
+        auto snapshot = RowGroups(version);
+        bool resident = true;
+        for (const auto &rowGroup: *snapshot)
+            for (auto columnIdx: columns)
+                resident = resident && rowGroup.columns[columnIdx] != nullptr;
+
+        // otherwise another query evicted some of them meanwhile
+        if (resident)
+            return snapshot;
+    }
+}
+
+size_t
+ColumnarTable::ResidentBytes() const
+{
+    size_t result = 0;
+    for (const auto &rowGroup: *RowGroups())
+        for (const auto &columnData: rowGroup.columns)
+            if (columnData)
+                result += columnData->ValuesBuffer().second;
+    return result;
+}
+
+/*
+ * Reads the chunks of a column of a lazily opened table in parallel, and
+ * publishes row groups which include them.
+ */
+Result<bool>
+ColumnarTable::LoadColumn(int columnIdx)
+{
+    const auto &footer = *lazy_footer_;
+    AccelType *type = schema_[columnIdx].type.get();
+
+    int groupCount = footer.chunks.size();
+    std::vector<TableFileChunkRead> reads;
+    for (int group = 0; group < groupCount; group++)
+        reads.push_back({ footer.chunks[group][columnIdx], type });
+
+    std::vector<ColumnDataP> chunks;
+    ASSIGN_OR_RAISE(chunks, ReadTableFileChunks(lazy_path_, reads));
+
+    std::lock_guard lock(append_mutex_);
+
+    auto current = RowGroups();
+    std::vector<RowGroup> rowGroups(current->begin(), current->end());
+    for (int group = 0; group < groupCount; group++)
+        rowGroups[group].columns[columnIdx] = std::move(chunks[group]);
+
+    PublishColumns(std::move(rowGroups), { columnIdx });
+
+    return true;
+}
+
+/*
+ * Makes all columns resident and stops evictions, before changes which
+ * need all column data or add row groups which aren't in the file.
+ */
+Result<bool>
+ColumnarTable::LoadAllColumns()
+{
+    if (!lazy_footer_)
+        return true;
+
+    {
+        std::lock_guard lock(append_mutex_);
+        evictable_ = false;
+    }
+
+    std::vector<int> columns;
+    for (int columnIdx = 0; columnIdx < schema_.size(); columnIdx++)
+        columns.push_back(columnIdx);
+
+    uint64_t version;
+    RAISE_IF_FAILS(RowGroups(columns, version));
+
+    return true;
+}
+
+/*
+ * Evicts least recently requested columns, except keep, until resident
+ * column data fits the budget. Caller must hold lazy_mutex_.
+ */
+void
+ColumnarTable::EvictColumns(const std::vector<int> &keep)
+{
+    if (column_budget_ == 0)
+        return;
+
+    std::lock_guard lock(append_mutex_);
+    if (!evictable_)
+        return;
+
+    auto current = RowGroups();
+    std::vector<size_t> columnBytes(schema_.size(), 0);
+    size_t residentBytes = 0;
+    for (const auto &rowGroup: *current)
+        for (int columnIdx = 0; columnIdx < schema_.size(); columnIdx++)
+            if (rowGroup.columns[columnIdx])
+            {
+                size_t bytes = rowGroup.columns[columnIdx]->ValuesBuffer().second;
+                columnBytes[columnIdx] += bytes;
+                residentBytes += bytes;
+            }
+
+    std::vector<int> evicted;
+    while (residentBytes > column_budget_)
+    {
+        int victim = -1;
+        for (int columnIdx = 0; columnIdx < schema_.size(); columnIdx++)
+        {
+            bool evictable =
+                columnBytes[columnIdx] > 0 &&
+                std::find(keep.begin(), keep.end(), columnIdx) == keep.end() &&
+                column_loads_[columnIdx].valid() &&
+                column_loads_[columnIdx].wait_for(std::chrono::seconds(0)) ==
+                    std::future_status::ready;
+
+            if (evictable &&
+                (victim < 0 ||
+                 column_last_use_[columnIdx] < column_last_use_[victim]))
+                victim = columnIdx;
+        }
+
+        if (victim < 0)
+            break;
+
+        residentBytes -= columnBytes[victim];
+        columnBytes[victim] = 0;
+        column_loads_[victim] = {};
+        evicted.push_back(victim);
+    }
+
+    if (evicted.empty())
+        return;
+
+    std::vector<RowGroup> rowGroups(current->begin(), current->end());
+    for (auto &rowGroup: rowGroups)
+        for (auto columnIdx: evicted)
+            rowGroup.columns[columnIdx] = nullptr;
+
+    PublishColumns(std::move(rowGroups), evicted);
+}
+
+int
+ColumnarTable::BufferedRowCount() const
+{
+    std::lock_guard lock(append_mutex_);
+
+    auto rowGroups = RowGroups();
+    int result = 0;
+    for (int group = sealed_count_; group < rowGroups->size(); group++)
+        result += (*rowGroups)[group].size;
+    return result;
+}
+
+template<class AccelTy>
+static std::vector<typename AccelTy::c_type>
+DecodeColumn(const std::vector<RowGroup> &rowGroups, int colIdx)
+{
+    std::vector<typename AccelTy::c_type> values;
+    for (const auto &rowGroup: rowGroups)
+        DecodeColumnData<AccelTy>(*rowGroup.columns[colIdx], values);
+    return values;
+}
+
+template<class AccelTy>
+static std::vector<ColumnDataP>
+MergeColumnData(const std::vector<RowGroup> &rowGroups,
+                int colIdx,
+                ColumnDataBase::Type layout,
+                int rowGroupSize,
+                const std::vector<uint32_t> *rowOrder)
+{
+    std::vector<typename AccelTy::c_type> values =
+        DecodeColumn<AccelTy>(rowGroups, colIdx);
+
+    if (rowOrder)
+    {
+        std::vector<typename AccelTy::c_type> ordered(values.size());
+        for (size_t i = 0; i < rowOrder->size(); i++)
+            ordered[i] = std::move(values[(*rowOrder)[i]]);
+        values = std::move(ordered);
+    }
+
+    std::vector<ColumnDataP> result;
+    for (int offset = 0; offset < values.size(); offset += rowGroupSize)
+    {
+        int size = std::min((int) values.size() - offset, rowGroupSize);
+        if (layout == ColumnDataBase::DICT_COLUMN_DATA)
+        {
+            result.push_back(
+                CreateDictColumnData<AccelTy>(values.data() + offset, size));
+        }
+        else if constexpr (!std::is_same<AccelTy, StringType>::value)
+        {
+            result.push_back(
+                CreateRawColumnData<AccelTy>(values.data() + offset, size));
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Row order stably sorted by the column, so sorting by each sort key from
+ * the last to the first orders rows by all of them.
+ */
+template<class AccelTy>
+static void
+SortRowOrder(const std::vector<RowGroup> &rowGroups,
+             int colIdx,
+             std::vector<uint32_t> &rowOrder)
+{
+    auto values = DecodeColumn<AccelTy>(rowGroups, colIdx);
+    std::stable_sort(std::execution::par, rowOrder.begin(), rowOrder.end(),
+                     [&values](uint32_t a, uint32_t b)
+                     {
+                         return values[a] < values[b];
+                     });
+}
+
+// indexes of rows of rowGroups in order of sortKeys
+std::vector<uint32_t>
+ColumnarTable::SortedRowOrder(const std::vector<RowGroup> &rowGroups,
+                              const std::vector<int> &sortKeys) const
+{
+    size_t rowCount = 0;
+    for (const auto &rowGroup: rowGroups)
+        rowCount += rowGroup.size;
+
+    std::vector<uint32_t> rowOrder(rowCount);
+    for (uint32_t row = 0; row < rowCount; row++)
+        rowOrder[row] = row;
+
+    for (auto key = sortKeys.rbegin(); key != sortKeys.rend(); key++)
+    {
+        switch (schema_[*key].type->type_num())
+        {
+            case STRING_TYPE:
+                SortRowOrder<StringType>(rowGroups, *key, rowOrder);
+                break;
+            case INT32_TYPE:
+                SortRowOrder<Int32Type>(rowGroups, *key, rowOrder);
+                break;
+            case INT64_TYPE:
+                SortRowOrder<Int64Type>(rowGroups, *key, rowOrder);
+                break;
+            case DECIMAL_TYPE:
+                SortRowOrder<DecimalType>(rowGroups, *key, rowOrder);
+                break;
+            case DATE_TYPE:
+                SortRowOrder<DateType>(rowGroups, *key, rowOrder);
+                break;
+        }
+    }
+
+    return rowOrder;
+}
+
+/*
+ * Re-encodes the given row groups into as many full row groups as possible,
+ * followed by at most one partially filled row group. If rowOrder is given,
+ * rows are reordered to it.
+ */
+std::vector<RowGroup>
+ColumnarTable::MergeRowGroups(const std::vector<RowGroup> &rowGroups,
+                              const std::vector<uint32_t> *rowOrder) const
+{
+    std::vector<RowGroup> result;
+
+    for (int colIdx = 0; colIdx < schema_.size(); colIdx++)
+    {
+        const auto &columnDesc = schema_[colIdx];
+        std::vector<ColumnDataP> columnDataVec;
+
+        switch (columnDesc.type->type_num())
+        {
+            case STRING_TYPE:
+                columnDataVec = MergeColumnData<StringType>(
+                    rowGroups, colIdx, columnDesc.layout, row_group_size_, rowOrder);
+                break;
+            case INT32_TYPE:
+                columnDataVec = MergeColumnData<Int32Type>(
+                    rowGroups, colIdx, columnDesc.layout, row_group_size_, rowOrder);
+                break;
+            case INT64_TYPE:
+                columnDataVec = MergeColumnData<Int64Type>(
+                    rowGroups, colIdx, columnDesc.layout, row_group_size_, rowOrder);
+                break;
+            case DECIMAL_TYPE:
+                columnDataVec = MergeColumnData<DecimalType>(
+                    rowGroups, colIdx, columnDesc.layout, row_group_size_, rowOrder);
+                break;
+            case DATE_TYPE:
+                columnDataVec = MergeColumnData<DateType>(
+                    rowGroups, colIdx, columnDesc.layout, row_group_size_, rowOrder);
+                break;
+        }
+
+        while (result.size() < columnDataVec.size())
+            result.push_back({});
+
+        for (int i = 0; i < columnDataVec.size(); i++) {
+            result[i].columns.push_back(std::move(columnDataVec[i]));
+            result[i].size = result[i].columns.back()->size;
+        }
+    }
+
     return result;
 }
 
@@ -4,13 +4,34 @@
 #include <vector>
 #include <optional>
 #include <ostream>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <future>
 #include "types.hpp"
 #include "column_data.hpp"
 #include "result_type.hpp"
+#include "row_group_cube.h"
+
+// Arrow C Data Interface
+struct ArrowArrayStream;
+
+namespace arrow
+{
+class RecordBatchReader;
+};
 
 namespace pgaccel {
 
-const int BITMAP_SIZE = 1 << 13;
+/*
+ * Bytes of a selection bitmap for rowCount rows. Padded to whole cache
+ * lines, since SIMD kernels write a full mask per register.
+ */
+constexpr int
+BitmapSize(int rowCount)
+{
+    return ((rowCount + 511) / 512) * 64;
+}
 
 struct ColumnDesc {
     std::string name;
@@ -19,12 +40,22 @@ struct ColumnDesc {
 };
 
 struct RowGroup {
+    // nullptr for columns of lazily opened tables which aren't resident
     std::vector<ColumnDataP> columns;
     int size;
-    std::unique_ptr<std::array<uint8_t, BITMAP_SIZE>> selectionBitmap;
-    int selectedSize;
+
+    // NUMA node of the column buffers, -1 if not placed
+    int numaNode = -1;
+
+    // pre-aggregates, nullptr unless the table has cubes enabled
+    RowGroupCubeP cube;
 };
 
+typedef std::shared_ptr<const std::vector<RowGroup>> RowGroupsSnapshot;
+
+struct TableFileFooter;
+struct TableFileChunkRead;
+
 class ColumnarTable;
 typedef std::unique_ptr<ColumnarTable> ColumnarTableP;
 
@@ -42,44 +73,258 @@ public:
 
     std::optional<int> ColumnIndex(const std::string& name) const;
 
-    const RowGroup &GetRowGroup(int idx) const {
-        return row_groups_[idx];
+    /*
+     * Appends publish a new row group list instead of modifying the current
+     * one, so readers which pin a snapshot see a consistent table while
+     * appends run concurrently.
+     */
+    RowGroupsSnapshot RowGroups() const;
+
+    /*
+     * Same, and also returns the version of the snapshot. Every published
+     * row group list gets a new version, unique across all tables, so it
+     * identifies the row groups for caches.
+     */
+    RowGroupsSnapshot RowGroups(uint64_t &version) const;
+
+    // a copy, which keeps the column data alive after later publishes
+    RowGroup GetRowGroup(int idx) const {
+        return (*RowGroups())[idx];
     }
 
     int RowGroupCount() const {
-        return row_groups_.size();
+        return RowGroups()->size();
     }
 
     int ColumnCount() const {
         return schema_.size();
     }
 
+    /*
+     * Rows in a full row group. Row groups are the unit of zone maps and of
+     * parallelism, so smaller row groups skip more precisely but have more
+     * per-row-group overhead.
+     */
+    int RowGroupSize() const {
+        return row_group_size_;
+    }
+
+    /*
+     * Appends the rows of other, which must have all columns of this table.
+     * Full row groups are added as they are, smaller ones are buffered as
+     * the table's trailing row groups and merged into full row groups once
+     * they have enough rows.
+     */
+    Result<bool> Append(const ColumnarTable &other);
+
+    // Merges buffered trailing row groups into a single, sealed row group.
+    void Flush();
+
+    int BufferedRowCount() const;
+
+    /*
+     * Enables or disables per-row-group pre-aggregates, see RowGroupCube.
+     * While enabled, they are built for existing row groups here and for
+     * new ones as they are appended. Off by default, since they cost
+     * memory and append time.
+     */
+    void SetCubes(bool enabled);
+
+    bool CubesEnabled() const {
+        return cubes_enabled_;
+    }
+
+    /*
+     * Rewrites the table with its rows ordered by the given columns, and
+     * records them as the table's sort keys, which are saved with it. Rows
+     * of each row group are then in order of the leading sort key, so
+     * range filters on it find their matching rows by binary search, see
+     * FilterNodeImpl::CreateSortedRangeFilter(). Appends clear the sort
+     * keys, since appended rows aren't in order.
+     */
+    Result<bool> SortBy(const std::vector<std::string> &columnNames);
+
+    // column indexes of the sort keys, empty if the table isn't sorted
+    std::vector<int> SortKeys() const;
+
+    /*
+     * Same, for the row groups of the given version. Empty if the version
+     * isn't current, so callers never apply sort keys to row groups they
+     * don't describe.
+     */
+    std::vector<int> SortKeys(uint64_t version) const;
+
+    /*
+     * Saves to a single-file container, see table_file.h.
+     */
     Result<bool> Save(const std::string &path);
+    Result<bool> Save(std::ostream &out);
+
+    /*
+     * Adds row groups sealed since the last Save, Load or SaveAppend to the
+     * end of the file. Existing column data is not rewritten, so tables
+     * reordered by SortBy() since then fail and need a Save().
+     */
+    Result<bool> SaveAppend(const std::string &path);
+    Result<bool> SaveAppend(std::iostream &file);
+
+    /*
+     * Legacy format: a data file of column data and a whitespace separated
+     * ".metadata" file. SaveAppend records appended row groups as segments
+     * in metadata. Save(path), SaveAppend(path) and Load(path) still
+     * handle files in this format. String dictionaries are saved entry by
+     * entry, see ColumnDataBase::Format.
+     */
     Result<bool> Save(std::ostream& metadataStream,
-                      std::ostream& dataStream) const;
+                      std::ostream& dataStream);
+    Result<bool> SaveAppend(std::ostream& metadataStream,
+                            std::ostream& dataStream);
 
     static ColumnarTableP ImportParquet(
         const std::string &tableName,
         const std::string &path,
-        std::optional<std::set<std::string>> fields = std::nullopt);
+        std::optional<std::set<std::string>> fields = std::nullopt,
+        int rowGroupSize = DefaultRowGroupSize);
+
+    /*
+     * Imports record batches, e.g. of a stream exported through the Arrow C
+     * Data Interface or read by parquet's arrow::FileReader. Values are
+     * narrowed and dictionary encoded straight from the Arrow buffers into
+     * column data, in row groups of rowGroupSize rows.
+     */
+    static Result<ColumnarTableP> ImportArrow(
+        const std::string &tableName,
+        arrow::RecordBatchReader &reader,
+        std::optional<std::set<std::string>> fields = std::nullopt,
+        int rowGroupSize = DefaultRowGroupSize);
+
+    // consumes and releases the stream
+    static Result<ColumnarTableP> ImportArrowStream(
+        const std::string &tableName,
+        struct ArrowArrayStream *stream,
+        std::optional<std::set<std::string>> fields = std::nullopt,
+        int rowGroupSize = DefaultRowGroupSize);
+
+    // from a Parquet or Arrow IPC file, see ExportFormatFromPath()
+    static Result<ColumnarTableP> ImportArrowFile(
+        const std::string &tableName,
+        const std::string &path,
+        std::optional<std::set<std::string>> fields = std::nullopt,
+        int rowGroupSize = DefaultRowGroupSize);
 
     static Result<ColumnarTableP> Load(
         const std::string &tableName,
         const std::string &path,
         std::optional<std::set<std::string>> fields = std::nullopt);
 
+    // from a single-file container, reads only the chunks of fields
+    static Result<ColumnarTableP> Load(
+        const std::string &tableName,
+        std::istream& in,
+        std::optional<std::set<std::string>> fields = std::nullopt);
+
+    // legacy format
     static Result<ColumnarTableP> Load(
         const std::string &tableName,
         std::istream& metadataStream,
         std::istream& dataStream,
         std::optional<std::set<std::string>> fields = std::nullopt);
 
+    /*
+     * Opens a table saved in a single-file container by reading only its
+     * footer. Columns are loaded in the background when a query first
+     * references them, see RequestColumn(). If budgetBytes isn't 0, least
+     * recently used columns are evicted to keep the resident column data
+     * within it. Append() and Save() load all columns and stop evictions,
+     * since appended row groups aren't in the file.
+     */
+    static Result<ColumnarTableP> Open(const std::string &tableName,
+                                       const std::string &path,
+                                       size_t budgetBytes = 0);
+
+    // starts loading the column in the background, unless it's resident
+    void RequestColumn(int columnIdx);
+
+    /*
+     * Same as RowGroups(version), but waits until the given columns are
+     * resident. The returned snapshot keeps them alive even if they're
+     * evicted afterwards.
+     */
+    Result<RowGroupsSnapshot> RowGroups(const std::vector<int> &columns,
+                                        uint64_t &version);
+
+    // bytes of column values in the current row groups
+    size_t ResidentBytes() const;
+
+    ~ColumnarTable();
 
 private:
-    ColumnarTable() {}
+    ColumnarTable():
+        row_groups_(std::make_shared<const std::vector<RowGroup>>()) {}
+
+    // keeps the sort keys, or replaces them
+    void Publish(std::vector<RowGroup> &&rowGroups);
+    void Publish(std::vector<RowGroup> &&rowGroups, std::vector<int> sortKeys);
+    void PublishColumns(std::vector<RowGroup> &&rowGroups, const std::vector<int> &columns);
+    Result<bool> WriteTableFileChunks(std::ostream &out,
+                                      const std::vector<RowGroup> &rowGroups,
+                                      int firstGroup,
+                                      TableFileFooter &footer) const;
+    std::vector<RowGroup> MergeRowGroups(
+        const std::vector<RowGroup> &rowGroups,
+        const std::vector<uint32_t> *rowOrder = nullptr) const;
+    std::vector<uint32_t> SortedRowOrder(const std::vector<RowGroup> &rowGroups,
+                                         const std::vector<int> &sortKeys) const;
+    typedef std::function<Result<std::vector<ColumnDataP>>(
+        const std::vector<TableFileChunkRead> &)> ChunkReader;
+
+    static Result<ColumnarTableP> LoadTableFile(
+        const std::string &tableName,
+        const TableFileFooter &footer,
+        std::optional<std::set<std::string>> fields,
+        const ChunkReader &readChunks);
+    std::shared_future<Result<bool>> StartColumnLoad(int columnIdx);
+    Result<bool> LoadColumn(int columnIdx);
+    Result<bool> LoadAllColumns();
+    void EvictColumns(const std::vector<int> &keep);
 
     std::vector<ColumnDesc> schema_;
-    std::vector<RowGroup> row_groups_;
+    int row_group_size_ = DefaultRowGroupSize;
+    RowGroupsSnapshot row_groups_;
+    uint64_t version_ = 0;
+    // of row_groups_, protected by row_groups_mutex_
+    std::vector<int> sort_keys_;
+    std::atomic<bool> cubes_enabled_{false};
+    mutable std::mutex row_groups_mutex_;
+    mutable std::mutex append_mutex_;
+
+    // row groups before sealed_count_ are final, the rest are buffered.
+    int sealed_count_ = 0;
+
+    // row groups before persisted_count_ are in the last saved/loaded file.
+    int persisted_count_ = 0;
+
+    // true if rows were reordered since the last save or load, so the file
+    // can only be replaced, not appended to
+    bool rewritten_ = false;
+
+    // file of lazily opened tables, empty otherwise
+    std::string lazy_path_;
+    std::shared_ptr<const TableFileFooter> lazy_footer_;
+    size_t column_budget_ = 0;
+
+    // false once new row groups may not be in the file, protected by
+    // append_mutex_
+    bool evictable_ = false;
+
+    // protects the fields below, taken before append_mutex_
+    mutable std::mutex lazy_mutex_;
+
+    // per column, valid while loading or resident
+    std::vector<std::shared_future<Result<bool>>> column_loads_;
+    std::vector<uint64_t> column_last_use_;
+    uint64_t use_clock_ = 0;
+
     std::string name_;
 };
 
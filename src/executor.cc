@@ -2,212 +2,110 @@
 #include "executor_groupby.h"
 #include "nodes.h"
 #include <functional>
+#include <set>
 
 namespace pgaccel
 {
 
-static Result<QueryOutput> ExecuteAggNoGroupByNoFilter(
-    const QueryDesc &query, bool useAvx, bool useParallelism);
-static Result<QueryOutput> ExecuteAggNoGroupByWithFilter(
-    const QueryDesc &query, bool useAvx, bool useParallelism);
-static Rows SingleFilterCount(const QueryDesc &query,
-                              const FilterNodeP &filterNode,
-                              bool useParallelism);
-static Rows ExecuteGroupBy(const AggregateNode &aggNode,
-                           bool useParallelism);
-static Row FieldNames(const std::vector<ColumnDesc> &schema);
-
-Result<QueryOutput>
-ExecuteQuery(const QueryDesc &query, bool useAvx, bool useParallelism)
-{
-    if (query.groupBy.size() == 0)
-    {
-        int filterCount = query.filterClauses.size();
-        if (filterCount == 0)
-        {
-            return ExecuteAggNoGroupByNoFilter(query, useAvx, useParallelism);
-        }
-        else
-        {
-            return ExecuteAggNoGroupByWithFilter(query, useAvx, useParallelism);
-        }
-    }
-    else
-    {
-        ExecutionParams params { useAvx };
-        PartitionedNodeP partitionedNode =
-            std::make_unique<ScanNode>(
-                query.tables[0],
-                FieldNames(query.tables[0]->Schema()));
-        if (query.filterClauses.size())
-        {
-            partitionedNode =
-                std::make_unique<FilterNode>(
-                    std::move(partitionedNode),
-                    query.filterClauses,
-                    params
-                );
-        }
-        auto aggNode = std::make_unique<AggregateNode>(
-            std::move(partitionedNode),
-            query.aggregateClauses,
-            query.groupBy, params);
-
-        QueryOutput result;
-        result.fieldNames = FieldNames(aggNode->Schema());
-        result.values = ExecuteGroupBy(*aggNode, useParallelism);
-        return result;
-    }
-}
+static Result<Pipeline> CompilePipeline(const QueryDesc &query, bool useAvx);
+static std::vector<std::string> ColumnNames(const std::vector<ColumnDesc> &schema);
 
-static Result<QueryOutput>
-ExecuteAggNoGroupByNoFilter(const QueryDesc &query,
-                            bool useAvx,
-                            bool useParallelism)
+/*
+ * All query shapes run through one pipeline: scan, an optional filter and
+ * an aggregate sink, grouped or scalar.
+ */
+Result<ResultBatch>
+ExecuteQuery(const QueryDesc &query, bool useAvx, bool useParallelism)
 {
-    const auto &agg = query.aggregateClauses[0];
-    switch (agg.type)
-    {
-        case AggregateClause::AGGREGATE_COUNT:
-        {
-            // SELECT count(*) FROM table
-            auto columnarTable = query.tables[0];
-            QueryOutput output;
-            output.fieldNames.push_back("count");
-            output.values = ExecuteAgg<int32_t>(
-                [](const RowGroup& r, uint8_t *bitmap) {
-                    return r.columns[0]->size;
-                },
-                [](int32_t &a, int32_t b) { a += b; },
-                [](int32_t a) {
-                    return Rows({{ std::to_string(a) }});
-                },
-                *columnarTable,
-                useParallelism
-            );
-
-            return output;
-        }
-
-        case AggregateClause::AGGREGATE_SUM:
-        {
-            // SELECT sum(col) FROM table
-            ColumnRef colRef = *agg.columnRef;
-            auto columnarTable = query.tables[colRef.tableIdx];
-
-            QueryOutput output;
-
-            output.fieldNames.push_back("sum");
-            output.values = ExecuteAgg<int64_t>(
-                [&](const RowGroup& r, uint8_t *bitmap) {
-                    return SumAll(r.columns[colRef.columnIdx],
-                                  colRef.Type().get(),
-                                  useAvx);
-                },
-                [](int64_t& a, int64_t b) { a += b; },
-                [&](int64_t totalSum) {
-                    return Rows({{ ToString(colRef.Type().get(), totalSum) }});
-                },
-                *columnarTable,
-                useParallelism
-            );
-
-            return output;
-        }
+    auto pipeline = CompilePipeline(query, useAvx);
+    if (!pipeline.ok())
+        return pipeline.status();
 
-        default:
-            return Status::Invalid("Unsupported aggregate type");
-    }
+    return pipeline->Execute(useParallelism);
 }
 
-static Result<QueryOutput>
-ExecuteAggNoGroupByWithFilter(const QueryDesc &query,
-                              bool useAvx,
-                              bool useParallelism)
+static Result<Pipeline>
+CompilePipeline(const QueryDesc &query, bool useAvx)
 {
-    // ensure single count(*) aggregate
-    int aggregateCount = query.aggregateClauses.size();
-    if (aggregateCount != 1)
-        return Status::Invalid(aggregateCount, " aggregates not suppprted yet");
-
-    auto filterNode = CreateFilterNode(query.filterClauses, useAvx);
-    switch (query.aggregateClauses[0].type)
+    bool grouped = query.groupBy.size() > 0;
+    for (const auto &agg: query.aggregateClauses)
     {
-        case AggregateClause::AGGREGATE_COUNT:
-        {
-            QueryOutput output;
-            output.fieldNames.push_back("count");
-            output.values = SingleFilterCount(query, filterNode, useParallelism);
-
-            return output;
-        }
-        case AggregateClause::AGGREGATE_SUM:
+        switch (agg.type)
         {
-            // SELECT sum(col) FROM table WHERE field=xyz;
+            case AggregateClause::AGGREGATE_COUNT:
+            case AggregateClause::AGGREGATE_SUM:
+                break;
+
+            case AggregateClause::AGGREGATE_PROJECT:
+                if (grouped)
+                    break;
+                return Status::Invalid("Column ", agg.columnRef->Name(),
+                                       " must appear in GROUP BY");
+
+            default:
+                return Status::Invalid("Unsupported aggregate type");
         }
-        default:
-            return Status::Invalid("Unsupported aggregate type");
     }
-}
 
-static Rows
-SingleFilterCount(const QueryDesc &query,
-                  const FilterNodeP &filterNode,
-                  bool useParallelism)
-{
-    return
-    ExecuteAgg<int32_t>(
-        [&](const RowGroup& r, uint8_t *bitmap) {
-                return filterNode->ExecuteCount(r);
-            },
-            [](int32_t& a, int32_t b) { a += b; },
-            [](int32_t a) {
-                return Rows({{ std::to_string(a) }});
-            },
-            *query.tables[0],
-            useParallelism
-        );
-}
+    ExecutionParams params { useAvx };
 
-static Rows ExecuteGroupBy(const AggregateNode &aggNode,
-                           bool useParallelism)
-{
-    int partitionCount = aggNode.LocalPartitionCount();
-
-    if (!useParallelism)
-    {
-        std::vector<std::future<LocalAggResultP>> localResults;
-        std::promise<LocalAggResultP> promise;
-        localResults.push_back(promise.get_future());
-        promise.set_value(aggNode.LocalTask([](int){ return true; }));
-
-        return aggNode.GlobalTask(localResults);
-    }
+    SinkNodeP sink;
+    if (grouped)
+        sink = std::make_unique<AggregateNode>(query.aggregateClauses,
+                                               query.groupBy,
+                                               params);
     else
+        sink = std::make_unique<ScalarAggregateNode>(query.aggregateClauses,
+                                                     params);
+
+    // the scan reads all columns, so table column indexes are also indexes
+    // into the scan's row groups
+    std::set<int> scannedColumnSet;
+    for (const auto &filterClause: query.filterClauses)
+        scannedColumnSet.insert(filterClause.columnRef.columnIdx);
+    for (const auto &agg: query.aggregateClauses)
+        if (agg.columnRef.has_value())
+            scannedColumnSet.insert(agg.columnRef->columnIdx);
+    for (const auto &columnRef: query.groupBy)
+        scannedColumnSet.insert(columnRef.columnIdx);
+    std::vector<int> scannedColumns(scannedColumnSet.begin(),
+                                    scannedColumnSet.end());
+
+    // lazily opened tables load the scanned columns first
+    auto table = query.tables[0];
+    uint64_t tableVersion;
+    RowGroupsSnapshot rowGroups;
+    ASSIGN_OR_RAISE(rowGroups, table->RowGroups(scannedColumns, tableVersion));
+
+    auto source = std::make_unique<ScanNode>(table,
+                                             std::move(rowGroups),
+                                             tableVersion,
+                                             ColumnNames(table->Schema()));
+
+    // all filter clauses compile into a single filter, so when the sink
+    // only counts, the filter can count matches without building bitmaps.
+    std::vector<OperatorNodeP> operators;
+    if (query.filterClauses.size())
     {
-        int numThreads = 8;
-        std::vector<std::future<LocalAggResultP>> localResults;
-        for (int i = 0; i < numThreads; i++)
-        {
-            localResults.push_back(
-                std::async([&](int m) {
-                    return aggNode.LocalTask(
-                        [&](int idx) {
-                            return idx % numThreads == m;
-                        });
-                }, i));
-        }
-
-        return aggNode.GlobalTask(localResults);
+        auto sortKeys = table->SortKeys(tableVersion);
+        operators.push_back(
+            std::make_unique<FilterNode>(query.filterClauses,
+                                         params,
+                                         source->TableVersion(),
+                                         sink->CountOnly(),
+                                         sortKeys.empty() ? -1 : sortKeys[0]));
     }
+
+    return Pipeline(std::move(source), std::move(operators), std::move(sink),
+                    std::move(scannedColumns));
 }
 
-static Row FieldNames(const std::vector<ColumnDesc> &schema)
+static std::vector<std::string> ColumnNames(const std::vector<ColumnDesc> &schema)
 {
-    Row fieldNames;
+    std::vector<std::string> columnNames;
     for (const auto & columnDesc: schema)
-        fieldNames.push_back(columnDesc.name);
-    return fieldNames;
+        columnNames.push_back(columnDesc.name);
+    return columnNames;
 }
 
 };
@@ -4,16 +4,19 @@
 #include "types.hpp"
 #include "result_type.hpp"
 #include "parser.h"
+#include "result_batch.h"
 #include <vector>
 #include <string>
-#include <future>
 
 namespace pgaccel
 {
 
 struct Value {
-    std::string strValue;
+    // points into a dictionary of the column data
+    std::string_view strValue;
     int64_t int64Value;
+    // StringPrefixKey() of strValue
+    uint64_t strPrefixKey;
 };
 
 typedef std::vector<Value> RowX;
@@ -23,9 +26,6 @@ struct RowsX {
     std::vector<RowX> rows;
 };
 
-typedef std::vector<std::string> Row;
-typedef std::vector<Row> Rows;
-
 // nodes
 
 class FilterNodeImpl;
@@ -37,6 +37,15 @@ public:
     virtual int ExecuteSet(const RowGroup &rowGroup, uint8_t *bitmask) const = 0;
     virtual int ExecuteAnd(const RowGroup &rowGroup, uint8_t *bitmask) const = 0;
 
+    /*
+     * True if the row group's zone map or dictionary shows that all of its
+     * rows match, so it needs no selection bitmap. False means unknown.
+     */
+    virtual bool SelectsAll(const RowGroup &rowGroup) const
+    {
+        return false;
+    }
+
     static FilterNodeP CreateSimpleCompare(const ColumnRef &colRef,
                                            const std::string &valueStr,
                                            FilterClause::Op op,
@@ -44,15 +53,19 @@ public:
                                            FilterClause::Op fusedOp,
                                            bool useAvx);
     static FilterNodeP CreateAndNode(std::vector<FilterNodeP>&& children);
+    static FilterNodeP CreateCodeSetFilter(const std::vector<FilterClause> &filterClauses,
+                                           bool useAvx);
 
-};
+    /*
+     * Comparisons on the leading sort key of a sorted table. Rows of each
+     * row group are in key order, so the matching rows are a range whose
+     * ends are found by binary search, and no row is evaluated.
+     */
+    static FilterNodeP CreateSortedRangeFilter(const std::vector<FilterClause> &filterClauses);
 
-struct QueryOutput {
-    Row fieldNames;
-    std::vector<Row> values;
 };
 
-Result<QueryOutput> ExecuteQuery(
+Result<ResultBatch> ExecuteQuery(
     const QueryDesc &query,
     bool useAvx,
     bool useParallelism);
@@ -61,13 +74,21 @@ int64_t SumAll(const ColumnDataP& columnData,
                const pgaccel::AccelType *type,
                bool useAvx);
 
+// sum of the values of the rows set in bitmap
+int64_t SumSelected(const ColumnDataP& columnData,
+                    const pgaccel::AccelType *type,
+                    const uint8_t *bitmap,
+                    bool useAvx);
+
+// leadingSortKey is the column index of the table's leading sort key, or -1
 FilterNodeP CreateFilterNode(
     const std::vector<FilterClause> &filterClauses,
-    bool useAvx);
+    bool useAvx,
+    int leadingSortKey = -1);
 
 template<class AccelTy>
-int DictIndex(const DictColumnData<AccelTy> &columnData, 
-              typename AccelTy::c_type value,
+int DictIndex(const DictColumnData<AccelTy> &columnData,
+              typename DictStorage<AccelTy>::entry_type value,
               FilterClause::Op op)
 {
     int left = 0, right = columnData.dict.size() - 1;
@@ -116,56 +137,32 @@ int DictIndex(const DictColumnData<AccelTy> &columnData,
     return result;
 }
 
-template<typename PartialResult>
-Rows
-ExecuteAgg(const std::function<PartialResult(const RowGroup&, uint8_t *)> &ProcessRowgroupF,
-           const std::function<void(PartialResult&, PartialResult&&)> &CombineF,
-           const std::function<Rows(const PartialResult&)> &FinalizeF,
-           const ColumnarTable &table,
-           bool useParallelism)
+/*
+ * String dictionaries are searched on their prefix keys, with the same
+ * results as the generic version.
+ */
+template<>
+inline int DictIndex(const DictColumnData<StringType> &columnData,
+                     std::string_view value,
+                     FilterClause::Op op)
 {
-    if (useParallelism)
-    {
-        int numThreads = 8;
-        int rowGroupCnt = table.RowGroupCount();
-
-        std::vector<std::future<PartialResult>> futureResults;
-        for (int i = 0; i < numThreads; i++)
-        {
-            futureResults.push_back(
-                std::async([&](int m) {
-                    PartialResult localResult {};
-                    uint8_t bitmap[1 << 13];
-                    for (int j = 0; j < rowGroupCnt; j++)
-                    {
-                        if (j % numThreads == m)
-                        {
-                            const RowGroup &rowGroup = table.GetRowGroup(j);
-                            CombineF(localResult, ProcessRowgroupF(rowGroup, bitmap));
-                        }
-                    }
-                    return localResult;
-                }, i));
-        }
-
-        PartialResult globalResult {};
-        for (auto &f: futureResults)
-            CombineF(globalResult, std::move(f.get()));
+    int dictSize = columnData.dict.size();
+    int lower = columnData.dict.LowerBound(value);
+    if (lower < dictSize && columnData.dict[lower] == value)
+        return lower;
 
-        return FinalizeF(globalResult);
-    }
-    else
+    switch (op)
     {
-        uint8_t bitmap[1 << 13];
-        PartialResult partialResult {};
-        int rowGroupCnt = table.RowGroupCount();
-        for (int groupIdx = 0; groupIdx < rowGroupCnt; groupIdx++)
-        {
-            const RowGroup &rowGroup = table.GetRowGroup(groupIdx);
-            CombineF(partialResult, ProcessRowgroupF(rowGroup, bitmap));
-        }
-
-        return FinalizeF(partialResult);
+        case FilterClause::FILTER_LT:
+            return lower;
+        case FilterClause::FILTER_LTE:
+            return lower == dictSize ? dictSize : lower - 1;
+        case FilterClause::FILTER_GT:
+            return lower - 1;
+        case FilterClause::FILTER_GTE:
+            return lower == 0 ? -1 : lower;
+        default:
+            return -1;
     }
 }
 
@@ -2,6 +2,9 @@
 #include "types.hpp"
 #include "executor.h"
 #include "avx_traits.hpp"
+#include "string_match.h"
+#include "util.h"
+#include "prefetch.h"
 #include <future>
 
 namespace pgaccel
@@ -105,8 +108,14 @@ int FilterMatchesRawAVX(
     int matches = 0;
     MaskType *bitmapTyped = (MaskType *) bitmap;
 
+    ScanPrefetch prefetch = GetScanPrefetch();
+    int prefetchAhead = prefetch.distance / sizeof(RegType);
+
     for (int i = 0; i < avxCnt; i++)
     {
+        if (prefetchAhead > 0 && i + prefetchAhead < avxCnt)
+            PrefetchLine(valuesR + i + prefetchAhead, prefetch.nonTemporal);
+
         MaskType mask;
         if constexpr(bitmapAction == BITMAP_AND)
         {
@@ -323,6 +332,20 @@ ComputeSkipAction(T value, FilterClause::Op op,
                   T fusedVal, FilterClause::Op fusedOp,
                   T minValue, T maxValue)
 {
+    // ranges are fused from a GT or GTE and a LT or LTE, and the vector
+    // range has to be checked against both ends
+    if (fusedOp != FilterClause::INVALID &&
+        (op == FilterClause::FILTER_GT || op == FilterClause::FILTER_GTE))
+    {
+        if (value > maxValue || fusedVal < minValue)
+            return FILTER_NONE;
+
+        if (value < minValue && fusedVal > maxValue)
+            return FILTER_ALL;
+
+        return CANNOT_SKIP;
+    }
+
     switch (op)
     {
         case FilterClause::FILTER_EQ:
@@ -377,6 +400,33 @@ ComputeSkipAction(T value, FilterClause::Op op,
     return CANNOT_SKIP;
 }
 
+/*
+ * Ends of a range which can't be skipped may still be outside the vector
+ * range, and so outside the range of its storage type. They're clamped to
+ * the vector range, which selects the same rows.
+ */
+template<typename T>
+static void
+ClampRange(T &value, FilterClause::Op &op,
+           T &fusedVal, FilterClause::Op &fusedOp,
+           T minValue, T maxValue)
+{
+    if (fusedOp == FilterClause::INVALID)
+        return;
+
+    if (value < minValue)
+    {
+        value = minValue;
+        op = FilterClause::FILTER_GTE;
+    }
+
+    if (fusedVal > maxValue)
+    {
+        fusedVal = maxValue;
+        fusedOp = FilterClause::FILTER_LTE;
+    }
+}
+
 template<class AccelTy, bool countMatches, BitmapAction bitmapAction>
 int FilterMatchesDict(const DictColumnData<AccelTy> &columnData, 
                       typename AccelTy::c_type value,
@@ -403,6 +453,8 @@ int FilterMatchesDict(const DictColumnData<AccelTy> &columnData,
             return FilterAll<bitmapAction>(columnData.size, bitmap);
     }
 
+    ClampRange(dictIdx, op, dictIdx2, fusedOp, 0, dictSize - 1);
+
     switch (columnData.bytesPerValue())
     {
         case 1:
@@ -425,9 +477,9 @@ int FilterMatchesDict(const DictColumnData<AccelTy> &columnData,
 
 template<class AccelTy, bool returnCount, BitmapAction bitmapAction>
 int FilterMatchesRaw(const RawColumnData<AccelTy> &columnData,
-                     const typename AccelTy::c_type &value,
+                     typename AccelTy::c_type value,
                      FilterClause::Op op,
-                     const typename AccelTy::c_type &fusedVal,
+                     typename AccelTy::c_type fusedVal,
                      FilterClause::Op fusedOp,
                      uint8_t *bitmap,
                      bool useAvx)
@@ -441,6 +493,8 @@ int FilterMatchesRaw(const RawColumnData<AccelTy> &columnData,
             return FilterAll<bitmapAction>(columnData.size, bitmap);
     }
 
+    ClampRange(value, op, fusedVal, fusedOp, columnData.minValue, columnData.maxValue);
+
     switch (columnData.bytesPerValue) {
     #define FILTER_MATCHES_RAW_DISPATCH_BY_SIZE(SIZE, TYPE) \
         case SIZE: \
@@ -477,6 +531,16 @@ public:
         return ExecuteAnd(rowGroup.columns[columnIndex].get(), bitmask);
     }
 
+    virtual bool SelectsAll(ColumnDataBase *columnData) const
+    {
+        return false;
+    }
+
+    virtual bool SelectsAll(const RowGroup &rowGroup) const
+    {
+        return SelectsAll(rowGroup.columns[columnIndex].get());
+    }
+
     int columnIndex;
 };
 
@@ -515,6 +579,14 @@ public:
             *typedColumnData, value, op, fusedVal, fusedOp, bitmask, useAvx);
     }
 
+    bool SelectsAll(ColumnDataBase *columnData) const
+    {
+        auto typedColumnData = static_cast<RawColumnData<AccelTy> *>(columnData);
+        return ComputeSkipAction(value, op, fusedVal, fusedOp,
+                                 typedColumnData->minValue,
+                                 typedColumnData->maxValue) == FILTER_ALL;
+    }
+
 private:
     typename AccelTy::c_type value, fusedVal;
     FilterClause::Op op, fusedOp;
@@ -556,12 +628,455 @@ public:
             *typedColumnData, value, op, fusedVal, fusedOp, bitmask, useAvx);
     }
 
+    bool SelectsAll(ColumnDataBase *columnData) const
+    {
+        auto typedColumnData = static_cast<DictColumnData<AccelTy> *>(columnData);
+        int dictIdx = DictIndex(*typedColumnData, value, op);
+        int dictIdx2 = fusedOp == FilterClause::INVALID ?
+            -1 : DictIndex(*typedColumnData, fusedVal, fusedOp);
+        int dictSize = typedColumnData->dict.size();
+        return ComputeSkipAction(dictIdx, op, dictIdx2, fusedOp,
+                                 0, dictSize - 1) == FILTER_ALL;
+    }
+
 private:
     typename AccelTy::c_type value, fusedVal;
     FilterClause::Op op, fusedOp;
     bool useAvx;
 };
 
+/*
+ * CodeSet is the set of dictionary codes of a row group which satisfy a
+ * predicate. 1-byte codes use a 256-entry byte table, which fits in four
+ * AVX-512 registers. 2-byte codes use a 64K-bit table, which is at most
+ * 8KB and stays in L1. Both are fixed size, so building a code set for
+ * each row group doesn't allocate; only the words the dictionary covers
+ * are cleared.
+ */
+struct CodeSet {
+    alignas(64) uint8_t byteTable[256];
+    alignas(64) uint32_t bitTable[(1 << 16) / 32];
+    int count;
+    int first;
+    int last;
+
+    template<class codeType>
+    inline bool Contains(codeType code) const
+    {
+        if constexpr (sizeof(codeType) == 1)
+            return byteTable[code];
+        else
+            return (bitTable[code >> 5] >> (code & 31)) & 1;
+    }
+};
+
+template<class codeType, bool countMatches, BitmapAction bitmapAction>
+int FilterMatchesCodes(const uint8_t *valueBuffer, int size,
+                       const CodeSet &codeSet,
+                       uint8_t *bitmap)
+{
+    int count = 0;
+    auto codes = reinterpret_cast<const codeType *>(valueBuffer);
+    for (int i = 0; i < size; i++) {
+
+        bool eval = codeSet.Contains(codes[i]);
+
+        if constexpr (bitmapAction == BITMAP_NOOP)
+        {
+            if constexpr (countMatches)
+                if (eval)
+                    count++;
+        }
+        else if constexpr (bitmapAction == BITMAP_SET)
+        {
+            if (eval)
+            {
+                bitmap[i >> 3] |= (1 << (i & 7));
+                if constexpr (countMatches)
+                    count++;
+            }
+            else
+            {
+                bitmap[i >> 3] &= ~(1 << (i & 7));
+            }
+        }
+        else if constexpr (bitmapAction == BITMAP_AND)
+        {
+            if (eval)
+            {
+                if constexpr (countMatches)
+                    if (bitmap[i >> 3] & (1 << (i & 7)))
+                        count++;
+            }
+            else
+            {
+                bitmap[i >> 3] &= ~(1 << (i & 7));
+            }
+        }
+    }
+
+    return count;
+}
+
+/*
+ * 1-byte codes: vpermi2b looks up 64 codes in a 128-entry half of the
+ * byte table, and the top bit of each code selects the half.
+ */
+template<bool countMatches, BitmapAction bitmapAction>
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+int FilterMatchesCodeSetAVX8(const uint8_t *buf, int size,
+                             const CodeSet &codeSet,
+                             uint8_t *bitmap)
+{
+    __m512i table0 = _mm512_load_si512(codeSet.byteTable);
+    __m512i table1 = _mm512_load_si512(codeSet.byteTable + 64);
+    __m512i table2 = _mm512_load_si512(codeSet.byteTable + 128);
+    __m512i table3 = _mm512_load_si512(codeSet.byteTable + 192);
+
+    auto codesR = reinterpret_cast<const __m512i *>(buf);
+    __mmask64 *bitmapTyped = (__mmask64 *) bitmap;
+
+    int avxCnt = size / 64;
+    int matches = 0;
+
+    ScanPrefetch prefetch = GetScanPrefetch();
+    int prefetchAhead = prefetch.distance / sizeof(__m512i);
+
+    for (int i = 0; i < avxCnt; i++)
+    {
+        if (prefetchAhead > 0 && i + prefetchAhead < avxCnt)
+            PrefetchLine(codesR + i + prefetchAhead, prefetch.nonTemporal);
+
+        __m512i codes = codesR[i];
+        __m512i low = _mm512_permutex2var_epi8(table0, codes, table1);
+        __m512i high = _mm512_permutex2var_epi8(table2, codes, table3);
+        __m512i lookup =
+            _mm512_mask_blend_epi8(_mm512_movepi8_mask(codes), low, high);
+
+        __mmask64 mask;
+        if constexpr (bitmapAction == BITMAP_AND)
+            mask = _mm512_mask_test_epi8_mask(bitmapTyped[i], lookup, lookup);
+        else
+            mask = _mm512_test_epi8_mask(lookup, lookup);
+
+        if constexpr (countMatches)
+            matches += __builtin_popcountll(mask);
+        if constexpr (bitmapAction != BITMAP_NOOP)
+            bitmapTyped[i] = mask;
+    }
+
+    int processed = 64 * avxCnt;
+    matches += FilterMatchesCodes<uint8_t, countMatches, bitmapAction>(
+        buf + processed, size - processed, codeSet,
+        bitmap == nullptr ? nullptr : bitmap + (processed / 8));
+
+    return matches;
+}
+
+/*
+ * 2-byte codes: gather the 32-bit words of the bit table which hold the
+ * bits for 16 codes, then shift each code's bit into place.
+ */
+template<bool countMatches, BitmapAction bitmapAction>
+int FilterMatchesCodeSetAVX16(const uint8_t *buf, int size,
+                              const CodeSet &codeSet,
+                              uint8_t *bitmap)
+{
+    auto codesR = reinterpret_cast<const __m256i *>(buf);
+    auto bitTable = reinterpret_cast<const int *>(codeSet.bitTable);
+    __mmask16 *bitmapTyped = (__mmask16 *) bitmap;
+
+    __m512i lowBits = _mm512_set1_epi32(31);
+    __m512i one = _mm512_set1_epi32(1);
+
+    int avxCnt = size / 16;
+    int matches = 0;
+
+    // codes are read in 32-byte steps, one prefetch per cache line
+    ScanPrefetch prefetch = GetScanPrefetch();
+    int prefetchAhead = prefetch.distance / sizeof(__m256i);
+
+    for (int i = 0; i < avxCnt; i++)
+    {
+        if (prefetchAhead > 0 && i % 2 == 0 && i + prefetchAhead < avxCnt)
+            PrefetchLine(codesR + i + prefetchAhead, prefetch.nonTemporal);
+
+        __m512i codes = _mm512_cvtepu16_epi32(codesR[i]);
+        __m512i words =
+            _mm512_i32gather_epi32(_mm512_srli_epi32(codes, 5), bitTable, 4);
+        __m512i bits =
+            _mm512_srlv_epi32(words, _mm512_and_epi32(codes, lowBits));
+
+        __mmask16 mask;
+        if constexpr (bitmapAction == BITMAP_AND)
+            mask = _mm512_mask_test_epi32_mask(bitmapTyped[i], bits, one);
+        else
+            mask = _mm512_test_epi32_mask(bits, one);
+
+        if constexpr (countMatches)
+            matches += __builtin_popcount(mask);
+        if constexpr (bitmapAction != BITMAP_NOOP)
+            bitmapTyped[i] = mask;
+    }
+
+    int processed = 16 * avxCnt;
+    matches += FilterMatchesCodes<uint16_t, countMatches, bitmapAction>(
+        buf + (processed * 2), size - processed, codeSet,
+        bitmap == nullptr ? nullptr : bitmap + (processed / 8));
+
+    return matches;
+}
+
+template<class codeType, bool countMatches, BitmapAction bitmapAction>
+int FilterMatchesCodeSet(const uint8_t *valueBuffer, int size,
+                         const CodeSet &codeSet,
+                         uint8_t *bitmap,
+                         bool useAvx)
+{
+    if (useAvx)
+    {
+        if constexpr (sizeof(codeType) == 1)
+        {
+            if (CpuSupportsAvx512Vbmi())
+                return FilterMatchesCodeSetAVX8<countMatches, bitmapAction>(
+                    valueBuffer, size, codeSet, bitmap);
+        }
+        else
+        {
+            return FilterMatchesCodeSetAVX16<countMatches, bitmapAction>(
+                valueBuffer, size, codeSet, bitmap);
+        }
+    }
+
+    return FilterMatchesCodes<codeType, countMatches, bitmapAction>(
+        valueBuffer, size, codeSet, bitmap);
+}
+
+/*
+ * DictPredicate is a filter clause which is evaluated against dictionary
+ * entries instead of rows.
+ */
+template<class AccelTy>
+struct DictPredicate {
+    using DictTy = typename AccelTy::c_type;
+
+    FilterClause::Op op;
+    std::vector<DictTy> values;
+    std::shared_ptr<LikePattern> pattern;
+    // StringPrefixKey() of values[0], for string comparisons
+    uint64_t prefixKey = 0;
+
+    bool Matches(const typename DictStorage<AccelTy>::type &dict, int code) const
+    {
+        switch (op)
+        {
+            case FilterClause::FILTER_EQ:
+                return Compare(dict, code) == 0;
+            case FilterClause::FILTER_NE:
+                return Compare(dict, code) != 0;
+            case FilterClause::FILTER_LT:
+                return Compare(dict, code) < 0;
+            case FilterClause::FILTER_LTE:
+                return Compare(dict, code) <= 0;
+            case FilterClause::FILTER_GT:
+                return Compare(dict, code) > 0;
+            case FilterClause::FILTER_GTE:
+                return Compare(dict, code) >= 0;
+            case FilterClause::FILTER_IN:
+                return std::binary_search(values.begin(), values.end(), dict[code]);
+            case FilterClause::FILTER_NOT_IN:
+                return !std::binary_search(values.begin(), values.end(), dict[code]);
+            case FilterClause::FILTER_LIKE:
+            case FilterClause::FILTER_NOT_LIKE:
+                if constexpr (std::is_same<AccelTy, StringType>::value)
+                    return pattern->Matches(dict[code].data(), dict[code].size()) ==
+                           (op == FilterClause::FILTER_LIKE);
+                break;
+        }
+
+        return false;
+    }
+
+private:
+    // sign of dictionary entry code compared to values[0]
+    int Compare(const typename DictStorage<AccelTy>::type &dict, int code) const
+    {
+        if constexpr (std::is_same<AccelTy, StringType>::value)
+            return dict.Compare(code, values[0], prefixKey);
+        else
+            return dict[code] < values[0] ? -1 : dict[code] > values[0];
+    }
+};
+
+template<class AccelTy>
+static void
+BuildCodeSet(const DictColumnData<AccelTy> &columnData,
+             const std::vector<DictPredicate<AccelTy>> &predicates,
+             CodeSet &codeSet)
+{
+    int dictSize = columnData.dict.size();
+    bool useByteTable = columnData.bytesPerValue() == 1;
+
+    if (useByteTable)
+        memset(codeSet.byteTable, 0, sizeof(codeSet.byteTable));
+    else
+        memset(codeSet.bitTable, 0, (dictSize + 31) / 32 * sizeof(uint32_t));
+
+    codeSet.count = 0;
+    codeSet.first = -1;
+    codeSet.last = -1;
+
+    for (int code = 0; code < dictSize; code++)
+    {
+        bool matches = true;
+        for (const auto &predicate: predicates)
+            if (!predicate.Matches(columnData.dict, code))
+            {
+                matches = false;
+                break;
+            }
+
+        if (!matches)
+            continue;
+
+        if (useByteTable)
+            codeSet.byteTable[code] = 0xff;
+        else
+            codeSet.bitTable[code >> 5] |= 1u << (code & 31);
+
+        if (codeSet.first == -1)
+            codeSet.first = code;
+        codeSet.last = code;
+        codeSet.count++;
+    }
+}
+
+template<class AccelTy, bool countMatches, BitmapAction bitmapAction>
+int FilterMatchesDictCodeSet(const DictColumnData<AccelTy> &columnData,
+                             const std::vector<DictPredicate<AccelTy>> &predicates,
+                             uint8_t *bitmap,
+                             bool useAvx)
+{
+    /*
+     * Evaluate predicates once per dictionary entry, so their cost depends
+     * on dictionary size and not on row count.
+     */
+    CodeSet codeSet;
+    BuildCodeSet(columnData, predicates, codeSet);
+
+    if (codeSet.count == 0)
+        return FilterNone<bitmapAction>(columnData.size, bitmap);
+
+    if (codeSet.count == columnData.dictSize())
+        return FilterAll<bitmapAction>(columnData.size, bitmap);
+
+    // Dictionary is sorted, so range predicates and prefix patterns match a
+    // contiguous range of codes, which we can evaluate as a range compare.
+    bool contiguous = (codeSet.last - codeSet.first + 1 == codeSet.count);
+
+    switch (columnData.bytesPerValue())
+    {
+        case 1:
+            if (contiguous)
+                return FilterMatchesRaw<uint8_t, countMatches, bitmapAction>(
+                    columnData.values, columnData.size,
+                    (uint8_t) codeSet.first, FilterClause::FILTER_GTE,
+                    (uint8_t) codeSet.last, FilterClause::FILTER_LTE,
+                    bitmap, useAvx);
+            return FilterMatchesCodeSet<uint8_t, countMatches, bitmapAction>(
+                columnData.values, columnData.size, codeSet, bitmap, useAvx);
+
+        case 2:
+            if (contiguous)
+                return FilterMatchesRaw<uint16_t, countMatches, bitmapAction>(
+                    columnData.values, columnData.size,
+                    (uint16_t) codeSet.first, FilterClause::FILTER_GTE,
+                    (uint16_t) codeSet.last, FilterClause::FILTER_LTE,
+                    bitmap, useAvx);
+            return FilterMatchesCodeSet<uint16_t, countMatches, bitmapAction>(
+                columnData.values, columnData.size, codeSet, bitmap, useAvx);
+    }
+
+    return 0;
+}
+
+template<typename AccelTy>
+class FilterDictCodeSetNode: public CompareFilterNode {
+public:
+    FilterDictCodeSetNode(std::vector<DictPredicate<AccelTy>> &&predicates,
+                          bool useAvx):
+        predicates(std::move(predicates)),
+        useAvx(useAvx) {}
+
+    int ExecuteCount(ColumnDataBase *columnData) const
+    {
+        auto typedColumnData = static_cast<DictColumnData<AccelTy> *>(columnData);
+        return FilterMatchesDictCodeSet<AccelTy, true, BITMAP_NOOP>(
+            *typedColumnData, predicates, nullptr, useAvx);
+    }
+
+    int ExecuteSet(ColumnDataBase *columnData, uint8_t *bitmask) const
+    {
+        auto typedColumnData = static_cast<DictColumnData<AccelTy> *>(columnData);
+        return FilterMatchesDictCodeSet<AccelTy, true, BITMAP_SET>(
+            *typedColumnData, predicates, bitmask, useAvx);
+    }
+
+    int ExecuteAnd(ColumnDataBase *columnData, uint8_t *bitmask) const
+    {
+        auto typedColumnData = static_cast<DictColumnData<AccelTy> *>(columnData);
+        return FilterMatchesDictCodeSet<AccelTy, true, BITMAP_AND>(
+            *typedColumnData, predicates, bitmask, useAvx);
+    }
+
+private:
+    std::vector<DictPredicate<AccelTy>> predicates;
+    bool useAvx;
+};
+
+template<class AccelTy>
+std::unique_ptr<CompareFilterNode>
+CreateDictCodeSetNode(const std::vector<FilterClause> &filterClauses,
+                      bool useAvx)
+{
+    std::vector<DictPredicate<AccelTy>> predicates;
+
+    for (const auto &filterClause: filterClauses)
+    {
+        auto type = static_cast<const AccelTy *>(filterClause.columnRef.Type().get());
+
+        DictPredicate<AccelTy> predicate;
+        predicate.op = filterClause.op;
+
+        switch (filterClause.op)
+        {
+            case FilterClause::FILTER_LIKE:
+            case FilterClause::FILTER_NOT_LIKE:
+                predicate.pattern =
+                    std::make_shared<LikePattern>(filterClause.value, useAvx);
+                break;
+
+            case FilterClause::FILTER_IN:
+            case FilterClause::FILTER_NOT_IN:
+                for (const auto &value: filterClause.values)
+                    predicate.values.push_back(type->Parse(value));
+                std::sort(predicate.values.begin(), predicate.values.end());
+                break;
+
+            default:
+                predicate.values.push_back(type->Parse(filterClause.value));
+                if constexpr (std::is_same<AccelTy, StringType>::value)
+                    predicate.prefixKey = StringPrefixKey(predicate.values[0]);
+                break;
+        }
+
+        predicates.push_back(std::move(predicate));
+    }
+
+    return std::make_unique<FilterDictCodeSetNode<AccelTy>>(
+                std::move(predicates), useAvx);
+}
+
 std::unique_ptr<CompareFilterNode>
 CreateRawFilterNode(const ColumnDesc &columnDesc,
                     const std::string &valueStr,
@@ -664,4 +1179,35 @@ FilterNodeImpl::CreateSimpleCompare(const ColumnRef &colRef,
     return std::move(result);
 }
 
+FilterNodeP
+FilterNodeImpl::CreateCodeSetFilter(const std::vector<FilterClause> &filterClauses,
+                                    bool useAvx)
+{
+    std::unique_ptr<CompareFilterNode> result;
+
+    const auto &colRef = filterClauses[0].columnRef;
+    switch (colRef.Type()->type_num())
+    {
+        case STRING_TYPE:
+            result = CreateDictCodeSetNode<StringType>(filterClauses, useAvx);
+            break;
+        case INT32_TYPE:
+            result = CreateDictCodeSetNode<Int32Type>(filterClauses, useAvx);
+            break;
+        case INT64_TYPE:
+            result = CreateDictCodeSetNode<Int64Type>(filterClauses, useAvx);
+            break;
+        case DECIMAL_TYPE:
+            result = CreateDictCodeSetNode<DecimalType>(filterClauses, useAvx);
+            break;
+        case DATE_TYPE:
+            result = CreateDictCodeSetNode<DateType>(filterClauses, useAvx);
+            break;
+    }
+
+    result->columnIndex = colRef.columnIdx;
+
+    return std::move(result);
+}
+
 };
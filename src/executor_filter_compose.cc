@@ -10,7 +10,7 @@ public:
 
     virtual int ExecuteCount(const RowGroup &rowGroup) const
     {
-        uint8_t bitmask[1 << 13];
+        alignas(64) uint8_t bitmask[BitmapSize(MaxRowGroupSize)];
         return ExecuteSet(rowGroup, bitmask);
     }
 
@@ -41,6 +41,15 @@ public:
         return result;
     }
 
+    virtual bool SelectsAll(const RowGroup &rowGroup) const
+    {
+        for (const auto &child: children)
+            if (!child->SelectsAll(rowGroup))
+                return false;
+
+        return true;
+    }
+
 private:
     std::vector<FilterNodeP> children;
 };
@@ -51,8 +60,80 @@ FilterNodeImpl::CreateAndNode(std::vector<FilterNodeP>&& children)
     return std::make_unique<AndFilterNode>(std::move(children));
 }
 
+static bool
+IsRangeStart(FilterClause::Op op)
+{
+    return op == FilterClause::FILTER_GT || op == FilterClause::FILTER_GTE;
+}
+
+static bool
+IsRangeEnd(FilterClause::Op op)
+{
+    return op == FilterClause::FILTER_LT || op == FilterClause::FILTER_LTE;
+}
+
+/*
+ * Filters on a dictionary encoded column are combined into a single code
+ * set lookup, unless they are a single comparison or a range, which the
+ * compare kernels evaluate directly on codes.
+ */
+static bool
+UseCodeSetFilter(const std::vector<FilterClause> &columnClauses)
+{
+    const auto &columnDesc = columnClauses[0].columnRef.columnDesc;
+    if (columnDesc.layout != ColumnDataBase::DICT_COLUMN_DATA)
+        return false;
+
+    for (const auto &filterClause: columnClauses)
+        switch (filterClause.op)
+        {
+            case FilterClause::FILTER_LIKE:
+            case FilterClause::FILTER_NOT_LIKE:
+            case FilterClause::FILTER_IN:
+            case FilterClause::FILTER_NOT_IN:
+                return true;
+        }
+
+    if (columnClauses.size() == 1)
+        return false;
+
+    if (columnClauses.size() == 2 &&
+        IsRangeStart(columnClauses[0].op) &&
+        IsRangeEnd(columnClauses[1].op))
+        return false;
+
+    return true;
+}
+
+// comparisons which select a range of the sort key's values
+static bool
+UseSortedRangeFilter(const std::vector<FilterClause> &columnClauses,
+                     int leadingSortKey)
+{
+    if (columnClauses[0].columnRef.columnIdx != leadingSortKey)
+        return false;
+
+    for (const auto &filterClause: columnClauses)
+        switch (filterClause.op)
+        {
+            case FilterClause::FILTER_EQ:
+            case FilterClause::FILTER_LT:
+            case FilterClause::FILTER_LTE:
+            case FilterClause::FILTER_GT:
+            case FilterClause::FILTER_GTE:
+                break;
+
+            default:
+                return false;
+        }
+
+    return true;
+}
+
 FilterNodeP
-CreateFilterNode(const std::vector<FilterClause> &filterClauses_, bool useAvx)
+CreateFilterNode(const std::vector<FilterClause> &filterClauses_,
+                 bool useAvx,
+                 int leadingSortKey)
 {
     if (filterClauses_.size() == 0)
         return nullptr;
@@ -71,7 +152,29 @@ CreateFilterNode(const std::vector<FilterClause> &filterClauses_, bool useAvx)
 
     for (int i = 0; i < filterClauses.size(); i++)
     {
-        if (i + 1 < filterClauses.size() &&
+        int columnEnd = i + 1;
+        while (columnEnd < filterClauses.size() &&
+               filterClauses[columnEnd].columnRef == filterClauses[i].columnRef)
+            columnEnd++;
+
+        std::vector<FilterClause> columnClauses(filterClauses.begin() + i,
+                                                filterClauses.begin() + columnEnd);
+
+        if (UseSortedRangeFilter(columnClauses, leadingSortKey))
+        {
+            filterNodes.push_back(
+                FilterNodeImpl::CreateSortedRangeFilter(columnClauses));
+
+            i = columnEnd - 1;
+        }
+        else if (UseCodeSetFilter(columnClauses))
+        {
+            filterNodes.push_back(
+                FilterNodeImpl::CreateCodeSetFilter(columnClauses, useAvx));
+
+            i = columnEnd - 1;
+        }
+        else if (i + 1 < filterClauses.size() &&
             filterClauses[i + 1].columnRef == filterClauses[i].columnRef &&
             (filterClauses[i].op == FilterClause::FILTER_GT ||
              filterClauses[i].op == FilterClause::FILTER_GTE) &&
@@ -0,0 +1,244 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace pgaccel
+{
+
+template<class AccelTy>
+static int RowBound(const ColumnDataBase &columnData,
+                    const typename AccelTy::c_type &value,
+                    bool upper);
+template<class storageType, class valueType>
+static int ValueBound(const uint8_t *values, int size, valueType value, bool upper);
+static void SetBitRange(uint8_t *bitmap, int begin, int end);
+static void ClearBitRange(uint8_t *bitmap, int begin, int end);
+static int CountBitRange(const uint8_t *bitmap, int begin, int end);
+
+/*
+ * Rows of a sorted table's row groups are in order of the leading sort
+ * key, and so are their dictionary codes, since dictionaries are sorted.
+ * Each comparison on the key is a bound on the rows which match it, found
+ * by binary search, so all comparisons together select the rows between
+ * the tightest bounds. Counts are the length of that range, and bitmaps
+ * are set a byte at a time.
+ */
+template<class AccelTy>
+class SortedRangeFilterNode: public FilterNodeImpl {
+public:
+    struct Bound {
+        typename AccelTy::c_type value;
+        FilterClause::Op op;
+    };
+
+    SortedRangeFilterNode(int columnIdx, std::vector<Bound> &&bounds):
+        columnIdx(columnIdx),
+        bounds(std::move(bounds)) {}
+
+    virtual int ExecuteCount(const RowGroup &rowGroup) const
+    {
+        auto rows = MatchingRows(rowGroup);
+        return rows.second - rows.first;
+    }
+
+    virtual int ExecuteSet(const RowGroup &rowGroup, uint8_t *bitmask) const
+    {
+        auto rows = MatchingRows(rowGroup);
+        memset(bitmask, 0, (rowGroup.size + 7) / 8);
+        SetBitRange(bitmask, rows.first, rows.second);
+        return rows.second - rows.first;
+    }
+
+    virtual int ExecuteAnd(const RowGroup &rowGroup, uint8_t *bitmask) const
+    {
+        auto rows = MatchingRows(rowGroup);
+        ClearBitRange(bitmask, 0, rows.first);
+        ClearBitRange(bitmask, rows.second, rowGroup.size);
+        return CountBitRange(bitmask, rows.first, rows.second);
+    }
+
+    virtual bool SelectsAll(const RowGroup &rowGroup) const
+    {
+        auto rows = MatchingRows(rowGroup);
+        return rows.first == 0 && rows.second == rowGroup.size;
+    }
+
+private:
+    // first and one past the last matching row
+    std::pair<int, int> MatchingRows(const RowGroup &rowGroup) const
+    {
+        const auto &columnData = *rowGroup.columns[columnIdx];
+        int begin = 0, end = rowGroup.size;
+
+        for (const auto &bound: bounds)
+        {
+            switch (bound.op)
+            {
+                case FilterClause::FILTER_EQ:
+                    begin = std::max(begin, RowBound<AccelTy>(columnData, bound.value, false));
+                    end = std::min(end, RowBound<AccelTy>(columnData, bound.value, true));
+                    break;
+                case FilterClause::FILTER_GT:
+                    begin = std::max(begin, RowBound<AccelTy>(columnData, bound.value, true));
+                    break;
+                case FilterClause::FILTER_GTE:
+                    begin = std::max(begin, RowBound<AccelTy>(columnData, bound.value, false));
+                    break;
+                case FilterClause::FILTER_LT:
+                    end = std::min(end, RowBound<AccelTy>(columnData, bound.value, false));
+                    break;
+                case FilterClause::FILTER_LTE:
+                    end = std::min(end, RowBound<AccelTy>(columnData, bound.value, true));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        return { begin, std::max(begin, end) };
+    }
+
+    int columnIdx;
+    std::vector<Bound> bounds;
+};
+
+template<class AccelTy>
+static FilterNodeP
+CreateSortedRangeFilter(const std::vector<FilterClause> &filterClauses)
+{
+    using Node = SortedRangeFilterNode<AccelTy>;
+
+    const auto &colRef = filterClauses[0].columnRef;
+    auto type = static_cast<const AccelTy *>(colRef.Type().get());
+
+    std::vector<typename Node::Bound> bounds;
+    for (const auto &filterClause: filterClauses)
+        bounds.push_back({ type->Parse(filterClause.value), filterClause.op });
+
+    return std::make_unique<Node>(colRef.columnIdx, std::move(bounds));
+}
+
+FilterNodeP
+FilterNodeImpl::CreateSortedRangeFilter(const std::vector<FilterClause> &filterClauses)
+{
+    switch (filterClauses[0].columnRef.Type()->type_num())
+    {
+        case STRING_TYPE:
+            return pgaccel::CreateSortedRangeFilter<StringType>(filterClauses);
+        case INT32_TYPE:
+            return pgaccel::CreateSortedRangeFilter<Int32Type>(filterClauses);
+        case INT64_TYPE:
+            return pgaccel::CreateSortedRangeFilter<Int64Type>(filterClauses);
+        case DECIMAL_TYPE:
+            return pgaccel::CreateSortedRangeFilter<DecimalType>(filterClauses);
+        case DATE_TYPE:
+            return pgaccel::CreateSortedRangeFilter<DateType>(filterClauses);
+    }
+
+    return nullptr;
+}
+
+/*
+ * Index of the first row whose key isn't less than value, or is greater
+ * than value if upper, like std::lower_bound() and std::upper_bound().
+ * Dictionary encoded keys are searched by code: the first code at the
+ * bound is the number of dictionary entries before it.
+ */
+template<class AccelTy>
+static int
+RowBound(const ColumnDataBase &columnData,
+         const typename AccelTy::c_type &value,
+         bool upper)
+{
+    if (columnData.type == ColumnDataBase::DICT_COLUMN_DATA)
+    {
+        auto &dictData = static_cast<const DictColumnData<AccelTy> &>(columnData);
+        const auto &dict = dictData.dict;
+
+        int code;
+        if constexpr (std::is_same<AccelTy, StringType>::value)
+        {
+            code = dict.LowerBound(value);
+            if (upper && code < dict.size() && dict[code] == value)
+                code++;
+        }
+        else
+        {
+            code = upper ?
+                std::upper_bound(dict.begin(), dict.end(), value) - dict.begin() :
+                std::lower_bound(dict.begin(), dict.end(), value) - dict.begin();
+        }
+
+        if (dictData.bytesPerValue() == 1)
+            return ValueBound<uint8_t>(dictData.values, dictData.size, code, false);
+        return ValueBound<uint16_t>(dictData.values, dictData.size, code, false);
+    }
+
+    if constexpr (!std::is_same<AccelTy, StringType>::value)
+    {
+        auto &rawData = static_cast<const RawColumnData<AccelTy> &>(columnData);
+        int64_t value64 = value;
+        switch (rawData.bytesPerValue)
+        {
+            case 1:
+                return ValueBound<int8_t>(rawData.values, rawData.size, value64, upper);
+            case 2:
+                return ValueBound<int16_t>(rawData.values, rawData.size, value64, upper);
+            case 4:
+                return ValueBound<int32_t>(rawData.values, rawData.size, value64, upper);
+            case 8:
+                return ValueBound<int64_t>(rawData.values, rawData.size, value64, upper);
+        }
+    }
+
+    return 0;
+}
+
+template<class storageType, class valueType>
+static int
+ValueBound(const uint8_t *values, int size, valueType value, bool upper)
+{
+    auto typedValues = reinterpret_cast<const storageType *>(values);
+    if (upper)
+        return std::upper_bound(typedValues, typedValues + size, value) - typedValues;
+    return std::lower_bound(typedValues, typedValues + size, value) - typedValues;
+}
+
+// bits outside whole bytes are set one at a time, the rest by memset
+static void
+SetBitRange(uint8_t *bitmap, int begin, int end)
+{
+    for (; begin < end && (begin & 7); begin++)
+        bitmap[begin >> 3] |= 1 << (begin & 7);
+    for (; end > begin && (end & 7); end--)
+        bitmap[(end - 1) >> 3] |= 1 << ((end - 1) & 7);
+    if (begin < end)
+        memset(bitmap + (begin >> 3), 0xff, (end - begin) >> 3);
+}
+
+static void
+ClearBitRange(uint8_t *bitmap, int begin, int end)
+{
+    for (; begin < end && (begin & 7); begin++)
+        bitmap[begin >> 3] &= ~(1 << (begin & 7));
+    for (; end > begin && (end & 7); end--)
+        bitmap[(end - 1) >> 3] &= ~(1 << ((end - 1) & 7));
+    if (begin < end)
+        memset(bitmap + (begin >> 3), 0, (end - begin) >> 3);
+}
+
+static int
+CountBitRange(const uint8_t *bitmap, int begin, int end)
+{
+    int count = 0;
+    for (; begin < end && (begin & 7); begin++)
+        count += (bitmap[begin >> 3] >> (begin & 7)) & 1;
+    for (; end > begin && (end & 7); end--)
+        count += (bitmap[(end - 1) >> 3] >> ((end - 1) & 7)) & 1;
+    for (int byte = begin >> 3; byte < (end >> 3); byte++)
+        count += __builtin_popcount(bitmap[byte]);
+    return count;
+}
+
+};
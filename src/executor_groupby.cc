@@ -2,6 +2,10 @@
 #include "util.h"
 #include "nodes.h"
 
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
 namespace pgaccel
 {
 
@@ -19,12 +23,12 @@ AggregateNodeImpl::AggregateNodeImpl(
         {
             case AggregateClause::AGGREGATE_COUNT:
                 aggregators.push_back(
-                    std::make_unique<CountAgg>(params.useAvx));
+                    std::make_unique<CountAgg>(params));
                 break;
 
             case AggregateClause::AGGREGATE_SUM:
                 aggregators.push_back(
-                    std::make_unique<SumAgg>(*aggClause.columnRef, params.useAvx));
+                    std::make_unique<SumAgg>(*aggClause.columnRef, params));
                 break;
             
             default:
@@ -35,6 +39,7 @@ AggregateNodeImpl::AggregateNodeImpl(
         {
             projection.push_back(groupBy.size() + aggregators.size() - 1);
             fieldNames.push_back(aggClause.ToString());
+            fieldTypes.push_back(aggregators.back()->ResultType());
         }
         else
         {
@@ -45,6 +50,7 @@ AggregateNodeImpl::AggregateNodeImpl(
                     break;
                 }
             fieldNames.push_back(aggClause.columnRef->Name());
+            fieldTypes.push_back(aggClause.columnRef->Type());
         }
     }
 
@@ -54,118 +60,193 @@ AggregateNodeImpl::AggregateNodeImpl(
     this->groupBy = groupBy;
 }
 
-void
-SetFilteredOut(int size, uint16_t *groups, uint8_t *bitmap, uint16_t v, bool useAvx)
-{
-    if (!useAvx)
-    {
-        for (int i = 0; i < size; i++)
-            if (!IsBitSet(bitmap, i))
-                groups[i] = v;
-        return;
-    }
-
-    __m512i *groupsAvx = (__m512i *) groups;
-    int avxCnt = size / 32;
-    uint32_t *bitmap32 = (uint32_t *) bitmap;
-
-    for (int i = 0; i < avxCnt; i++)
-    {
-        groupsAvx[i] = _mm512_mask_set1_epi16(groupsAvx[i], ~bitmap32[i], v);
-    }
+/*
+ * How aggregation kernels apply a selection bitmap: there's none, branch
+ * on each row's bit, or mask each row's contribution with its bit.
+ */
+enum SelectionMode {
+    SELECT_ALL,
+    SELECT_BRANCH,
+    SELECT_MASK
+};
 
-    for (int i = avxCnt * 32; i < size; i++)
-        if (!IsBitSet(bitmap, i))
-            groups[i] = v;
+static SelectionMode
+GetSelectionMode(const uint8_t *bitmap, const ExecutionParams &params)
+{
+    if (bitmap == nullptr)
+        return SELECT_ALL;
+    return params.groupByEliminateBranches ? SELECT_MASK : SELECT_BRANCH;
 }
 
-LocalAggResult
-AggregateNodeImpl::ProcessRowGroup(const RowGroup &rowGroup, uint8_t *selectionBitmap) const
+/*
+ * Marks the groups of selected rows as visited, and returns the new count
+ * of visited groups. Stops early once all groups have been visited.
+ */
+template<class codeType>
+static int
+MarkVisitedGroups(const ColumnDataGroups &groups,
+                  const uint8_t *bitmap,
+                  bool *visited,
+                  int visitedCount)
 {
-    LocalAggResult localResult(GroupBySchema());
+    auto codes = reinterpret_cast<const codeType *>(groups.codes);
+    for (int i = 0; i < groups.size && visitedCount < groups.groupCount; i++)
+        if (bitmap == nullptr || IsBitSet(bitmap, i))
+        {
+            if (!visited[codes[i]])
+            {
+                visited[codes[i]] = true;
+                visitedCount++;
+            }
+        }
+    return visitedCount;
+}
 
-    ColumnDataGroups groups;
+void
+AggregateNodeImpl::ProcessRowGroup(const RowGroup &rowGroup,
+                                   uint8_t *selectionBitmap,
+                                   LocalAggResult &result,
+                                   Arena &arena) const
+{
     int col = groupBy[0].columnIdx;
     auto dictData = static_cast<DictColumnDataBase *>(rowGroup.columns[col].get());
-    groups.groupCount = dictData->dictSize();
 
-    uint8_t bitmap[1<<13];
     if (filterNode)
     {
-        filterNode->ExecuteSet(rowGroup, bitmap);
+        int bitmapSize = BitmapSize(rowGroup.size);
+        uint8_t *bitmap = arena.AllocateArray<uint8_t>(bitmapSize);
+        if (selectionBitmap)
+        {
+            memcpy(bitmap, selectionBitmap, bitmapSize);
+            filterNode->ExecuteAnd(rowGroup, bitmap);
+        }
+        else
+        {
+            filterNode->ExecuteSet(rowGroup, bitmap);
+        }
         selectionBitmap = bitmap;
     }
 
-    dictData->to_16(groups.groups);
+    int codeWidth = dictData->bytesPerValue();
+    auto [codes, codesLength] = dictData->ValuesBuffer();
 
-    int resultGroupCount = groups.groupCount;
-    if (selectionBitmap && params.groupByEliminateBranches)
+    ColumnDataGroups groups;
+    groups.groupCount = dictData->dictSize();
+    groups.codeWidth = codeWidth;
+
+    bool *groupVisited = arena.AllocateZeroed<bool>(groups.groupCount);
+    int visitedCount = 0;
+
+    std::vector<int64_t *> partials;
+    partials.reserve(aggregators.size());
+    for (int j = 0; j < aggregators.size(); j++)
+        partials.push_back(arena.AllocateZeroed<int64_t>(groups.groupCount));
+
+    // row groups without a selection are answered from their cube, if it
+    // covers the group by column and all aggregates
+    bool fromCube = !selectionBitmap && rowGroup.cube &&
+                    AggregateFromCube(*rowGroup.cube, col, groups.groupCount,
+                                      groupVisited, partials);
+
+    for (int offset = 0; !fromCube && offset < rowGroup.size;
+         offset += VectorBlockSize)
     {
-        SetFilteredOut(rowGroup.size,
-                       groups.groups,
-                       selectionBitmap,
-                       groups.groupCount,
-                       params.useAvx);
-        groups.groupCount += 1;
-        selectionBitmap = nullptr;
+        groups.offset = offset;
+        groups.size = std::min(VectorBlockSize, rowGroup.size - offset);
+        groups.codes = codes + offset * codeWidth;
+
+        uint8_t *blockBitmap =
+            selectionBitmap ? selectionBitmap + offset / 8 : nullptr;
+
+        if (codeWidth == 1)
+            visitedCount = MarkVisitedGroups<uint8_t>(
+                groups, blockBitmap, groupVisited, visitedCount);
+        else
+            visitedCount = MarkVisitedGroups<uint16_t>(
+                groups, blockBitmap, groupVisited, visitedCount);
+
+        for (int j = 0; j < aggregators.size(); j++)
+            aggregators[j]->LocalAggregate(rowGroup, groups, blockBitmap, partials[j]);
     }
 
-    std::vector<bool> groupVisited(groups.groupCount, false);
-    int setGroups = 0;
-    for (int i = 0; i < rowGroup.size && setGroups < groups.groupCount; i++)
-        if (selectionBitmap == nullptr ||
-            IsBitSet(selectionBitmap, i))
-        {
-            if (!groupVisited[groups.groups[i]])
-            {
-                groupVisited[groups.groups[i]] = true;
-                setGroups++;
-            }
-        }
+    if (groupBySchema[0]->type_num() == STRING_TYPE)
+        result.pinned.push_back(rowGroup.columns[col]);
 
-    std::vector<RowX> labels;
+    RowX &key = result.key;
+    key.resize(1);
+    for (int i = 0; i < groups.groupCount; i++)
     {
-        for (int i = 0; i < resultGroupCount; i++)
-            if (groupVisited[i]) {
-                Value v;
-                switch (groupBySchema[0]->type_num())
-                {
-                    case STRING_TYPE:
-                    {
-                        auto typedDictData = (DictColumnData<StringType> *) dictData;
-                        v.strValue = typedDictData->dict[i];
-                        break;
-                    }
-                    case DATE_TYPE:
-                    {
-                        auto typedDictData = (DictColumnData<DateType> *) dictData;
-                        v.int64Value = typedDictData->dict[i];
-                        break;
-                    }
-                }
+        if (!groupVisited[i])
+            continue;
 
-                labels.push_back({ v });
+        switch (groupBySchema[0]->type_num())
+        {
+            case STRING_TYPE:
+            {
+                // a view, the column data is pinned above
+                auto typedDictData = (DictColumnData<StringType> *) dictData;
+                key[0].strValue = typedDictData->dict[i];
+                key[0].strPrefixKey = typedDictData->dict.prefixKeys[i];
+                break;
             }
-            else {
-                labels.push_back({});
+            case DATE_TYPE:
+            {
+                auto typedDictData = (DictColumnData<DateType> *) dictData;
+                key[0].int64Value = typedDictData->dict[i];
+                break;
             }
+        }
+
+        auto it = result.groupAggStates.find(key);
+        if (it == result.groupAggStates.end())
+        {
+            AggStateVec states;
+            for (int j = 0; j < aggregators.size(); j++)
+                states.push_back(aggregators[j]->CreateState(partials[j][i]));
+            result.groupAggStates.emplace(key, std::move(states));
+        }
+        else
+        {
+            for (int j = 0; j < aggregators.size(); j++)
+                aggregators[j]->Accumulate(it->second[j].get(), partials[j][i]);
+        }
     }
+}
 
-    for (const auto &agg: aggregators) {
-        auto localAggResult = agg->LocalAggregate(rowGroup, groups, selectionBitmap);
-        for (int i = 0; i < resultGroupCount; i++)
-            if (groupVisited[i]) {
-                localResult.groupAggStates[labels[i]].push_back(
-                    std::move(localAggResult[i]));
-            }
+bool
+AggregateNodeImpl::AggregateFromCube(const RowGroupCube &cube,
+                                     int groupByColumn,
+                                     int groupCount,
+                                     bool *groupVisited,
+                                     const std::vector<int64_t *> &partials) const
+{
+    const int64_t *counts = cube.Counts(groupByColumn);
+    if (!counts)
+        return false;
+
+    std::vector<const int64_t *> cubePartials;
+    for (const auto &aggregator: aggregators)
+    {
+        cubePartials.push_back(aggregator->CubePartials(cube, groupByColumn));
+        if (!cubePartials.back())
+            return false;
     }
 
-    return localResult;
+    for (int i = 0; i < groupCount; i++)
+        groupVisited[i] = counts[i] > 0;
+
+    for (int j = 0; j < aggregators.size(); j++)
+        memcpy(partials[j], cubePartials[j], groupCount * sizeof(int64_t));
+
+    return true;
 }
 
 void
 AggregateNodeImpl::Combine(LocalAggResult &left, LocalAggResult &&right) const
 {
+    for (auto &columnData: right.pinned)
+        left.pinned.push_back(std::move(columnData));
+
     for (auto &group: right.groupAggStates)
     {
         auto label = group.first;
@@ -186,72 +267,226 @@ AggregateNodeImpl::Combine(LocalAggResult &left, LocalAggResult &&right) const
     }
 }
 
-Rows
+ResultBatch
 AggregateNodeImpl::Finalize(const LocalAggResult &localResult) const
 {
-    Rows result;
-    for (const auto &group: localResult.groupAggStates)
+    ResultBatch result;
+    for (int i = 0; i < projection.size(); i++)
+        result.AddColumn(fieldNames[i], fieldTypes[i]);
+
+    for (const auto &columnData: localResult.pinned)
+        result.Pin(columnData);
+
+    for (int i = 0; i < projection.size(); i++)
     {
-        Row row;
-        for (int i = 0; i < groupBySchema.size(); i++)
+        auto &column = result.Column(i);
+        int idx = projection[i];
+        if (idx >= groupBy.size())
         {
-            switch (groupBySchema[i]->type_num())
-            {
-                case STRING_TYPE:
-                    row.push_back(group.first[i].strValue);
-                    break;
-                case DATE_TYPE:
-                    row.push_back(
-                        ToString(groupBySchema[i].get(),
-                                 group.first[i].int64Value));
-                    break;
-            }
+            const auto &aggregator = aggregators[idx - groupBy.size()];
+            for (const auto &group: localResult.groupAggStates)
+                aggregator->Finalize(group.second[idx - groupBy.size()].get(), column);
         }
-
-        for (int i = 0; i < aggregators.size(); i++)
+        else if (column.IsString())
         {
-            row.push_back(
-                aggregators[i]->Finalize(group.second[i].get()));
+            column.strings.reserve(localResult.groupAggStates.size());
+            for (const auto &group: localResult.groupAggStates)
+                column.strings.push_back(group.first[idx].strValue);
+        }
+        else
+        {
+            column.ints.reserve(localResult.groupAggStates.size());
+            for (const auto &group: localResult.groupAggStates)
+                column.ints.push_back(group.first[idx].int64Value);
         }
-
-        Row projectedRow;
-        for (auto idx: projection)
-            projectedRow.push_back(row[idx]);
-
-        result.push_back(projectedRow);
     }
 
     return result;
 }
 
-Row
+std::vector<std::string>
 AggregateNodeImpl::FieldNames() const
 {
     return fieldNames;
 }
 
-AggStateVec
-CountAgg::LocalAggregate(const RowGroup& rowGroup,
-                         const ColumnDataGroups& groups,
-                         uint8_t *bitmap) const
+std::vector<std::shared_ptr<AccelType>>
+AggregateNodeImpl::FieldTypes() const
 {
+    return fieldTypes;
+}
 
-    std::vector<int> countsPerGroup(groups.groupCount, 0);
+template<class codeType, SelectionMode mode>
+static void
+CountGroups(const codeType *codes,
+            int size,
+            const uint8_t *bitmap,
+            int64_t *partials)
+{
+    for (int i = 0; i < size; i++)
+    {
+        if constexpr (mode == SELECT_ALL)
+            partials[codes[i]]++;
+        else if constexpr (mode == SELECT_MASK)
+            partials[codes[i]] += IsBitSet(bitmap, i);
+        else if (IsBitSet(bitmap, i))
+            partials[codes[i]]++;
+    }
+}
 
-    if (bitmap) {
-        for (int i = 0; i < rowGroup.size; i++)
-            if (IsBitSet(bitmap, i))
-                countsPerGroup[groups.groups[i]]++;
-    } else {
-        for (int i = 0; i < rowGroup.size; i++)
-            countsPerGroup[groups.groups[i]]++;
+template<class codeType>
+static void
+CountGroups(const ColumnDataGroups &groups,
+            const uint8_t *bitmap,
+            SelectionMode mode,
+            int64_t *partials)
+{
+    auto codes = reinterpret_cast<const codeType *>(groups.codes);
+    switch (mode)
+    {
+        case SELECT_ALL:
+            return CountGroups<codeType, SELECT_ALL>(
+                        codes, groups.size, bitmap, partials);
+        case SELECT_BRANCH:
+            return CountGroups<codeType, SELECT_BRANCH>(
+                        codes, groups.size, bitmap, partials);
+        case SELECT_MASK:
+            return CountGroups<codeType, SELECT_MASK>(
+                        codes, groups.size, bitmap, partials);
     }
+}
 
-    AggStateVec result;
-    for (int i = 0; i < groups.groupCount; i++)
-        result.push_back(std::make_unique<CountAggState>(countsPerGroup[i]));
+/*
+ * Histogram of 1-byte codes for dictionaries of up to SmallDictSize codes.
+ * Each register of 64 codes is compared against every code, and the
+ * selected matches are popcounted.
+ */
+const int SmallDictSize = 16;
+
+static void
+HistogramSmallDict(const ColumnDataGroups &groups,
+                   const uint8_t *bitmap,
+                   int64_t *partials)
+{
+    const uint8_t *codes = groups.codes;
+    auto bitmap64 = reinterpret_cast<const uint64_t *>(bitmap);
 
-    return result;
+    __m512i codeRegs[SmallDictSize];
+    for (int code = 0; code < groups.groupCount; code++)
+        codeRegs[code] = _mm512_set1_epi8(code);
+
+    uint64_t counts[SmallDictSize] = {};
+    int avxCnt = groups.size / 64;
+    for (int i = 0; i < avxCnt; i++)
+    {
+        __m512i values = _mm512_loadu_si512(codes + 64 * i);
+        __mmask64 selected = bitmap ? bitmap64[i] : ~0ULL;
+        for (int code = 0; code < groups.groupCount; code++)
+            counts[code] += __builtin_popcountll(
+                _mm512_mask_cmpeq_epi8_mask(selected, values, codeRegs[code]));
+    }
+
+    for (int code = 0; code < groups.groupCount; code++)
+        partials[code] += counts[code];
+
+    for (int i = 64 * avxCnt; i < groups.size; i++)
+        if (bitmap == nullptr || IsBitSet(bitmap, i))
+            partials[codes[i]]++;
+}
+
+/*
+ * Histogram of 1-byte codes. Consecutive rows go to interleaved
+ * sub-histograms, so runs of equal codes don't serialize on the
+ * store-to-load forwarding of a single counter.
+ */
+const int SubHistogramCount = 4;
+
+template<bool hasBitmap>
+static void
+HistogramInterleaved(const ColumnDataGroups &groups,
+                     const uint8_t *bitmap,
+                     int64_t *partials)
+{
+    const uint8_t *codes = groups.codes;
+    uint32_t counts[SubHistogramCount][256];
+    for (int k = 0; k < SubHistogramCount; k++)
+        memset(counts[k], 0, groups.groupCount * sizeof(uint32_t));
+
+    // unrolled by hand, compilers don't reliably interleave a loop over k
+    int i = 0;
+    for (; i + SubHistogramCount <= groups.size; i += SubHistogramCount)
+    {
+        if constexpr (hasBitmap)
+        {
+            counts[0][codes[i]] += IsBitSet(bitmap, i);
+            counts[1][codes[i + 1]] += IsBitSet(bitmap, i + 1);
+            counts[2][codes[i + 2]] += IsBitSet(bitmap, i + 2);
+            counts[3][codes[i + 3]] += IsBitSet(bitmap, i + 3);
+        }
+        else
+        {
+            counts[0][codes[i]]++;
+            counts[1][codes[i + 1]]++;
+            counts[2][codes[i + 2]]++;
+            counts[3][codes[i + 3]]++;
+        }
+    }
+
+    for (; i < groups.size; i++)
+        if (!hasBitmap || IsBitSet(bitmap, i))
+            counts[0][codes[i]]++;
+
+    for (int code = 0; code < groups.groupCount; code++)
+    {
+        int64_t count = 0;
+        for (int k = 0; k < SubHistogramCount; k++)
+            count += counts[k][code];
+        partials[code] += count;
+    }
+}
+
+void
+CountAgg::LocalAggregate(const RowGroup& rowGroup,
+                         const ColumnDataGroups& groups,
+                         uint8_t *bitmap,
+                         int64_t *partials) const
+{
+    SelectionMode mode = GetSelectionMode(bitmap, params);
+    if (groups.codeWidth == 1 && mode != SELECT_BRANCH)
+    {
+        if (params.useAvx && groups.groupCount <= SmallDictSize)
+            HistogramSmallDict(groups, bitmap, partials);
+        else if (bitmap)
+            HistogramInterleaved<true>(groups, bitmap, partials);
+        else
+            HistogramInterleaved<false>(groups, bitmap, partials);
+    }
+    else if (groups.codeWidth == 1)
+    {
+        CountGroups<uint8_t>(groups, bitmap, mode, partials);
+    }
+    else
+    {
+        CountGroups<uint16_t>(groups, bitmap, mode, partials);
+    }
+}
+
+const int64_t *
+CountAgg::CubePartials(const RowGroupCube &cube, int groupByColumn) const
+{
+    return cube.Counts(groupByColumn);
+}
+
+AggStateP
+CountAgg::CreateState(int64_t partial) const
+{
+    return std::make_unique<CountAggState>(partial);
+}
+
+void
+CountAgg::Accumulate(AggState *state, int64_t partial) const
+{
+    static_cast<CountAggState *>(state)->value += partial;
 }
 
 void
@@ -263,83 +498,84 @@ CountAgg::Combine(AggState *state1, const AggState *state2) const
     countState1->value += countState2->value;
 }
 
-std::string
-CountAgg::Finalize(const AggState *state) const
+void
+CountAgg::Finalize(const AggState *state, ResultColumn &column) const
 {
     auto countState = static_cast<const CountAggState *>(state);
-    return std::to_string(countState->value);
+    column.ints.push_back(countState->value);
 }
 
-template<class storageType, bool hasBitmap>
-void
-CalculateRawDataSum(
-    uint8_t *data,
-    int size,
-    uint8_t *bitmap,
-    std::vector<int64_t> &sumsPerGroup,
-    const uint16_t *groups)
+std::shared_ptr<AccelType>
+CountAgg::ResultType() const
+{
+    return std::make_shared<Int64Type>();
+}
+
+template<class storageType, class codeType, SelectionMode mode>
+static void
+SumGroups(const storageType *values,
+          const codeType *codes,
+          int size,
+          const uint8_t *bitmap,
+          int64_t *sums)
 {
-    auto values = (storageType *) data;
     for (int i = 0; i < size; i++)
-        if constexpr(hasBitmap)
-        {
-            if (IsBitSet(bitmap, i))
-                sumsPerGroup[groups[i]] += values[i];
-        }
-        else
-        {
-            sumsPerGroup[groups[i]] += values[i];
-        }
+    {
+        if constexpr (mode == SELECT_ALL)
+            sums[codes[i]] += values[i];
+        else if constexpr (mode == SELECT_MASK)
+            sums[codes[i]] += values[i] & -(int64_t) IsBitSet(bitmap, i);
+        else if (IsBitSet(bitmap, i))
+            sums[codes[i]] += values[i];
+    }
 }
 
-template<class AccelTy, bool hasBitmap>
-void
-CalculateRawDataSum(
-    RawColumnData<AccelTy> *columnData,
-    uint8_t *bitmap,
-    std::vector<int64_t> &sumsPerGroup,
-    const uint16_t *groups)
+template<class storageType, class codeType>
+static void
+SumGroups(const uint8_t *data,
+          const ColumnDataGroups &groups,
+          const uint8_t *bitmap,
+          SelectionMode mode,
+          int64_t *sums)
 {
-    switch (columnData->bytesPerValue)
+    auto values = reinterpret_cast<const storageType *>(data) + groups.offset;
+    auto codes = reinterpret_cast<const codeType *>(groups.codes);
+    switch (mode)
     {
-        #define CalculateRawDataSum_DISPATCH(width, storageType) \
-            case width: \
-                return CalculateRawDataSum<storageType, hasBitmap>( \
-                        columnData->values, columnData->size, bitmap, sumsPerGroup, groups);
-        CalculateRawDataSum_DISPATCH(1, int8_t);
-        CalculateRawDataSum_DISPATCH(2, int16_t);
-        CalculateRawDataSum_DISPATCH(4, int32_t);
-        CalculateRawDataSum_DISPATCH(8, int64_t);
+        case SELECT_ALL:
+            return SumGroups<storageType, codeType, SELECT_ALL>(
+                        values, codes, groups.size, bitmap, sums);
+        case SELECT_BRANCH:
+            return SumGroups<storageType, codeType, SELECT_BRANCH>(
+                        values, codes, groups.size, bitmap, sums);
+        case SELECT_MASK:
+            return SumGroups<storageType, codeType, SELECT_MASK>(
+                        values, codes, groups.size, bitmap, sums);
     }
 }
 
-template<bool hasBitmap>
-void
-CalculateRawDataSum(
-    ColumnDataBase *columnData,
-    uint8_t *bitmap,
-    std::vector<int64_t> &sumsPerGroup,
-    const uint16_t *groups,
-    AccelType *type)
+template<class storageType>
+static void
+SumGroups(const uint8_t *data,
+          const ColumnDataGroups &groups,
+          const uint8_t *bitmap,
+          SelectionMode mode,
+          int64_t *sums)
 {
-    DISPATCH_RAW_TYPE(
-        type->type_num(),
-        return CalculateRawDataSum<AccelTy COMMA hasBitmap>(
-                    (RawColumnData<AccelTy> *) columnData,
-                    bitmap,
-                    sumsPerGroup,
-                    groups));
+    if (groups.codeWidth == 1)
+        SumGroups<storageType, uint8_t>(data, groups, bitmap, mode, sums);
+    else
+        SumGroups<storageType, uint16_t>(data, groups, bitmap, mode, sums);
 }
 
-AggStateVec
+void
 SumAgg::LocalAggregate(const RowGroup& rowGroup,
                        const ColumnDataGroups& groups,
-                       uint8_t *bitmap) const
+                       uint8_t *bitmap,
+                       int64_t *partials) const
 {
-    std::vector<int64_t> sumsPerGroup(groups.groupCount, 0);
-
-    auto dataType = this->columnRef.Type().get();
     auto columnData = rowGroup.columns[this->columnRef.columnIdx].get();
+    SelectionMode mode = GetSelectionMode(bitmap, params);
 
     switch (columnData->type)
     {
@@ -348,21 +584,40 @@ SumAgg::LocalAggregate(const RowGroup& rowGroup,
             break;
 
         case ColumnDataBase::RAW_COLUMN_DATA:
-            if (bitmap == NULL)
-                CalculateRawDataSum<false>(
-                    columnData, bitmap, sumsPerGroup, groups.groups, dataType);
-            else
-                CalculateRawDataSum<true>(
-                    columnData, bitmap, sumsPerGroup, groups.groups, dataType);
+        {
+            auto rawData = static_cast<RawColumnDataBase *>(columnData);
+            switch (rawData->bytesPerValue)
+            {
+                #define SUM_GROUPS_DISPATCH(width, storageType) \
+                    case width: \
+                        return SumGroups<storageType>( \
+                                    rawData->values, groups, bitmap, mode, partials);
+                SUM_GROUPS_DISPATCH(1, int8_t);
+                SUM_GROUPS_DISPATCH(2, int16_t);
+                SUM_GROUPS_DISPATCH(4, int32_t);
+                SUM_GROUPS_DISPATCH(8, int64_t);
+            }
             break;
+        }
     }
+}
 
-    AggStateVec result;
-    for (int i = 0; i < groups.groupCount; i++)
-        result.push_back(
-            std::make_unique<SumAggState>(sumsPerGroup[i], columnRef.Type()));
+const int64_t *
+SumAgg::CubePartials(const RowGroupCube &cube, int groupByColumn) const
+{
+    return cube.Sums(groupByColumn, columnRef.columnIdx);
+}
 
-    return result;
+AggStateP
+SumAgg::CreateState(int64_t partial) const
+{
+    return std::make_unique<SumAggState>(partial, columnRef.Type());
+}
+
+void
+SumAgg::Accumulate(AggState *state, int64_t partial) const
+{
+    static_cast<SumAggState *>(state)->value += partial;
 }
 
 void
@@ -374,11 +629,17 @@ SumAgg::Combine(AggState *state1, const AggState *state2) const
     sumState1->value += sumState2->value;
 }
 
-std::string
-SumAgg::Finalize(const AggState *state) const
+void
+SumAgg::Finalize(const AggState *state, ResultColumn &column) const
 {
     auto sumState = static_cast<const SumAggState *>(state);
-    return ToString(sumState->valueType.get(), sumState->value);
+    column.ints.push_back(sumState->value);
+}
+
+std::shared_ptr<AccelType>
+SumAgg::ResultType() const
+{
+    return columnRef.Type();
 }
 
 };
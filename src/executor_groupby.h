@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "executor.h"
 #include <functional>
 
@@ -11,22 +12,56 @@ struct ExecutionParams {
     bool groupByEliminateBranches = true;
 };
 
+/*
+ * Row groups are aggregated in vector blocks of this many rows, so that a
+ * block's group codes, selection bitmap and values stay in L1/L2 while
+ * each aggregator passes over them. A multiple of 512, so block bitmaps
+ * start at cache line boundaries.
+ */
+const int VectorBlockSize = 4096;
+
+/*
+ * Group codes of the rows of a vector block, which starts at row offset of
+ * its row group. codes points into the dictionary codes of the group by
+ * column, which are codeWidth bytes each, so kernels read 1-byte codes
+ * without widening them.
+ */
 struct ColumnDataGroups {
     int groupCount;
-    uint16_t groups[1 << 16] __attribute__ ((aligned (512)));
+    int offset;
+    int size;
+    const uint8_t *codes;
+    int codeWidth;
 };
 
 class AggState {};
 typedef std::unique_ptr<AggState> AggStateP;
 typedef std::vector<AggStateP> AggStateVec;
 
+/*
+ * Aggregators add a partial int64 value per group for each vector block of
+ * a row group into a zeroed array, which is then folded into the per-group
+ * states with CreateState() and Accumulate(). bitmap, if not null, is the
+ * selection of the block's rows.
+ */
 class Aggregator {
 public:
-    virtual AggStateVec LocalAggregate(const RowGroup& rowGroup,
-                                       const ColumnDataGroups& groups,
-                                       uint8_t *bitmap) const = 0;
+    virtual void LocalAggregate(const RowGroup& rowGroup,
+                                const ColumnDataGroups& groups,
+                                uint8_t *bitmap,
+                                int64_t *partials) const = 0;
+
+    /*
+     * Partials of a whole row group from its pre-aggregates, nullptr if
+     * the cube doesn't cover this aggregate.
+     */
+    virtual const int64_t *CubePartials(const RowGroupCube &cube,
+                                        int groupByColumn) const = 0;
+    virtual AggStateP CreateState(int64_t partial) const = 0;
+    virtual void Accumulate(AggState *state, int64_t partial) const = 0;
     virtual void Combine(AggState *result1, const AggState *result2) const = 0;
-    virtual std::string Finalize(const AggState *result) const = 0;
+    virtual void Finalize(const AggState *result, ResultColumn &column) const = 0;
+    virtual std::shared_ptr<AccelType> ResultType() const = 0;
 };
 
 typedef std::unique_ptr<Aggregator> AggregatorP;
@@ -39,16 +74,22 @@ struct CountAggState: public AggState {
 
 class CountAgg: public Aggregator {
 public:
-    CountAgg(bool useAvx): useAvx(useAvx) { }
-
-    virtual AggStateVec LocalAggregate(const RowGroup& rowGroup,
-                                       const ColumnDataGroups& groups,
-                                       uint8_t *bitmap) const;
+    CountAgg(const ExecutionParams &params): params(params) { }
+
+    virtual void LocalAggregate(const RowGroup& rowGroup,
+                                const ColumnDataGroups& groups,
+                                uint8_t *bitmap,
+                                int64_t *partials) const;
+    virtual const int64_t *CubePartials(const RowGroupCube &cube,
+                                        int groupByColumn) const;
+    virtual AggStateP CreateState(int64_t partial) const;
+    virtual void Accumulate(AggState *state, int64_t partial) const;
     virtual void Combine(AggState *result1, const AggState *result2) const;
-    virtual std::string Finalize(const AggState *result) const;
+    virtual void Finalize(const AggState *result, ResultColumn &column) const;
+    virtual std::shared_ptr<AccelType> ResultType() const;
 
 private:
-    bool useAvx;
+    ExecutionParams params;
 };
 
 struct SumAggState: public AggState {
@@ -63,18 +104,24 @@ struct SumAggState: public AggState {
 
 class SumAgg: public Aggregator {
 public:
-    SumAgg(const ColumnRef &columnRef, bool useAvx):
-        useAvx(useAvx),
+    SumAgg(const ColumnRef &columnRef, const ExecutionParams &params):
+        params(params),
         columnRef(columnRef) { }
 
-    virtual AggStateVec LocalAggregate(const RowGroup& rowGroup,
-                                       const ColumnDataGroups& groups,
-                                       uint8_t *bitmap) const;
+    virtual void LocalAggregate(const RowGroup& rowGroup,
+                                const ColumnDataGroups& groups,
+                                uint8_t *bitmap,
+                                int64_t *partials) const;
+    virtual const int64_t *CubePartials(const RowGroupCube &cube,
+                                        int groupByColumn) const;
+    virtual AggStateP CreateState(int64_t partial) const;
+    virtual void Accumulate(AggState *state, int64_t partial) const;
     virtual void Combine(AggState *result1, const AggState *result2) const;
-    virtual std::string Finalize(const AggState *result) const;
+    virtual void Finalize(const AggState *result, ResultColumn &column) const;
+    virtual std::shared_ptr<AccelType> ResultType() const;
 
 private:
-    bool useAvx;
+    ExecutionParams params;
     ColumnRef columnRef;
 };
 
@@ -89,6 +136,8 @@ struct LocalAggResult {
             for (int i = 0; i < a.size() && i < b.size(); i++)
                 if (schema[i]->type_num() == STRING_TYPE)
                 {
+                    if (a[i].strPrefixKey != b[i].strPrefixKey)
+                        return a[i].strPrefixKey < b[i].strPrefixKey;
                     if (a[i].strValue != b[i].strValue)
                         return a[i].strValue < b[i].strValue;
                 }
@@ -110,6 +159,12 @@ struct LocalAggResult {
     Schema schema;
     std::map<RowX, std::vector<AggStateP>,
              std::function<bool(const RowX&, const RowX&)>> groupAggStates;
+
+    // column data whose dictionaries string labels point into
+    std::vector<ColumnDataP> pinned;
+
+    // reused lookup key, so probing existing groups doesn't allocate
+    RowX key;
 };
 
 typedef std::unique_ptr<LocalAggResult> LocalAggResultP;
@@ -121,22 +176,36 @@ public:
                      FilterNodeP &&filterNode,
                      const ExecutionParams &params);
 
-    LocalAggResult ProcessRowGroup(const RowGroup &rowGroup,
-                                   uint8_t *selectionBitmap = nullptr) const;
+    /*
+     * Aggregates the selected rows of the row group into result. Transient
+     * state is allocated in arena.
+     */
+    void ProcessRowGroup(const RowGroup &rowGroup,
+                         uint8_t *selectionBitmap,
+                         LocalAggResult &result,
+                         Arena &arena) const;
     void Combine(LocalAggResult &left, LocalAggResult &&right) const;
-    Rows Finalize(const LocalAggResult &localResult) const;
+    ResultBatch Finalize(const LocalAggResult &localResult) const;
 
     LocalAggResult::Schema GroupBySchema() const {
         return groupBySchema;
     }
 
-    Row FieldNames() const;
+    std::vector<std::string> FieldNames() const;
+    std::vector<std::shared_ptr<AccelType>> FieldTypes() const;
 
 private:
+    bool AggregateFromCube(const RowGroupCube &cube,
+                           int groupByColumn,
+                           int groupCount,
+                           bool *groupVisited,
+                           const std::vector<int64_t *> &partials) const;
+
     std::vector<AggregatorP> aggregators;
     std::vector<ColumnRef> groupBy;
     std::vector<int> projection;
-    Row fieldNames;
+    std::vector<std::string> fieldNames;
+    std::vector<std::shared_ptr<AccelType>> fieldTypes;
     FilterNodeP filterNode;
     ExecutionParams params;
     LocalAggResult::Schema groupBySchema;
@@ -1,4 +1,5 @@
 #include "executor.h"
+#include "util.h"
 #include <immintrin.h>
 
 namespace pgaccel
@@ -18,12 +19,12 @@ SumAllAvx512_16(uint8_t *valuesRaw, int size, int noOverflowCnt)
         __m512i result = _mm512_set1_epi16(0);
         int x = std::min(avxCnt, i + noOverflowCnt);
         for (int j = i; j < x; j++) {
-            result = _mm512_add_epi16(result, valuesR[j]);
+            result = _mm512_add_epi16(result, _mm512_loadu_si512(valuesR + j));
         }
 
-        auto avxVec = (int16_t *) &result;
-        for (int i = 0; i < (512 / 16); i++)
-            sum += avxVec[i];
+        // widen pairs of 16-bit lanes to 32 bits before reducing
+        sum += _mm512_reduce_add_epi32(
+                    _mm512_madd_epi16(result, _mm512_set1_epi16(1)));
     }
 
     auto values16 = reinterpret_cast<const int16_t *>(valuesRaw);
@@ -45,14 +46,12 @@ SumAllAvx512_16(uint8_t *valuesRaw, int size)
     __m512i result = _mm512_set1_epi32(0);
 
     for (int i = 0; i < avxCnt; i++) {
-        __m512i v = _mm512_cvtepi16_epi32(valuesR[i]);
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256(valuesR + i));
         result = _mm512_add_epi32(result, v);
     }
 
-    auto avxVec = (int32_t *) &result;
-    for (int i = 0; i < (256 / 16); i++)
-        sum += avxVec[i];
-    
+    sum += _mm512_reduce_add_epi32(result);
+
     auto values16 = reinterpret_cast<const int16_t *>(valuesRaw);
     for (int i = (256 / 16) * avxCnt; i < size; i++) {
         sum += values16[i];
@@ -116,4 +115,74 @@ SumAll(const ColumnDataP& columnData,
     return 0;
 }
 
+/*
+ * Sums 16 values per iteration, masking out the rows which aren't set in
+ * the bitmap.
+ */
+static int32_t
+SumSelectedAvx512_16(const uint8_t *valuesRaw, int size, const uint8_t *bitmap)
+{
+    auto valuesR = reinterpret_cast<const __m256i*>(valuesRaw);
+    auto bitmap16 = reinterpret_cast<const __mmask16 *>(bitmap);
+
+    int avxCnt = size / 16;
+    __m512i result = _mm512_set1_epi32(0);
+
+    for (int i = 0; i < avxCnt; i++) {
+        __m512i v = _mm512_maskz_cvtepi16_epi32(bitmap16[i],
+                                                _mm256_loadu_si256(valuesR + i));
+        result = _mm512_add_epi32(result, v);
+    }
+
+    int32_t sum = _mm512_reduce_add_epi32(result);
+
+    auto values16 = reinterpret_cast<const int16_t *>(valuesRaw);
+    for (int i = 16 * avxCnt; i < size; i++)
+        if (IsBitSet(bitmap, i))
+            sum += values16[i];
+
+    return sum;
+}
+
+template<class storageType>
+int64_t
+SumSelectedRaw(const RawColumnDataBase *columnData, const uint8_t *bitmap)
+{
+    int64_t result = 0;
+    auto values = reinterpret_cast<const storageType *>(columnData->values);
+    for (int i = 0; i < columnData->size; i++)
+        if (IsBitSet(bitmap, i))
+            result += values[i];
+    return result;
+}
+
+int64_t
+SumSelected(const ColumnDataP& columnData,
+            const pgaccel::AccelType *type,
+            const uint8_t *bitmap,
+            bool useAvx)
+{
+    if (columnData->type != ColumnDataBase::RAW_COLUMN_DATA)
+        return 0;
+
+    auto rawColumnData = static_cast<RawColumnDataBase *>(columnData.get());
+    switch (rawColumnData->bytesPerValue)
+    {
+        case 1:
+            return SumSelectedRaw<int8_t>(rawColumnData, bitmap);
+        case 2:
+            if (useAvx)
+                return SumSelectedAvx512_16(rawColumnData->values,
+                                            rawColumnData->size,
+                                            bitmap);
+            else
+                return SumSelectedRaw<int16_t>(rawColumnData, bitmap);
+        case 4:
+            return SumSelectedRaw<int32_t>(rawColumnData, bitmap);
+        case 8:
+            return SumSelectedRaw<int64_t>(rawColumnData, bitmap);
+    }
+    return 0;
+}
+
 };
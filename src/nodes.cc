@@ -1,6 +1,12 @@
 #include "nodes.h"
+#include "numa_placement.h"
+#include "prefetch.h"
+#include "selection_cache.h"
 #include "util.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace pgaccel
 {
 
@@ -11,8 +17,12 @@ namespace pgaccel
  */
 
 ScanNode::ScanNode(ColumnarTable *table,
+                   RowGroupsSnapshot snapshot,
+                   uint64_t tableVersion,
                    const std::vector<std::string> &selectedColumnNames)
-    : table(table)
+    : table(table),
+      rowGroups(std::move(snapshot)),
+      tableVersion(tableVersion)
 {
     const auto &tableSchema = table->Schema();
     for (auto columnName: selectedColumnNames)
@@ -28,20 +38,34 @@ ScanNode::ScanNode(ColumnarTable *table,
             }
         }
     }
+
+    bool identity = selectedColumnIndexes.size() == tableSchema.size();
+    for (size_t i = 0; identity && i < selectedColumnIndexes.size(); i++)
+        identity = selectedColumnIndexes[i] == i;
+
+    if (!identity)
+    {
+        projectedRowGroups.reserve(rowGroups->size());
+        for (const auto &tableRowGroup: *rowGroups)
+        {
+            RowGroup projected;
+            for (auto columnIdx: selectedColumnIndexes)
+                projected.columns.push_back(tableRowGroup.columns[columnIdx]);
+            projected.size = tableRowGroup.size;
+            projected.numaNode = tableRowGroup.numaNode;
+            // cubes refer to table column indexes, so they aren't kept
+            projectedRowGroups.push_back(std::move(projected));
+        }
+    }
 }
 
-std::unique_ptr<RowGroup>
+Morsel
 ScanNode::Execute(int partition) const
 {
-    const auto &tableRowGroup = table->GetRowGroup(partition);
-
-    auto resultRowGroup = std::make_unique<RowGroup>();
-    for (auto columnIdx: selectedColumnIndexes)
-        resultRowGroup->columns.push_back(tableRowGroup.columns[columnIdx]);
-    resultRowGroup->size = tableRowGroup.size;
-    resultRowGroup->selectedSize = tableRowGroup.size;
-
-    return std::move(resultRowGroup);
+    const RowGroup *rowGroup = projectedRowGroups.empty() ?
+                                    &(*rowGroups)[partition] :
+                                    &projectedRowGroups[partition];
+    return { rowGroup, partition, nullptr, rowGroup->size };
 }
 
 std::vector<ColumnDesc>
@@ -53,7 +77,27 @@ ScanNode::Schema() const
 int
 ScanNode::PartitionCount() const
 {
-    return table->RowGroupCount();
+    return rowGroups->size();
+}
+
+int
+ScanNode::PartitionNode(int partition) const
+{
+    return (*rowGroups)[partition].numaNode;
+}
+
+void
+ScanNode::Prefetch(int partition, const std::vector<int> &columns,
+                   size_t length) const
+{
+    const RowGroup *rowGroup = projectedRowGroups.empty() ?
+                                    &(*rowGroups)[partition] :
+                                    &projectedRowGroups[partition];
+    for (int columnIdx: columns)
+    {
+        auto buffer = rowGroup->columns[columnIdx]->ValuesBuffer();
+        PrefetchShared(buffer.first, std::min(length, buffer.second));
+    }
 }
 
 /*
@@ -62,38 +106,95 @@ ScanNode::PartitionCount() const
  * ====================
  */
 
-FilterNode::FilterNode(PartitionedNodeP child,
-                       const std::vector<FilterClause> filterClauses,
-                       const ExecutionParams &params)
-    : child(std::move(child)),
-      impl(CreateFilterNode(filterClauses, params.useAvx))
+FilterNode::FilterNode(const std::vector<FilterClause> &filterClauses,
+                       const ExecutionParams &params,
+                       uint64_t tableVersion,
+                       bool countOnly,
+                       int leadingSortKey)
+    : impl(CreateFilterNode(filterClauses, params.useAvx, leadingSortKey)),
+      countOnly(countOnly),
+      tableVersion(tableVersion),
+      cacheKey(CanonicalFilterKey(filterClauses))
 {
 }
 
-std::unique_ptr<RowGroup>
-FilterNode::Execute(int partition) const
+bool
+FilterNode::Push(Morsel &morsel, Arena &arena) const
 {
-    auto result = child->Execute(partition);
-    if (impl)
+    if (!impl)
+        return morsel.selectedSize > 0;
+
+    // row groups which match entirely keep no selection, which is cheaper
+    // for sinks and lets them use the row group's pre-aggregates
+    if (!morsel.selectionBitmap && impl->SelectsAll(*morsel.rowGroup))
+        return morsel.selectedSize > 0;
+
+    if (!morsel.selectionBitmap && SelectionCache::Shared().Enabled())
+        return PushCached(morsel, arena);
+
+    if (countOnly && !morsel.selectionBitmap)
     {
-        result->selectionBitmap =
-            std::make_unique<std::array<uint8_t, BITMAP_SIZE>>();
-        result->selectedSize =
-            impl->ExecuteSet(*result, result->selectionBitmap->data());
+        morsel.selectedSize = impl->ExecuteCount(*morsel.rowGroup);
+        return morsel.selectedSize > 0;
     }
-    return std::move(result);
-}
 
-int
-FilterNode::PartitionCount() const
-{
-    return child->PartitionCount();
+    int bitmapSize = BitmapSize(morsel.rowGroup->size);
+    uint8_t *bitmap = arena.AllocateArray<uint8_t>(bitmapSize);
+    if (morsel.selectionBitmap)
+    {
+        memcpy(bitmap, morsel.selectionBitmap, bitmapSize);
+        morsel.selectedSize = impl->ExecuteAnd(*morsel.rowGroup, bitmap);
+    }
+    else
+    {
+        morsel.selectedSize = impl->ExecuteSet(*morsel.rowGroup, bitmap);
+    }
+    morsel.selectionBitmap = bitmap;
+
+    return morsel.selectedSize > 0;
 }
 
-std::vector<ColumnDesc>
-FilterNode::Schema() const
+/*
+ * Narrows a morsel without a prior selection using the cached selection
+ * of its row group, or computes and caches it. Cached bitmaps are copied
+ * into the arena, so they can be evicted while the morsel is in flight.
+ */
+bool
+FilterNode::PushCached(Morsel &morsel, Arena &arena) const
 {
-    return child->Schema();
+    auto &cache = SelectionCache::Shared();
+    SelectionCacheKey key { tableVersion, morsel.rowGroupIdx, cacheKey };
+
+    auto cached = cache.Lookup(key);
+    if (cached)
+    {
+        morsel.selectedSize = cached->Count();
+        if (!countOnly && morsel.selectedSize > 0)
+        {
+            uint8_t *bitmap =
+                arena.AllocateArray<uint8_t>(BitmapSize(morsel.rowGroup->size));
+            cached->Decompress(bitmap);
+            morsel.selectionBitmap = bitmap;
+        }
+        return morsel.selectedSize > 0;
+    }
+
+    // counting is much cheaper than computing, compressing and caching a
+    // bitmap which this query doesn't use, so only queries which need the
+    // bitmap fill the cache
+    if (countOnly)
+    {
+        morsel.selectedSize = impl->ExecuteCount(*morsel.rowGroup);
+        return morsel.selectedSize > 0;
+    }
+
+    uint8_t *bitmap =
+        arena.AllocateArray<uint8_t>(BitmapSize(morsel.rowGroup->size));
+    morsel.selectedSize = impl->ExecuteSet(*morsel.rowGroup, bitmap);
+    cache.Insert(key, CompressedBitmap::Compress(bitmap, morsel.rowGroup->size));
+    morsel.selectionBitmap = bitmap;
+
+    return morsel.selectedSize > 0;
 }
 
 /*
@@ -102,69 +203,254 @@ FilterNode::Schema() const
  * =======================
  */
 
-AggregateNode::AggregateNode(PartitionedNodeP child,
-                             const std::vector<AggregateClause> &aggregateClauses,
+struct AggregateLocalState: public LocalSinkState {
+    AggregateLocalState(const LocalAggResult::Schema &schema)
+        : result(schema) {}
+
+    LocalAggResult result;
+};
+
+AggregateNode::AggregateNode(const std::vector<AggregateClause> &aggregateClauses,
                              const std::vector<ColumnRef> &groupBy,
                              const ExecutionParams &params)
-    : child(std::move(child)),
-      impl(aggregateClauses, groupBy, nullptr, params)
+    : impl(aggregateClauses, groupBy, nullptr, params)
 {
-    for (const auto &fieldName: impl.FieldNames())
+    auto fieldNames = impl.FieldNames();
+    auto fieldTypes = impl.FieldTypes();
+    for (int i = 0; i < fieldNames.size(); i++)
         schema.push_back({
-            fieldName,
-            std::make_shared<StringType>(),
+            fieldNames[i],
+            fieldTypes[i],
             ColumnDataBase::RAW_COLUMN_DATA
-        }); 
+        });
 }
 
-LocalAggResultP
-AggregateNode::LocalTask(std::function<bool(int)> selectPartitionF) const
+LocalSinkStateP
+AggregateNode::CreateLocalState() const
 {
-    LocalAggResultP result =
-        std::make_unique<LocalAggResult>(impl.GroupBySchema());
+    return std::make_unique<AggregateLocalState>(impl.GroupBySchema());
+}
 
-    int partitionCount = LocalPartitionCount();
-    for (int i = 0; i < partitionCount; i++)
-        if (selectPartitionF(i))
-        {
-            auto childRowGroup = child->Execute(i);
-            if (childRowGroup->selectedSize == 0)
-                continue;
-            uint8_t *selectionBitmap = nullptr;
-            if (childRowGroup->selectionBitmap)
-                selectionBitmap = childRowGroup->selectionBitmap->data();
-            impl.Combine(
-                *result,
-                impl.ProcessRowGroup(*childRowGroup, selectionBitmap));
-        }
+void
+AggregateNode::Consume(const Morsel &morsel,
+                       LocalSinkState &state,
+                       Arena &arena) const
+{
+    auto &localState = static_cast<AggregateLocalState &>(state);
+    impl.ProcessRowGroup(*morsel.rowGroup,
+                         morsel.selectionBitmap,
+                         localState.result,
+                         arena);
+}
+
+void
+AggregateNode::Combine(LocalSinkState &left, LocalSinkState &&right) const
+{
+    impl.Combine(static_cast<AggregateLocalState &>(left).result,
+                 std::move(static_cast<AggregateLocalState &>(right).result));
+}
 
-    return std::move(result);
+ResultBatch
+AggregateNode::Finalize(const LocalSinkState &state) const
+{
+    return impl.Finalize(static_cast<const AggregateLocalState &>(state).result);
 }
 
-Rows
-AggregateNode::GlobalTask(std::vector<std::future<LocalAggResultP>> &localResults) const
+std::vector<ColumnDesc>
+AggregateNode::Schema() const
 {
-    LocalAggResultP result;
-    for (auto &localResult: localResults) {
-        if (!result)
-            result = std::move(localResult.get());
+    return schema;
+}
+
+/*
+ * =============================
+ * ==== ScalarAggregateNode ====
+ * =============================
+ */
+
+struct ScalarAggregateLocalState: public LocalSinkState {
+    ScalarAggregateLocalState(int aggregateCount)
+        : values(aggregateCount, 0) {}
+
+    std::vector<int64_t> values;
+};
+
+ScalarAggregateNode::ScalarAggregateNode(
+    const std::vector<AggregateClause> &aggregateClauses,
+    const ExecutionParams &params)
+        : aggregateClauses(aggregateClauses),
+          params(params)
+{
+    for (const auto &agg: aggregateClauses)
+    {
+        if (agg.type == AggregateClause::AGGREGATE_COUNT)
+            schema.push_back({
+                "count",
+                std::make_shared<Int64Type>(),
+                ColumnDataBase::RAW_COLUMN_DATA
+            });
         else
-            impl.Combine(*result, std::move(*(localResult.get())));
+            schema.push_back({
+                "sum",
+                agg.columnRef->Type(),
+                ColumnDataBase::RAW_COLUMN_DATA
+            });
     }
+}
 
-    return impl.Finalize(*result);
+LocalSinkStateP
+ScalarAggregateNode::CreateLocalState() const
+{
+    return std::make_unique<ScalarAggregateLocalState>(aggregateClauses.size());
 }
 
-int
-AggregateNode::LocalPartitionCount() const
+void
+ScalarAggregateNode::Consume(const Morsel &morsel,
+                             LocalSinkState &state,
+                             Arena &arena) const
 {
-    return child->PartitionCount();
+    auto &values = static_cast<ScalarAggregateLocalState &>(state).values;
+    for (int i = 0; i < aggregateClauses.size(); i++)
+    {
+        const auto &agg = aggregateClauses[i];
+        if (agg.type == AggregateClause::AGGREGATE_COUNT)
+        {
+            values[i] += morsel.selectedSize;
+            continue;
+        }
+
+        const auto &columnData = morsel.rowGroup->columns[agg.columnRef->columnIdx];
+        if (morsel.selectionBitmap)
+            values[i] += SumSelected(columnData,
+                                     agg.columnRef->Type().get(),
+                                     morsel.selectionBitmap,
+                                     params.useAvx);
+        else
+            values[i] += SumAll(columnData,
+                                agg.columnRef->Type().get(),
+                                params.useAvx);
+    }
+}
+
+void
+ScalarAggregateNode::Combine(LocalSinkState &left, LocalSinkState &&right) const
+{
+    auto &leftValues = static_cast<ScalarAggregateLocalState &>(left).values;
+    auto &rightValues = static_cast<ScalarAggregateLocalState &>(right).values;
+    for (int i = 0; i < leftValues.size(); i++)
+        leftValues[i] += rightValues[i];
+}
+
+ResultBatch
+ScalarAggregateNode::Finalize(const LocalSinkState &state) const
+{
+    const auto &values = static_cast<const ScalarAggregateLocalState &>(state).values;
+
+    ResultBatch result;
+    for (int i = 0; i < schema.size(); i++)
+    {
+        int idx = result.AddColumn(schema[i].name, schema[i].type);
+        result.Column(idx).ints.push_back(values[i]);
+    }
+
+    return result;
 }
 
 std::vector<ColumnDesc>
-AggregateNode::Schema() const
+ScalarAggregateNode::Schema() const
 {
     return schema;
 }
 
+bool
+ScalarAggregateNode::CountOnly() const
+{
+    for (const auto &agg: aggregateClauses)
+        if (agg.type != AggregateClause::AGGREGATE_COUNT)
+            return false;
+    return true;
+}
+
+/*
+ * ==================
+ * ==== Pipeline ====
+ * ==================
+ */
+
+Pipeline::Pipeline(std::unique_ptr<ScanNode> source,
+                   std::vector<OperatorNodeP> operators,
+                   SinkNodeP sink,
+                   std::vector<int> scannedColumns)
+    : source(std::move(source)),
+      operators(std::move(operators)),
+      sink(std::move(sink)),
+      scannedColumns(std::move(scannedColumns))
+{
+}
+
+ResultBatch
+Pipeline::Execute(bool useParallelism) const
+{
+    int partitionCount = source->PartitionCount();
+
+    if (!useParallelism)
+    {
+        Arena arena;
+        auto state = sink->CreateLocalState();
+        for (int i = 0; i < partitionCount; i++)
+            PushMorsel(i, *state, arena);
+
+        return sink->Finalize(*state);
+    }
+
+    // one task per row group, so concurrent queries interleave finely on
+    // the shared pool. Each worker consumes into its own local state.
+    std::vector<int> partitionNodes;
+    if (NumaNodeCount() > 1)
+        for (int i = 0; i < partitionCount; i++)
+            partitionNodes.push_back(source->PartitionNode(i));
+
+    WorkerArenas arenas;
+    PerWorker<LocalSinkStateP> localStates;
+    WorkerPool::Shared().ParallelFor(partitionCount, [&](int i) {
+        auto &state = localStates.Local();
+        if (!state)
+            state = sink->CreateLocalState();
+        PushMorsel(i, *state, arenas.Local());
+    }, partitionNodes);
+
+    auto result = sink->CreateLocalState();
+    for (auto &state: localStates.All())
+        if (state)
+            sink->Combine(*result, std::move(*state));
+
+    return sink->Finalize(*result);
+}
+
+void
+Pipeline::PushMorsel(int partition, LocalSinkState &state, Arena &arena) const
+{
+    // everything allocated for the previous morsel has already been
+    // consumed by the sink
+    arena.Reset();
+
+    Morsel morsel = source->Execute(partition);
+    if (morsel.selectedSize == 0)
+        return;
+
+    RecordNumaTraffic(*morsel.rowGroup);
+
+    // in parallel mode the next row group may go to another worker, but
+    // it's likely to share our last level cache
+    int prefetchDistance = GetScanPrefetch().distance;
+    if (prefetchDistance > 0 && partition + 1 < source->PartitionCount())
+        source->Prefetch(partition + 1, scannedColumns, prefetchDistance);
+
+    for (const auto &op: operators)
+        if (!op->Push(morsel, arena))
+            return;
+
+    sink->Consume(morsel, state, arena);
+}
+
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "arena.h"
 #include "column_data.hpp"
 #include "columnar_table.h"
 #include "executor_groupby.h"
@@ -9,116 +10,229 @@
 namespace pgaccel
 {
 
+/*
+ * Queries run as push-based pipelines. A ScanNode source produces one
+ * morsel per row group, which a worker pushes through a chain of operators
+ * into a sink. Morsels only reference the column data of the pinned row
+ * groups, and selection bitmaps are allocated in the worker's arena, so
+ * nothing is copied or heap allocated between stages.
+ */
+struct Morsel {
+    const RowGroup *rowGroup;
+    // index of the row group in the scanned table
+    int rowGroupIdx;
+    // nullptr when all rows are selected
+    uint8_t *selectionBitmap;
+    int selectedSize;
+};
+
 class Node {
 public:
     enum Type {
         SCAN_NODE,
-        EXTEND_NODE,
         FILTER_NODE,
-        AGGREGATE_NODE
+        AGGREGATE_NODE,
+        SCALAR_AGGREGATE_NODE
     };
 
+    virtual ~Node() = default;
     virtual Type GetType() const = 0;
-    virtual std::vector<ColumnDesc> Schema() const = 0;
 };
 
-class PartitionedNode: public Node {
+/*
+ * OperatorNode transforms a morsel in place, e.g. by narrowing its
+ * selection. Returns false when no rows remain, which drops the morsel.
+ */
+class OperatorNode: public Node {
 public:
-    virtual std::unique_ptr<RowGroup> Execute(int partition) const = 0;
-    virtual int PartitionCount() const = 0;
+    virtual bool Push(Morsel &morsel, Arena &arena) const = 0;
 };
 
-typedef std::unique_ptr<Node> NodeP;
-typedef std::unique_ptr<PartitionedNode> PartitionedNodeP;
+class LocalSinkState {
+public:
+    virtual ~LocalSinkState() = default;
+};
 
+typedef std::unique_ptr<LocalSinkState> LocalSinkStateP;
 
 /*
- * ScanNode scans a subset of columns of a columnar table.
+ * SinkNode consumes morsels into per-worker local states, which are
+ * combined and finalized after all morsels have been pushed.
  */
-class ScanNode: public PartitionedNode {
+class SinkNode: public Node {
 public:
+    virtual LocalSinkStateP CreateLocalState() const = 0;
+    virtual void Consume(const Morsel &morsel,
+                         LocalSinkState &state,
+                         Arena &arena) const = 0;
+    virtual void Combine(LocalSinkState &left, LocalSinkState &&right) const = 0;
+    virtual ResultBatch Finalize(const LocalSinkState &state) const = 0;
+    virtual std::vector<ColumnDesc> Schema() const = 0;
+
+    // true if Consume() only reads selectedSize of morsels
+    virtual bool CountOnly() const
+    {
+        return false;
+    }
+};
+
+typedef std::unique_ptr<OperatorNode> OperatorNodeP;
+typedef std::unique_ptr<SinkNode> SinkNodeP;
+
+/*
+ * ScanNode scans a subset of columns of a columnar table. Row groups are
+ * pinned at construction, so appends during execution aren't visible.
+ * Projected row groups are also built at construction, so Execute() only
+ * returns a pointer.
+ */
+class ScanNode: public Node {
+public:
+    // rowGroups is a snapshot of the table's row groups, see
+    // ColumnarTable::RowGroups()
     ScanNode(ColumnarTable *table,
+             RowGroupsSnapshot rowGroups,
+             uint64_t tableVersion,
              const std::vector<std::string> &selectedColumnNames);
 
     virtual Type GetType() const {
         return SCAN_NODE;
     }
 
-    virtual std::unique_ptr<RowGroup> Execute(int partition) const;
-    virtual int PartitionCount() const;
-    virtual std::vector<ColumnDesc> Schema() const;
+    Morsel Execute(int partition) const;
+    int PartitionCount() const;
+
+    // NUMA node of the partition's row group, -1 if not placed
+    int PartitionNode(int partition) const;
+
+    // prefetches the first bytes of the given columns of the partition
+    void Prefetch(int partition, const std::vector<int> &columns,
+                  size_t length) const;
+
+    std::vector<ColumnDesc> Schema() const;
+
+    // version of the pinned row groups, see ColumnarTable::RowGroups()
+    uint64_t TableVersion() const {
+        return tableVersion;
+    }
 
 private:
     ColumnarTable *table;
+    RowGroupsSnapshot rowGroups;
+    uint64_t tableVersion;
+    std::vector<RowGroup> projectedRowGroups;
     std::vector<int> selectedColumnIndexes;
     std::vector<ColumnDesc> schema;
 };
 
 /*
- * ExtendNode extends the child node's output by some calculated
- * columns.
+ * FilterNode narrows the selection of morsels to the rows which satisfy
+ * all filter clauses. In count-only mode it only counts the matches of
+ * morsels without a selection, for sinks which don't read bitmaps.
+ *
+ * Selections of morsels without a prior selection are looked up in and
+ * added to the shared SelectionCache, keyed by tableVersion.
  */
-class ExtendNode: public PartitionedNode {
+class FilterNode: public OperatorNode {
 public:
-    ExtendNode(PartitionedNodeP child);
+    FilterNode(const std::vector<FilterClause> &filterClauses,
+               const ExecutionParams &params,
+               uint64_t tableVersion,
+               bool countOnly = false,
+               int leadingSortKey = -1);
 
     virtual Type GetType() const {
-        return EXTEND_NODE;
+        return FILTER_NODE;
     }
 
-    virtual std::unique_ptr<RowGroup> Execute(int partition) const;
-    virtual int PartitionCount() const;
-    virtual std::vector<ColumnDesc> Schema() const;
+    virtual bool Push(Morsel &morsel, Arena &arena) const;
+
+private:
+    bool PushCached(Morsel &morsel, Arena &arena) const;
+
+    FilterNodeP impl;
+    bool countOnly;
+    uint64_t tableVersion;
+    std::string cacheKey;
 };
 
 /*
- * FilterNode
+ * AggregateNode computes aggregates per group.
  */
-
-class FilterNode: public PartitionedNode {
+class AggregateNode: public SinkNode {
 public:
-    FilterNode(PartitionedNodeP child,
-               const std::vector<FilterClause> filterClauses,
-               const ExecutionParams &params);
+    AggregateNode(const std::vector<AggregateClause> &aggregateClauses,
+                  const std::vector<ColumnRef> &groupBy,
+                  const ExecutionParams &params);
 
     virtual Type GetType() const {
-        return FILTER_NODE;
+        return AGGREGATE_NODE;
     }
 
-    virtual std::unique_ptr<RowGroup> Execute(int partition) const;
-    virtual int PartitionCount() const;
+    virtual LocalSinkStateP CreateLocalState() const;
+    virtual void Consume(const Morsel &morsel,
+                         LocalSinkState &state,
+                         Arena &arena) const;
+    virtual void Combine(LocalSinkState &left, LocalSinkState &&right) const;
+    virtual ResultBatch Finalize(const LocalSinkState &state) const;
     virtual std::vector<ColumnDesc> Schema() const;
 
 private:
-    PartitionedNodeP child;
-    FilterNodeP impl;
+    AggregateNodeImpl impl;
+    std::vector<ColumnDesc> schema;
 };
 
 /*
- * AggregateNode
+ * ScalarAggregateNode computes aggregates without GROUP BY, into a single
+ * row. Only count(*) and sum() are supported.
  */
-
-class AggregateNode: public Node {
+class ScalarAggregateNode: public SinkNode {
 public:
-    AggregateNode(PartitionedNodeP child,
-                  const std::vector<AggregateClause> &aggregateClauses,
-                  const std::vector<ColumnRef> &groupBy,
-                  const ExecutionParams &params);
+    ScalarAggregateNode(const std::vector<AggregateClause> &aggregateClauses,
+                        const ExecutionParams &params);
 
     virtual Type GetType() const {
-        return AGGREGATE_NODE;
+        return SCALAR_AGGREGATE_NODE;
     }
 
-    LocalAggResultP LocalTask(std::function<bool(int)> selectPartitionF) const;
-    Rows GlobalTask(std::vector<std::future<LocalAggResultP>> &localResults) const;
-
-    virtual int LocalPartitionCount() const;
+    virtual LocalSinkStateP CreateLocalState() const;
+    virtual void Consume(const Morsel &morsel,
+                         LocalSinkState &state,
+                         Arena &arena) const;
+    virtual void Combine(LocalSinkState &left, LocalSinkState &&right) const;
+    virtual ResultBatch Finalize(const LocalSinkState &state) const;
     virtual std::vector<ColumnDesc> Schema() const;
+    virtual bool CountOnly() const;
 
 private:
-    PartitionedNodeP child;
-    AggregateNodeImpl impl;
+    std::vector<AggregateClause> aggregateClauses;
     std::vector<ColumnDesc> schema;
+    ExecutionParams params;
+};
+
+/*
+ * Pipeline is a compiled query: a source, a chain of operators and a sink.
+ * While a morsel is pushed, the heads of the scanned columns of the next
+ * row group are prefetched, so the kernels' own prefetching doesn't start
+ * each row group with a run of cache misses.
+ */
+class Pipeline {
+public:
+    Pipeline(std::unique_ptr<ScanNode> source,
+             std::vector<OperatorNodeP> operators,
+             SinkNodeP sink,
+             std::vector<int> scannedColumns = {});
+
+    ResultBatch Execute(bool useParallelism) const;
+
+private:
+    void PushMorsel(int partition, LocalSinkState &state, Arena &arena) const;
+
+    std::unique_ptr<ScanNode> source;
+    std::vector<OperatorNodeP> operators;
+    SinkNodeP sink;
+
+    // source columns which operators and the sink read
+    std::vector<int> scannedColumns;
 };
 
 };
@@ -0,0 +1,336 @@
+#include "numa_placement.h"
+#include "column_storage.h"
+#include "columnar_table.h"
+
+#include <algorithm>
+#include <map>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef PGACCEL_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+namespace pgaccel
+{
+
+static bool NumaAvailable();
+static void MoveRangeToNode(uintptr_t start, uintptr_t end, int node);
+
+/*
+ * Moves column buffers to the nodes of their row groups. Moving part of a
+ * huge page splits it, so buffers carved from column storage regions move
+ * with their whole region, to the node which most of the region's new
+ * buffers are for. A region is moved once: buffers carved from it later
+ * are allocated on its node, and moving it again would take the pages of
+ * earlier row groups off their node. Other buffers move page by page.
+ */
+class BufferPlacement {
+public:
+    // records that columnData should be on node
+    void Add(const ColumnDataBase &columnData, int node);
+
+    // moves the regions of the added buffers which weren't moved yet
+    void MoveRegions();
+
+    // node which most bytes of the row group's buffers are on
+    static int RowGroupNode(const RowGroup &rowGroup, int defaultNode);
+
+private:
+    // bytes of a region's added buffers for each node
+    struct RegionBytes {
+        size_t size = 0;
+        std::vector<size_t> nodeBytes;
+    };
+
+    std::map<uint8_t *, RegionBytes> regions;
+};
+
+static std::atomic<NumaPlacement> placement{NumaPlacement::INTERLEAVE};
+static NumaTraffic traffic;
+
+// node the calling thread is bound to, -1 if not bound
+static thread_local int boundNode = -1;
+
+static bool
+NumaAvailable()
+{
+#ifdef PGACCEL_NUMA
+    static bool available = numa_available() >= 0;
+    return available;
+#else
+    return false;
+#endif
+}
+
+int
+NumaNodeCount()
+{
+#ifdef PGACCEL_NUMA
+    if (NumaAvailable())
+    {
+        static int nodeCount = numa_num_configured_nodes();
+        return nodeCount;
+    }
+#endif
+    return 1;
+}
+
+int
+CurrentNumaNode()
+{
+    if (boundNode >= 0)
+        return boundNode;
+
+#ifdef PGACCEL_NUMA
+    if (NumaNodeCount() > 1)
+    {
+        int node = numa_node_of_cpu(sched_getcpu());
+        return node >= 0 ? node : 0;
+    }
+#endif
+    return 0;
+}
+
+void
+BindThreadToNumaNode(int node)
+{
+#ifdef PGACCEL_NUMA
+    if (NumaNodeCount() > 1 && numa_run_on_node(node) == 0)
+        boundNode = node;
+#endif
+}
+
+int
+NumaNodeOfCpuIndex(int cpuIdx)
+{
+#ifdef PGACCEL_NUMA
+    if (NumaNodeCount() > 1)
+    {
+        // the i-th cpu which the process may run on
+        static std::vector<int> cpuNodes = []() {
+            std::vector<int> result;
+            int cpuCount = numa_num_configured_cpus();
+            for (int cpu = 0; cpu < cpuCount; cpu++)
+                if (numa_bitmask_isbitset(numa_all_cpus_ptr, cpu))
+                    result.push_back(numa_node_of_cpu(cpu));
+            return result;
+        }();
+
+        if (!cpuNodes.empty())
+            return cpuNodes[cpuIdx % cpuNodes.size()];
+    }
+#endif
+    return 0;
+}
+
+NumaPlacement
+GetNumaPlacement()
+{
+    return placement;
+}
+
+void
+SetNumaPlacement(NumaPlacement newPlacement)
+{
+    placement = newPlacement;
+}
+
+std::string
+NumaPlacementName(NumaPlacement placement)
+{
+    switch (placement)
+    {
+        case NumaPlacement::OFF:
+            return "off";
+        case NumaPlacement::INTERLEAVE:
+            return "interleave";
+        case NumaPlacement::PARTITION:
+            return "partition";
+    }
+    return "unknown";
+}
+
+void
+PlaceRowGroups(std::vector<RowGroup> &rowGroups)
+{
+    NumaPlacement currentPlacement = placement;
+    if (currentPlacement == NumaPlacement::OFF)
+        return;
+
+    int nodeCount = NumaNodeCount();
+    int rowGroupCount = rowGroups.size();
+    std::vector<int> placedGroups;
+    BufferPlacement bufferPlacement;
+    for (int i = 0; i < rowGroupCount; i++)
+    {
+        auto &rowGroup = rowGroups[i];
+        if (rowGroup.numaNode >= 0)
+            continue;
+
+        if (currentPlacement == NumaPlacement::INTERLEAVE)
+            rowGroup.numaNode = i % nodeCount;
+        else
+            rowGroup.numaNode = (int64_t) i * nodeCount / rowGroupCount;
+        placedGroups.push_back(i);
+
+        if (nodeCount > 1)
+            for (const auto &columnData: rowGroup.columns)
+                if (columnData)
+                    bufferPlacement.Add(*columnData, rowGroup.numaNode);
+    }
+
+    if (nodeCount == 1)
+        return;
+
+    bufferPlacement.MoveRegions();
+
+    // label row groups with where their pages are, which workers and
+    // traffic counters rely on
+    for (int i: placedGroups)
+        rowGroups[i].numaNode =
+            BufferPlacement::RowGroupNode(rowGroups[i], rowGroups[i].numaNode);
+}
+
+void
+PlaceColumns(std::vector<RowGroup> &rowGroups, const std::vector<int> &columns)
+{
+    if (placement == NumaPlacement::OFF || NumaNodeCount() == 1)
+        return;
+
+    BufferPlacement bufferPlacement;
+    for (const auto &rowGroup: rowGroups)
+        if (rowGroup.numaNode >= 0)
+            for (auto columnIdx: columns)
+                if (rowGroup.columns[columnIdx])
+                    bufferPlacement.Add(*rowGroup.columns[columnIdx], rowGroup.numaNode);
+
+    bufferPlacement.MoveRegions();
+
+    for (auto &rowGroup: rowGroups)
+        if (rowGroup.numaNode >= 0)
+            rowGroup.numaNode = BufferPlacement::RowGroupNode(rowGroup, rowGroup.numaNode);
+}
+
+void
+BufferPlacement::Add(const ColumnDataBase &columnData, int node)
+{
+    static uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+
+    auto buffer = columnData.ValuesBuffer();
+    if (buffer.first == nullptr)
+        return;
+
+    uint8_t *regionStart;
+    size_t regionSize;
+    int regionNode;
+    if (ColumnBufferRegion(buffer.first, regionStart, regionSize, regionNode))
+    {
+        if (regionNode >= 0)
+            return;
+
+        auto &regionBytes = regions[regionStart];
+        regionBytes.size = regionSize;
+        if (regionBytes.nodeBytes.size() <= (size_t) node)
+            regionBytes.nodeBytes.resize(node + 1);
+        regionBytes.nodeBytes[node] += buffer.second;
+        return;
+    }
+
+    // pages at the edges can be shared with other allocations, so only
+    // those entirely in the buffer are moved
+    uintptr_t start = (uintptr_t) buffer.first;
+    uintptr_t end = start + buffer.second;
+    start = (start + pageSize - 1) & ~(pageSize - 1);
+    end = end & ~(pageSize - 1);
+    MoveRangeToNode(start, end, node);
+}
+
+void
+BufferPlacement::MoveRegions()
+{
+    for (const auto &[start, regionBytes]: regions)
+    {
+        const auto &nodeBytes = regionBytes.nodeBytes;
+        int node = std::max_element(nodeBytes.begin(), nodeBytes.end()) -
+                   nodeBytes.begin();
+        MoveRangeToNode((uintptr_t) start, (uintptr_t) start + regionBytes.size, node);
+        SetColumnBufferRegionNode(start, node);
+    }
+    regions.clear();
+}
+
+int
+BufferPlacement::RowGroupNode(const RowGroup &rowGroup, int defaultNode)
+{
+    std::vector<size_t> nodeBytes;
+    for (const auto &columnData: rowGroup.columns)
+    {
+        if (!columnData)
+            continue;
+
+        auto buffer = columnData->ValuesBuffer();
+        uint8_t *regionStart;
+        size_t regionSize;
+        int node;
+        if (buffer.first == nullptr ||
+            !ColumnBufferRegion(buffer.first, regionStart, regionSize, node) ||
+            node < 0)
+            node = defaultNode;
+
+        if (nodeBytes.size() <= (size_t) node)
+            nodeBytes.resize(node + 1);
+        nodeBytes[node] += buffer.second;
+    }
+
+    if (nodeBytes.empty())
+        return defaultNode;
+    return std::max_element(nodeBytes.begin(), nodeBytes.end()) - nodeBytes.begin();
+}
+
+// start and end are page aligned
+static void
+MoveRangeToNode(uintptr_t start, uintptr_t end, int node)
+{
+#ifdef PGACCEL_NUMA
+    if (start >= end || node >= 64)
+        return;
+
+    unsigned long nodeMask = 1UL << node;
+    mbind((void *) start, end - start, MPOL_PREFERRED,
+          &nodeMask, sizeof(nodeMask) * 8, MPOL_MF_MOVE);
+#endif
+}
+
+NumaTraffic &
+GetNumaTraffic()
+{
+    return traffic;
+}
+
+void
+ResetNumaTraffic()
+{
+    traffic.localBytes = 0;
+    traffic.remoteBytes = 0;
+    traffic.unplacedBytes = 0;
+}
+
+void
+RecordNumaTraffic(const RowGroup &rowGroup)
+{
+    uint64_t bytes = 0;
+    for (const auto &columnData: rowGroup.columns)
+        if (columnData)
+            bytes += columnData->ValuesBuffer().second;
+
+    if (rowGroup.numaNode < 0)
+        traffic.unplacedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    else if (rowGroup.numaNode == CurrentNumaNode())
+        traffic.localBytes.fetch_add(bytes, std::memory_order_relaxed);
+    else
+        traffic.remoteBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+};
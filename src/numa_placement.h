@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pgaccel
+{
+
+struct RowGroup;
+
+/*
+ * NUMA placement of row groups.
+ *
+ * When a table publishes row groups, each new row group is assigned a node
+ * and the pages of its column buffers are moved there. Worker pool threads
+ * are bound to nodes, and prefer morsels of row groups on their own node.
+ *
+ * Builds without libnuma, and machines with a single node, see one node:
+ * every row group is assigned node 0 and nothing is moved.
+ */
+enum class NumaPlacement {
+    // leave pages where the loading thread first touched them
+    OFF,
+    // row group i goes to node i % nodeCount
+    INTERLEAVE,
+    // consecutive ranges of row groups go to the same node
+    PARTITION
+};
+
+int NumaNodeCount();
+
+// node which the calling thread runs on
+int CurrentNumaNode();
+
+// binds the calling thread to the cpus of node
+void BindThreadToNumaNode(int node);
+
+// node of the i-th online cpu, used to spread pool threads over nodes
+int NumaNodeOfCpuIndex(int cpuIdx);
+
+NumaPlacement GetNumaPlacement();
+void SetNumaPlacement(NumaPlacement placement);
+std::string NumaPlacementName(NumaPlacement placement);
+
+/*
+ * Assigns a node to row groups which don't have one yet, according to the
+ * current placement policy, and migrates their column buffers there.
+ * Buffers which share a huge page region with buffers of other nodes may
+ * end up elsewhere, so row groups are then labelled with the node which
+ * most of their bytes are on.
+ */
+void PlaceRowGroups(std::vector<RowGroup> &rowGroups);
+
+/*
+ * Migrates the buffers of columns which were added to placed row groups,
+ * e.g. when a lazily opened table loads them, to their row groups' nodes.
+ */
+void PlaceColumns(std::vector<RowGroup> &rowGroups, const std::vector<int> &columns);
+
+/*
+ * Bytes of column data scanned by morsels, split by whether the row group
+ * was on the node of the thread which scanned it.
+ */
+struct NumaTraffic {
+    std::atomic<uint64_t> localBytes{0};
+    std::atomic<uint64_t> remoteBytes{0};
+    // row groups which weren't placed, see NumaPlacement::OFF
+    std::atomic<uint64_t> unplacedBytes{0};
+};
+
+NumaTraffic &GetNumaTraffic();
+void ResetNumaTraffic();
+void RecordNumaTraffic(const RowGroup &rowGroup);
+
+};
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <string_view>
 
 #include "columnar_table.h"
 #include "util.h"
@@ -17,14 +18,17 @@
 namespace pgaccel
 {
 
+// values are read from parquet in batches of this many
+const int ReadBatchSize = 1 << 16;
+
 template<class ParquetTy, class AccelTy>
 std::vector<ColumnDataP>
-GenerateRawColumnData(parquet::ColumnReader &untypedReader)
+GenerateRawColumnData(parquet::ColumnReader &untypedReader, int rowGroupSize)
 {
     using ReaderType = parquet::TypedColumnReader<ParquetTy>&;
     ReaderType& typedReader = static_cast<ReaderType>(untypedReader);
 
-    const int N = RowGroupSize;
+    const int N = ReadBatchSize;
     std::vector<ColumnDataP> result;
 
     std::vector<typename AccelTy::c_type> allValues;
@@ -42,133 +46,118 @@ GenerateRawColumnData(parquet::ColumnReader &untypedReader)
         }
     }
 
-    for (int offset = 0; offset < allValues.size(); offset += RowGroupSize)
+    for (int offset = 0; offset < allValues.size(); offset += rowGroupSize)
     {
-        int rowGroupSize = std::min((int) allValues.size() - offset, RowGroupSize);
-        auto columnData = std::make_unique<RawColumnData<AccelTy>>();
-        columnData->type = ColumnDataBase::RAW_COLUMN_DATA;
-
-        typename AccelTy::c_type maxValue = allValues[offset], minValue = allValues[offset];
-        for (int i = 0; i < rowGroupSize; i++) {
-            minValue = std::min(minValue, allValues[i + offset]);
-            maxValue = std::max(maxValue, allValues[i + offset]);
-        }
-
-#define FILL_RAW_DATA(type) \
-        { \
-        auto valuesTyped = reinterpret_cast<type *>(columnData->values); \
-        for (int i = 0; i < rowGroupSize; i++) \
-            valuesTyped[i] = allValues[i + offset]; \
-        }
-
-        if (maxValue <= INT8_MAX && minValue >= INT8_MIN) {
-            columnData->bytesPerValue = 1;
-            columnData->values = (uint8_t *) aligned_alloc(512, rowGroupSize);
-            FILL_RAW_DATA(int8_t);
-        } else if (maxValue <= INT16_MAX && minValue >= INT16_MIN) {
-            columnData->bytesPerValue = 2;
-            columnData->values = (uint8_t *) aligned_alloc(512, 2 * rowGroupSize);
-            FILL_RAW_DATA(int16_t);
-        } else if (maxValue <= INT32_MAX && minValue >= INT32_MIN) {
-            columnData->bytesPerValue = 4;
-            columnData->values = (uint8_t *) aligned_alloc(512, 4 * rowGroupSize);
-            FILL_RAW_DATA(int32_t);
-        } else {
-            columnData->bytesPerValue = 8;
-            columnData->values = (uint8_t *) aligned_alloc(512, 8 * rowGroupSize);
-            FILL_RAW_DATA(int64_t);
-        }
-
-        columnData->size = rowGroupSize;
-        columnData->minValue = minValue;
-        columnData->maxValue = maxValue;
-
-        result.push_back(std::move(columnData));
+        int size = std::min((int) allValues.size() - offset, rowGroupSize);
+        result.push_back(
+            CreateRawColumnData<AccelTy>(allValues.data() + offset, size));
     }
 
     return std::move(result);
 }
 
+// dictionary key of a parquet value, strings point into the reader's pages
+static std::string_view
+ParquetKey(const parquet::ByteArray &value)
+{
+    return std::string_view((const char *) value.ptr, value.len);
+}
+
+static int32_t
+ParquetKey(int32_t value)
+{
+    return value;
+}
+
+/*
+ * Builds the dictionary of each row group while reading. If all pages of
+ * the column chunk are dictionary encoded, the reader exposes parquet's
+ * dictionary and its indices, so each dictionary entry is hashed once
+ * rather than once per row.
+ */
 template<class ParquetTy, class AccelTy>
 std::vector<ColumnDataP>
-GenerateDictColumnData(parquet::ColumnReader &untypedReader)
+GenerateDictColumnData(parquet::ColumnReader &untypedReader, int rowGroupSize)
 {
     using ReaderType = parquet::TypedColumnReader<ParquetTy>&;
-    using DictTy = typename AccelTy::c_type;
+    using ValueTy = typename ParquetTy::c_type;
     ReaderType& typedReader = static_cast<ReaderType>(untypedReader);
     std::vector<ColumnDataP> result;
 
-    const int N = RowGroupSize;
+    const int N = ReadBatchSize;
+    bool exposesDictionary =
+        untypedReader.GetExposedEncoding() == parquet::ExposedEncoding::DICTIONARY;
+
+    DictionaryBuilder<AccelTy> builder;
+    std::vector<uint32_t> ids;
+    ids.reserve(rowGroupSize);
+
+    // id of each entry of parquet's dictionary in builder, -1 if not added yet
+    const ValueTy *parquetDict = nullptr;
+    std::vector<int64_t> idOfEntry;
+
+    auto finishRowGroup = [&]() {
+        result.push_back(builder.Finish(ids.data(), ids.size()));
+        builder.Reset();
+        ids.clear();
+        std::fill(idOfEntry.begin(), idOfEntry.end(), -1);
+    };
 
-    std::vector<DictTy> convertedValues;
     while (true) {
         int16_t rep_levels[N];
         int16_t def_levels[N];
-        typename ParquetTy::c_type values[N];
         int64_t valuesRead = 0;
-        typedReader.ReadBatch(N, def_levels, rep_levels, values, &valuesRead);
-        if (valuesRead == 0)
-            break;
 
-        for (int i = 0; i < valuesRead; i++) {
-            convertedValues.push_back(AccelTy::FromParquet(values[i]));
-        }
-    }
-
-    std::mutex push_mutex;
+        if (exposesDictionary)
+        {
+            int32_t indices[N];
+            const ValueTy *dict = nullptr;
+            int32_t dictLength = 0;
+            typedReader.ReadBatchWithDictionary(N, def_levels, rep_levels,
+                                                indices, &valuesRead,
+                                                &dict, &dictLength);
+            if (valuesRead == 0)
+                break;
 
-    for (int offset = 0; offset < convertedValues.size(); offset += RowGroupSize)
-    {
-        int rowGroupSize = std::min((int) convertedValues.size() - offset, RowGroupSize);
-        auto columnData = std::make_unique<DictColumnData<AccelTy>>();
-        columnData->type = ColumnDataBase::DICT_COLUMN_DATA;
-        columnData->valueType = std::make_unique<AccelTy>();
-        std::unordered_set<DictTy> distinctValues;
-
-        // ordered map: 5.3s, 5.4s
-        // unordered map: 4.2s
-        // + unordered set + sort: 3.4s
-        std::unordered_map<DictTy, int> dictIndexMap;
-
-        for (int i = offset; i < offset + rowGroupSize; i++) {
-            distinctValues.insert(convertedValues[i]);
-        }
+            if (dict != nullptr && dict != parquetDict)
+            {
+                parquetDict = dict;
+                idOfEntry.assign(dictLength, -1);
+            }
 
-        std::vector<DictTy> distinctValuesSorted(
-            distinctValues.begin(),
-            distinctValues.end());
-        std::sort(distinctValuesSorted.begin(), distinctValuesSorted.end());
+            for (int i = 0; i < valuesRead; i++)
+            {
+                int32_t entry = indices[i];
+                if (idOfEntry[entry] < 0)
+                    idOfEntry[entry] = builder.Add(ParquetKey(parquetDict[entry]));
 
-        int dictSize = 0;
-        for (const auto &distinctValue: distinctValuesSorted) {
-            dictIndexMap[distinctValue] = dictSize++;
-            columnData->dict.push_back(distinctValue);
+                ids.push_back(idOfEntry[entry]);
+                if (ids.size() == rowGroupSize)
+                    finishRowGroup();
+            }
         }
+        else
+        {
+            ValueTy values[N];
+            typedReader.ReadBatch(N, def_levels, rep_levels, values, &valuesRead);
+            if (valuesRead == 0)
+                break;
 
-        if (dictSize < 256) {
-            uint8_t *values8 = (uint8_t *) aligned_alloc(512, rowGroupSize);
-            for (int i = offset; i < offset + rowGroupSize; i++) {
-                values8[i - offset] = dictIndexMap[convertedValues[i]];
-            }
-            columnData->values = values8;
-        } else {
-            uint16_t *values16 = (uint16_t *) aligned_alloc(512, 2 * rowGroupSize);
-            for (int i = offset; i < offset + rowGroupSize; i++) {
-                values16[i - offset] = dictIndexMap[convertedValues[i]];
+            for (int i = 0; i < valuesRead; i++)
+            {
+                ids.push_back(builder.Add(ParquetKey(values[i])));
+                if (ids.size() == rowGroupSize)
+                    finishRowGroup();
             }
-            columnData->values = (uint8_t *) values16;
         }
-
-        columnData->size = rowGroupSize;
-
-        std::lock_guard lock(push_mutex);
-        result.push_back(std::move(columnData));
     }
 
+    if (!ids.empty())
+        finishRowGroup();
+
     return std::move(result);
 }
 
-
 std::vector<RowGroup>
 LoadParquetRowGroup(parquet::RowGroupReader& rowGroupReader,
                     const ColumnarTable &columnarTable)
@@ -178,8 +167,7 @@ LoadParquetRowGroup(parquet::RowGroupReader& rowGroupReader,
     int parquetColCount = rowGroupReader.metadata()->num_columns();
     for (size_t colIdx = 0; colIdx < parquetColCount; colIdx++)
     {
-        auto columnReader = rowGroupReader.Column(colIdx);
-        auto name = columnReader->descr()->name();
+        auto name = rowGroupReader.metadata()->schema()->Column(colIdx)->name();
         auto maybeColumnIdx = columnarTable.ColumnIndex(name);
         if (!maybeColumnIdx.has_value())
             continue;
@@ -187,36 +175,43 @@ LoadParquetRowGroup(parquet::RowGroupReader& rowGroupReader,
         std::vector<ColumnDataP> columnDataVec;
 
         const auto &accelType = columnarTable.Schema()[*maybeColumnIdx].type;
+        bool isDictColumn = accelType->type_num() == STRING_TYPE ||
+                            accelType->type_num() == DATE_TYPE;
+        auto columnReader =
+            isDictColumn ?
+            rowGroupReader.ColumnWithExposeEncoding(
+                colIdx, parquet::ExposedEncoding::DICTIONARY) :
+            rowGroupReader.Column(colIdx);
 
         switch (accelType->type_num()) {
             case STRING_TYPE:
                 columnDataVec =
                     GenerateDictColumnData<parquet::ByteArrayType, pgaccel::StringType>(
-                        *columnReader);
+                        *columnReader, columnarTable.RowGroupSize());
                 break;
 
             case DATE_TYPE:
                 columnDataVec =
                     GenerateDictColumnData<parquet::Int32Type, pgaccel::DateType>(
-                        *columnReader);
+                        *columnReader, columnarTable.RowGroupSize());
                 break;
 
             case INT32_TYPE:
                 columnDataVec =
                     GenerateRawColumnData<parquet::Int32Type, pgaccel::Int32Type>(
-                        *columnReader);
+                        *columnReader, columnarTable.RowGroupSize());
                 break;
 
             case DECIMAL_TYPE:
                 columnDataVec =
                     GenerateRawColumnData<parquet::Int64Type, pgaccel::DecimalType>(
-                        *columnReader);
+                        *columnReader, columnarTable.RowGroupSize());
                 break;
 
             case INT64_TYPE:
                 columnDataVec =
                     GenerateRawColumnData<parquet::Int64Type, pgaccel::Int64Type>(
-                        *columnReader);
+                        *columnReader, columnarTable.RowGroupSize());
                 break;
         }
 
@@ -235,8 +230,15 @@ LoadParquetRowGroup(parquet::RowGroupReader& rowGroupReader,
 std::unique_ptr<ColumnarTable> 
 ColumnarTable::ImportParquet(const std::string &tableName,
                              const std::string &path,
-                             std::optional<std::set<std::string>> maybeFields)
+                             std::optional<std::set<std::string>> maybeFields,
+                             int rowGroupSize)
 {
+    if (rowGroupSize < 1 || rowGroupSize > MaxRowGroupSize)
+    {
+        std::cout << "invalid row group size: " << rowGroupSize << std::endl;
+        return {};
+    }
+
     arrow::fs::LocalFileSystem fs;
     auto openResult = fs.OpenInputFile(path);
     if (!openResult.ok()) {
@@ -263,6 +265,7 @@ ColumnarTable::ImportParquet(const std::string &tableName,
 
     auto result = std::unique_ptr<ColumnarTable>(new ColumnarTable);
     result->name_ = tableName;
+    result->row_group_size_ = rowGroupSize;
 
     for (size_t col = 0; col < parquetSchema->num_columns(); col++)
     {
@@ -324,6 +327,7 @@ ColumnarTable::ImportParquet(const std::string &tableName,
     for (size_t i = 0; i < fileMetadata->num_row_groups(); i++)
         rowGroupIdxs.push_back(i);
 
+    std::vector<RowGroup> resultRowGroups;
     std::mutex push_mutex;
     std::mutex log_mutex;
     std::for_each(
@@ -341,9 +345,12 @@ ColumnarTable::ImportParquet(const std::string &tableName,
 
             std::lock_guard lock(push_mutex);
             for(auto &rowGroup: rowGroups)
-                result->row_groups_.push_back(std::move(rowGroup));
+                resultRowGroups.push_back(std::move(rowGroup));
         });
 
+    result->sealed_count_ = resultRowGroups.size();
+    result->Publish(std::move(resultRowGroups));
+
     return result;
 }
 
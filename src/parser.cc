@@ -123,9 +123,31 @@ std::string FilterClause::ToString() const
         case FilterClause::FILTER_GTE:
             sout << ">=";
             break;
+        case FilterClause::FILTER_LIKE:
+            sout << "like";
+            break;
+        case FilterClause::FILTER_NOT_LIKE:
+            sout << "not like";
+            break;
+        case FilterClause::FILTER_IN:
+            sout << "in";
+            break;
+        case FilterClause::FILTER_NOT_IN:
+            sout << "not in";
+            break;
     }
     sout << "',columnRef=" << columnRef.ToString();
-    sout << ",value='" << value << "'";
+    if (op == FilterClause::FILTER_IN || op == FilterClause::FILTER_NOT_IN)
+    {
+        sout << ",values=(";
+        for (int i = 0; i < values.size(); i++)
+            sout << (i ? "," : "") << "'" << values[i] << "'";
+        sout << ")";
+    }
+    else
+    {
+        sout << ",value='" << value << "'";
+    }
     sout << ")";
     return sout.str();
 }
@@ -435,6 +457,43 @@ ParseFilterAtom(QueryDesc &queryDesc,
             return result;
         }
 
+    bool negated = ParseToken("not", tokens, currentIdx).ok();
+
+    if (ParseToken("like", tokens, currentIdx).ok())
+    {
+        if (columnType.type_num() != STRING_TYPE)
+            return Status::Invalid("LIKE is only supported for string columns: ",
+                                   result.columnRef.Name());
+
+        result.op = negated ? FilterClause::FILTER_NOT_LIKE : FilterClause::FILTER_LIKE;
+        ASSIGN_OR_RAISE(result.value, ParseValue(columnType, tokens, currentIdx));
+        return result;
+    }
+
+    if (ParseToken("in", tokens, currentIdx).ok())
+    {
+        if (result.columnRef.columnDesc.layout != ColumnDataBase::DICT_COLUMN_DATA)
+            return Status::Invalid("IN is only supported for dictionary encoded columns: ",
+                                   result.columnRef.Name());
+
+        result.op = negated ? FilterClause::FILTER_NOT_IN : FilterClause::FILTER_IN;
+        RAISE_IF_FAILS(ParseToken("(", tokens, currentIdx));
+        while (true)
+        {
+            std::string value;
+            ASSIGN_OR_RAISE(value, ParseValue(columnType, tokens, currentIdx));
+            result.values.push_back(value);
+
+            if (!ParseToken(",", tokens, currentIdx).ok())
+                break;
+        }
+        RAISE_IF_FAILS(ParseToken(")", tokens, currentIdx));
+        return result;
+    }
+
+    if (negated)
+        return Status::Invalid("Expected LIKE or IN after NOT");
+
     return Status::Invalid("Invalid operator: ", tokens[currentIdx]);
 }
 
@@ -484,6 +543,9 @@ ResolveColumn(QueryDesc &queryDesc,
             auto desc = table->Schema()[fieldIdx];
             auto type = desc.type;
             maybeRef = ColumnRef { desc, tableIdx, fieldIdx };
+
+            // lazily opened tables start loading it while we parse on
+            table->RequestColumn(fieldIdx);
         }
     }
 
@@ -56,12 +56,19 @@ struct FilterClause {
         FILTER_GTE,
         FILTER_LT,
         FILTER_LTE,
+        FILTER_LIKE,
+        FILTER_NOT_LIKE,
+        FILTER_IN,
+        FILTER_NOT_IN,
         INVALID
     } op;
 
     ColumnRef columnRef;
     std::string value;
 
+    // value list of IN and NOT IN
+    std::vector<std::string> values;
+
     std::string ToString() const;
 };
 
@@ -92,7 +99,7 @@ struct QueryDesc {
 };
 
 typedef std::unique_ptr<QueryDesc> QueryDescP;
-typedef std::map<std::string, std::unique_ptr<pgaccel::ColumnarTable>> TableRegistry;
+typedef std::map<std::string, std::shared_ptr<pgaccel::ColumnarTable>> TableRegistry;
 
 Result<QueryDesc> ParseSelect(const std::string &query, const TableRegistry &registry);
 };
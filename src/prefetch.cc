@@ -0,0 +1,34 @@
+#include "prefetch.h"
+
+#include <atomic>
+
+namespace pgaccel
+{
+
+const size_t CacheLineSize = 64;
+
+static std::atomic<int> prefetchDistance{DefaultPrefetchDistance};
+static std::atomic<bool> prefetchNonTemporal{false};
+
+ScanPrefetch
+GetScanPrefetch()
+{
+    return { prefetchDistance.load(std::memory_order_relaxed),
+             prefetchNonTemporal.load(std::memory_order_relaxed) };
+}
+
+void
+SetScanPrefetch(ScanPrefetch prefetch)
+{
+    prefetchDistance = prefetch.distance;
+    prefetchNonTemporal = prefetch.nonTemporal;
+}
+
+void
+PrefetchShared(const uint8_t *start, size_t length)
+{
+    for (size_t offset = 0; offset < length; offset += CacheLineSize)
+        _mm_prefetch((const char *) start + offset, _MM_HINT_T2);
+}
+
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace pgaccel
+{
+
+/*
+ * Software prefetching for scans. Hardware prefetchers only follow a
+ * stream within a 4KB page and after a few misses, so scan kernels
+ * prefetch a fixed distance ahead of their loads, and pipelines prefetch
+ * the first lines of the next row group's columns while the current row
+ * group is processed.
+ *
+ * A distance of 0 disables prefetching. Non-temporal prefetches bring
+ * lines close to the core without displacing the rest of the cache
+ * hierarchy, which suits columns read once per query.
+ */
+struct ScanPrefetch {
+    // bytes ahead of the current load
+    int distance;
+    bool nonTemporal;
+};
+
+const int DefaultPrefetchDistance = 1024;
+
+ScanPrefetch GetScanPrefetch();
+void SetScanPrefetch(ScanPrefetch prefetch);
+
+inline void
+PrefetchLine(const void *addr, bool nonTemporal)
+{
+    if (nonTemporal)
+        _mm_prefetch((const char *) addr, _MM_HINT_NTA);
+    else
+        _mm_prefetch((const char *) addr, _MM_HINT_T0);
+}
+
+/*
+ * Prefetches into the shared cache, for data which another core may
+ * process, like the next row group of a parallel scan.
+ */
+void PrefetchShared(const uint8_t *start, size_t length);
+
+};
@@ -0,0 +1,409 @@
+#include "query_server.h"
+#include "executor.h"
+#include "parser.h"
+#include "worker_pool.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pgaccel
+{
+
+// epoll ids of the non-connection fds
+const uint64_t LISTEN_ID = 0;
+const uint64_t WAKE_ID = 1;
+
+static bool SetNonBlocking(int fd);
+static void AddToEpoll(int epollFd, int fd, uint64_t id, uint32_t events);
+
+Result<std::unique_ptr<QueryServer>>
+QueryServer::Start(const std::string &address,
+                   Catalog &catalog,
+                   const ServerOptions &options)
+{
+    SocketAddress socketAddress;
+    ASSIGN_OR_RAISE(socketAddress, ParseSocketAddress(address));
+
+    std::unique_ptr<QueryServer> server(new QueryServer(catalog, options));
+    server->address = address;
+    server->nextConnectionId = WAKE_ID + 1;
+    RAISE_IF_FAILS(server->Listen(socketAddress));
+
+    server->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    server->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->epollFd < 0 || server->wakeFd < 0)
+        return Status::Invalid("Could not set up event loop: ", strerror(errno));
+
+    AddToEpoll(server->epollFd, server->listenFd, LISTEN_ID, EPOLLIN);
+    AddToEpoll(server->epollFd, server->wakeFd, WAKE_ID, EPOLLIN);
+
+    server->loopThread = std::thread([s = server.get()]() { s->EventLoop(); });
+
+    return server;
+}
+
+QueryServer::~QueryServer()
+{
+    Stop();
+}
+
+void
+QueryServer::Stop()
+{
+    if (!stopping.exchange(true) && loopThread.joinable())
+    {
+        uint64_t one = 1;
+        write(wakeFd, &one, sizeof(one));
+        loopThread.join();
+    }
+
+    // running queries hold a pointer to us
+    std::unique_lock lock(completionMutex);
+    sessionsDone.wait(lock, [&]() { return runningSessions == 0; });
+    lock.unlock();
+
+    for (auto &[id, conn]: connections)
+        close(conn->fd);
+    connections.clear();
+
+    for (int *fd: { &listenFd, &epollFd, &wakeFd })
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+
+    if (!unixPath.empty())
+        unlink(unixPath.c_str());
+    unixPath.clear();
+}
+
+Result<bool>
+QueryServer::Listen(const SocketAddress &socketAddress)
+{
+    if (socketAddress.isUnix)
+    {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, socketAddress.path.c_str());
+
+        // remove the socket file left behind by a previous server
+        unlink(socketAddress.path.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr *) &addr, sizeof(addr)) != 0)
+            return Status::Invalid("Could not bind to ", address, ": ", strerror(errno));
+
+        unixPath = socketAddress.path;
+    }
+    else
+    {
+        addrinfo hints {}, *addrs;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        std::string port = std::to_string(socketAddress.port);
+        if (getaddrinfo(socketAddress.host.c_str(), port.c_str(), &hints, &addrs) != 0)
+            return Status::Invalid("Could not resolve ", socketAddress.host);
+
+        listenFd = socket(addrs->ai_family, addrs->ai_socktype | SOCK_CLOEXEC,
+                          addrs->ai_protocol);
+        int reuse = 1;
+        bool bound =
+            listenFd >= 0 &&
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+            bind(listenFd, addrs->ai_addr, addrs->ai_addrlen) == 0;
+        freeaddrinfo(addrs);
+
+        if (!bound)
+            return Status::Invalid("Could not bind to ", address, ": ", strerror(errno));
+    }
+
+    if (listen(listenFd, SOMAXCONN) != 0 || !SetNonBlocking(listenFd))
+        return Status::Invalid("Could not listen on ", address, ": ", strerror(errno));
+
+    return true;
+}
+
+void
+QueryServer::EventLoop()
+{
+    epoll_event events[64];
+
+    while (!stopping)
+    {
+        int eventCount = epoll_wait(epollFd, events, 64, -1);
+        if (eventCount < 0 && errno == EINTR)
+            continue;
+
+        for (int i = 0; i < eventCount; i++)
+        {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID)
+            {
+                Accept();
+                continue;
+            }
+
+            if (id == WAKE_ID)
+            {
+                uint64_t count;
+                read(wakeFd, &count, sizeof(count));
+                ProcessCompletions();
+                continue;
+            }
+
+            // might have been closed by an earlier event of this batch
+            auto it = connections.find(id);
+            if (it == connections.end())
+                continue;
+
+            // peer is gone, so results can't be delivered anymore
+            auto &conn = *it->second;
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+                Close(conn);
+            else if (events[i].events & EPOLLIN)
+                ReadFrom(conn);
+            else if (events[i].events & EPOLLOUT)
+                WriteTo(conn);
+        }
+    }
+}
+
+void
+QueryServer::Accept()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        auto conn = std::make_unique<Connection>();
+        conn->id = nextConnectionId++;
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        AddToEpoll(epollFd, fd, conn->id, conn->events);
+        connections[conn->id] = std::move(conn);
+    }
+}
+
+void
+QueryServer::ReadFrom(Connection &conn)
+{
+    char buffer[1 << 16];
+    while (true)
+    {
+        ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+        if (n > 0)
+        {
+            conn.inBuffer.append(buffer, n);
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // EOF or error. Queries already received are still answered.
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            conn.readClosed = true;
+        break;
+    }
+
+    WireMessage message;
+    while (true)
+    {
+        auto decoded = DecodeMessage(conn.inBuffer, conn.inOffset, message,
+                                     WIRE_MAX_QUERY_LENGTH);
+        if (!decoded.ok())
+        {
+            // the client can't be answered in order anymore
+            Close(conn);
+            return;
+        }
+
+        if (!*decoded)
+            break;
+
+        if (message.type != WIRE_QUERY)
+        {
+            // unknown message, the stream can't be trusted anymore
+            conn.readClosed = true;
+            break;
+        }
+
+        conn.pendingQueries.push_back(std::move(message.payload));
+    }
+
+    conn.inBuffer.erase(0, conn.inOffset);
+    conn.inOffset = 0;
+
+    StartNextQuery(conn);
+    WriteTo(conn);
+}
+
+void
+QueryServer::WriteTo(Connection &conn)
+{
+    while (conn.outOffset < conn.outBuffer.size())
+    {
+        ssize_t n = send(conn.fd,
+                         conn.outBuffer.data() + conn.outOffset,
+                         conn.outBuffer.size() - conn.outOffset,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0)
+        {
+            Close(conn);
+            return;
+        }
+
+        conn.outOffset += n;
+    }
+
+    if (conn.outOffset == conn.outBuffer.size())
+    {
+        conn.outBuffer.clear();
+        conn.outOffset = 0;
+    }
+
+    bool done = conn.readClosed && !conn.running && conn.pendingQueries.empty();
+    if (done && conn.outBuffer.empty())
+    {
+        Close(conn);
+        return;
+    }
+
+    UpdateInterest(conn);
+}
+
+void
+QueryServer::StartNextQuery(Connection &conn)
+{
+    if (conn.running || conn.pendingQueries.empty())
+        return;
+
+    conn.running = true;
+    std::string query = std::move(conn.pendingQueries.front());
+    conn.pendingQueries.pop_front();
+
+    {
+        std::lock_guard lock(completionMutex);
+        runningSessions++;
+    }
+
+    WorkerPool::Shared().Submit([this, id = conn.id, query = std::move(query)]() {
+        RunQuery(id, std::move(query));
+    });
+}
+
+/*
+ * Runs on a worker of the shared pool. The result is encoded here, so the
+ * event loop only has to copy bytes.
+ */
+void
+QueryServer::RunQuery(uint64_t connectionId, std::string query)
+{
+    Completion completion { connectionId };
+
+    auto snapshot = catalog.Snapshot();
+    auto queryDesc = ParseSelect(query, snapshot->tables);
+    if (!queryDesc.ok())
+    {
+        EncodeError(completion.response, queryDesc.status().Message());
+    }
+    else
+    {
+        auto output = ExecuteQuery(*queryDesc, options.useAvx, options.useParallelism);
+        if (output.ok())
+            EncodeResultBatch(completion.response, *output, options.batchRows);
+        else
+            EncodeError(completion.response, output.status().Message());
+    }
+
+    queryCount++;
+
+    std::lock_guard lock(completionMutex);
+    completions.push_back(std::move(completion));
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+
+    if (--runningSessions == 0)
+        sessionsDone.notify_all();
+}
+
+void
+QueryServer::ProcessCompletions()
+{
+    std::vector<Completion> done;
+    {
+        std::lock_guard lock(completionMutex);
+        done.swap(completions);
+    }
+
+    for (auto &completion: done)
+    {
+        auto it = connections.find(completion.connectionId);
+        if (it == connections.end())
+            continue;
+
+        auto &conn = *it->second;
+        conn.outBuffer += completion.response;
+        conn.running = false;
+
+        StartNextQuery(conn);
+        WriteTo(conn);
+    }
+}
+
+void
+QueryServer::UpdateInterest(Connection &conn)
+{
+    uint32_t events = (conn.readClosed ? 0 : EPOLLIN) |
+                      (conn.outBuffer.empty() ? 0 : EPOLLOUT);
+    if (events == conn.events)
+        return;
+
+    epoll_event event {};
+    event.events = events;
+    event.data.u64 = conn.id;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.events = events;
+}
+
+void
+QueryServer::Close(Connection &conn)
+{
+    // results of a running query are dropped when it completes
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+    close(conn.fd);
+    connections.erase(conn.id);
+}
+
+static bool
+SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void
+AddToEpoll(int epollFd, int fd, uint64_t id, uint32_t events)
+{
+    epoll_event event {};
+    event.events = events;
+    event.data.u64 = id;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+};
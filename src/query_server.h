@@ -0,0 +1,114 @@
+#pragma once
+
+#include "catalog.h"
+#include "result_type.hpp"
+#include "wire_protocol.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pgaccel
+{
+
+struct ServerOptions {
+    bool useAvx = true;
+    bool useParallelism = true;
+    int batchRows = WIRE_BATCH_ROWS;
+};
+
+/*
+ * QueryServer accepts connections on a Unix or TCP socket and answers
+ * queries sent using the wire protocol.
+ *
+ * A single event loop thread does all socket I/O using epoll. Queries run
+ * on the shared worker pool against a pinned catalog snapshot, and their
+ * encoded results are handed back to the event loop. Queries of a connection run
+ * one at a time and are answered in order, so clients can pipeline them;
+ * queries of different connections run concurrently.
+ */
+class QueryServer {
+public:
+    static Result<std::unique_ptr<QueryServer>> Start(const std::string &address,
+                                                      Catalog &catalog,
+                                                      const ServerOptions &options);
+    ~QueryServer();
+
+    void Stop();
+
+    const std::string &Address() const
+    {
+        return address;
+    }
+
+    uint64_t QueryCount() const
+    {
+        return queryCount;
+    }
+
+private:
+    struct Connection {
+        uint64_t id;
+        int fd;
+        std::string inBuffer;
+        size_t inOffset = 0;
+        std::string outBuffer;
+        size_t outOffset = 0;
+        std::deque<std::string> pendingQueries;
+        bool running = false;
+        bool readClosed = false;
+
+        // epoll events we're currently waiting for
+        uint32_t events;
+    };
+
+    struct Completion {
+        uint64_t connectionId;
+        std::string response;
+    };
+
+    QueryServer(Catalog &catalog, const ServerOptions &options)
+        : catalog(catalog), options(options) {}
+
+    Result<bool> Listen(const SocketAddress &socketAddress);
+    void EventLoop();
+    void Accept();
+    void ReadFrom(Connection &conn);
+    void WriteTo(Connection &conn);
+    void StartNextQuery(Connection &conn);
+    void RunQuery(uint64_t connectionId, std::string query);
+    void ProcessCompletions();
+    void UpdateInterest(Connection &conn);
+    void Close(Connection &conn);
+
+    Catalog &catalog;
+    ServerOptions options;
+    std::string address;
+    std::string unixPath;
+
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::thread loopThread;
+    std::atomic<bool> stopping = false;
+    std::atomic<uint64_t> queryCount = 0;
+
+    // only accessed by the event loop thread. Keyed by a connection id
+    // rather than the fd, since fds of closed connections get reused.
+    std::map<uint64_t, std::unique_ptr<Connection>> connections;
+    uint64_t nextConnectionId;
+
+    // results of finished queries, waiting for the event loop
+    std::mutex completionMutex;
+    std::condition_variable sessionsDone;
+    std::vector<Completion> completions;
+    int runningSessions = 0;
+};
+
+};
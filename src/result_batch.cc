@@ -0,0 +1,59 @@
+#include "result_batch.h"
+
+namespace pgaccel
+{
+
+std::string
+ResultColumn::Format(size_t row) const
+{
+    if (IsString())
+        return std::string(strings[row]);
+    return ToString(type.get(), ints[row]);
+}
+
+int
+ResultBatch::AddColumn(const std::string &name, std::shared_ptr<AccelType> type)
+{
+    columns_.push_back({ name, std::move(type) });
+    return columns_.size() - 1;
+}
+
+Row
+ResultBatch::FieldNames() const
+{
+    Row result;
+    for (const auto &column: columns_)
+        result.push_back(column.name);
+    return result;
+}
+
+Row
+ResultBatch::FormatRow(size_t row) const
+{
+    Row result;
+    for (const auto &column: columns_)
+        result.push_back(column.Format(row));
+    return result;
+}
+
+Rows
+ResultBatch::FormatRows() const
+{
+    Rows result;
+    for (size_t row = 0; row < RowCount(); row++)
+        result.push_back(FormatRow(row));
+    return result;
+}
+
+ResultBatch
+ResultBatch::Scalar(const std::string &name,
+                    std::shared_ptr<AccelType> type,
+                    int64_t value)
+{
+    ResultBatch result;
+    result.AddColumn(name, std::move(type));
+    result.columns_[0].ints.push_back(value);
+    return result;
+}
+
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pgaccel
+{
+
+typedef std::vector<std::string> Row;
+typedef std::vector<Row> Rows;
+
+/*
+ * A typed result column. Int32, Int64, Decimal and Date values are stored
+ * as int64 in ints, strings as views in strings. Views usually point into
+ * dictionaries of the scanned column data, which the batch pins.
+ */
+struct ResultColumn {
+    std::string name;
+    std::shared_ptr<AccelType> type;
+    std::vector<int64_t> ints;
+    std::vector<std::string_view> strings;
+
+    bool IsString() const
+    {
+        return type->type_num() == STRING_TYPE;
+    }
+
+    size_t Size() const
+    {
+        return IsString() ? strings.size() : ints.size();
+    }
+
+    std::string Format(size_t row) const;
+};
+
+/*
+ * ResultBatch is the columnar result of a query. Values are kept in binary
+ * form, and are formatted only when printed or sent as text.
+ */
+class ResultBatch {
+public:
+    // Returns the index of the new column.
+    int AddColumn(const std::string &name, std::shared_ptr<AccelType> type);
+
+    ResultColumn &Column(int idx)
+    {
+        return columns_[idx];
+    }
+
+    const ResultColumn &Column(int idx) const
+    {
+        return columns_[idx];
+    }
+
+    int ColumnCount() const
+    {
+        return columns_.size();
+    }
+
+    size_t RowCount() const
+    {
+        return columns_.empty() ? 0 : columns_[0].Size();
+    }
+
+    // Keeps storage referenced by string views alive as long as the batch.
+    void Pin(std::shared_ptr<const void> storage)
+    {
+        pinned_.push_back(std::move(storage));
+    }
+
+    Row FieldNames() const;
+    Row FormatRow(size_t row) const;
+    Rows FormatRows() const;
+
+    static ResultBatch Scalar(const std::string &name,
+                              std::shared_ptr<AccelType> type,
+                              int64_t value);
+
+private:
+    std::vector<ResultColumn> columns_;
+    std::vector<std::shared_ptr<const void>> pinned_;
+};
+
+};
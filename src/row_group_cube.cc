@@ -0,0 +1,155 @@
+#include "row_group_cube.h"
+#include "columnar_table.h"
+
+#include <algorithm>
+
+namespace pgaccel
+{
+
+template<class storageType>
+static void SumByCode(const uint8_t *codes, const RawColumnDataBase &rawData,
+                      int64_t *sums);
+
+RowGroupCubeP
+RowGroupCube::Build(const RowGroup &rowGroup)
+{
+    auto result = std::make_shared<RowGroupCube>();
+
+    for (int dictColumn = 0; dictColumn < rowGroup.columns.size(); dictColumn++)
+    {
+        if (!result->AddCounts(rowGroup, dictColumn))
+            continue;
+
+        for (int rawColumn = 0; rawColumn < rowGroup.columns.size(); rawColumn++)
+            result->AddSums(rowGroup, dictColumn, rawColumn);
+    }
+
+    return result;
+}
+
+RowGroupCubeP
+RowGroupCube::Update(const RowGroupCube &base,
+                     const RowGroup &rowGroup,
+                     const std::vector<int> &columns)
+{
+    auto result = std::make_shared<RowGroupCube>(base);
+    auto changed = [&columns](int columnIdx)
+    {
+        return std::find(columns.begin(), columns.end(), columnIdx) != columns.end();
+    };
+
+    for (auto columnIdx: columns)
+        result->counts.erase(columnIdx);
+    for (auto it = result->sums.begin(); it != result->sums.end();)
+    {
+        if (changed(it->first.first) || changed(it->first.second))
+            it = result->sums.erase(it);
+        else
+            ++it;
+    }
+
+    for (int dictColumn = 0; dictColumn < rowGroup.columns.size(); dictColumn++)
+    {
+        if (changed(dictColumn))
+        {
+            if (!result->AddCounts(rowGroup, dictColumn))
+                continue;
+
+            for (int rawColumn = 0; rawColumn < rowGroup.columns.size(); rawColumn++)
+                result->AddSums(rowGroup, dictColumn, rawColumn);
+        }
+        else if (result->counts.count(dictColumn))
+        {
+            for (auto rawColumn: columns)
+                result->AddSums(rowGroup, dictColumn, rawColumn);
+        }
+    }
+
+    return result;
+}
+
+bool
+RowGroupCube::AddCounts(const RowGroup &rowGroup, int dictColumn)
+{
+    const auto &groupData = rowGroup.columns[dictColumn];
+    if (!groupData || groupData->type != ColumnDataBase::DICT_COLUMN_DATA)
+        return false;
+
+    auto dictData = static_cast<const DictColumnDataBase *>(groupData.get());
+    if (dictData->bytesPerValue() != 1)
+        return false;
+
+    const uint8_t *codes = dictData->values;
+    auto &columnCounts = counts[dictColumn];
+    columnCounts.resize(dictData->dictSize());
+    for (int i = 0; i < rowGroup.size; i++)
+        columnCounts[codes[i]]++;
+
+    return true;
+}
+
+void
+RowGroupCube::AddSums(const RowGroup &rowGroup, int dictColumn, int rawColumn)
+{
+    const auto &valueData = rowGroup.columns[rawColumn];
+    if (!valueData || valueData->type != ColumnDataBase::RAW_COLUMN_DATA)
+        return;
+
+    auto dictData = static_cast<const DictColumnDataBase *>(rowGroup.columns[dictColumn].get());
+    const uint8_t *codes = dictData->values;
+    auto rawData = static_cast<const RawColumnDataBase *>(valueData.get());
+    auto &columnSums = sums[{ dictColumn, rawColumn }];
+    columnSums.resize(dictData->dictSize());
+
+    switch (rawData->bytesPerValue)
+    {
+        case 1:
+            SumByCode<int8_t>(codes, *rawData, columnSums.data());
+            break;
+        case 2:
+            SumByCode<int16_t>(codes, *rawData, columnSums.data());
+            break;
+        case 4:
+            SumByCode<int32_t>(codes, *rawData, columnSums.data());
+            break;
+        case 8:
+            SumByCode<int64_t>(codes, *rawData, columnSums.data());
+            break;
+    }
+}
+
+const int64_t *
+RowGroupCube::Counts(int dictColumn) const
+{
+    auto it = counts.find(dictColumn);
+    return it == counts.end() ? nullptr : it->second.data();
+}
+
+const int64_t *
+RowGroupCube::Sums(int dictColumn, int rawColumn) const
+{
+    auto it = sums.find({ dictColumn, rawColumn });
+    return it == sums.end() ? nullptr : it->second.data();
+}
+
+size_t
+RowGroupCube::ByteSize() const
+{
+    size_t result = sizeof(*this);
+    for (const auto &entry: counts)
+        result += entry.second.size() * sizeof(int64_t);
+    for (const auto &entry: sums)
+        result += entry.second.size() * sizeof(int64_t);
+    return result;
+}
+
+template<class storageType>
+static void
+SumByCode(const uint8_t *codes, const RawColumnDataBase &rawData, int64_t *sums)
+{
+    auto values = reinterpret_cast<const storageType *>(rawData.values);
+    for (int i = 0; i < rawData.size; i++)
+        sums[codes[i]] += values[i];
+}
+
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace pgaccel
+{
+
+struct RowGroup;
+
+/*
+ * Pre-aggregates of a row group: the row count of each code of each
+ * dictionary column with 1-byte codes, and the sum of each raw column per
+ * such code. Grouped aggregates over row groups which a query selects
+ * entirely are answered from them in O(dictionary size) instead of
+ * scanning the row group.
+ *
+ * Columns are identified by their index in the table schema.
+ */
+class RowGroupCube {
+public:
+    static std::shared_ptr<const RowGroupCube> Build(const RowGroup &rowGroup);
+
+    /*
+     * Cube of rowGroup, whose columns differ from those of base's row group
+     * only in columns, e.g. columns of a lazily opened table which were
+     * loaded or evicted. Entries which don't involve them are kept.
+     */
+    static std::shared_ptr<const RowGroupCube> Update(const RowGroupCube &base,
+                                                      const RowGroup &rowGroup,
+                                                      const std::vector<int> &columns);
+
+    // per code, nullptr if the column isn't pre-aggregated
+    const int64_t *Counts(int dictColumn) const;
+    const int64_t *Sums(int dictColumn, int rawColumn) const;
+
+    size_t ByteSize() const;
+
+private:
+    // false if the column isn't a resident dictionary column with 1-byte codes
+    bool AddCounts(const RowGroup &rowGroup, int dictColumn);
+    void AddSums(const RowGroup &rowGroup, int dictColumn, int rawColumn);
+
+    std::map<int, std::vector<int64_t>> counts;
+    std::map<std::pair<int, int>, std::vector<int64_t>> sums;
+};
+
+typedef std::shared_ptr<const RowGroupCube> RowGroupCubeP;
+
+};
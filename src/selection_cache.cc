@@ -0,0 +1,342 @@
+#include "selection_cache.h"
+#include "columnar_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <tuple>
+
+namespace pgaccel
+{
+
+const size_t DefaultSelectionCacheCapacity = 64UL << 20;
+
+static void SetBits(uint8_t *bitmap, int start, int length);
+
+/*
+ * ==========================
+ * ==== CompressedBitmap ====
+ * ==========================
+ */
+
+CompressedBitmapP
+CompressedBitmap::Compress(const uint8_t *bitmap, int rowCount)
+{
+    auto result = std::make_shared<CompressedBitmap>();
+    result->rowCount = rowCount;
+
+    // bits past rowCount may be garbage written by SIMD kernels
+    int wordCount = (rowCount + 63) / 64;
+    std::vector<uint64_t> words(wordCount);
+    memcpy(words.data(), bitmap, (rowCount + 7) / 8);
+    if (rowCount % 64)
+        words.back() &= (1ULL << (rowCount % 64)) - 1;
+
+    int count = 0;
+    int runCount = 0;
+    uint64_t carry = 0;
+    for (auto word: words)
+    {
+        count += __builtin_popcountll(word);
+        runCount += __builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+    }
+    result->count = count;
+
+    size_t arrayBytes = count * sizeof(uint16_t);
+    size_t runBytes = runCount * 2 * sizeof(uint16_t);
+    size_t bitmapBytes = (rowCount + 7) / 8;
+
+    if (arrayBytes <= runBytes && arrayBytes <= bitmapBytes)
+    {
+        result->container = ARRAY_CONTAINER;
+        result->positions.reserve(count);
+        for (int w = 0; w < wordCount; w++)
+            for (uint64_t word = words[w]; word; word &= word - 1)
+                result->positions.push_back(w * 64 + __builtin_ctzll(word));
+    }
+    else if (runBytes <= bitmapBytes)
+    {
+        result->container = RUN_CONTAINER;
+        result->positions.reserve(runCount * 2);
+        int runStart = -1;
+        for (int i = 0; i <= rowCount; i++)
+        {
+            bool set = i < rowCount && (words[i / 64] >> (i % 64)) & 1;
+            if (set && runStart < 0)
+            {
+                runStart = i;
+            }
+            else if (!set && runStart >= 0)
+            {
+                result->positions.push_back(runStart);
+                result->positions.push_back(i - runStart - 1);
+                runStart = -1;
+            }
+        }
+    }
+    else
+    {
+        result->container = BITMAP_CONTAINER;
+        result->bitmap.resize(bitmapBytes);
+        memcpy(result->bitmap.data(), words.data(), bitmapBytes);
+    }
+
+    return result;
+}
+
+void
+CompressedBitmap::Decompress(uint8_t *bitmap) const
+{
+    memset(bitmap, 0, BitmapSize(rowCount));
+
+    switch (container)
+    {
+        case ARRAY_CONTAINER:
+            for (auto position: positions)
+                bitmap[position >> 3] |= 1 << (position & 7);
+            break;
+
+        case RUN_CONTAINER:
+            for (size_t i = 0; i < positions.size(); i += 2)
+                SetBits(bitmap, positions[i], positions[i + 1] + 1);
+            break;
+
+        case BITMAP_CONTAINER:
+            memcpy(bitmap, this->bitmap.data(), this->bitmap.size());
+            break;
+    }
+}
+
+size_t
+CompressedBitmap::ByteSize() const
+{
+    return sizeof(*this) +
+           positions.size() * sizeof(uint16_t) +
+           bitmap.size();
+}
+
+static void
+SetBits(uint8_t *bitmap, int start, int length)
+{
+    int end = start + length;
+
+    // partial leading byte, whole bytes, partial trailing byte
+    while (start < end && (start & 7))
+    {
+        bitmap[start >> 3] |= 1 << (start & 7);
+        start++;
+    }
+    if (end - start >= 8)
+    {
+        memset(bitmap + (start >> 3), 0xff, (end - start) >> 3);
+        start += (end - start) & ~7;
+    }
+    while (start < end)
+    {
+        bitmap[start >> 3] |= 1 << (start & 7);
+        start++;
+    }
+}
+
+/*
+ * ========================
+ * ==== SelectionCache ====
+ * ========================
+ */
+
+bool
+SelectionCacheKey::operator<(const SelectionCacheKey &other) const
+{
+    return std::tie(tableVersion, rowGroup, filter) <
+           std::tie(other.tableVersion, other.rowGroup, other.filter);
+}
+
+std::string
+CanonicalFilterKey(const std::vector<FilterClause> &filterClauses)
+{
+    std::vector<std::string> clauses;
+    for (const auto &filterClause: filterClauses)
+        clauses.push_back(filterClause.ToString());
+    std::sort(clauses.begin(), clauses.end());
+
+    std::string result;
+    for (const auto &clause: clauses)
+    {
+        if (!result.empty())
+            result += " AND ";
+        result += clause;
+    }
+    return result;
+}
+
+SelectionCache::SelectionCache(size_t capacity)
+    : capacity(capacity)
+{
+}
+
+SelectionCache &
+SelectionCache::Shared()
+{
+    static SelectionCache cache(DefaultSelectionCacheCapacity);
+    return cache;
+}
+
+bool
+SelectionCache::Enabled() const
+{
+    return capacity > 0;
+}
+
+CompressedBitmapP
+SelectionCache::Lookup(const SelectionCacheKey &key)
+{
+    auto &shard = ShardOf(key);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+        shard.misses++;
+        return nullptr;
+    }
+
+    shard.hits++;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return it->second->bitmap;
+}
+
+void
+SelectionCache::Insert(const SelectionCacheKey &key, CompressedBitmapP bitmap)
+{
+    auto &shard = ShardOf(key);
+    std::lock_guard lock(shard.mutex);
+
+    // another worker may have inserted it meanwhile
+    if (shard.index.count(key))
+        return;
+
+    Entry entry { key, std::move(bitmap) };
+    size_t entryBytes = EntryBytes(entry);
+    size_t shardCapacity = ShardCapacity();
+    if (entryBytes > shardCapacity)
+        return;
+
+    shard.EvictUntil(shardCapacity - entryBytes);
+
+    shard.entries.push_front(std::move(entry));
+    shard.index.emplace(key, shard.entries.begin());
+    shard.bytes += entryBytes;
+}
+
+void
+SelectionCache::Invalidate(uint64_t tableVersion)
+{
+    for (auto &shard: shards)
+    {
+        std::lock_guard lock(shard.mutex);
+
+        for (auto it = shard.entries.begin(); it != shard.entries.end();)
+        {
+            if (it->key.tableVersion == tableVersion)
+            {
+                shard.bytes -= EntryBytes(*it);
+                shard.index.erase(it->key);
+                it = shard.entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+void
+SelectionCache::Clear()
+{
+    for (auto &shard: shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.entries.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+    }
+}
+
+void
+SelectionCache::SetCapacity(size_t capacity)
+{
+    this->capacity = capacity;
+    for (auto &shard: shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.EvictUntil(ShardCapacity());
+    }
+}
+
+SelectionCacheStats
+SelectionCache::Stats() const
+{
+    SelectionCacheStats stats;
+    for (auto &shard: shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.entryCount += shard.entries.size();
+        stats.bytes += shard.bytes;
+    }
+    stats.capacity = capacity;
+    return stats;
+}
+
+void
+SelectionCache::ResetStats()
+{
+    for (auto &shard: shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.hits = 0;
+        shard.misses = 0;
+        shard.evictions = 0;
+    }
+}
+
+// spreads the row groups of a query, and the filters on a row group, over shards
+SelectionCache::Shard &
+SelectionCache::ShardOf(const SelectionCacheKey &key)
+{
+    size_t hash = std::hash<std::string>()(key.filter) ^
+                  (key.tableVersion * 0x9E3779B97F4A7C15ULL) ^
+                  key.rowGroup;
+    return shards[hash % ShardCount];
+}
+
+size_t
+SelectionCache::ShardCapacity() const
+{
+    return capacity / ShardCount;
+}
+
+// evicts least recently used entries until at most the given bytes are used
+void
+SelectionCache::Shard::EvictUntil(size_t maxBytes)
+{
+    while (bytes > maxBytes && !entries.empty())
+    {
+        bytes -= EntryBytes(entries.back());
+        index.erase(entries.back().key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+size_t
+SelectionCache::EntryBytes(const Entry &entry)
+{
+    return sizeof(Entry) + entry.key.filter.size() + entry.bitmap->ByteSize();
+}
+
+};
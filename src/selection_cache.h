@@ -0,0 +1,149 @@
+#pragma once
+
+#include "parser.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pgaccel
+{
+
+/*
+ * Selection bitmap of a row group, stored in the smallest of three
+ * roaring-style containers: sorted positions of the selected rows, runs of
+ * selected rows, or the plain bitmap.
+ */
+class CompressedBitmap {
+public:
+    static std::shared_ptr<const CompressedBitmap> Compress(const uint8_t *bitmap,
+                                                            int rowCount);
+
+    // writes BitmapSize(RowCount()) bytes
+    void Decompress(uint8_t *bitmap) const;
+
+    int RowCount() const {
+        return rowCount;
+    }
+
+    // number of selected rows
+    int Count() const {
+        return count;
+    }
+
+    size_t ByteSize() const;
+
+    enum Container {
+        ARRAY_CONTAINER,
+        RUN_CONTAINER,
+        BITMAP_CONTAINER
+    };
+
+    Container GetContainer() const {
+        return container;
+    }
+
+private:
+    Container container;
+    int rowCount;
+    int count;
+
+    // positions for ARRAY_CONTAINER, (start, length - 1) pairs for
+    // RUN_CONTAINER
+    std::vector<uint16_t> positions;
+    std::vector<uint8_t> bitmap;
+};
+
+typedef std::shared_ptr<const CompressedBitmap> CompressedBitmapP;
+
+struct SelectionCacheKey {
+    // version of the table's row group list, see ColumnarTable::Version()
+    uint64_t tableVersion;
+    int rowGroup;
+    // see CanonicalFilterKey()
+    std::string filter;
+
+    bool operator<(const SelectionCacheKey &other) const;
+};
+
+// same for filter clause lists which only differ in order
+std::string CanonicalFilterKey(const std::vector<FilterClause> &filterClauses);
+
+struct SelectionCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entryCount = 0;
+    size_t bytes = 0;
+    size_t capacity = 0;
+};
+
+/*
+ * SelectionCache is a bounded LRU cache of the selection bitmaps of row
+ * groups, so queries which repeat the filters of earlier queries don't
+ * evaluate them again. Entries are keyed by table version, so a change to
+ * the table makes its entries unreachable, and Invalidate() drops them.
+ *
+ * Entries are spread over shards by key, each with its own lock and LRU
+ * list, so workers filtering different row groups rarely wait for each
+ * other. Each shard holds an equal part of the capacity. A capacity of 0
+ * disables the cache.
+ */
+class SelectionCache {
+public:
+    explicit SelectionCache(size_t capacity);
+
+    static SelectionCache &Shared();
+
+    bool Enabled() const;
+
+    // returns nullptr on a miss
+    CompressedBitmapP Lookup(const SelectionCacheKey &key);
+    void Insert(const SelectionCacheKey &key, CompressedBitmapP bitmap);
+
+    // drops the entries of the given table version
+    void Invalidate(uint64_t tableVersion);
+
+    void Clear();
+    void SetCapacity(size_t capacity);
+    SelectionCacheStats Stats() const;
+    void ResetStats();
+
+private:
+    struct Entry {
+        SelectionCacheKey key;
+        CompressedBitmapP bitmap;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+
+        // most recently used first
+        std::list<Entry> entries;
+        std::map<SelectionCacheKey, std::list<Entry>::iterator> index;
+
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+
+        void EvictUntil(size_t bytes);
+    };
+
+    static const int ShardCount = 16;
+
+    Shard &ShardOf(const SelectionCacheKey &key);
+    size_t ShardCapacity() const;
+    static size_t EntryBytes(const Entry &entry);
+
+    std::array<Shard, ShardCount> shards;
+    std::atomic<size_t> capacity;
+};
+
+};
@@ -0,0 +1,191 @@
+#include "string_match.h"
+
+#include <immintrin.h>
+#include <cstring>
+#include <string_view>
+
+namespace pgaccel
+{
+
+LikePattern::LikePattern(const std::string &pattern, bool useAvx)
+    : pattern(pattern),
+      useAvx(useAvx)
+{
+    anchoredStart = pattern.empty() || pattern.front() != '%';
+    anchoredEnd = pattern.empty() || pattern.back() != '%';
+    hasSingleCharWildcard = pattern.find('_') != std::string::npos;
+
+    std::string current;
+    for (auto c: pattern)
+    {
+        if (c == '%')
+        {
+            if (current.length())
+                segments.push_back(current);
+            current = "";
+        }
+        else
+        {
+            current += c;
+        }
+    }
+
+    if (current.length())
+        segments.push_back(current);
+}
+
+bool
+LikePattern::Matches(const char *str, int len) const
+{
+    if (hasSingleCharWildcard)
+        return MatchesGeneric(str, len);
+    return MatchesSegments(str, len);
+}
+
+bool
+LikePattern::MatchesSegments(const char *str, int len) const
+{
+    if (segments.empty())
+        return !(anchoredStart && anchoredEnd) || len == 0;
+
+    int first = 0, last = segments.size();
+    int pos = 0, end = len;
+
+    if (anchoredStart)
+    {
+        const auto &prefix = segments[0];
+        if (len < prefix.length() ||
+            memcmp(str, prefix.data(), prefix.length()) != 0)
+            return false;
+
+        // pattern without any '%'
+        if (anchoredEnd && last == 1)
+            return len == prefix.length();
+
+        pos = prefix.length();
+        first++;
+    }
+
+    if (anchoredEnd && last > first)
+    {
+        const auto &suffix = segments[last - 1];
+        if (len - pos < suffix.length() ||
+            memcmp(str + len - suffix.length(), suffix.data(), suffix.length()) != 0)
+            return false;
+
+        end = len - suffix.length();
+        last--;
+    }
+
+    // middle segments can match anywhere, leftmost match leaves the most
+    // room for the segments after it.
+    for (int i = first; i < last; i++)
+    {
+        const auto &segment = segments[i];
+        int idx = FindSubstring(str + pos, end - pos,
+                                segment.data(), segment.length(),
+                                useAvx);
+        if (idx < 0)
+            return false;
+        pos += idx + segment.length();
+    }
+
+    return true;
+}
+
+bool
+LikePattern::MatchesGeneric(const char *str, int len) const
+{
+    int patternLen = pattern.length();
+    int s = 0, p = 0;
+    int starP = -1, starS = 0;
+
+    while (s < len)
+    {
+        if (p < patternLen && pattern[p] == '%')
+        {
+            starP = p++;
+            starS = s;
+        }
+        else if (p < patternLen && (pattern[p] == '_' || pattern[p] == str[s]))
+        {
+            s++;
+            p++;
+        }
+        else if (starP >= 0)
+        {
+            // backtrack: let the last '%' absorb one more character
+            p = starP + 1;
+            s = ++starS;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (p < patternLen && pattern[p] == '%')
+        p++;
+
+    return p == patternLen;
+}
+
+/*
+ * SIMD substring search: compare the first and the last byte of the needle
+ * against 64 candidate positions at once, and only verify the positions
+ * where both match. Masked loads never touch bytes past the haystack.
+ */
+static int
+FindSubstringAvx(const char *haystack, int haystackLen,
+                 const char *needle, int needleLen)
+{
+    __m512i first = _mm512_set1_epi8(needle[0]);
+    __m512i last = _mm512_set1_epi8(needle[needleLen - 1]);
+    int candidates = haystackLen - needleLen + 1;
+
+    for (int i = 0; i < candidates; i += 64)
+    {
+        int remaining = candidates - i;
+        __mmask64 loadMask =
+            remaining >= 64 ? ~0ULL : ((1ULL << remaining) - 1);
+
+        __m512i blockFirst = _mm512_maskz_loadu_epi8(loadMask, haystack + i);
+        __m512i blockLast =
+            _mm512_maskz_loadu_epi8(loadMask, haystack + i + needleLen - 1);
+
+        __mmask64 mask = _mm512_mask_cmpeq_epi8_mask(loadMask, blockFirst, first);
+        mask = _mm512_mask_cmpeq_epi8_mask(mask, blockLast, last);
+
+        while (mask)
+        {
+            int pos = i + __builtin_ctzll(mask);
+            if (needleLen <= 2 ||
+                memcmp(haystack + pos + 1, needle + 1, needleLen - 2) == 0)
+                return pos;
+            mask &= mask - 1;
+        }
+    }
+
+    return -1;
+}
+
+int
+FindSubstring(const char *haystack, int haystackLen,
+              const char *needle, int needleLen,
+              bool useAvx)
+{
+    if (needleLen == 0)
+        return 0;
+
+    if (needleLen > haystackLen)
+        return -1;
+
+    if (useAvx)
+        return FindSubstringAvx(haystack, haystackLen, needle, needleLen);
+
+    auto pos = std::string_view(haystack, haystackLen).find(
+                    std::string_view(needle, needleLen));
+    return pos == std::string_view::npos ? -1 : pos;
+}
+
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace pgaccel
+{
+
+/*
+ * LikePattern evaluates SQL LIKE patterns, where '%' matches any sequence
+ * of characters and '_' matches exactly one character.
+ *
+ * Patterns without '_' are split into literal segments at '%' and matched
+ * with substring searches, which covers the common exact, prefix ('abc%'),
+ * suffix ('%abc') and contains ('%abc%') forms. Patterns with '_' use a
+ * general wildcard matcher. ESCAPE clauses are not supported.
+ */
+class LikePattern {
+public:
+    LikePattern(const std::string &pattern, bool useAvx);
+
+    bool Matches(const char *str, int len) const;
+
+    bool Matches(const std::string &str) const
+    {
+        return Matches(str.data(), str.length());
+    }
+
+    const std::string &Pattern() const
+    {
+        return pattern;
+    }
+
+private:
+    bool MatchesSegments(const char *str, int len) const;
+    bool MatchesGeneric(const char *str, int len) const;
+
+    std::string pattern;
+    std::vector<std::string> segments;
+    bool anchoredStart;
+    bool anchoredEnd;
+    bool hasSingleCharWildcard;
+    bool useAvx;
+};
+
+/*
+ * Returns the position of the first occurrence of needle in haystack, or
+ * -1 if not found.
+ */
+int FindSubstring(const char *haystack, int haystackLen,
+                  const char *needle, int needleLen,
+                  bool useAvx);
+
+};
@@ -0,0 +1,703 @@
+#include "table_file.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace pgaccel
+{
+
+const char TableFileMagic[8] = { 'P', 'G', 'A', 'C', 'C', 'E', 'L', '1' };
+
+// magic and version
+const size_t TableFileHeaderSize = 8 + 4;
+
+// footer offset, length and crc, trailer crc, and magic
+const size_t TableFileTrailerSize = 8 + 8 + 4 + 4 + 8;
+
+// bytes read at a time when looking for an earlier trailer
+const size_t TableFileScanBlockSize = 1 << 20;
+
+// reads of chunks from files smaller than this are buffered
+const size_t TableFileReadBufferSize = 64 << 10;
+
+/*
+ * Reads values of a footer from a buffer. Reads past the end fail, and
+ * leave the reader failed.
+ */
+class FooterReader {
+public:
+    FooterReader(const std::string &buffer): buffer(buffer) {}
+
+    template<class T>
+    bool Get(T &value)
+    {
+        if (failed || buffer.size() - position < sizeof(T))
+            return !(failed = true);
+        memcpy(&value, buffer.data() + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    bool GetString(std::string &value)
+    {
+        uint32_t length;
+        if (!Get(length) || buffer.size() - position < length)
+            return !(failed = true);
+        value.assign(buffer.data() + position, length);
+        position += length;
+        return true;
+    }
+
+    bool Failed() const {
+        return failed;
+    }
+
+    bool AtEnd() const {
+        return position == buffer.size();
+    }
+
+private:
+    const std::string &buffer;
+    size_t position = 0;
+    bool failed = false;
+};
+
+template<class T>
+static void Put(std::string &buffer, T value);
+static void PutString(std::string &buffer, const std::string &value);
+static void ZoneMap(const ColumnDataBase &columnData, const AccelType *type,
+                    int64_t &minValue, int64_t &maxValue);
+static Result<ColumnDataP> ParseChunk(char *data,
+                                      const TableFileChunk &chunk,
+                                      AccelType *type);
+static Result<ColumnDataP> ReadChunk(int fd,
+                                     const TableFileChunk &chunk,
+                                     AccelType *type,
+                                     std::string &buffer);
+static bool ReadFully(int fd, char *buffer, size_t length, uint64_t offset);
+static Result<TableFileFooter> ReadFooterAt(std::istream &in, uint64_t trailerEnd);
+
+/*
+ * Chunks are parsed in place, without copying them into a string stream.
+ */
+class MemoryStreamBuf: public BoundedStreamBuf {
+public:
+    MemoryStreamBuf(char *data, size_t length)
+    {
+        setg(data, data, data + length);
+    }
+
+    uint64_t BytesLeft() const override {
+        return egptr() - gptr();
+    }
+};
+
+/*
+ * Reads a chunk of a file with pread(), and checksums the bytes as they're
+ * read. Small reads go through a buffer. Reads of at least a buffer's
+ * size, like the values of a column, go straight to the caller's memory,
+ * so column buffers are filled without a copy.
+ */
+class ChunkReadBuf: public BoundedStreamBuf {
+public:
+    ChunkReadBuf(int fd, const TableFileChunk &chunk, std::string &buffer):
+        fd(fd), offset(chunk.offset), length(chunk.length), buffer(buffer)
+    {
+        buffer.resize(TableFileReadBufferSize);
+        setg(buffer.data(), buffer.data(), buffer.data());
+    }
+
+    bool Failed() const {
+        return failed;
+    }
+
+    bool AtEnd() const {
+        return position == length && gptr() == egptr();
+    }
+
+    // of the bytes read so far
+    uint32_t Crc() const {
+        return crc;
+    }
+
+    uint64_t BytesLeft() const override {
+        return length - position + (egptr() - gptr());
+    }
+
+protected:
+    int_type underflow() override
+    {
+        size_t count = std::min<uint64_t>(buffer.size(), length - position);
+        if (count == 0 || !Read(buffer.data(), count))
+            return traits_type::eof();
+
+        setg(buffer.data(), buffer.data(), buffer.data() + count);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char *data, std::streamsize count) override
+    {
+        std::streamsize done = std::min<std::streamsize>(count, egptr() - gptr());
+        memcpy(data, gptr(), done);
+        gbump(done);
+
+        if (count - done >= (std::streamsize) buffer.size())
+        {
+            size_t direct = std::min<uint64_t>(count - done, length - position);
+            if (!Read(data + done, direct))
+                return done;
+            done += direct;
+        }
+
+        while (done < count && underflow() != traits_type::eof())
+        {
+            std::streamsize buffered = std::min<std::streamsize>(count - done,
+                                                                 egptr() - gptr());
+            memcpy(data + done, gptr(), buffered);
+            gbump(buffered);
+            done += buffered;
+        }
+
+        return done;
+    }
+
+private:
+    bool Read(char *data, size_t count)
+    {
+        if (!ReadFully(fd, data, count, offset + position))
+        {
+            failed = true;
+            return false;
+        }
+
+        crc = Crc32c((const uint8_t *) data, count, crc);
+        position += count;
+        return true;
+    }
+
+    int fd;
+    uint64_t offset;
+    uint64_t length;
+    std::string &buffer;
+    uint64_t position = 0;
+    uint32_t crc = 0;
+    bool failed = false;
+};
+
+uint32_t
+Crc32c(const uint8_t *data, size_t length, uint32_t crc)
+{
+    uint64_t result = ~crc;
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        result = _mm_crc32_u64(result, word);
+    }
+
+    uint32_t result32 = result;
+    for (; i < length; i++)
+        result32 = _mm_crc32_u8(result32, data[i]);
+
+    return ~result32;
+}
+
+bool
+IsTableFile(std::istream &in)
+{
+    auto position = in.tellg();
+
+    char magic[sizeof(TableFileMagic)];
+    bool result = in.read(magic, sizeof(magic)) &&
+                  memcmp(magic, TableFileMagic, sizeof(magic)) == 0;
+
+    in.clear();
+    in.seekg(position);
+    return result;
+}
+
+void
+WriteTableFileHeader(std::ostream &out)
+{
+    std::string header(TableFileMagic, sizeof(TableFileMagic));
+    Put<uint32_t>(header, TableFileVersion);
+    out.write(header.data(), header.size());
+}
+
+Result<TableFileChunk>
+WriteTableFileChunk(std::ostream &out,
+                    const ColumnDataBase &columnData,
+                    const AccelType *type)
+{
+    std::ostringstream chunkStream;
+    RAISE_IF_FAILS(columnData.Save(chunkStream));
+    std::string chunkData = chunkStream.str();
+
+    TableFileChunk chunk;
+    chunk.offset = out.tellp();
+    chunk.length = chunkData.size();
+    chunk.crc = Crc32c((const uint8_t *) chunkData.data(), chunkData.size());
+    chunk.encoding = columnData.type;
+    ZoneMap(columnData, type, chunk.minValue, chunk.maxValue);
+
+    out.write(chunkData.data(), chunkData.size());
+    if (!out)
+        return Status::Invalid("Failed to write table file chunk");
+
+    return chunk;
+}
+
+void
+WriteTableFileFooter(std::ostream &out, const TableFileFooter &footer)
+{
+    std::string footerData = footer.Serialize();
+
+    std::string trailer;
+    Put<uint64_t>(trailer, out.tellp());
+    Put<uint64_t>(trailer, footerData.size());
+    Put<uint32_t>(trailer,
+                  Crc32c((const uint8_t *) footerData.data(), footerData.size()));
+    Put<uint32_t>(trailer, Crc32c((const uint8_t *) trailer.data(), trailer.size()));
+    trailer.append(TableFileMagic, sizeof(TableFileMagic));
+
+    out.write(footerData.data(), footerData.size());
+    out.write(trailer.data(), trailer.size());
+}
+
+Result<TableFileFooter>
+ReadTableFileFooter(std::istream &in)
+{
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = in.tellg();
+    if (!in || fileSize < TableFileHeaderSize + TableFileTrailerSize)
+        return Status::Invalid("Table file is too short");
+
+    std::string header(TableFileHeaderSize, '\0');
+    in.seekg(0);
+    in.read(header.data(), header.size());
+
+    if (!in || memcmp(header.data(), TableFileMagic, sizeof(TableFileMagic)) != 0)
+        return Status::Invalid("Not a table file");
+
+    uint32_t version;
+    memcpy(&version, header.data() + sizeof(TableFileMagic), sizeof(version));
+    if (version != TableFileVersion)
+        return Status::Invalid("Unsupported table file version: ", version);
+
+    auto result = ReadFooterAt(in, fileSize);
+    if (result.ok())
+        return result;
+
+    /*
+     * An append which didn't finish leaves the previous trailer in place,
+     * followed by some of the new chunks. Look for the last valid trailer
+     * before the end, a block at a time. Blocks overlap so that magics
+     * across block boundaries are found.
+     */
+    const uint64_t scanStart =
+        TableFileHeaderSize + TableFileTrailerSize - sizeof(TableFileMagic);
+    uint64_t scanEnd = fileSize - 1;
+    std::string block;
+    while (scanEnd >= scanStart + sizeof(TableFileMagic))
+    {
+        uint64_t blockStart = scanEnd - scanStart > TableFileScanBlockSize ?
+                              scanEnd - TableFileScanBlockSize : scanStart;
+        block.resize(scanEnd - blockStart);
+        in.clear();
+        in.seekg(blockStart);
+        in.read(block.data(), block.size());
+        if (!in)
+            break;
+
+        for (size_t i = block.size() - sizeof(TableFileMagic) + 1; i-- > 0;)
+        {
+            if (memcmp(block.data() + i, TableFileMagic, sizeof(TableFileMagic)) != 0)
+                continue;
+
+            auto earlier = ReadFooterAt(in, blockStart + i + sizeof(TableFileMagic));
+            if (earlier.ok())
+                return earlier;
+        }
+
+        scanEnd = blockStart + sizeof(TableFileMagic) - 1;
+    }
+
+    return result;
+}
+
+Result<ColumnDataP>
+ReadTableFileChunk(std::istream &in,
+                   const TableFileChunk &chunk,
+                   AccelType *type)
+{
+    std::string chunkData(chunk.length, '\0');
+    in.seekg(chunk.offset);
+    in.read(chunkData.data(), chunkData.size());
+    if (!in)
+        return Status::Invalid("Failed to read table file chunk at ", chunk.offset);
+
+    return ParseChunk(chunkData.data(), chunk, type);
+}
+
+Result<std::vector<ColumnDataP>>
+ReadTableFileChunks(const std::string &path,
+                    const std::vector<TableFileChunkRead> &reads,
+                    int threadCount)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Status::Invalid("Could not open ", path);
+
+    std::vector<Result<ColumnDataP>> results(reads.size(), Status::Invalid(""));
+    std::atomic<size_t> nextRead{0};
+
+    // each thread takes the next read, so slow reads don't hold others back
+    auto readLoop = [&]()
+    {
+        std::string buffer;
+        for (size_t i = nextRead++; i < reads.size(); i = nextRead++)
+            results[i] = ReadChunk(fd, reads[i].chunk, reads[i].type, buffer);
+    };
+
+    int threadsToStart = std::min<size_t>(std::max(threadCount, 1), reads.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadsToStart; i++)
+        threads.emplace_back(readLoop);
+    readLoop();
+    for (auto &thread: threads)
+        thread.join();
+
+    close(fd);
+
+    std::vector<ColumnDataP> columnData;
+    columnData.reserve(reads.size());
+    for (auto &result: results)
+    {
+        if (!result.ok())
+            return result.status();
+        columnData.push_back(std::move(result).ValueUnsafe());
+    }
+
+    return columnData;
+}
+
+Result<std::shared_ptr<AccelType>>
+CreateAccelType(TypeNum typeNum, int scale)
+{
+    std::shared_ptr<AccelType> result;
+    switch (typeNum)
+    {
+        case TypeNum::INT32_TYPE:
+            result = std::make_shared<Int32Type>();
+            break;
+        case TypeNum::INT64_TYPE:
+            result = std::make_shared<Int64Type>();
+            break;
+        case TypeNum::STRING_TYPE:
+            result = std::make_shared<StringType>();
+            break;
+        case TypeNum::DATE_TYPE:
+            result = std::make_shared<DateType>();
+            break;
+        case TypeNum::DECIMAL_TYPE:
+        {
+            auto decimalType = std::make_shared<DecimalType>();
+            decimalType->scale = scale;
+            result = decimalType;
+            break;
+        }
+        default:
+            return Status::Invalid("Unknown type number: ", typeNum);
+    }
+
+    return result;
+}
+
+/*
+ * =========================
+ * ==== TableFileFooter ====
+ * =========================
+ */
+
+std::string
+TableFileFooter::Serialize() const
+{
+    std::string result;
+
+    Put<uint32_t>(result, columns.size());
+    for (const auto &column: columns)
+    {
+        PutString(result, column.name);
+        Put<uint8_t>(result, column.typeNum);
+        Put<int32_t>(result, column.scale);
+        Put<uint8_t>(result, column.layout);
+    }
+
+    Put<int32_t>(result, rowGroupSize);
+    Put<uint32_t>(result, rowGroupSizes.size());
+    for (int group = 0; group < rowGroupSizes.size(); group++)
+    {
+        Put<int32_t>(result, rowGroupSizes[group]);
+        for (const auto &chunk: chunks[group])
+        {
+            Put<uint64_t>(result, chunk.offset);
+            Put<uint64_t>(result, chunk.length);
+            Put<uint32_t>(result, chunk.crc);
+            Put<uint8_t>(result, chunk.encoding);
+            Put<int64_t>(result, chunk.minValue);
+            Put<int64_t>(result, chunk.maxValue);
+        }
+    }
+
+    Put<uint32_t>(result, sortKeys.size());
+    for (auto sortKey: sortKeys)
+        Put<int32_t>(result, sortKey);
+
+    return result;
+}
+
+Result<TableFileFooter>
+TableFileFooter::Parse(const std::string &buffer)
+{
+    TableFileFooter result;
+    FooterReader reader(buffer);
+
+    uint32_t columnCount = 0;
+    reader.Get(columnCount);
+    for (uint32_t i = 0; i < columnCount && !reader.Failed(); i++)
+    {
+        TableFileColumn column;
+        uint8_t typeNum = 0, layout = 0;
+        reader.GetString(column.name);
+        reader.Get(typeNum);
+        reader.Get(column.scale);
+        reader.Get(layout);
+        column.typeNum = (TypeNum) typeNum;
+        column.layout = (ColumnDataBase::Type) layout;
+        result.columns.push_back(std::move(column));
+    }
+
+    uint32_t groupCount = 0;
+    reader.Get(result.rowGroupSize);
+    reader.Get(groupCount);
+    for (uint32_t group = 0; group < groupCount && !reader.Failed(); group++)
+    {
+        int32_t groupSize = 0;
+        reader.Get(groupSize);
+        result.rowGroupSizes.push_back(groupSize);
+
+        std::vector<TableFileChunk> groupChunks(columnCount);
+        for (auto &chunk: groupChunks)
+        {
+            uint8_t encoding = 0;
+            reader.Get(chunk.offset);
+            reader.Get(chunk.length);
+            reader.Get(chunk.crc);
+            reader.Get(encoding);
+            reader.Get(chunk.minValue);
+            reader.Get(chunk.maxValue);
+            chunk.encoding = (ColumnDataBase::Type) encoding;
+        }
+        result.chunks.push_back(std::move(groupChunks));
+    }
+
+    if (!reader.Failed() && !reader.AtEnd())
+    {
+        uint32_t sortKeyCount = 0;
+        reader.Get(sortKeyCount);
+        for (uint32_t i = 0; i < sortKeyCount && !reader.Failed(); i++)
+        {
+            int32_t sortKey = -1;
+            if (!reader.Get(sortKey))
+                break;
+            if (sortKey < 0 || sortKey >= columnCount)
+                return Status::Invalid("Invalid sort key in table file footer: ", sortKey);
+            result.sortKeys.push_back(sortKey);
+        }
+    }
+
+    if (reader.Failed())
+        return Status::Invalid("Truncated table file footer");
+
+    return result;
+}
+
+template<class T>
+static void
+Put(std::string &buffer, T value)
+{
+    buffer.append((const char *) &value, sizeof(value));
+}
+
+static void
+PutString(std::string &buffer, const std::string &value)
+{
+    Put<uint32_t>(buffer, value.size());
+    buffer.append(value);
+}
+
+static Result<ColumnDataP>
+ParseChunk(char *data, const TableFileChunk &chunk, AccelType *type)
+{
+    if (Crc32c((const uint8_t *) data, chunk.length) != chunk.crc)
+        return Status::Invalid("Checksum mismatch in table file chunk at ",
+                               chunk.offset);
+
+    MemoryStreamBuf chunkBuf(data, chunk.length);
+    std::istream chunkStream(&chunkBuf);
+
+    ColumnDataP columnData;
+    ASSIGN_OR_RAISE(columnData, ColumnDataBase::Load(chunkStream, type));
+    if (!chunkStream || columnData->type != chunk.encoding)
+        return Status::Invalid("Malformed table file chunk at ", chunk.offset);
+
+    return columnData;
+}
+
+/*
+ * Reads the footer which the trailer ending at trailerEnd points to. The
+ * footer is right before the trailer, so a trailer with garbage offsets
+ * fails here rather than at allocating the footer.
+ */
+static Result<TableFileFooter>
+ReadFooterAt(std::istream &in, uint64_t trailerEnd)
+{
+    uint64_t trailerStart = trailerEnd - TableFileTrailerSize;
+
+    std::string trailer(TableFileTrailerSize, '\0');
+    in.clear();
+    in.seekg(trailerStart);
+    in.read(trailer.data(), trailer.size());
+    if (!in || memcmp(trailer.data() + trailer.size() - sizeof(TableFileMagic),
+                      TableFileMagic, sizeof(TableFileMagic)) != 0)
+        return Status::Invalid("Table file trailer is missing, the file may be truncated");
+
+    uint64_t footerOffset, footerLength;
+    uint32_t footerCrc, trailerCrc;
+    FooterReader trailerReader(trailer);
+    trailerReader.Get(footerOffset);
+    trailerReader.Get(footerLength);
+    trailerReader.Get(footerCrc);
+    trailerReader.Get(trailerCrc);
+
+    size_t checkedSize = TableFileTrailerSize - sizeof(trailerCrc) - sizeof(TableFileMagic);
+    if (Crc32c((const uint8_t *) trailer.data(), checkedSize) != trailerCrc)
+        return Status::Invalid("Table file trailer checksum mismatch");
+
+    if (footerOffset < TableFileHeaderSize || footerOffset > trailerStart ||
+        footerLength != trailerStart - footerOffset)
+        return Status::Invalid("Invalid table file footer position");
+
+    std::string footerData(footerLength, '\0');
+    in.seekg(footerOffset);
+    in.read(footerData.data(), footerData.size());
+    if (!in)
+        return Status::Invalid("Failed to read table file footer");
+
+    if (Crc32c((const uint8_t *) footerData.data(), footerData.size()) != footerCrc)
+        return Status::Invalid("Table file footer checksum mismatch");
+
+    return TableFileFooter::Parse(footerData);
+}
+
+/*
+ * Parses a chunk while reading it from fd, see ChunkReadBuf. The checksum
+ * is only known after the whole chunk is read, so column data is checked
+ * against it after parsing. Parsing validates sizes before allocating, so
+ * corrupt chunks don't cause huge allocations.
+ */
+static Result<ColumnDataP>
+ReadChunk(int fd, const TableFileChunk &chunk, AccelType *type, std::string &buffer)
+{
+    ChunkReadBuf chunkBuf(fd, chunk, buffer);
+    std::istream chunkStream(&chunkBuf);
+
+    auto columnData = ColumnDataBase::Load(chunkStream, type);
+    bool malformed = !columnData.ok() || !chunkStream || !chunkBuf.AtEnd() ||
+                     (*columnData)->type != chunk.encoding;
+    if (malformed)
+    {
+        // checksum the rest, so corrupt chunks are told apart
+        chunkStream.clear();
+        chunkStream.ignore(std::numeric_limits<std::streamsize>::max());
+    }
+
+    if (chunkBuf.Failed())
+        return Status::Invalid("Failed to read table file chunk at ", chunk.offset);
+    if (chunkBuf.Crc() != chunk.crc)
+        return Status::Invalid("Checksum mismatch in table file chunk at ",
+                               chunk.offset);
+    if (!columnData.ok())
+        return columnData.status();
+    if (malformed)
+        return Status::Invalid("Malformed table file chunk at ", chunk.offset);
+
+    return columnData;
+}
+
+// pread() may return less than asked for, e.g. when interrupted
+static bool
+ReadFully(int fd, char *buffer, size_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t bytesRead = pread(fd, buffer, length, offset);
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+        if (bytesRead <= 0)
+            return false;
+
+        buffer += bytesRead;
+        length -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
+}
+
+template<class AccelTy>
+static void
+RawZoneMap(const ColumnDataBase &columnData, int64_t &minValue, int64_t &maxValue)
+{
+    auto &rawData = static_cast<const RawColumnData<AccelTy> &>(columnData);
+    minValue = rawData.minValue;
+    maxValue = rawData.maxValue;
+}
+
+static void
+ZoneMap(const ColumnDataBase &columnData, const AccelType *type,
+        int64_t &minValue, int64_t &maxValue)
+{
+    minValue = 0;
+    maxValue = 0;
+
+    if (columnData.type != ColumnDataBase::RAW_COLUMN_DATA)
+        return;
+
+    switch (type->type_num())
+    {
+        case TypeNum::INT32_TYPE:
+            RawZoneMap<Int32Type>(columnData, minValue, maxValue);
+            break;
+        case TypeNum::INT64_TYPE:
+            RawZoneMap<Int64Type>(columnData, minValue, maxValue);
+            break;
+        case TypeNum::DECIMAL_TYPE:
+            RawZoneMap<DecimalType>(columnData, minValue, maxValue);
+            break;
+        case TypeNum::DATE_TYPE:
+            RawZoneMap<DateType>(columnData, minValue, maxValue);
+            break;
+    }
+}
+
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "column_data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace pgaccel
+{
+
+/*
+ * Single-file container for saved tables. The file is
+ *
+ *   header:  magic, format version
+ *   chunks:  the serialized column data of each row group, column by column
+ *   footer:  schema, row group sizes, for each chunk its offset,
+ *            length, CRC32C, encoding and zone map, and sort keys
+ *   trailer: footer offset, length and CRC32C, CRC32C of the trailer, magic
+ *
+ * All integers are little endian. The footer lets loaders read only the
+ * chunks they need, and checksums detect corruption when a chunk is
+ * read. Appends write new chunks and a new footer after the old one, so
+ * the previous footer stays valid until the new trailer is written: if
+ * the trailer at the end of the file isn't valid, loaders fall back to
+ * the last valid trailer before it.
+ *
+ * Version 2 saves string dictionaries as entry offsets and bytes, see
+ * StringDict, and version 3 adds the trailer's checksum. Files of other
+ * versions are rejected. Footers which end after the chunks are of tables
+ * without sort keys.
+ */
+const uint32_t TableFileVersion = 3;
+
+struct TableFileColumn {
+    std::string name;
+    TypeNum typeNum;
+    // digits after the decimal point, for DECIMAL_TYPE
+    int32_t scale;
+    ColumnDataBase::Type layout;
+};
+
+struct TableFileChunk {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t crc;
+    ColumnDataBase::Type encoding;
+    // min and max of raw columns, 0 for dictionary columns
+    int64_t minValue;
+    int64_t maxValue;
+};
+
+struct TableFileFooter {
+    std::vector<TableFileColumn> columns;
+    int32_t rowGroupSize;
+    std::vector<int32_t> rowGroupSizes;
+    // indexed by row group, then column
+    std::vector<std::vector<TableFileChunk>> chunks;
+    // column indexes the rows are ordered by, see ColumnarTable::SortBy()
+    std::vector<int32_t> sortKeys;
+
+    std::string Serialize() const;
+    static Result<TableFileFooter> Parse(const std::string &buffer);
+};
+
+// CRC32C (Castagnoli), computed with the SSE4.2 crc32 instruction
+uint32_t Crc32c(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+// true if the stream starts with the container's magic, doesn't move it
+bool IsTableFile(std::istream &in);
+
+void WriteTableFileHeader(std::ostream &out);
+
+/*
+ * Serializes columnData at the current end of out and describes it as a
+ * chunk, with the zone map of raw columns.
+ */
+Result<TableFileChunk> WriteTableFileChunk(std::ostream &out,
+                                           const ColumnDataBase &columnData,
+                                           const AccelType *type);
+
+// writes the footer and the trailer which points to it
+void WriteTableFileFooter(std::ostream &out, const TableFileFooter &footer);
+
+/*
+ * Validates the header and trailer, and reads the footer. Falls back to
+ * the footer of an earlier trailer if appending to the file didn't finish.
+ */
+Result<TableFileFooter> ReadTableFileFooter(std::istream &in);
+
+// reads and verifies a chunk, and parses its column data
+Result<ColumnDataP> ReadTableFileChunk(std::istream &in,
+                                       const TableFileChunk &chunk,
+                                       AccelType *type);
+
+struct TableFileChunkRead {
+    TableFileChunk chunk;
+    AccelType *type;
+};
+
+// reads in flight when loading from a file
+const int DefaultTableFileReadThreads = 16;
+
+/*
+ * Reads, verifies and parses chunks of the file at path with concurrent
+ * pread() calls from threadCount threads, so fast storage sees many
+ * outstanding requests. Column values are read straight into their column
+ * buffers. Results are in the order of reads.
+ */
+Result<std::vector<ColumnDataP>> ReadTableFileChunks(
+    const std::string &path,
+    const std::vector<TableFileChunkRead> &reads,
+    int threadCount = DefaultTableFileReadThreads);
+
+Result<std::shared_ptr<AccelType>> CreateAccelType(TypeNum typeNum, int scale);
+
+};
@@ -44,4 +44,10 @@ uint64_t MeasureDurationMs(const std::function<void()> &body)
     return duration.count() / 1000;
 }
 
+bool CpuSupportsAvx512Vbmi()
+{
+    static bool supported = __builtin_cpu_supports("avx512vbmi");
+    return supported;
+}
+
 };
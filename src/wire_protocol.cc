@@ -0,0 +1,405 @@
+#include "wire_protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pgaccel
+{
+
+static void PutU8(std::string &out, uint8_t v);
+static void PutU16(std::string &out, uint16_t v);
+static void PutU32(std::string &out, uint32_t v);
+static void PutU64(std::string &out, uint64_t v);
+static uint64_t GetUInt(const std::string &buffer, size_t &offset, int bytes);
+static void BeginMessage(std::string &out, WireMessageType type, size_t &start);
+static void EndMessage(std::string &out, size_t start);
+static Result<ResultBatch> DecodeResult(std::vector<WireMessage> &messages);
+static Result<std::shared_ptr<AccelType>> CreateType(int typeNum, int scale);
+
+void
+EncodeQuery(std::string &out, const std::string &query)
+{
+    size_t start;
+    BeginMessage(out, WIRE_QUERY, start);
+    out += query;
+    EndMessage(out, start);
+}
+
+void
+EncodeError(std::string &out, const std::string &message)
+{
+    size_t start;
+    BeginMessage(out, WIRE_ERROR, start);
+    out += message;
+    EndMessage(out, start);
+}
+
+void
+EncodeResultBatch(std::string &out, const ResultBatch &batch, int batchRows)
+{
+    size_t start;
+    int columnCount = batch.ColumnCount();
+
+    BeginMessage(out, WIRE_SCHEMA, start);
+    PutU16(out, columnCount);
+    for (int col = 0; col < columnCount; col++)
+    {
+        const auto &column = batch.Column(col);
+        int typeNum = column.type->type_num();
+        PutU8(out, typeNum);
+        PutU8(out, typeNum == DECIMAL_TYPE ? column.type->asDecimalType()->scale : 0);
+        PutU16(out, column.name.length());
+        out += column.name;
+    }
+    EndMessage(out, start);
+
+    size_t rowCount = batch.RowCount();
+    for (size_t first = 0; first < rowCount; first += batchRows)
+    {
+        size_t last = std::min(rowCount, first + batchRows);
+
+        BeginMessage(out, WIRE_BATCH, start);
+        PutU32(out, last - first);
+        for (int col = 0; col < columnCount; col++)
+        {
+            const auto &column = batch.Column(col);
+            for (size_t row = first; row < last; row++)
+            {
+                if (column.IsString())
+                {
+                    PutU32(out, column.strings[row].length());
+                    out += column.strings[row];
+                }
+                else
+                {
+                    PutU64(out, column.ints[row]);
+                }
+            }
+        }
+        EndMessage(out, start);
+    }
+
+    BeginMessage(out, WIRE_COMPLETE, start);
+    PutU64(out, rowCount);
+    EndMessage(out, start);
+}
+
+Result<bool>
+DecodeMessage(const std::string &buffer,
+              size_t &offset,
+              WireMessage &message,
+              size_t maxLength)
+{
+    if (buffer.size() - offset < WIRE_HEADER_SIZE)
+        return false;
+
+    size_t pos = offset;
+    size_t length = GetUInt(buffer, pos, 4);
+    if (length > maxLength)
+        return Status::Invalid("Message of ", length, " bytes exceeds the limit of ",
+                               maxLength, " bytes");
+
+    if (buffer.size() - offset < WIRE_HEADER_SIZE + length)
+        return false;
+
+    message.type = (WireMessageType) GetUInt(buffer, pos, 1);
+    message.payload = buffer.substr(pos, length);
+    offset = pos + length;
+
+    return true;
+}
+
+Result<SocketAddress>
+ParseSocketAddress(const std::string &address)
+{
+    SocketAddress result;
+    if (address.rfind("unix:", 0) == 0)
+    {
+        result.isUnix = true;
+        result.path = address.substr(5);
+        if (result.path.empty() ||
+            result.path.length() >= sizeof(((sockaddr_un *) nullptr)->sun_path))
+            return Status::Invalid("Invalid unix socket path: ", result.path);
+        return result;
+    }
+
+    if (address.rfind("tcp:", 0) == 0)
+    {
+        std::string hostPort = address.substr(4);
+        auto colon = hostPort.rfind(':');
+
+        result.isUnix = false;
+        result.host = colon == std::string::npos ? "127.0.0.1" : hostPort.substr(0, colon);
+        std::string port = colon == std::string::npos ? hostPort : hostPort.substr(colon + 1);
+
+        char *end;
+        result.port = strtol(port.c_str(), &end, 10);
+        if (port.empty() || *end != 0 || result.port <= 0 || result.port > 65535)
+            return Status::Invalid("Invalid port: ", port);
+        return result;
+    }
+
+    return Status::Invalid("Expected unix:<path> or tcp:[<host>:]<port>, got ", address);
+}
+
+/*
+ * =====================
+ * ==== QueryClient ====
+ * =====================
+ */
+
+Result<std::unique_ptr<QueryClient>>
+QueryClient::Connect(const std::string &addressStr)
+{
+    SocketAddress address;
+    ASSIGN_OR_RAISE(address, ParseSocketAddress(addressStr));
+
+    int fd = -1;
+    if (address.isUnix)
+    {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address.path.c_str());
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        addrinfo hints {}, *addrs;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        std::string port = std::to_string(address.port);
+        if (getaddrinfo(address.host.c_str(), port.c_str(), &hints, &addrs) != 0)
+            return Status::Invalid("Could not resolve ", address.host);
+
+        for (auto addr = addrs; addr && fd < 0; addr = addr->ai_next)
+        {
+            fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        freeaddrinfo(addrs);
+    }
+
+    if (fd < 0)
+        return Status::Invalid("Could not connect to ", addressStr, ": ", strerror(errno));
+
+    return std::unique_ptr<QueryClient>(new QueryClient(fd));
+}
+
+QueryClient::~QueryClient()
+{
+    close(fd);
+}
+
+Result<bool>
+QueryClient::Send(const std::string &query)
+{
+    std::string out;
+    EncodeQuery(out, query);
+
+    size_t written = 0;
+    while (written < out.size())
+    {
+        ssize_t n = write(fd, out.data() + written, out.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return Status::Invalid("Could not send query: ", strerror(errno));
+        written += n;
+    }
+
+    return true;
+}
+
+Result<ResultBatch>
+QueryClient::Receive()
+{
+    std::vector<WireMessage> messages;
+    while (true)
+    {
+        WireMessage message;
+        ASSIGN_OR_RAISE(message, ReceiveMessage());
+
+        bool done = message.type == WIRE_COMPLETE || message.type == WIRE_ERROR;
+        messages.push_back(std::move(message));
+        if (done)
+            break;
+    }
+
+    return DecodeResult(messages);
+}
+
+Result<WireMessage>
+QueryClient::ReceiveMessage()
+{
+    WireMessage message;
+    while (true)
+    {
+        bool decoded;
+        ASSIGN_OR_RAISE(decoded, DecodeMessage(inBuffer, inOffset, message));
+        if (decoded)
+            break;
+
+        char buffer[1 << 16];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return Status::Invalid("Connection closed by server");
+
+        inBuffer.erase(0, inOffset);
+        inOffset = 0;
+        inBuffer.append(buffer, n);
+    }
+
+    return message;
+}
+
+static Result<ResultBatch>
+DecodeResult(std::vector<WireMessage> &messages)
+{
+    if (messages.back().type == WIRE_ERROR)
+        return Status::Invalid(messages.back().payload);
+
+    if (messages[0].type != WIRE_SCHEMA)
+        return Status::Invalid("Expected a schema message");
+
+    ResultBatch batch;
+
+    const auto &schema = messages[0].payload;
+    size_t pos = 0;
+    int columnCount = GetUInt(schema, pos, 2);
+    for (int col = 0; col < columnCount; col++)
+    {
+        int typeNum = GetUInt(schema, pos, 1);
+        int scale = GetUInt(schema, pos, 1);
+        int nameLength = GetUInt(schema, pos, 2);
+
+        std::shared_ptr<AccelType> type;
+        ASSIGN_OR_RAISE(type, CreateType(typeNum, scale));
+        batch.AddColumn(schema.substr(pos, nameLength), type);
+        pos += nameLength;
+    }
+
+    for (size_t i = 1; i + 1 < messages.size(); i++)
+    {
+        // string values are views into the payload
+        auto payload = std::make_shared<const std::string>(std::move(messages[i].payload));
+        batch.Pin(payload);
+        pos = 0;
+
+        int rowCount = GetUInt(*payload, pos, 4);
+        for (int col = 0; col < columnCount; col++)
+        {
+            auto &column = batch.Column(col);
+            for (int row = 0; row < rowCount; row++)
+            {
+                if (column.IsString())
+                {
+                    int length = GetUInt(*payload, pos, 4);
+                    column.strings.push_back(std::string_view(payload->data() + pos, length));
+                    pos += length;
+                }
+                else
+                {
+                    column.ints.push_back(GetUInt(*payload, pos, 8));
+                }
+            }
+        }
+    }
+
+    return batch;
+}
+
+static Result<std::shared_ptr<AccelType>>
+CreateType(int typeNum, int scale)
+{
+    switch (typeNum)
+    {
+        case TypeNum::INT32_TYPE:
+            return std::shared_ptr<AccelType>(std::make_shared<Int32Type>());
+        case TypeNum::INT64_TYPE:
+            return std::shared_ptr<AccelType>(std::make_shared<Int64Type>());
+        case TypeNum::STRING_TYPE:
+            return std::shared_ptr<AccelType>(std::make_shared<StringType>());
+        case TypeNum::DATE_TYPE:
+            return std::shared_ptr<AccelType>(std::make_shared<DateType>());
+        case TypeNum::DECIMAL_TYPE:
+        {
+            auto decimalType = std::make_shared<DecimalType>();
+            decimalType->scale = scale;
+            return std::shared_ptr<AccelType>(decimalType);
+        }
+        default:
+            return Status::Invalid("Unknown type number: ", typeNum);
+    }
+}
+
+static void
+BeginMessage(std::string &out, WireMessageType type, size_t &start)
+{
+    start = out.size();
+    PutU32(out, 0);
+    PutU8(out, type);
+}
+
+static void
+EndMessage(std::string &out, size_t start)
+{
+    uint32_t length = out.size() - start - WIRE_HEADER_SIZE;
+    for (int i = 0; i < 4; i++)
+        out[start + i] = (length >> (8 * i)) & 0xff;
+}
+
+static void
+PutU8(std::string &out, uint8_t v)
+{
+    out.push_back(v);
+}
+
+static void
+PutU16(std::string &out, uint16_t v)
+{
+    for (int i = 0; i < 2; i++)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void
+PutU32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static void
+PutU64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        out.push_back((v >> (8 * i)) & 0xff);
+}
+
+static uint64_t
+GetUInt(const std::string &buffer, size_t &offset, int bytes)
+{
+    uint64_t result = 0;
+    for (int i = 0; i < bytes; i++)
+        result |= (uint64_t) (uint8_t) buffer[offset + i] << (8 * i);
+    offset += bytes;
+    return result;
+}
+
+};
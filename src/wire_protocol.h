@@ -0,0 +1,106 @@
+#pragma once
+
+#include "result_batch.h"
+#include "result_type.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace pgaccel
+{
+
+/*
+ * Wire protocol of the query server.
+ *
+ * Every message is a little-endian uint32 payload length, a one byte
+ * message type and the payload. Clients send QUERY messages and may send
+ * more before reading the results of earlier ones. The server answers each
+ * query in order, either with an ERROR message, or with a SCHEMA message,
+ * zero or more BATCH messages and a COMPLETE message.
+ *
+ *   QUERY:    query text
+ *   SCHEMA:   u16 column count, then per column: u8 type number, u8 decimal
+ *             scale, u16 name length, name
+ *   BATCH:    u32 row count, then column by column the values. Strings are
+ *             a u32 length followed by the bytes, values of other types are
+ *             8 byte two's complement integers, in the same representation
+ *             as in column data.
+ *   COMPLETE: u64 total row count
+ *   ERROR:    error message
+ */
+enum WireMessageType : uint8_t {
+    WIRE_QUERY = 'Q',
+    WIRE_SCHEMA = 'S',
+    WIRE_BATCH = 'B',
+    WIRE_COMPLETE = 'C',
+    WIRE_ERROR = 'E'
+};
+
+struct WireMessage {
+    WireMessageType type;
+    std::string payload;
+};
+
+const int WIRE_HEADER_SIZE = 5;
+const int WIRE_BATCH_ROWS = 4096;
+
+// longest query the server accepts, longer ones close the connection
+const size_t WIRE_MAX_QUERY_LENGTH = 16 << 20;
+
+void EncodeQuery(std::string &out, const std::string &query);
+void EncodeError(std::string &out, const std::string &message);
+void EncodeResultBatch(std::string &out,
+                       const ResultBatch &batch,
+                       int batchRows = WIRE_BATCH_ROWS);
+
+/*
+ * Decodes the message starting at buffer[offset] and advances offset past
+ * it. Returns false if the buffer doesn't hold the whole message yet, and
+ * an error if the payload is longer than maxLength.
+ */
+Result<bool> DecodeMessage(const std::string &buffer,
+                           size_t &offset,
+                           WireMessage &message,
+                           size_t maxLength = UINT32_MAX);
+
+/*
+ * Socket address, either "unix:<path>", "tcp:<port>" (loopback only) or
+ * "tcp:<host>:<port>".
+ */
+struct SocketAddress {
+    bool isUnix;
+    std::string path;
+    std::string host;
+    int port;
+};
+
+Result<SocketAddress> ParseSocketAddress(const std::string &address);
+
+/*
+ * QueryClient is a blocking client of the query server.
+ */
+class QueryClient {
+public:
+    static Result<std::unique_ptr<QueryClient>> Connect(const std::string &address);
+    ~QueryClient();
+
+    // Sends a query without waiting for its result, so queries can be
+    // pipelined by calling Send several times before Receive.
+    Result<bool> Send(const std::string &query);
+
+    // Receives the result of the oldest query whose result hasn't been
+    // received yet. String values point into the received messages.
+    Result<ResultBatch> Receive();
+
+private:
+    QueryClient(int fd): fd(fd) {}
+
+    Result<WireMessage> ReceiveMessage();
+
+    int fd;
+    std::string inBuffer;
+    size_t inOffset = 0;
+};
+
+};
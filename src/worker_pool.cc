@@ -0,0 +1,194 @@
+#include "worker_pool.h"
+#include "numa_placement.h"
+
+#include <algorithm>
+
+namespace pgaccel
+{
+
+static thread_local int currentWorker = -1;
+
+WorkerPool::WorkerPool(int threadCount)
+{
+    for (int i = 0; i < threadCount; i++)
+        threads_.emplace_back([this, i]() { WorkerMain(i); });
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+
+    workAvailable_.notify_all();
+    for (auto &thread: threads_)
+        thread.join();
+
+    // submitted jobs which never ran
+    for (auto job: jobs_)
+        if (job->detached)
+            delete job;
+}
+
+WorkerPool &
+WorkerPool::Shared()
+{
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+void
+WorkerPool::ParallelFor(int taskCount, const std::function<void(int)> &task)
+{
+    ParallelFor(taskCount, task, {});
+}
+
+void
+WorkerPool::ParallelFor(int taskCount, const std::function<void(int)> &task,
+                        const std::vector<int> &taskNodes)
+{
+    if (taskCount == 0)
+        return;
+
+    Job job;
+    job.task = &task;
+    job.taskCount = taskCount;
+
+    int nodeCount = NumaNodeCount();
+    if (nodeCount > 1 && taskNodes.size() == (size_t) taskCount)
+    {
+        // filled backwards, so each node's tasks are taken in order
+        job.nodeTasks.resize(nodeCount);
+        for (int i = taskCount - 1; i >= 0; i--)
+            job.nodeTasks[std::max(taskNodes[i], 0) % nodeCount].push_back(i);
+    }
+
+    int node = CurrentNumaNode();
+
+    std::unique_lock lock(mutex_);
+    jobs_.push_back(&job);
+    activeJobs_++;
+    workAvailable_.notify_all();
+
+    while (job.handedOut < job.taskCount)
+    {
+        int taskIdx = NextTask(&job, node);
+        if (job.handedOut == job.taskCount)
+            jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+
+        RunTask(&job, taskIdx, lock);
+    }
+
+    // tasks handed out to workers might still be running
+    jobFinished_.wait(lock, [&]() { return job.doneCount == job.taskCount; });
+    activeJobs_--;
+}
+
+void
+WorkerPool::Submit(std::function<void()> task)
+{
+    auto job = new Job;
+    job->ownedTask = [task = std::move(task)](int) { task(); };
+    job->task = &job->ownedTask;
+    job->taskCount = 1;
+    job->detached = true;
+
+    std::lock_guard lock(mutex_);
+    jobs_.push_back(job);
+    activeJobs_++;
+    workAvailable_.notify_one();
+}
+
+int
+WorkerPool::ActiveJobCount() const
+{
+    std::lock_guard lock(mutex_);
+    return activeJobs_;
+}
+
+int
+WorkerPool::CurrentWorker()
+{
+    return currentWorker;
+}
+
+void
+WorkerPool::WorkerMain(int workerIdx)
+{
+    currentWorker = workerIdx;
+    BindThreadToNumaNode(NumaNodeOfCpuIndex(workerIdx));
+    int node = CurrentNumaNode();
+
+    std::unique_lock lock(mutex_);
+    while (true)
+    {
+        workAvailable_.wait(lock, [&]() { return stopping_ || !jobs_.empty(); });
+        if (stopping_)
+            return;
+
+        Job *job = jobs_.front();
+        jobs_.pop_front();
+
+        int taskIdx = NextTask(job, node);
+        if (job->handedOut < job->taskCount)
+            jobs_.push_back(job);
+
+        RunTask(job, taskIdx, lock);
+    }
+}
+
+/*
+ * Hands out the next task of the job, preferring tasks of the given node.
+ * Must be called with the lock held.
+ */
+int
+WorkerPool::NextTask(Job *job, int node)
+{
+    int taskIdx = job->handedOut++;
+    if (job->nodeTasks.empty())
+        return taskIdx;
+
+    int nodeCount = job->nodeTasks.size();
+    for (int i = 0; i < nodeCount; i++)
+    {
+        auto &tasks = job->nodeTasks[(node + i) % nodeCount];
+        if (!tasks.empty())
+        {
+            taskIdx = tasks.back();
+            tasks.pop_back();
+            break;
+        }
+    }
+
+    return taskIdx;
+}
+
+/*
+ * Runs a task with the lock released. Completion is recorded under the
+ * lock, so the job's owner can't return from ParallelFor and destroy the
+ * job before we're done touching it. Submitted jobs have no owner waiting,
+ * so they're deleted here.
+ */
+void
+WorkerPool::RunTask(Job *job, int taskIdx, std::unique_lock<std::mutex> &lock)
+{
+    lock.unlock();
+    (*job->task)(taskIdx);
+    lock.lock();
+
+    if (++job->doneCount < job->taskCount)
+        return;
+
+    if (job->detached)
+    {
+        activeJobs_--;
+        delete job;
+    }
+    else
+    {
+        jobFinished_.notify_all();
+    }
+}
+
+};
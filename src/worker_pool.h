@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pgaccel
+{
+
+/*
+ * WorkerPool is a fixed set of threads shared by all running queries.
+ *
+ * Each ParallelFor call is a job. Workers hand out tasks round-robin over
+ * the active jobs, so a long query doesn't hold all workers while shorter
+ * queries wait behind it. The calling thread works on its own job too, so
+ * a job always makes progress even when all workers are busy.
+ *
+ * On NUMA machines workers are bound to nodes, spread like the cpus, and
+ * jobs can tell the node of each task so workers take local tasks first.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(int threadCount);
+    ~WorkerPool();
+
+    // pool used by query execution, sized by the hardware concurrency.
+    static WorkerPool &Shared();
+
+    // Runs task(0) .. task(taskCount - 1) and waits until all are done.
+    void ParallelFor(int taskCount, const std::function<void(int)> &task);
+
+    /*
+     * Same, but taskNodes[i] is the NUMA node of the data task(i) reads.
+     * Threads run the tasks of their own node before helping other nodes.
+     */
+    void ParallelFor(int taskCount, const std::function<void(int)> &task,
+                     const std::vector<int> &taskNodes);
+
+    /*
+     * Runs task on a pool thread without waiting for it. The task may call
+     * ParallelFor(), whose calling thread then is that pool thread.
+     */
+    void Submit(std::function<void()> task);
+
+    int ThreadCount() const
+    {
+        return threads_.size();
+    }
+
+    int ActiveJobCount() const;
+
+    // index of the calling pool thread, or -1 for threads of no pool
+    static int CurrentWorker();
+
+private:
+    struct Job {
+        const std::function<void(int)> *task;
+        int taskCount;
+        int handedOut = 0;
+        int doneCount = 0;
+
+        // tasks not handed out yet per node, empty for jobs without nodes
+        std::vector<std::vector<int>> nodeTasks;
+
+        // jobs of Submit() own their task, and are deleted once it's done
+        std::function<void(int)> ownedTask;
+        bool detached = false;
+    };
+
+    void WorkerMain(int workerIdx);
+    int NextTask(Job *job, int node);
+    void RunTask(Job *job, int taskIdx, std::unique_lock<std::mutex> &lock);
+
+    mutable std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable jobFinished_;
+
+    // jobs with tasks not handed out yet. A worker takes one task from the
+    // front job and moves the job to the back.
+    std::deque<Job *> jobs_;
+    int activeJobs_ = 0;
+    bool stopping_ = false;
+
+    std::vector<std::thread> threads_;
+};
+
+/*
+ * PerWorker holds one T for each thread of the shared pool plus one for
+ * the thread which calls ParallelFor(), so tasks of a job can keep state
+ * across tasks without locking.
+ */
+template<class T>
+class PerWorker {
+public:
+    PerWorker()
+        : slots(WorkerPool::Shared().ThreadCount() + 1) {}
+
+    // slot of the calling thread
+    T &Local()
+    {
+        int worker = WorkerPool::CurrentWorker();
+        return slots[worker >= 0 ? worker : slots.size() - 1];
+    }
+
+    std::vector<T> &All()
+    {
+        return slots;
+    }
+
+private:
+    std::vector<T> slots;
+};
+
+};
@@ -1,10 +1,32 @@
+#include "arena.h"
+#include "arrow_export.h"
+#include "catalog.h"
+#include "column_storage.h"
 #include "columnar_table.h"
 #include "parser.h"
+#include "query_server.h"
+#include "row_group_cube.h"
+#include "selection_cache.h"
+#include "table_file.h"
 #include "executor.h"
+#include "nodes.h"
+#include "numa_placement.h"
+#include "util.h"
 
+#include <arrow/api.h>
+#include <arrow/c/abi.h>
+#include <arrow/c/bridge.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/reader.h>
+#include <cstring>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <iostream>
 #include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 using namespace pgaccel;
@@ -12,6 +34,14 @@ using namespace pgaccel;
 static void VerifyQuery(const TableRegistry &registry,
                         const string &query,
                         const vector<vector<string>> &expectedResult);
+static void VerifySameResults(const TableRegistry &expectedRegistry,
+                              const TableRegistry &actualRegistry,
+                              const vector<string> &queries);
+static void VerifySameResults(const TableRegistry &expectedRegistry,
+                              const TableRegistry &actualRegistry,
+                              const vector<string> &queries,
+                              bool useAvx,
+                              bool useParallel);
 static void VerifyLineitemBasic(const TableRegistry &registry);
 
 static std::string TestsDir()
@@ -23,6 +53,20 @@ static std::string TestsDir()
 
 const std::string LINEITEM_PARQUET = TestsDir() + "/data/lineitem.parquet";
 
+/*
+ * A unix socket path under the test's temporary directory. Socket paths
+ * must fit in sockaddr_un::sun_path, so deep temporary directories fall
+ * back to /tmp.
+ */
+static std::string TestSocketPath(const string &name)
+{
+    string fileName = name + "_" + to_string(getpid()) + ".sock";
+    string path = testing::TempDir() + "/" + fileName;
+    if (path.size() >= sizeof(sockaddr_un::sun_path))
+        path = "/tmp/" + fileName;
+    return path;
+}
+
 
 class PgAccelTest : public ::testing::Test {
 protected:
@@ -60,6 +104,970 @@ TEST_F(PgAccelTest, SaveAndLoad) {
     VerifyLineitemBasic(registry_pgaccel);
 }
 
+TEST_F(PgAccelTest, TableFile) {
+    // check value of the CRC32C specification
+    string check = "123456789";
+    ASSERT_EQ(Crc32c((const uint8_t *) check.data(), check.size()), 0xE3069283);
+
+    auto &lineitem = registry_parquet["lineitem"];
+    stringstream file;
+    ASSERT_TRUE(lineitem->Save(file).ok());
+    string saved = file.str();
+    int savedGroupCount = lineitem->RowGroupCount();
+
+    ASSERT_TRUE(lineitem->Append(*lineitem).ok());
+    lineitem->Flush();
+    ASSERT_TRUE(lineitem->SaveAppend(file).ok());
+
+    auto loaded = ColumnarTable::Load("lineitem", file);
+    ASSERT_TRUE(loaded.ok());
+    ASSERT_EQ((*loaded)->RowGroupCount(), lineitem->RowGroupCount());
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", std::move(loaded).ValueUnsafe() });
+    VerifySameResults(registry_parquet, registry,
+                      { "SELECT count(*) FROM lineitem;",
+                        "SELECT sum(L_QUANTITY) FROM lineitem WHERE L_SHIPMODE = 'AIR';" });
+
+    // only the requested columns are read
+    auto partial = ColumnarTable::Load("lineitem", file, set<string>{ "L_SHIPMODE" });
+    ASSERT_TRUE(partial.ok());
+    ASSERT_EQ((*partial)->ColumnCount(), 1);
+
+    // a flipped bit in column data is detected at load
+    string corrupted = file.str();
+    corrupted[corrupted.size() / 2] ^= 1;
+    stringstream corruptedFile(corrupted);
+    auto corruptedLoad = ColumnarTable::Load("lineitem", corruptedFile);
+    ASSERT_FALSE(corruptedLoad.ok());
+    ASSERT_NE(corruptedLoad.status().Message().find("Checksum"), string::npos);
+
+    // an append which didn't finish leaves the saved table loadable
+    string appended = file.str();
+    for (size_t tornSize: { appended.size() - 1, (saved.size() + appended.size()) / 2 })
+    {
+        stringstream tornFile(appended.substr(0, tornSize));
+        auto tornLoad = ColumnarTable::Load("lineitem", tornFile);
+        ASSERT_TRUE(tornLoad.ok());
+        ASSERT_EQ((*tornLoad)->RowGroupCount(), savedGroupCount);
+    }
+
+    // garbage footer lengths fail with a status
+    string garbage = saved;
+    memset(garbage.data() + garbage.size() - 24, 0xff, 8);
+    stringstream garbageFile(garbage);
+    ASSERT_FALSE(ColumnarTable::Load("lineitem", garbageFile).ok());
+}
+
+TEST_F(PgAccelTest, TableFilePath) {
+    auto &lineitem = registry_parquet["lineitem"];
+    string path = testing::TempDir() + "/lineitem_path.pga";
+    ASSERT_TRUE(lineitem->Save(path).ok());
+    ASSERT_TRUE(lineitem->Append(*lineitem).ok());
+    lineitem->Flush();
+    ASSERT_TRUE(lineitem->SaveAppend(path).ok());
+
+    // chunks are parsed while they're read, with one or many readers
+    for (int threadCount: { 1, DefaultTableFileReadThreads })
+    {
+        ifstream in(path, ios::binary);
+        auto footer = ReadTableFileFooter(in);
+        ASSERT_TRUE(footer.ok());
+
+        vector<shared_ptr<AccelType>> types;
+        vector<TableFileChunkRead> reads;
+        for (const auto &groupChunks: footer->chunks)
+        {
+            for (size_t colIdx = 0; colIdx < groupChunks.size(); colIdx++)
+            {
+                const auto &column = footer->columns[colIdx];
+                types.push_back(*CreateAccelType(column.typeNum, column.scale));
+                reads.push_back({ groupChunks[colIdx], types.back().get() });
+            }
+        }
+
+        auto chunks = ReadTableFileChunks(path, reads, threadCount);
+        ASSERT_TRUE(chunks.ok());
+        for (size_t i = 0; i < reads.size(); i++)
+        {
+            stringstream expected, actual;
+            in.clear();
+            auto fromStream = ReadTableFileChunk(in, reads[i].chunk, reads[i].type);
+            ASSERT_TRUE(fromStream.ok());
+            ASSERT_TRUE((*fromStream)->Save(expected).ok());
+            ASSERT_TRUE((*chunks)[i]->Save(actual).ok());
+            ASSERT_EQ(actual.str(), expected.str());
+        }
+    }
+
+    auto loaded = ColumnarTable::Load("lineitem", path);
+    ASSERT_TRUE(loaded.ok());
+    ASSERT_EQ((*loaded)->RowGroupCount(), lineitem->RowGroupCount());
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", std::move(loaded).ValueUnsafe() });
+    VerifySameResults(registry_parquet, registry,
+                      { "SELECT count(*) FROM lineitem;",
+                        "SELECT L_SHIPMODE, sum(L_QUANTITY) FROM lineitem GROUP BY L_SHIPMODE;" });
+
+    // corrupt dictionary offsets are reported as checksum mismatches
+    // rather than allocated for
+    {
+        ifstream in(path, ios::binary);
+        auto footer = ReadTableFileFooter(in);
+        ASSERT_TRUE(footer.ok());
+        auto shipMode = *lineitem->ColumnIndex("L_SHIPMODE");
+        const auto &chunk = footer->chunks[0][shipMode];
+        in.seekg(chunk.offset + 4);
+        int dictSize;
+        in.read((char *) &dictSize, sizeof(dictSize));
+        in.close();
+
+        string original;
+        {
+            ifstream file(path, ios::binary);
+            original.assign(istreambuf_iterator<char>(file), {});
+        }
+        string corrupted = original;
+        corrupted[chunk.offset + 8 + 4 * dictSize + 3] = 0x7f;
+        {
+            ofstream file(path, ios::binary | ios::trunc);
+            file.write(corrupted.data(), corrupted.size());
+        }
+
+        auto corruptedLoad = ReadTableFileChunks(path, { { chunk, lineitem->Schema()[shipMode].type.get() } });
+        ASSERT_FALSE(corruptedLoad.ok());
+        ASSERT_NE(corruptedLoad.status().Message().find("Checksum"), string::npos);
+
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write(original.data(), original.size());
+    }
+
+    // a flipped bit in column values is detected after reading them
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekg(0, ios::end);
+        uint64_t position = (uint64_t) file.tellg() / 4;
+        file.seekg(position);
+        char byte = file.get();
+        file.seekp(position);
+        file.put(byte ^ 1);
+    }
+    auto corruptedLoad = ColumnarTable::Load("lineitem", path);
+    ASSERT_FALSE(corruptedLoad.ok());
+    ASSERT_NE(corruptedLoad.status().Message().find("Checksum"), string::npos);
+
+    unlink(path.c_str());
+}
+
+TEST_F(PgAccelTest, LegacyStringDictionaries) {
+    auto &lineitem = registry_parquet["lineitem"];
+    auto &columnData = *lineitem->GetRowGroup(0).columns[*lineitem->ColumnIndex("L_SHIPMODE")];
+    auto &dictData = static_cast<const DictColumnData<StringType> &>(columnData);
+    AccelType *type = dictData.valueType.get();
+
+    // entries are saved as a length and bytes, like before StringDict
+    stringstream legacy;
+    ASSERT_TRUE(columnData.Save(legacy, ColumnDataBase::LEGACY_FORMAT).ok());
+    string bytes = legacy.str();
+    int firstLength;
+    memcpy(&firstLength, bytes.data() + 8, sizeof(firstLength));
+    ASSERT_EQ(firstLength, (int) dictData.dict[0].size());
+    ASSERT_EQ(bytes.substr(12, firstLength), dictData.dict[0]);
+
+    auto loaded = ColumnDataBase::Load(legacy, type, ColumnDataBase::LEGACY_FORMAT);
+    ASSERT_TRUE(loaded.ok());
+    auto &loadedDict = static_cast<const DictColumnData<StringType> &>(**loaded);
+    ASSERT_EQ(loadedDict.labels(), dictData.labels());
+
+    // truncated dictionaries fail in both formats
+    for (auto format: { ColumnDataBase::TABLE_FILE_FORMAT, ColumnDataBase::LEGACY_FORMAT })
+    {
+        stringstream saved;
+        ASSERT_TRUE(columnData.Save(saved, format).ok());
+        stringstream truncated(saved.str().substr(0, 16));
+        ASSERT_FALSE(ColumnDataBase::Load(truncated, type, format).ok());
+    }
+
+    // corrupt lengths fail before allocating for them: the last offset,
+    // or the length of the first legacy entry
+    int dictSize = dictData.dict.size();
+    for (auto [format, position]: { make_pair(ColumnDataBase::TABLE_FILE_FORMAT, 8 + 4 * dictSize + 3),
+                                    make_pair(ColumnDataBase::LEGACY_FORMAT, 8 + 3) })
+    {
+        stringstream saved;
+        ASSERT_TRUE(columnData.Save(saved, format).ok());
+        string corrupted = saved.str();
+        corrupted[position] = 0x7f;
+        stringstream corruptedStream(corrupted);
+        auto corruptedLoad = ColumnDataBase::Load(corruptedStream, type, format);
+        ASSERT_FALSE(corruptedLoad.ok());
+        ASSERT_NE(corruptedLoad.status().Message().find("dictionary"), string::npos);
+    }
+}
+
+TEST_F(PgAccelTest, LazyColumns) {
+    string path = testing::TempDir() + "/lineitem_lazy.pga";
+    ASSERT_TRUE(registry_parquet["lineitem"]->Save(path).ok());
+
+    // a budget of 1 byte keeps only the columns of the last query
+    auto opened = ColumnarTable::Open("lineitem", path, 1);
+    ASSERT_TRUE(opened.ok());
+    ColumnarTable *lineitem = opened->get();
+    ASSERT_EQ(lineitem->ResidentBytes(), 0);
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", std::move(opened).ValueUnsafe() });
+
+    vector<string> queries = {
+        "SELECT count(*) FROM lineitem WHERE L_SHIPMODE = 'AIR';",
+        "SELECT sum(L_QUANTITY) FROM lineitem;",
+        "SELECT L_SHIPMODE, sum(L_QUANTITY) FROM lineitem GROUP BY L_SHIPMODE;",
+    };
+    VerifySameResults(registry_parquet, registry, queries);
+
+    auto shipMode = lineitem->ColumnIndex("L_SHIPMODE");
+    auto quantity = lineitem->ColumnIndex("L_QUANTITY");
+    auto shipDate = lineitem->ColumnIndex("L_SHIPDATE");
+    ASSERT_NE(lineitem->GetRowGroup(0).columns[*shipMode], nullptr);
+    ASSERT_NE(lineitem->GetRowGroup(0).columns[*quantity], nullptr);
+    ASSERT_EQ(lineitem->GetRowGroup(0).columns[*shipDate], nullptr);
+
+    // loads and evictions don't change rows, so they keep the version,
+    // cached selections, and the cube entries of other columns
+    lineitem->SetCubes(true);
+    auto &cache = SelectionCache::Shared();
+    auto filtered = ParseSelect(
+        "SELECT sum(L_QUANTITY) FROM lineitem WHERE L_SHIPMODE = 'AIR';", registry);
+    auto byDate = ParseSelect(
+        "SELECT count(*) FROM lineitem WHERE L_SHIPDATE < '1995-01-01';", registry);
+    ASSERT_TRUE(filtered.ok() && byDate.ok());
+    auto expectedSum = ExecuteQuery(*filtered, true, true);
+    ASSERT_TRUE(expectedSum.ok());
+    ASSERT_NE(lineitem->GetRowGroup(0).cube->Sums(*shipMode, *quantity), nullptr);
+
+    uint64_t versionBefore, versionAfter;
+    lineitem->RowGroups(versionBefore);
+    ASSERT_TRUE(ExecuteQuery(*byDate, true, true).ok());
+    ASSERT_EQ(lineitem->GetRowGroup(0).columns[*shipMode], nullptr);
+    ASSERT_EQ(lineitem->GetRowGroup(0).cube->Counts(*shipMode), nullptr);
+
+    cache.ResetStats();
+    auto cachedSum = ExecuteQuery(*filtered, true, true);
+    ASSERT_TRUE(cachedSum.ok());
+    ASSERT_EQ(cachedSum->FormatRows(), expectedSum->FormatRows());
+    ASSERT_GT(cache.Stats().hits, 0);
+    lineitem->RowGroups(versionAfter);
+    ASSERT_EQ(versionBefore, versionAfter);
+
+    auto rowGroup = lineitem->GetRowGroup(0);
+    auto rebuilt = RowGroupCube::Build(rowGroup);
+    for (auto dictColumn: { *shipMode, *shipDate })
+    {
+        ASSERT_EQ(rowGroup.cube->Counts(dictColumn) == nullptr,
+                  rebuilt->Counts(dictColumn) == nullptr);
+        ASSERT_EQ(rowGroup.cube->Sums(dictColumn, *quantity) == nullptr,
+                  rebuilt->Sums(dictColumn, *quantity) == nullptr);
+    }
+    ASSERT_EQ(rowGroup.cube->ByteSize(), rebuilt->ByteSize());
+
+    unlink(path.c_str());
+}
+
+TEST_F(PgAccelTest, ScanColumnSubset) {
+    auto &lineitem = registry_parquet["lineitem"];
+    uint64_t version;
+    auto snapshot = lineitem->RowGroups(version);
+
+    ScanNode scan(lineitem.get(), snapshot, version, { "L_QUANTITY", "L_SHIPMODE" });
+    ASSERT_EQ(scan.PartitionCount(), lineitem->RowGroupCount());
+    ASSERT_EQ(scan.Schema()[0].name, "L_QUANTITY");
+
+    auto quantity = *lineitem->ColumnIndex("L_QUANTITY");
+    auto shipMode = *lineitem->ColumnIndex("L_SHIPMODE");
+    for (int partition = 0; partition < scan.PartitionCount(); partition++)
+    {
+        auto morsel = scan.Execute(partition);
+        ASSERT_EQ(morsel.rowGroup->columns.size(), 2);
+        ASSERT_EQ(morsel.rowGroup->columns[0], (*snapshot)[partition].columns[quantity]);
+        ASSERT_EQ(morsel.rowGroup->columns[1], (*snapshot)[partition].columns[shipMode]);
+        ASSERT_EQ(morsel.selectedSize, (*snapshot)[partition].size);
+    }
+}
+
+TEST_F(PgAccelTest, Append) {
+    set<string> fields = { "L_ORDERKEY", "L_SHIPMODE", "L_SHIPDATE", "L_QUANTITY" };
+    ColumnarTableP newRows =
+        ColumnarTable::ImportParquet("lineitem", LINEITEM_PARQUET, fields);
+    ASSERT_NE(newRows.get(), nullptr);
+
+    auto &lineitem = registry_parquet["lineitem"];
+    stringstream dataStream, metadataStream;
+    lineitem->Save(metadataStream, dataStream);
+
+    ASSERT_TRUE(lineitem->Append(*newRows).ok());
+    lineitem->Flush();
+    ASSERT_EQ(lineitem->BufferedRowCount(), 0);
+    ASSERT_TRUE(lineitem->SaveAppend(metadataStream, dataStream).ok());
+
+    VerifyQuery(registry_parquet,
+                "SELECT count(*) from lineitem;",
+                {{"400000"}});
+    VerifyQuery(registry_parquet,
+                "SELECT count(*) FROM lineitem WHERE L_SHIPMODE='AIR';",
+                {{"57102"}});
+
+    dataStream.seekg(0);
+    metadataStream.seekg(0);
+    Result<ColumnarTableP> loaded =
+        ColumnarTable::Load("lineitem", metadataStream, dataStream);
+    ASSERT_TRUE(loaded.ok());
+
+    TableRegistry registry_pgaccel;
+    registry_pgaccel.insert ({ "lineitem", std::move(loaded).ValueUnsafe() });
+
+    VerifyQuery(registry_pgaccel,
+                "SELECT count(*) from lineitem;",
+                {{"400000"}});
+    VerifyQuery(registry_pgaccel,
+                "SELECT count(*) FROM lineitem WHERE L_SHIPMODE='AIR';",
+                {{"57102"}});
+}
+
+TEST_F(PgAccelTest, AppendDecimalScale) {
+    // the same values at scale 2 and at scale 3
+    auto importDecimals = [](int scale) {
+        arrow::Decimal128Builder builder(arrow::decimal128(15, scale));
+        for (int i = 0; i < 100; i++)
+            EXPECT_TRUE(builder.Append(arrow::Decimal128(i * 100 + 25)).ok());
+        auto array = *builder.Finish();
+        auto batch = arrow::RecordBatch::Make(
+            arrow::schema({ arrow::field("L_QUANTITY", array->type()) }),
+            array->length(), { array });
+        auto reader = *arrow::RecordBatchReader::Make({ batch });
+        return ColumnarTable::ImportArrow("lineitem", *reader);
+    };
+
+    auto centi = importDecimals(2);
+    auto milli = importDecimals(3);
+    auto moreCenti = importDecimals(2);
+    ASSERT_TRUE(centi.ok() && milli.ok() && moreCenti.ok());
+
+    auto mismatched = (*centi)->Append(**milli);
+    ASSERT_FALSE(mismatched.ok());
+    ASSERT_NE(mismatched.status().Message().find("scale"), string::npos);
+
+    ASSERT_TRUE((*centi)->Append(**moreCenti).ok());
+    (*centi)->Flush();
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", std::move(centi).ValueUnsafe() });
+    VerifyQuery(registry,
+                "SELECT count(*), sum(L_QUANTITY) FROM lineitem;",
+                {{"200", "9950.00"}});
+}
+TEST_F(PgAccelTest, ConcurrentSessions) {
+    Catalog catalog;
+    catalog.Put("lineitem", std::move(registry_parquet["lineitem"]));
+
+    // a pinned snapshot still sees the table after it's dropped
+    auto snapshot = catalog.Snapshot();
+    ASSERT_TRUE(catalog.Drop("lineitem"));
+    ASSERT_EQ(catalog.Snapshot()->tables.count("lineitem"), 0);
+    ASSERT_EQ(catalog.Snapshot()->epoch, snapshot->epoch + 1);
+
+    std::vector<std::thread> sessions;
+    for (int i = 0; i < 4; i++)
+        sessions.emplace_back([&]() { VerifyLineitemBasic(snapshot->tables); });
+
+    for (auto &session: sessions)
+        session.join();
+}
+
+TEST_F(PgAccelTest, QueryServer) {
+    Catalog catalog;
+    catalog.Put("lineitem", std::move(registry_parquet["lineitem"]));
+
+    string address = "unix:" + TestSocketPath("pgaccel_test");
+    ServerOptions options;
+    options.batchRows = 3;
+    auto server = QueryServer::Start(address, catalog, options);
+    ASSERT_TRUE(server.ok());
+
+    auto client = QueryClient::Connect(address);
+    ASSERT_TRUE(client.ok());
+
+    // pipelined: all queries are sent before reading any result
+    ASSERT_TRUE((*client)->Send("SELECT count(*) FROM lineitem;").ok());
+    ASSERT_TRUE((*client)->Send("SELECT count(*) FROM nonexistent;").ok());
+    ASSERT_TRUE((*client)->Send("SELECT L_SHIPMODE, count(*) FROM lineitem "
+                                "GROUP BY L_SHIPMODE;").ok());
+
+    auto count = (*client)->Receive();
+    ASSERT_TRUE(count.ok());
+    ASSERT_EQ(count->Column(0).ints, vector<int64_t>({ 200000 }));
+
+    ASSERT_FALSE((*client)->Receive().ok());
+
+    auto groups = (*client)->Receive();
+    ASSERT_TRUE(groups.ok());
+    ASSERT_EQ(groups->FieldNames(), vector<string>({"L_SHIPMODE", "count"}));
+    ASSERT_EQ(groups->RowCount(), 7);
+    ASSERT_EQ(groups->Column(0).strings[0], "AIR");
+    ASSERT_EQ(groups->Column(1).ints[0], 28551);
+}
+
+TEST_F(PgAccelTest, WireMessageLimits) {
+    // a length prefix near 2^32 must not wrap around the buffer size
+    string buffer;
+    EncodeQuery(buffer, "SELECT count(*) FROM lineitem;");
+    buffer[0] = buffer[1] = buffer[2] = buffer[3] = (char) 0xff;
+
+    size_t offset = 0;
+    WireMessage message;
+    ASSERT_FALSE(DecodeMessage(buffer, offset, message, WIRE_MAX_QUERY_LENGTH).ok());
+    auto incomplete = DecodeMessage(buffer, offset, message);
+    ASSERT_TRUE(incomplete.ok());
+    ASSERT_FALSE(*incomplete);
+    ASSERT_EQ(offset, 0u);
+
+    Catalog catalog;
+    catalog.Put("lineitem", std::move(registry_parquet["lineitem"]));
+
+    string path = TestSocketPath("pgaccel_limits");
+    auto server = QueryServer::Start("unix:" + path, catalog, ServerOptions());
+    ASSERT_TRUE(server.ok());
+
+    // the server closes the connection instead of waiting for 4GB
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    ASSERT_EQ(connect(fd, (sockaddr *) &addr, sizeof(addr)), 0);
+    ASSERT_EQ(write(fd, buffer.data(), buffer.size()), (ssize_t) buffer.size());
+    char reply;
+    ASSERT_LE(read(fd, &reply, 1), 0);
+    close(fd);
+
+    // and keeps answering other clients
+    auto client = QueryClient::Connect("unix:" + path);
+    ASSERT_TRUE(client.ok());
+    ASSERT_TRUE((*client)->Send("SELECT count(*) FROM lineitem;").ok());
+    ASSERT_TRUE((*client)->Receive().ok());
+}
+
+TEST_F(PgAccelTest, TypedResults) {
+    auto parsed = ParseSelect(
+        "SELECT L_SHIPDATE, count(*), sum(L_QUANTITY) FROM LINEITEM "
+        "WHERE L_SHIPDATE < '1992-01-05' "
+        "GROUP BY L_SHIPDATE;",
+        registry_parquet);
+    ASSERT_TRUE(parsed.ok());
+
+    auto result = ExecuteQuery(*parsed, true, true);
+    ASSERT_TRUE(result.ok());
+    ASSERT_EQ(result->Column(0).type->type_num(), DATE_TYPE);
+    ASSERT_EQ(result->Column(1).type->type_num(), INT64_TYPE);
+    ASSERT_EQ(result->Column(2).type->type_num(), DECIMAL_TYPE);
+
+    DateType dateType;
+    ASSERT_EQ(result->Column(0).ints,
+              vector<int64_t>({ dateType.Parse("1992-01-03"),
+                                dateType.Parse("1992-01-04") }));
+    ASSERT_EQ(result->Column(1).ints, vector<int64_t>({ 1, 3 }));
+    ASSERT_EQ(result->Column(2).ints, vector<int64_t>({ 3100, 3800 }));
+}
+
+TEST_F(PgAccelTest, FilteredScalarAggregates) {
+    auto grouped = ParseSelect(
+        "SELECT L_SHIPMODE, count(*), sum(L_QUANTITY) FROM LINEITEM "
+        "GROUP BY L_SHIPMODE;",
+        registry_parquet);
+    ASSERT_TRUE(grouped.ok());
+    auto groups = ExecuteQuery(*grouped, true, true);
+    ASSERT_TRUE(groups.ok());
+    ASSERT_EQ(groups->Column(0).strings[0], "AIR");
+
+    // filtered count and sum, which used to be unsupported together, must
+    // match the AIR group in all modes.
+    auto parsed = ParseSelect(
+        "SELECT count(*), sum(L_QUANTITY) FROM LINEITEM "
+        "WHERE L_SHIPMODE = 'AIR';",
+        registry_parquet);
+    ASSERT_TRUE(parsed.ok());
+    for (bool useAvx: { true, false })
+        for (bool useParallel: { true, false })
+        {
+            auto result = ExecuteQuery(*parsed, useAvx, useParallel);
+            ASSERT_TRUE(result.ok());
+            ASSERT_EQ(result->FieldNames(), vector<string>({"count", "sum"}));
+            ASSERT_EQ(result->Column(0).ints[0], groups->Column(1).ints[0]);
+            ASSERT_EQ(result->Column(1).ints[0], groups->Column(2).ints[0]);
+        }
+}
+
+TEST_F(PgAccelTest, NumaPlacement) {
+    auto rowGroups = registry_parquet["lineitem"]->RowGroups();
+    for (const auto &rowGroup: *rowGroups)
+    {
+        ASSERT_GE(rowGroup.numaNode, 0);
+        ASSERT_LT(rowGroup.numaNode, NumaNodeCount());
+    }
+
+    ResetNumaTraffic();
+    VerifyQuery(registry_parquet,
+                "SELECT count(*) FROM lineitem WHERE L_SHIPMODE = 'AIR';",
+                {{ "28551" }});
+    const auto &traffic = GetNumaTraffic();
+    ASSERT_GT(traffic.localBytes + traffic.remoteBytes, 0);
+    ASSERT_EQ(traffic.unplacedBytes, 0);
+}
+
+TEST_F(PgAccelTest, ColumnStorage) {
+    // table data lives in huge page regions by default
+    ASSERT_GT(GetColumnStorageStats().usedBytes, 0);
+
+    for (auto mode: { HugePageMode::THP, HugePageMode::OFF })
+    {
+        SetHugePageMode(mode);
+        uint8_t *small = AllocateColumnBuffer(1000);
+        uint8_t *large = AllocateColumnBuffer(100 << 20);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(small) % 512, 0);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(large) % 512, 0);
+        memset(small, 1, 1000);
+        memset(large, 1, 100 << 20);
+
+        // NUMA placement moves whole regions, which must cover the buffer
+        uint8_t *regionStart;
+        size_t regionSize;
+        int regionNode;
+        bool inRegion = ColumnBufferRegion(large, regionStart, regionSize, regionNode);
+        ASSERT_EQ(inRegion, mode != HugePageMode::OFF);
+        if (inRegion)
+        {
+            ASSERT_LE(regionStart, large);
+            ASSERT_GE(regionStart + regionSize, large + (100 << 20));
+            ASSERT_EQ(regionNode, -1);
+
+            // regions are moved once, and remember where to
+            SetColumnBufferRegionNode(regionStart, 0);
+            ASSERT_TRUE(ColumnBufferRegion(large, regionStart, regionSize, regionNode));
+            ASSERT_EQ(regionNode, 0);
+        }
+
+        FreeColumnBuffer(small);
+        FreeColumnBuffer(large);
+    }
+
+    // an empty current region is unmapped when the mode changes
+    SetHugePageMode(HugePageMode::THP);
+    int regionCount = GetColumnStorageStats().regionCount;
+    FreeColumnBuffer(AllocateColumnBuffer(100 << 20));
+    ASSERT_EQ(GetColumnStorageStats().regionCount, regionCount + 1);
+    SetHugePageMode(HugePageMode::THP);
+    ASSERT_EQ(GetColumnStorageStats().regionCount, regionCount);
+}
+
+TEST_F(PgAccelTest, RowGroupSize) {
+    set<string> fields = { "L_ORDERKEY", "L_SHIPMODE", "L_SHIPDATE", "L_QUANTITY" };
+    ColumnarTableP lineitem =
+        ColumnarTable::ImportParquet("lineitem", LINEITEM_PARQUET, fields, 5000);
+    ASSERT_NE(lineitem.get(), nullptr);
+    ASSERT_EQ(lineitem->RowGroupSize(), 5000);
+    for (const auto &rowGroup: *lineitem->RowGroups())
+        ASSERT_LE(rowGroup.size, 5000);
+
+    // the row group size survives save and load
+    stringstream dataStream, metadataStream;
+    lineitem->Save(metadataStream, dataStream);
+    auto loaded = ColumnarTable::Load("lineitem", metadataStream, dataStream);
+    ASSERT_TRUE(loaded.ok());
+    ASSERT_EQ((*loaded)->RowGroupSize(), 5000);
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", std::move(lineitem) });
+    VerifyLineitemBasic(registry);
+}
+
+TEST_F(PgAccelTest, SelectionCache) {
+    // sparse, clustered and dense selections use different containers,
+    // and all must round trip
+    const int rowCount = 10000;
+    vector<vector<bool>> selections(3, vector<bool>(rowCount));
+    for (int i = 0; i < rowCount; i++)
+    {
+        selections[0][i] = i % 97 == 0;
+        selections[1][i] = (i / 1000) % 2 == 0;
+        selections[2][i] = (i * 7919) % 3 != 0;
+    }
+
+    for (const auto &selection: selections)
+    {
+        vector<uint8_t> bitmap(BitmapSize(rowCount), 0xff);
+        for (int i = 0; i < rowCount; i++)
+            if (!selection[i])
+                bitmap[i / 8] &= ~(1 << (i % 8));
+
+        auto compressed = CompressedBitmap::Compress(bitmap.data(), rowCount);
+        vector<uint8_t> decompressed(BitmapSize(rowCount));
+        compressed->Decompress(decompressed.data());
+        for (int i = 0; i < rowCount; i++)
+            ASSERT_EQ(IsBitSet(decompressed.data(), i), selection[i]);
+    }
+
+    auto &cache = SelectionCache::Shared();
+    cache.Clear();
+    cache.ResetStats();
+
+    auto parsed = ParseSelect(
+        "SELECT count(*) FROM lineitem WHERE L_SHIPMODE = 'AIR';",
+        registry_parquet);
+    auto parsedSum = ParseSelect(
+        "SELECT sum(L_QUANTITY) FROM lineitem WHERE L_SHIPMODE = 'AIR';",
+        registry_parquet);
+    ASSERT_TRUE(parsed.ok() && parsedSum.ok());
+
+    // count-only queries count on a miss, and don't fill the cache
+    auto first = ExecuteQuery(*parsed, true, true);
+    ASSERT_TRUE(first.ok());
+    ASSERT_EQ(cache.Stats().entryCount, 0);
+
+    // queries which use the selection fill it, and later counts hit it
+    ASSERT_TRUE(ExecuteQuery(*parsedSum, true, true).ok());
+    ASSERT_GT(cache.Stats().entryCount, 0);
+    auto second = ExecuteQuery(*parsed, true, true);
+    ASSERT_TRUE(second.ok());
+    ASSERT_EQ(first->Column(0).ints, second->Column(0).ints);
+    ASSERT_GT(cache.Stats().hits, 0);
+
+    // appends publish new row groups, which drops the table's entries
+    auto &lineitem = registry_parquet["lineitem"];
+    ASSERT_TRUE(lineitem->Append(*lineitem).ok());
+    ASSERT_EQ(cache.Stats().entryCount, 0);
+
+    auto afterAppend = ExecuteQuery(*parsed, true, true);
+    ASSERT_TRUE(afterAppend.ok());
+    ASSERT_EQ(afterAppend->Column(0).ints[0], 2 * first->Column(0).ints[0]);
+}
+
+TEST_F(PgAccelTest, RowGroupCubes) {
+    auto &lineitem = registry_parquet["lineitem"];
+    auto shipMode = lineitem->ColumnIndex("L_SHIPMODE");
+    ASSERT_TRUE(shipMode.has_value());
+
+    // the first filter covers all row groups, the second only some
+    vector<string> queries = {
+        "SELECT L_SHIPMODE, count(*), sum(L_QUANTITY) FROM lineitem "
+        "WHERE L_QUANTITY < 100 GROUP BY L_SHIPMODE;",
+        "SELECT L_SHIPMODE, count(*), sum(L_QUANTITY) FROM lineitem "
+        "WHERE L_ORDERKEY < 100000 GROUP BY L_SHIPMODE;",
+    };
+
+    vector<Rows> expected;
+    for (const auto &query: queries)
+    {
+        auto parsed = ParseSelect(query, registry_parquet);
+        ASSERT_TRUE(parsed.ok());
+        auto result = ExecuteQuery(*parsed, true, true);
+        ASSERT_TRUE(result.ok());
+        expected.push_back(result->FormatRows());
+    }
+
+    lineitem->SetCubes(true);
+    for (const auto &rowGroup: *lineitem->RowGroups())
+    {
+        ASSERT_NE(rowGroup.cube, nullptr);
+        auto dictData =
+            static_cast<DictColumnDataBase *>(rowGroup.columns[*shipMode].get());
+        auto counts = rowGroup.cube->Counts(*shipMode);
+        ASSERT_NE(counts, nullptr);
+
+        int64_t total = 0;
+        for (int code = 0; code < dictData->dictSize(); code++)
+            total += counts[code];
+        ASSERT_EQ(total, rowGroup.size);
+    }
+
+    for (int i = 0; i < queries.size(); i++)
+    {
+        auto parsed = ParseSelect(queries[i], registry_parquet);
+        ASSERT_TRUE(parsed.ok());
+        auto result = ExecuteQuery(*parsed, true, true);
+        ASSERT_TRUE(result.ok());
+        ASSERT_EQ(result->FormatRows(), expected[i]);
+    }
+
+    lineitem->SetCubes(false);
+    ASSERT_EQ(lineitem->GetRowGroup(0).cube, nullptr);
+}
+
+TEST_F(PgAccelTest, ArrowExport) {
+    auto &lineitem = registry_parquet["lineitem"];
+    auto arrowTable = ToArrowTable(*lineitem);
+    ASSERT_TRUE(arrowTable.ok());
+    ASSERT_EQ((*arrowTable)->num_columns(), lineitem->ColumnCount());
+
+    // dictionary codes and entries are wrapped, not copied
+    auto shipMode = lineitem->ColumnIndex("L_SHIPMODE");
+    auto shipModeData = (*arrowTable)->column(*shipMode)->chunk(0)->data();
+    auto dictData = static_cast<DictColumnData<StringType> *>(
+        lineitem->GetRowGroup(0).columns[*shipMode].get());
+    ASSERT_EQ(shipModeData->buffers[1]->data(), dictData->values);
+    ASSERT_EQ(shipModeData->dictionary->buffers[2]->data(),
+              reinterpret_cast<const uint8_t *>(dictData->dict.bytes.data()));
+
+    // parquet reimports to the same table
+    string parquetPath = testing::TempDir() + "/lineitem_export.parquet";
+    ASSERT_TRUE(WriteArrowTable(**arrowTable, parquetPath, ExportFormat::PARQUET,
+                                lineitem->RowGroupSize()).ok());
+
+    TableRegistry registry;
+    registry.insert({ "lineitem", ColumnarTable::ImportParquet("lineitem", parquetPath) });
+    ASSERT_NE(registry["lineitem"], nullptr);
+
+    string query = "SELECT L_SHIPMODE, count(*), sum(L_QUANTITY) FROM lineitem "
+                   "WHERE L_SHIPDATE < '1995-01-01' GROUP BY L_SHIPMODE;";
+    VerifySameResults(registry_parquet, registry, { query });
+
+    auto expected = ParseSelect(query, registry_parquet);
+    ASSERT_TRUE(expected.ok());
+    auto expectedResult = ExecuteQuery(*expected, true, true);
+    ASSERT_TRUE(expectedResult.ok());
+
+    // so do query results through Arrow IPC
+    auto resultTable = ToArrowTable(*expectedResult);
+    ASSERT_TRUE(resultTable.ok());
+    string ipcPath = testing::TempDir() + "/result_export.arrow";
+    ASSERT_TRUE(ExportFormatFromPath(ipcPath).ok());
+    ASSERT_TRUE(WriteArrowTable(**resultTable, ipcPath, *ExportFormatFromPath(ipcPath),
+                                lineitem->RowGroupSize()).ok());
+
+    auto file = arrow::io::ReadableFile::Open(ipcPath);
+    ASSERT_TRUE(file.ok());
+    auto reader = arrow::ipc::RecordBatchFileReader::Open(*file);
+    ASSERT_TRUE(reader.ok());
+    auto ipcTable = (*reader)->ToTable();
+    ASSERT_TRUE(ipcTable.ok());
+    ASSERT_TRUE((*ipcTable)->Equals(**resultTable));
+
+    unlink(parquetPath.c_str());
+    unlink(ipcPath.c_str());
+}
+
+TEST_F(PgAccelTest, ArrowImport) {
+    set<string> fields = { "L_ORDERKEY", "L_SHIPMODE", "L_SHIPDATE", "L_QUANTITY" };
+    vector<string> queries = {
+        "SELECT L_SHIPMODE, count(*), sum(L_QUANTITY) FROM lineitem "
+        "WHERE L_SHIPDATE < '1995-01-01' GROUP BY L_SHIPMODE;",
+        "SELECT count(*), sum(L_ORDERKEY) FROM lineitem WHERE L_SHIPMODE = 'AIR';",
+    };
+
+    // parquet through arrow's FileReader
+    auto imported = ColumnarTable::ImportArrowFile("lineitem", LINEITEM_PARQUET, fields);
+    ASSERT_TRUE(imported.ok());
+
+    // a table through the C Data Interface, with row groups of another size
+    auto arrowTable = ToArrowTable(*registry_parquet["lineitem"]);
+    ASSERT_TRUE(arrowTable.ok());
+    struct ArrowArrayStream stream;
+    ASSERT_TRUE(arrow::ExportRecordBatchReader(
+        std::make_shared<arrow::TableBatchReader>(**arrowTable), &stream).ok());
+    auto streamed = ColumnarTable::ImportArrowStream("lineitem", &stream,
+                                                     std::nullopt, 10000);
+    ASSERT_TRUE(streamed.ok());
+    ASSERT_EQ((*streamed)->GetRowGroup(0).size, 10000);
+
+    TableRegistry importedRegistry, streamedRegistry;
+    importedRegistry.insert({ "lineitem", std::move(imported).ValueUnsafe() });
+    streamedRegistry.insert({ "lineitem", std::move(streamed).ValueUnsafe() });
+
+    VerifySameResults(registry_parquet, importedRegistry, queries);
+    VerifySameResults(registry_parquet, streamedRegistry, queries);
+}
+
+TEST_F(PgAccelTest, Arena) {
+    Arena arena;
+    auto small = arena.AllocateArray<uint8_t>(100);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(small) % 64, 0);
+
+    // outgrow the first block, then reset consolidates into a single block
+    // which fits the whole round.
+    for (int i = 0; i < 10; i++)
+        arena.AllocateZeroed<uint16_t>(1 << 16);
+    arena.Reset();
+    size_t capacity = arena.Capacity();
+
+    for (int round = 0; round < 3; round++)
+    {
+        arena.AllocateArray<uint8_t>(100);
+        for (int i = 0; i < 10; i++)
+            arena.AllocateZeroed<uint16_t>(1 << 16);
+        arena.Reset();
+        ASSERT_EQ(arena.Capacity(), capacity);
+    }
+}
+
+TEST_F(PgAccelTest, DictionaryBuilder) {
+    // keys point into a buffer which is overwritten, as parquet pages are
+    DictionaryBuilder<StringType> builder;
+    std::vector<uint32_t> ids;
+    char buffer[16];
+    for (int i = 0; i < 3000; i++)
+    {
+        int length = snprintf(buffer, sizeof(buffer), "key%d", (i * 7) % 1000);
+        ids.push_back(builder.Add(std::string_view(buffer, length)));
+    }
+    ASSERT_EQ(builder.DistinctCount(), 1000);
+
+    auto columnData = builder.Finish(ids.data(), ids.size());
+    auto &dictData = static_cast<DictColumnData<StringType> &>(*columnData);
+    for (int code = 1; code < dictData.dictSize(); code++)
+        ASSERT_LT(dictData.dict[code - 1], dictData.dict[code]);
+    ASSERT_EQ(dictData.bytesPerValue(), 2);
+
+    auto codes = reinterpret_cast<const uint16_t *>(dictData.values);
+    for (int i = 0; i < 3000; i++)
+        ASSERT_EQ(dictData.dict[codes[i]], "key" + std::to_string((i * 7) % 1000));
+
+    builder.Reset();
+    ASSERT_EQ(builder.Add("key1"), 0);
+    ASSERT_EQ(builder.DistinctCount(), 1);
+}
+
+TEST_F(PgAccelTest, StringPrefixKeys) {
+    // many entries share their first 8 bytes, so searches hit ties
+    std::vector<std::string> strings = { "", "a", "abcdefg", "abcdefgh",
+                                         "abcdefghA", "abcdefghB", "abcdefgi",
+                                         std::string("abc\0", 4), "\xff\xff" };
+    for (int i = 0; i < 300; i++)
+        strings.push_back("abcdefgh" + std::to_string(i * 3));
+
+    std::vector<uint32_t> ids;
+    DictionaryBuilder<StringType> builder;
+    for (const auto &str: strings)
+        ids.push_back(builder.Add(str));
+    auto columnData = builder.Finish(ids.data(), ids.size());
+    auto &dictData = static_cast<DictColumnData<StringType> &>(*columnData);
+
+    std::sort(strings.begin(), strings.end());
+    ASSERT_EQ(dictData.dictSize(), strings.size());
+    for (int code = 0; code < strings.size(); code++)
+        ASSERT_EQ(dictData.dict[code], strings[code]);
+
+    for (int i = -1; i < 1000; i++)
+    {
+        std::string value = i < 0 ? "abcdefgh" : "abcdefgh" + std::to_string(i);
+        int lower = std::lower_bound(strings.begin(), strings.end(), value) - strings.begin();
+        bool found = lower < strings.size() && strings[lower] == value;
+        ASSERT_EQ(dictData.dict.LowerBound(value), lower);
+        ASSERT_EQ(DictIndex(dictData, value, FilterClause::FILTER_EQ), found ? lower : -1);
+        ASSERT_EQ(DictIndex(dictData, value, FilterClause::FILTER_LT), lower);
+        ASSERT_EQ(DictIndex(dictData, value, FilterClause::FILTER_GTE), lower);
+    }
+}
+
+TEST_F(PgAccelTest, FusedRangeSkipping) {
+    // one end of each range is outside every row group, so the other end
+    // alone decides. Ends outside the dictionary or the storage type of
+    // narrow row groups must not wrap around.
+    vector<pair<string, string>> queries = {
+        { "SELECT count(*) FROM lineitem WHERE L_ORDERKEY > 0 AND L_ORDERKEY <= 3000;",
+          "SELECT count(*) FROM lineitem WHERE L_ORDERKEY <= 3000;" },
+        { "SELECT count(*) FROM lineitem "
+          "WHERE L_ORDERKEY > 1000 AND L_ORDERKEY < 4000000;",
+          "SELECT count(*) FROM lineitem WHERE L_ORDERKEY > 1000;" },
+        { "SELECT count(*) FROM lineitem "
+          "WHERE L_SHIPDATE >= '1900-01-01' AND L_SHIPDATE < '1995-01-01';",
+          "SELECT count(*) FROM lineitem WHERE L_SHIPDATE < '1995-01-01';" },
+        { "SELECT count(*) FROM lineitem "
+          "WHERE L_SHIPDATE > '1995-01-01' AND L_SHIPDATE <= '1990-01-01';",
+          "SELECT count(*) FROM lineitem WHERE L_SHIPDATE < '1900-01-01';" },
+    };
+
+    for (const auto &[between, upperOnly]: queries)
+    {
+        auto actual = ParseSelect(between, registry_parquet);
+        auto expected = ParseSelect(upperOnly, registry_parquet);
+        ASSERT_TRUE(actual.ok() && expected.ok());
+        for (bool useAvx: { true, false })
+            ASSERT_EQ(ExecuteQuery(*actual, useAvx, true)->FormatRows(),
+                      ExecuteQuery(*expected, useAvx, true)->FormatRows());
+    }
+}
+
+TEST_F(PgAccelTest, SortedTable) {
+    set<string> fields = { "L_ORDERKEY", "L_SHIPMODE", "L_SHIPDATE", "L_QUANTITY" };
+    vector<string> queries = {
+        "SELECT count(*), sum(L_QUANTITY) FROM lineitem "
+        "WHERE L_SHIPDATE >= '1994-01-01' AND L_SHIPDATE < '1995-01-01';",
+        "SELECT count(*) FROM lineitem WHERE L_SHIPDATE = '1996-02-12';",
+        "SELECT L_SHIPMODE, count(*) FROM lineitem "
+        "WHERE L_SHIPDATE <= '1992-06-30' GROUP BY L_SHIPMODE;",
+        "SELECT count(*), sum(L_ORDERKEY) FROM lineitem "
+        "WHERE L_SHIPMODE = 'AIR' AND L_SHIPDATE > '1997-03-15';",
+        "SELECT count(*) FROM lineitem WHERE L_SHIPDATE < '1900-01-01';",
+        "SELECT count(*) FROM lineitem WHERE L_ORDERKEY > 1000 AND L_ORDERKEY <= 3000;",
+    };
+
+    // small row groups, so ranges start and end within row groups
+    auto imported = ColumnarTable::ImportArrowFile("lineitem", LINEITEM_PARQUET,
+                                                   fields, 10000);
+    ASSERT_TRUE(imported.ok());
+    ColumnarTableP lineitem = std::move(imported).ValueUnsafe();
+    ASSERT_TRUE(lineitem->SortBy({ "L_SHIPDATE", "L_ORDERKEY" }).ok());
+    ASSERT_FALSE(lineitem->SortBy({ "L_NOSUCHCOLUMN" }).ok());
+    ASSERT_EQ(lineitem->SortKeys(),
+              vector<int>({ *lineitem->ColumnIndex("L_SHIPDATE"),
+                            *lineitem->ColumnIndex("L_ORDERKEY") }));
+
+    // sort keys survive a save and load
+    stringstream file;
+    ASSERT_TRUE(lineitem->Save(file).ok());
+    auto loaded = ColumnarTable::Load("lineitem", file);
+    ASSERT_TRUE(loaded.ok());
+    ASSERT_EQ((*loaded)->SortKeys(), lineitem->SortKeys());
+
+    // and the raw encoded order key can lead too
+    auto byOrderKey = ColumnarTable::ImportArrowFile("lineitem", LINEITEM_PARQUET,
+                                                     fields, 10000);
+    ASSERT_TRUE(byOrderKey.ok());
+    ASSERT_TRUE((*byOrderKey)->SortBy({ "L_ORDERKEY" }).ok());
+
+    TableRegistry sortedRegistry, loadedRegistry, byOrderKeyRegistry;
+    sortedRegistry.insert({ "lineitem", std::move(lineitem) });
+    loadedRegistry.insert({ "lineitem", std::move(loaded).ValueUnsafe() });
+    byOrderKeyRegistry.insert({ "lineitem", std::move(byOrderKey).ValueUnsafe() });
+
+    for (auto registry: { &sortedRegistry, &loadedRegistry, &byOrderKeyRegistry })
+    {
+        VerifySameResults(registry_parquet, *registry, queries);
+        VerifySameResults(registry_parquet, *registry, queries, false, false);
+    }
+
+    // appended rows aren't in order
+    auto &sorted = sortedRegistry["lineitem"];
+    ASSERT_TRUE(sorted->Append(*registry_parquet["lineitem"]).ok());
+    ASSERT_TRUE(sorted->SortKeys().empty());
+
+    // sorted rows can't be appended to files with the unsorted rows
+    auto &unsorted = registry_parquet["lineitem"];
+    stringstream dataStream, metadataStream, tableFile;
+    ASSERT_TRUE(unsorted->Save(metadataStream, dataStream).ok());
+    ASSERT_TRUE(unsorted->Save(tableFile).ok());
+    auto savedSize = dataStream.str().size();
+
+    ASSERT_TRUE(unsorted->SortBy({ "L_SHIPDATE" }).ok());
+    auto legacyAppend = unsorted->SaveAppend(metadataStream, dataStream);
+    ASSERT_FALSE(legacyAppend.ok());
+    ASSERT_NE(legacyAppend.status().Message().find("use Save()"), string::npos);
+    ASSERT_EQ(dataStream.str().size(), savedSize);
+    ASSERT_FALSE(unsorted->SaveAppend(tableFile).ok());
+
+    stringstream sortedFile;
+    ASSERT_TRUE(unsorted->Save(sortedFile).ok());
+    ASSERT_TRUE(unsorted->SaveAppend(sortedFile).ok());
+}
+
 static void
 VerifyLineitemBasic(const TableRegistry &registry)
 {
@@ -163,6 +1171,56 @@ VerifyLineitemBasic(const TableRegistry &registry)
             "L_SHIPDATE < '2022-01-01';",
             {{ "200000" }});
 
+    // LIKE patterns
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE 'AIR';",
+            {{ "28551" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE 'REG%';",
+            {{ "28422" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE '%AIR';",
+            {{ "56973" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE '%AI%';",
+            {{ "85630" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE '_AIL';",
+            {{ "28657" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE NOT LIKE '%AIR';",
+            {{ "143027" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE LIKE '%AI%' "
+            "AND L_SHIPMODE NOT LIKE 'REG%';",
+            {{ "57208" }});
+
+    // IN lists and multiple filters on a dictionary column
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE L_SHIPMODE IN ('AIR', 'MAIL');",
+            {{ "57208" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE "
+            "L_SHIPMODE NOT IN ('AIR', 'MAIL', 'SHIP');",
+            {{ "114136" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE "
+            "L_SHIPMODE > 'FOB' AND L_SHIPMODE != 'RAIL';",
+            {{ "114403" }});
+
+    VerifyQuery(registry,
+            "SELECT count(*) FROM lineitem WHERE "
+            "L_SHIPDATE IN ('1992-01-03', '1992-01-04');",
+            {{ "4" }});
+
     // group by
     VerifyQuery(registry,
             "SELECT L_SHIPMODE, count(*) FROM LINEITEM GROUP BY L_SHIPMODE;",
@@ -181,6 +1239,14 @@ VerifyLineitemBasic(const TableRegistry &registry)
             { { "SHIP", "25810" },
               { "TRUCK", "25851" }});
 
+    VerifyQuery(registry,
+            "SELECT L_SHIPMODE, count(*) FROM LINEITEM "
+            "WHERE L_SHIPMODE LIKE '%AI%' "
+            "GROUP BY L_SHIPMODE;",
+            { { "AIR", "28551" },
+              { "MAIL", "28657" },
+              { "REG AIR", "28422" }});
+
     VerifyQuery(registry,
             "SELECT L_SHIPDATE, count(*), sum(L_QUANTITY) FROM LINEITEM "
             "WHERE L_SHIPDATE < '1992-01-05' "
@@ -204,7 +1270,7 @@ VerifyQuery(const TableRegistry &registry,
     auto result = ExecuteQuery(*parsed, useAvx, useParallel);
     ASSERT_TRUE(result.ok());
 
-    ASSERT_EQ(result->values, expectedResult);
+    ASSERT_EQ(result->FormatRows(), expectedResult);
 }
 
 static void
@@ -215,3 +1281,36 @@ VerifyQuery(const TableRegistry &registry,
     VerifyQuery(registry, query, expectedResult, true, true);
     VerifyQuery(registry, query, expectedResult, false, true);
 }
+
+/*
+ * Runs each query against both registries, e.g. a table as imported and
+ * as saved and loaded again, and checks that they return the same rows.
+ */
+static void
+VerifySameResults(const TableRegistry &expectedRegistry,
+                  const TableRegistry &actualRegistry,
+                  const vector<string> &queries,
+                  bool useAvx,
+                  bool useParallel)
+{
+    for (const auto &query: queries)
+    {
+        auto expected = ParseSelect(query, expectedRegistry);
+        auto actual = ParseSelect(query, actualRegistry);
+        ASSERT_TRUE(expected.ok() && actual.ok());
+
+        auto expectedResult = ExecuteQuery(*expected, useAvx, useParallel);
+        auto actualResult = ExecuteQuery(*actual, useAvx, useParallel);
+        ASSERT_TRUE(expectedResult.ok() && actualResult.ok());
+        ASSERT_EQ(actualResult->FormatRows(), expectedResult->FormatRows()) << query;
+    }
+}
+
+static void
+VerifySameResults(const TableRegistry &expectedRegistry,
+                  const TableRegistry &actualRegistry,
+                  const vector<string> &queries)
+{
+    VerifySameResults(expectedRegistry, actualRegistry, queries, true, true);
+    VerifySameResults(expectedRegistry, actualRegistry, queries, false, true);
+}